@@ -0,0 +1,223 @@
+#include "BillboardBuffer.h"
+#include <string.h>
+
+//half width and height scale of each particle type, these match the quads the vertex buffer path builds
+static const float BillboardSizes[BillboardBuffer::BILLBOARD_TYPE_COUNT] = { 0.015f, 0.010f, 0.20f };
+static const float BillboardStretches[BillboardBuffer::BILLBOARD_TYPE_COUNT] = { 1.0f, 16.0f, 1.0f };
+
+
+//round to nearest even like the gpu's f32tof16, but clamped to the largest half instead of going to infinity
+static unsigned int FloatToHalf(float value)
+{
+    unsigned int bits, sign, magnitude, exponent, mantissa, shift, remainder, result;
+
+    memcpy(&bits, &value, sizeof(bits));
+    sign = (bits >> 16) & 0x8000;
+    magnitude = bits & 0x7fffffff;
+
+    if (magnitude > 0x7f800000)
+    {
+        return 0;
+    }
+    // 65520 and up would round to infinity
+    if (magnitude >= 0x477ff000)
+    {
+        return sign | 0x7bff;
+    }
+    // below the smallest normal half the implicit one becomes part of a denormal mantissa
+    if (magnitude < 0x38800000)
+    {
+        if (magnitude < 0x33000000)
+        {
+            return sign;
+        }
+        exponent = magnitude >> 23;
+        mantissa = (magnitude & 0x7fffff) | 0x800000;
+        shift = 126 - exponent;
+        result = mantissa >> shift;
+        remainder = mantissa & ((1u << shift) - 1);
+        if (remainder > (1u << (shift - 1)) || (remainder == (1u << (shift - 1)) && (result & 1)))
+        {
+            result++;
+        }
+        return sign | result;
+    }
+
+    // rebias the exponent from 127 to 15, a carry out of the mantissa correctly bumps the exponent
+    magnitude -= 0x38000000;
+    result = (magnitude + 0xfff + ((magnitude >> 13) & 1)) >> 13;
+    return sign | result;
+}
+
+
+static float HalfToFloat(unsigned int half)
+{
+    unsigned int sign, exponent, mantissa, bits;
+    float value;
+
+    sign = (half & 0x8000) << 16;
+    exponent = (half >> 10) & 0x1f;
+    mantissa = half & 0x3ff;
+
+    if (exponent == 0)
+    {
+        // denormal, mantissa times 2^-24
+        value = (float)mantissa * (1.0f / 16777216.0f);
+        return sign ? -value : value;
+    }
+    if (exponent == 31)
+    {
+        bits = sign | 0x7f800000 | (mantissa << 13);
+    }
+    else
+    {
+        bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    }
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+
+BillboardBuffer::BillboardBuffer()
+{
+    m_buffer = nullptr;
+    m_view = nullptr;
+    m_maxInstances = 0;
+}
+
+
+BillboardBuffer::~BillboardBuffer()
+{
+}
+
+
+bool BillboardBuffer::Initialize(ID3D11Device* device, int maxInstances)
+{
+    D3D11_BUFFER_DESC bufferDesc;
+    D3D11_SHADER_RESOURCE_VIEW_DESC viewDesc;
+    HRESULT result;
+
+    if (maxInstances <= 0)
+    {
+        return false;
+    }
+    m_maxInstances = maxInstances;
+
+    bufferDesc.Usage = D3D11_USAGE_DYNAMIC;
+    bufferDesc.ByteWidth = sizeof(BillboardInstance) * m_maxInstances;
+    bufferDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+    bufferDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+    bufferDesc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+    bufferDesc.StructureByteStride = sizeof(BillboardInstance);
+
+    result = device->CreateBuffer(&bufferDesc, nullptr, &m_buffer);
+    if (FAILED(result))
+    {
+        return false;
+    }
+
+    viewDesc.Format = DXGI_FORMAT_UNKNOWN;
+    viewDesc.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
+    viewDesc.Buffer.FirstElement = 0;
+    viewDesc.Buffer.NumElements = m_maxInstances;
+
+    result = device->CreateShaderResourceView(m_buffer, &viewDesc, &m_view);
+    if (FAILED(result))
+    {
+        return false;
+    }
+    return true;
+}
+
+
+void BillboardBuffer::Shutdown()
+{
+    if (m_view)
+    {
+        m_view->Release();
+        m_view = nullptr;
+    }
+
+    if (m_buffer)
+    {
+        m_buffer->Release();
+        m_buffer = nullptr;
+    }
+
+    m_maxInstances = 0;
+    return;
+}
+
+
+BillboardBuffer::BillboardInstance* BillboardBuffer::Map(ID3D11DeviceContext* deviceContext)
+{
+    D3D11_MAPPED_SUBRESOURCE mappedResource;
+    HRESULT result;
+
+    result = deviceContext->Map(m_buffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedResource);
+    if (FAILED(result))
+    {
+        return nullptr;
+    }
+    return (BillboardInstance*)mappedResource.pData;
+}
+
+
+void BillboardBuffer::Unmap(ID3D11DeviceContext* deviceContext)
+{
+    deviceContext->Unmap(m_buffer, 0);
+    return;
+}
+
+
+void BillboardBuffer::Render(ID3D11DeviceContext* deviceContext)
+{
+    ID3D11Buffer* nullBuffer = nullptr;
+    unsigned int stride = 0;
+    unsigned int offset = 0;
+
+    // the corners come from the vertex id so nothing is read by the input assembler
+    deviceContext->IASetVertexBuffers(0, 1, &nullBuffer, &stride, &offset);
+    deviceContext->IASetIndexBuffer(nullptr, DXGI_FORMAT_UNKNOWN, 0);
+    deviceContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+
+    deviceContext->VSSetShaderResources(ShaderSlot, 1, &m_view);
+    return;
+}
+
+
+void BillboardBuffer::PackInstance(const XMFLOAT3& position, const XMFLOAT4& color, BillboardType type, BillboardInstance* instance)
+{
+    instance->position = position;
+    instance->size = BillboardSizes[type];
+    PackColor(color, &instance->colorRG, &instance->colorBA);
+    instance->type = (unsigned int)type;
+    instance->stretch = BillboardStretches[type];
+    return;
+}
+
+
+void BillboardBuffer::PackColor(const XMFLOAT4& color, unsigned int* colorRG, unsigned int* colorBA)
+{
+    (*colorRG) = FloatToHalf(color.x) | (FloatToHalf(color.y) << 16);
+    (*colorBA) = FloatToHalf(color.z) | (FloatToHalf(color.w) << 16);
+    return;
+}
+
+
+XMFLOAT4 BillboardBuffer::UnpackColor(unsigned int colorRG, unsigned int colorBA)
+{
+    return XMFLOAT4(HalfToFloat(colorRG & 0xffff), HalfToFloat(colorRG >> 16), HalfToFloat(colorBA & 0xffff), HalfToFloat(colorBA >> 16));
+}
+
+
+int BillboardBuffer::GetMaxInstances()
+{
+    return m_maxInstances;
+}
+
+
+ID3D11ShaderResourceView* BillboardBuffer::GetShaderResourceView()
+{
+    return m_view;
+}
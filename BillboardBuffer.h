@@ -0,0 +1,66 @@
+#pragma once
+#include <d3d11.h>
+#include <DirectXMath.h>
+
+using namespace DirectX;
+
+// Particle instances for drawing without a vertex or index buffer. Every particle is one 32 byte record in a structured
+// buffer and billboard.vs builds the camera facing quad corners from SV_VertexID, so the particles are drawn with
+// DrawInstanced(VerticesPerBillboard, instanceCount, 0, 0) and a null input layout.
+class BillboardBuffer
+{
+public:
+    enum BillboardType
+    {
+        BILLBOARD_DEFAULT,
+        BILLBOARD_RAIN,
+        BILLBOARD_FIRE,
+        BILLBOARD_TYPE_COUNT
+    };
+
+    //layout must match BillboardInstance in billboard.vs
+    struct BillboardInstance
+    {
+        XMFLOAT3 position;
+        //half width of the quad in world units
+        float size;
+        //half4 so fire and other hdr colors above 1 survive, red and blue in the low 16 bits
+        unsigned int colorRG;
+        unsigned int colorBA;
+        unsigned int type;
+        //height of the quad relative to its width
+        float stretch;
+    };
+
+    static const int VerticesPerBillboard = 6;
+    //vertex shader register the instance buffer is bound to
+    static const int ShaderSlot = 0;
+
+    BillboardBuffer();
+    ~BillboardBuffer();
+
+    bool Initialize(ID3D11Device* device, int maxInstances);
+    void Shutdown();
+
+    //returns the mapped buffer for the next frame's instances or nullptr if the map failed, Unmap must follow
+    BillboardInstance* Map(ID3D11DeviceContext* deviceContext);
+    void Unmap(ID3D11DeviceContext* deviceContext);
+
+    //clears the input assembler buffers and binds the instances to the vertex shader
+    void Render(ID3D11DeviceContext* deviceContext);
+
+    //fills one instance record, the size and stretch come from the particle type
+    static void PackInstance(const XMFLOAT3& position, const XMFLOAT4& color, BillboardType type, BillboardInstance* instance);
+    //values past the largest half are clamped to it and NaN becomes 0, everything else rounds to the nearest half
+    static void PackColor(const XMFLOAT4& color, unsigned int* colorRG, unsigned int* colorBA);
+    //what billboard.vs reads back from a packed color
+    static XMFLOAT4 UnpackColor(unsigned int colorRG, unsigned int colorBA);
+
+    int GetMaxInstances();
+    ID3D11ShaderResourceView* GetShaderResourceView();
+
+private:
+    ID3D11Buffer* m_buffer;
+    ID3D11ShaderResourceView* m_view;
+    int m_maxInstances;
+};
@@ -0,0 +1,486 @@
+#include "CollisionWorld.h"
+
+#include <algorithm>
+#include <math.h>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define COLLISION_USE_SSE 1
+#endif
+
+//leaves hold at most this many triangles
+static const int MaxLeafTriangles = 4;
+//deep enough for any tree built from up to 2^31 triangles with median splits
+static const int MaxTraversalDepth = 64;
+//determinants smaller than this are segments running along the triangle's plane
+static const float ParallelEpsilon = 1e-12f;
+
+
+//segment directions with a zero component would turn the slab test into 0 * infinity
+static float SafeDirection(float value)
+{
+    if (fabsf(value) < 1e-20f)
+    {
+        return (value < 0.0f) ? -1e-20f : 1e-20f;
+    }
+    return value;
+}
+
+
+CollisionWorld::CollisionWorld()
+{
+    m_meshCount = 0;
+    m_built = false;
+}
+
+
+CollisionWorld::~CollisionWorld()
+{
+}
+
+
+int CollisionWorld::AddMesh(const XMFLOAT3* vertices, int vertexCount, const unsigned int* indices, int indexCount, CollisionResponse response)
+{
+    CollisionTriangle triangle;
+    XMFLOAT3 centroid;
+    float length;
+
+    for (auto i = 0; i + 2 < indexCount; i += 3)
+    {
+        if ((int)indices[i] >= vertexCount || (int)indices[i + 1] >= vertexCount || (int)indices[i + 2] >= vertexCount)
+        {
+            continue;
+        }
+
+        const XMFLOAT3& a = vertices[indices[i]];
+        const XMFLOAT3& b = vertices[indices[i + 1]];
+        const XMFLOAT3& c = vertices[indices[i + 2]];
+
+        triangle.vertex0 = a;
+        triangle.edge1 = XMFLOAT3(b.x - a.x, b.y - a.y, b.z - a.z);
+        triangle.edge2 = XMFLOAT3(c.x - a.x, c.y - a.y, c.z - a.z);
+        triangle.normal = XMFLOAT3(
+            (triangle.edge1.y * triangle.edge2.z) - (triangle.edge1.z * triangle.edge2.y),
+            (triangle.edge1.z * triangle.edge2.x) - (triangle.edge1.x * triangle.edge2.z),
+            (triangle.edge1.x * triangle.edge2.y) - (triangle.edge1.y * triangle.edge2.x));
+        length = sqrtf((triangle.normal.x * triangle.normal.x) + (triangle.normal.y * triangle.normal.y) + (triangle.normal.z * triangle.normal.z));
+        if (length <= 0.0f)
+        {
+            //degenerate
+            continue;
+        }
+        triangle.normal.x /= length;
+        triangle.normal.y /= length;
+        triangle.normal.z /= length;
+        triangle.mesh = m_meshCount;
+        triangle.response = response;
+
+        centroid = XMFLOAT3((a.x + b.x + c.x) / 3.0f, (a.y + b.y + c.y) / 3.0f, (a.z + b.z + c.z) / 3.0f);
+        m_triangles.push_back(triangle);
+        m_centroids.push_back(centroid);
+    }
+
+    m_built = false;
+    m_meshCount++;
+    return m_meshCount - 1;
+}
+
+
+void CollisionWorld::Clear()
+{
+    m_triangles.clear();
+    m_centroids.clear();
+    m_nodes.clear();
+    m_meshCount = 0;
+    m_built = false;
+    return;
+}
+
+
+bool CollisionWorld::Build()
+{
+    m_nodes.clear();
+    m_built = false;
+
+    if (m_triangles.empty())
+    {
+        return false;
+    }
+
+    // a binary tree with at least one triangle per leaf never needs more than 2n - 1 nodes
+    m_nodes.reserve(2 * m_triangles.size());
+    m_nodes.push_back(BvhNode());
+    BuildNode(0, 0, (int)m_triangles.size());
+
+    m_built = true;
+    return true;
+}
+
+
+void CollisionWorld::BuildNode(int nodeIndex, int first, int count)
+{
+    float minimum[3] = { 1e30f, 1e30f, 1e30f };
+    float maximum[3] = { -1e30f, -1e30f, -1e30f };
+    float centroidMinimum[3] = { 1e30f, 1e30f, 1e30f };
+    float centroidMaximum[3] = { -1e30f, -1e30f, -1e30f };
+    int axis, half, left;
+
+    for (auto i = first; i < first + count; ++i)
+    {
+        const CollisionTriangle& triangle = m_triangles[i];
+        float corners[3][3] =
+        {
+            { triangle.vertex0.x, triangle.vertex0.y, triangle.vertex0.z },
+            { triangle.vertex0.x + triangle.edge1.x, triangle.vertex0.y + triangle.edge1.y, triangle.vertex0.z + triangle.edge1.z },
+            { triangle.vertex0.x + triangle.edge2.x, triangle.vertex0.y + triangle.edge2.y, triangle.vertex0.z + triangle.edge2.z }
+        };
+        float centroid[3] = { m_centroids[i].x, m_centroids[i].y, m_centroids[i].z };
+
+        for (auto k = 0; k < 3; ++k)
+        {
+            for (auto corner = 0; corner < 3; ++corner)
+            {
+                minimum[k] = fminf(minimum[k], corners[corner][k]);
+                maximum[k] = fmaxf(maximum[k], corners[corner][k]);
+            }
+            centroidMinimum[k] = fminf(centroidMinimum[k], centroid[k]);
+            centroidMaximum[k] = fmaxf(centroidMaximum[k], centroid[k]);
+        }
+    }
+
+    for (auto k = 0; k < 3; ++k)
+    {
+        m_nodes[nodeIndex].minimum[k] = minimum[k];
+        m_nodes[nodeIndex].maximum[k] = maximum[k];
+    }
+
+    if (count <= MaxLeafTriangles)
+    {
+        m_nodes[nodeIndex].leftOrFirst = first;
+        m_nodes[nodeIndex].count = count;
+        return;
+    }
+
+    // median split along the longest axis of the centroids, this keeps the tree balanced for the packet traversal stack
+    axis = 0;
+    if (centroidMaximum[1] - centroidMinimum[1] > centroidMaximum[axis] - centroidMinimum[axis])
+    {
+        axis = 1;
+    }
+    if (centroidMaximum[2] - centroidMinimum[2] > centroidMaximum[axis] - centroidMinimum[axis])
+    {
+        axis = 2;
+    }
+
+    std::vector<int> order(count);
+    for (auto i = 0; i < count; ++i)
+    {
+        order[i] = first + i;
+    }
+    half = count / 2;
+    std::nth_element(order.begin(), order.begin() + half, order.end(), [this, axis](int a, int b)
+    {
+        const float* centroidA = &m_centroids[a].x;
+        const float* centroidB = &m_centroids[b].x;
+        return centroidA[axis] < centroidB[axis];
+    });
+
+    // reorder the triangles and centroids of this node to match
+    std::vector<CollisionTriangle> triangles(count);
+    std::vector<XMFLOAT3> centroids(count);
+    for (auto i = 0; i < count; ++i)
+    {
+        triangles[i] = m_triangles[order[i]];
+        centroids[i] = m_centroids[order[i]];
+    }
+    std::copy(triangles.begin(), triangles.end(), m_triangles.begin() + first);
+    std::copy(centroids.begin(), centroids.end(), m_centroids.begin() + first);
+
+    left = (int)m_nodes.size();
+    m_nodes.push_back(BvhNode());
+    m_nodes.push_back(BvhNode());
+    m_nodes[nodeIndex].leftOrFirst = left;
+    m_nodes[nodeIndex].count = 0;
+
+    BuildNode(left, first, half);
+    BuildNode(left + 1, first + half, count - half);
+    return;
+}
+
+
+void CollisionWorld::IntersectSegments(const XMFLOAT3* starts, const XMFLOAT3* ends, int count, CollisionHit* hits)
+{
+    int packetCount;
+
+    for (auto i = 0; i < count; i += PacketSize)
+    {
+        packetCount = (count - i < PacketSize) ? count - i : PacketSize;
+        if (!m_built)
+        {
+            for (auto j = 0; j < packetCount; ++j)
+            {
+                hits[i + j].t = 1.0f;
+                hits[i + j].triangle = -1;
+            }
+            continue;
+        }
+        IntersectPacket(&starts[i], &ends[i], packetCount, &hits[i]);
+    }
+    return;
+}
+
+
+#ifdef COLLISION_USE_SSE
+
+void CollisionWorld::IntersectPacket(const XMFLOAT3* starts, const XMFLOAT3* ends, int count, CollisionHit* hits)
+{
+    float originX[PacketSize], originY[PacketSize], originZ[PacketSize];
+    float directionX[PacketSize], directionY[PacketSize], directionZ[PacketSize];
+    float best[PacketSize];
+    int bestTriangle[PacketSize];
+    int stack[MaxTraversalDepth];
+    int stackSize, lane;
+
+    // unused lanes repeat the first segment with a best distance no hit can beat
+    for (auto i = 0; i < PacketSize; ++i)
+    {
+        lane = (i < count) ? i : 0;
+        originX[i] = starts[lane].x;
+        originY[i] = starts[lane].y;
+        originZ[i] = starts[lane].z;
+        directionX[i] = SafeDirection(ends[lane].x - starts[lane].x);
+        directionY[i] = SafeDirection(ends[lane].y - starts[lane].y);
+        directionZ[i] = SafeDirection(ends[lane].z - starts[lane].z);
+        best[i] = (i < count) ? 1.0f : -1.0f;
+    }
+
+    __m128 ox = _mm_loadu_ps(originX);
+    __m128 oy = _mm_loadu_ps(originY);
+    __m128 oz = _mm_loadu_ps(originZ);
+    __m128 dx = _mm_loadu_ps(directionX);
+    __m128 dy = _mm_loadu_ps(directionY);
+    __m128 dz = _mm_loadu_ps(directionZ);
+    __m128 inverseX = _mm_div_ps(_mm_set1_ps(1.0f), dx);
+    __m128 inverseY = _mm_div_ps(_mm_set1_ps(1.0f), dy);
+    __m128 inverseZ = _mm_div_ps(_mm_set1_ps(1.0f), dz);
+    __m128 bestT = _mm_loadu_ps(best);
+    __m128i bestIndex = _mm_set1_epi32(-1);
+
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 epsilon = _mm_set1_ps(ParallelEpsilon);
+    const __m128 signMask = _mm_set1_ps(-0.0f);
+
+    stackSize = 0;
+    stack[stackSize++] = 0;
+    while (stackSize > 0)
+    {
+        const BvhNode& node = m_nodes[stack[--stackSize]];
+
+        // slab test of the node box against all four segments
+        __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.minimum[0]), ox), inverseX);
+        __m128 t2 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.maximum[0]), ox), inverseX);
+        __m128 tNear = _mm_min_ps(t1, t2);
+        __m128 tFar = _mm_max_ps(t1, t2);
+        t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.minimum[1]), oy), inverseY);
+        t2 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.maximum[1]), oy), inverseY);
+        tNear = _mm_max_ps(tNear, _mm_min_ps(t1, t2));
+        tFar = _mm_min_ps(tFar, _mm_max_ps(t1, t2));
+        t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.minimum[2]), oz), inverseZ);
+        t2 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.maximum[2]), oz), inverseZ);
+        tNear = _mm_max_ps(tNear, _mm_min_ps(t1, t2));
+        tFar = _mm_min_ps(tFar, _mm_max_ps(t1, t2));
+
+        __m128 boxHit = _mm_and_ps(_mm_cmpge_ps(tFar, _mm_max_ps(tNear, zero)), _mm_cmple_ps(tNear, bestT));
+        if (_mm_movemask_ps(boxHit) == 0)
+        {
+            continue;
+        }
+
+        if (node.count == 0)
+        {
+            if (stackSize + 2 <= MaxTraversalDepth)
+            {
+                stack[stackSize++] = node.leftOrFirst + 1;
+                stack[stackSize++] = node.leftOrFirst;
+            }
+            continue;
+        }
+
+        for (auto i = node.leftOrFirst; i < node.leftOrFirst + node.count; ++i)
+        {
+            const CollisionTriangle& triangle = m_triangles[i];
+            __m128 e1x = _mm_set1_ps(triangle.edge1.x);
+            __m128 e1y = _mm_set1_ps(triangle.edge1.y);
+            __m128 e1z = _mm_set1_ps(triangle.edge1.z);
+            __m128 e2x = _mm_set1_ps(triangle.edge2.x);
+            __m128 e2y = _mm_set1_ps(triangle.edge2.y);
+            __m128 e2z = _mm_set1_ps(triangle.edge2.z);
+
+            // moller trumbore for four segments at once
+            __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+            __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+            __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+            __m128 determinant = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+            __m128 inverseDeterminant = _mm_div_ps(one, determinant);
+
+            __m128 tx = _mm_sub_ps(ox, _mm_set1_ps(triangle.vertex0.x));
+            __m128 ty = _mm_sub_ps(oy, _mm_set1_ps(triangle.vertex0.y));
+            __m128 tz = _mm_sub_ps(oz, _mm_set1_ps(triangle.vertex0.z));
+            __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, px), _mm_mul_ps(ty, py)), _mm_mul_ps(tz, pz)), inverseDeterminant);
+
+            __m128 qx = _mm_sub_ps(_mm_mul_ps(ty, e1z), _mm_mul_ps(tz, e1y));
+            __m128 qy = _mm_sub_ps(_mm_mul_ps(tz, e1x), _mm_mul_ps(tx, e1z));
+            __m128 qz = _mm_sub_ps(_mm_mul_ps(tx, e1y), _mm_mul_ps(ty, e1x));
+            __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), inverseDeterminant);
+            __m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inverseDeterminant);
+
+            __m128 valid = _mm_cmpgt_ps(_mm_andnot_ps(signMask, determinant), epsilon);
+            valid = _mm_and_ps(valid, _mm_cmpge_ps(u, zero));
+            valid = _mm_and_ps(valid, _mm_cmpge_ps(v, zero));
+            valid = _mm_and_ps(valid, _mm_cmple_ps(_mm_add_ps(u, v), one));
+            valid = _mm_and_ps(valid, _mm_cmpge_ps(t, zero));
+            valid = _mm_and_ps(valid, _mm_cmplt_ps(t, bestT));
+
+            bestT = _mm_or_ps(_mm_and_ps(valid, t), _mm_andnot_ps(valid, bestT));
+            __m128i validIndex = _mm_castps_si128(valid);
+            bestIndex = _mm_or_si128(_mm_and_si128(validIndex, _mm_set1_epi32(i)), _mm_andnot_si128(validIndex, bestIndex));
+        }
+    }
+
+    _mm_storeu_ps(best, bestT);
+    _mm_storeu_si128((__m128i*)bestTriangle, bestIndex);
+    for (auto i = 0; i < count; ++i)
+    {
+        hits[i].t = best[i];
+        hits[i].triangle = bestTriangle[i];
+    }
+    return;
+}
+
+#else
+
+void CollisionWorld::IntersectPacket(const XMFLOAT3* starts, const XMFLOAT3* ends, int count, CollisionHit* hits)
+{
+    int stack[MaxTraversalDepth];
+    int stackSize;
+
+    for (auto lane = 0; lane < count; ++lane)
+    {
+        float origin[3] = { starts[lane].x, starts[lane].y, starts[lane].z };
+        float direction[3] = { SafeDirection(ends[lane].x - starts[lane].x), SafeDirection(ends[lane].y - starts[lane].y), SafeDirection(ends[lane].z - starts[lane].z) };
+        float best = 1.0f;
+        int bestTriangle = -1;
+
+        stackSize = 0;
+        stack[stackSize++] = 0;
+        while (stackSize > 0)
+        {
+            const BvhNode& node = m_nodes[stack[--stackSize]];
+            float tNear = -1e30f;
+            float tFar = 1e30f;
+            for (auto k = 0; k < 3; ++k)
+            {
+                float t1 = (node.minimum[k] - origin[k]) / direction[k];
+                float t2 = (node.maximum[k] - origin[k]) / direction[k];
+                tNear = fmaxf(tNear, fminf(t1, t2));
+                tFar = fminf(tFar, fmaxf(t1, t2));
+            }
+            if (tFar < fmaxf(tNear, 0.0f) || tNear > best)
+            {
+                continue;
+            }
+
+            if (node.count == 0)
+            {
+                if (stackSize + 2 <= MaxTraversalDepth)
+                {
+                    stack[stackSize++] = node.leftOrFirst + 1;
+                    stack[stackSize++] = node.leftOrFirst;
+                }
+                continue;
+            }
+
+            for (auto i = node.leftOrFirst; i < node.leftOrFirst + node.count; ++i)
+            {
+                const CollisionTriangle& triangle = m_triangles[i];
+                float px = (direction[1] * triangle.edge2.z) - (direction[2] * triangle.edge2.y);
+                float py = (direction[2] * triangle.edge2.x) - (direction[0] * triangle.edge2.z);
+                float pz = (direction[0] * triangle.edge2.y) - (direction[1] * triangle.edge2.x);
+                float determinant = (triangle.edge1.x * px) + (triangle.edge1.y * py) + (triangle.edge1.z * pz);
+                if (fabsf(determinant) <= ParallelEpsilon)
+                {
+                    continue;
+                }
+                float inverseDeterminant = 1.0f / determinant;
+
+                float tx = origin[0] - triangle.vertex0.x;
+                float ty = origin[1] - triangle.vertex0.y;
+                float tz = origin[2] - triangle.vertex0.z;
+                float u = ((tx * px) + (ty * py) + (tz * pz)) * inverseDeterminant;
+                if (u < 0.0f || u > 1.0f)
+                {
+                    continue;
+                }
+
+                float qx = (ty * triangle.edge1.z) - (tz * triangle.edge1.y);
+                float qy = (tz * triangle.edge1.x) - (tx * triangle.edge1.z);
+                float qz = (tx * triangle.edge1.y) - (ty * triangle.edge1.x);
+                float v = ((direction[0] * qx) + (direction[1] * qy) + (direction[2] * qz)) * inverseDeterminant;
+                if (v < 0.0f || u + v > 1.0f)
+                {
+                    continue;
+                }
+
+                float t = ((triangle.edge2.x * qx) + (triangle.edge2.y * qy) + (triangle.edge2.z * qz)) * inverseDeterminant;
+                if (t >= 0.0f && t < best)
+                {
+                    best = t;
+                    bestTriangle = i;
+                }
+            }
+        }
+
+        hits[lane].t = best;
+        hits[lane].triangle = bestTriangle;
+    }
+    return;
+}
+
+#endif
+
+
+const XMFLOAT3& CollisionWorld::GetTriangleNormal(int triangle)
+{
+    return m_triangles[triangle].normal;
+}
+
+
+int CollisionWorld::GetTriangleMesh(int triangle)
+{
+    return m_triangles[triangle].mesh;
+}
+
+
+CollisionResponse CollisionWorld::GetTriangleResponse(int triangle)
+{
+    return m_triangles[triangle].response;
+}
+
+
+bool CollisionWorld::IsEmpty()
+{
+    return !m_built;
+}
+
+
+int CollisionWorld::GetTriangleCount()
+{
+    return (int)m_triangles.size();
+}
+
+
+int CollisionWorld::GetNodeCount()
+{
+    return (int)m_nodes.size();
+}
@@ -0,0 +1,97 @@
+#pragma once
+#include <DirectXMath.h>
+
+#include <vector>
+
+using namespace DirectX;
+
+//what happens to a particle whose motion crosses a triangle
+enum CollisionResponse
+{
+    COLLISION_BOUNCE,
+    COLLISION_KILL
+};
+
+struct CollisionHit
+{
+    //fraction of the segment before the hit, 1 or more when nothing was hit
+    float t;
+    //-1 when nothing was hit
+    int triangle;
+};
+
+enum ImpactParticleType
+{
+    IMPACT_RAIN,
+    IMPACT_FIRE,
+    IMPACT_GENERAL
+};
+
+//a particle hitting the scene, for gameplay and sound
+struct ParticleImpact
+{
+    XMFLOAT3 position;
+    //facing the side the particle came from
+    XMFLOAT3 normal;
+    ImpactParticleType particleType;
+    int mesh;
+};
+
+// Static collision geometry for particles. Triangle meshes are built into a bounding volume hierarchy with small leaves
+// and the particles' motion for the frame is tested as segments, four at a time, so every node and triangle test is one
+// SSE pass over a packet of particles.
+class CollisionWorld
+{
+private:
+    struct CollisionTriangle
+    {
+        XMFLOAT3 vertex0;
+        XMFLOAT3 edge1, edge2;
+        XMFLOAT3 normal;
+        int mesh;
+        CollisionResponse response;
+    };
+
+    // 32 bytes, the children of an inner node are next to each other at leftOrFirst, a leaf holds count triangles from leftOrFirst
+    struct BvhNode
+    {
+        float minimum[3];
+        int leftOrFirst;
+        float maximum[3];
+        int count;
+    };
+
+public:
+    static const int PacketSize = 4;
+
+    CollisionWorld();
+    ~CollisionWorld();
+
+    //adds a triangle list, Build must be called before the new triangles are hit
+    //@return id of the mesh, reported back by GetTriangleMesh
+    int AddMesh(const XMFLOAT3* vertices, int vertexCount, const unsigned int* indices, int indexCount, CollisionResponse response);
+    void Clear();
+    bool Build();
+
+    //finds the first triangle crossed by each segment from starts[i] to ends[i]
+    void IntersectSegments(const XMFLOAT3* starts, const XMFLOAT3* ends, int count, CollisionHit* hits);
+
+    const XMFLOAT3& GetTriangleNormal(int triangle);
+    int GetTriangleMesh(int triangle);
+    CollisionResponse GetTriangleResponse(int triangle);
+
+    bool IsEmpty();
+    int GetTriangleCount();
+    int GetNodeCount();
+
+private:
+    void BuildNode(int nodeIndex, int first, int count);
+    //tests up to PacketSize segments against the tree
+    void IntersectPacket(const XMFLOAT3* starts, const XMFLOAT3* ends, int count, CollisionHit* hits);
+
+    std::vector<CollisionTriangle> m_triangles;
+    std::vector<BvhNode> m_nodes;
+    std::vector<XMFLOAT3> m_centroids;
+    int m_meshCount;
+    bool m_built;
+};
@@ -0,0 +1,364 @@
+#include "CompactParticlePool.h"
+
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+
+const float CompactParticlePool::VelocityScale = 256.0f;
+const float CompactParticlePool::LifeTimeScale = 1024.0f;
+
+
+static int16_t QuantizeVelocity(float velocity)
+{
+    float scaled = velocity * CompactParticlePool::VelocityScale;
+    if (scaled > 32767.0f)
+    {
+        return 32767;
+    }
+    if (scaled < -32767.0f)
+    {
+        return -32767;
+    }
+    return (int16_t)lrintf(scaled);
+}
+
+
+CompactParticlePool::CompactParticlePool()
+{
+    m_particles = nullptr;
+    m_count = 0;
+    m_maxParticles = 0;
+    m_paletteCount = 0;
+    m_lifeTimeRemainder = 0.0f;
+}
+
+
+CompactParticlePool::~CompactParticlePool()
+{
+}
+
+
+bool CompactParticlePool::Initialize(int maxParticles)
+{
+    if (maxParticles <= 0)
+    {
+        return false;
+    }
+
+    m_particles = new CompactParticle[maxParticles];
+    if (!m_particles)
+    {
+        return false;
+    }
+
+    m_maxParticles = maxParticles;
+    m_count = 0;
+    m_paletteCount = 0;
+    m_lifeTimeRemainder = 0.0f;
+    return true;
+}
+
+
+void CompactParticlePool::Shutdown()
+{
+    if (m_particles)
+    {
+        delete[] m_particles;
+        m_particles = nullptr;
+    }
+    m_count = 0;
+    m_maxParticles = 0;
+    return;
+}
+
+
+bool CompactParticlePool::Spawn(const XMFLOAT3& position, const XMFLOAT3& velocity, float lifeTime, int palette)
+{
+    CompactParticle* particle;
+    float lifeTimeSteps;
+
+    if (m_count >= m_maxParticles)
+    {
+        return false;
+    }
+
+    particle = &m_particles[m_count];
+    particle->positionX = position.x;
+    particle->positionY = position.y;
+    particle->positionZ = position.z;
+    particle->velocityX = QuantizeVelocity(velocity.x);
+    particle->velocityY = QuantizeVelocity(velocity.y);
+    particle->velocityZ = QuantizeVelocity(velocity.z);
+
+    // a living particle always has at least one step left
+    lifeTimeSteps = ceilf(lifeTime * LifeTimeScale);
+    if (lifeTimeSteps < 1.0f)
+    {
+        lifeTimeSteps = 1.0f;
+    }
+    else if (lifeTimeSteps > 65535.0f)
+    {
+        lifeTimeSteps = 65535.0f;
+    }
+    particle->remainingLifeTime = (uint16_t)lifeTimeSteps;
+    particle->palette = (uint8_t)palette;
+    particle->padding[0] = 0;
+    particle->padding[1] = 0;
+    particle->padding[2] = 0;
+
+    m_count++;
+    return true;
+}
+
+
+void CompactParticlePool::Update(float frameTime, float gravity)
+{
+    CompactParticle* particle;
+    float velocityX, velocityY, velocityZ, lifeTimeSteps;
+    int gravitySteps, age;
+
+    // gravity and age are the same for every particle this frame so they are converted once
+    gravitySteps = (int)lrintf(gravity * frameTime * VelocityScale);
+
+    lifeTimeSteps = (frameTime * LifeTimeScale) + m_lifeTimeRemainder;
+    age = (int)lifeTimeSteps;
+    m_lifeTimeRemainder = lifeTimeSteps - age;
+
+    for (auto i = 0; i < m_count; ++i)
+    {
+        particle = &m_particles[i];
+
+        //if particle is off the ground, increase y velocity by gravity constant
+        if (particle->positionY > 0.0f)
+        {
+            int newVelocity = particle->velocityY + gravitySteps;
+            particle->velocityY = (int16_t)(newVelocity < -32767 ? -32767 : (newVelocity > 32767 ? 32767 : newVelocity));
+        }
+
+        velocityX = particle->velocityX * (1.0f / VelocityScale);
+        velocityY = particle->velocityY * (1.0f / VelocityScale);
+        velocityZ = particle->velocityZ * (1.0f / VelocityScale);
+
+        particle->positionX += velocityX * frameTime;
+        particle->positionY += velocityY * frameTime;
+        particle->positionZ += velocityZ * frameTime;
+
+        particle->remainingLifeTime = (particle->remainingLifeTime > age) ? (uint16_t)(particle->remainingLifeTime - age) : 0;
+
+        if (particle->positionY < 0.0f)
+        {
+            particle->positionY = 0.1f;
+
+            // change particle velocity to simulate bouncing off the ground, with some reduction in non-veritcal velocity
+            particle->velocityY = QuantizeVelocity(velocityY * -0.4f);
+            particle->velocityX = QuantizeVelocity(velocityX * 0.6f);
+            particle->velocityZ = QuantizeVelocity(velocityZ * 0.6f);
+        }
+    }
+    return;
+}
+
+
+void CompactParticlePool::Kill()
+{
+    int count = 0;
+
+    // the survivors are packed down in place so they keep their order
+    for (auto i = 0; i < m_count; ++i)
+    {
+        if (m_particles[i].remainingLifeTime != 0)
+        {
+            if (count != i)
+            {
+                m_particles[count] = m_particles[i];
+            }
+            count++;
+        }
+    }
+    m_count = count;
+    return;
+}
+
+
+void CompactParticlePool::SetParticleMotion(int index, const XMFLOAT3& position, const XMFLOAT3& velocity)
+{
+    CompactParticle* particle = &m_particles[index];
+
+    particle->positionX = position.x;
+    particle->positionY = position.y;
+    particle->positionZ = position.z;
+    particle->velocityX = QuantizeVelocity(velocity.x);
+    particle->velocityY = QuantizeVelocity(velocity.y);
+    particle->velocityZ = QuantizeVelocity(velocity.z);
+    return;
+}
+
+
+void CompactParticlePool::ExpireParticle(int index)
+{
+    m_particles[index].remainingLifeTime = 0;
+    return;
+}
+
+
+int CompactParticlePool::GetStateSize()
+{
+    return sizeof(StateHeader) + (m_paletteCount * sizeof(XMFLOAT4)) + (m_count * sizeof(CompactParticle));
+}
+
+
+int CompactParticlePool::GetMaxStateSize()
+{
+    return sizeof(StateHeader) + (MaxPaletteColors * sizeof(XMFLOAT4)) + (m_maxParticles * sizeof(CompactParticle));
+}
+
+
+void CompactParticlePool::SaveState(unsigned char* buffer)
+{
+    StateHeader header;
+
+    header.count = m_count;
+    header.paletteCount = m_paletteCount;
+    header.lifeTimeRemainder = m_lifeTimeRemainder;
+    memcpy(buffer, &header, sizeof(header));
+    buffer += sizeof(header);
+
+    memcpy(buffer, m_palette, m_paletteCount * sizeof(XMFLOAT4));
+    buffer += m_paletteCount * sizeof(XMFLOAT4);
+    memcpy(buffer, m_particles, m_count * sizeof(CompactParticle));
+    return;
+}
+
+
+bool CompactParticlePool::RestoreState(const unsigned char* buffer, int size)
+{
+    StateHeader header;
+
+    if (size < (int)sizeof(header))
+    {
+        return false;
+    }
+    memcpy(&header, buffer, sizeof(header));
+    buffer += sizeof(header);
+
+    if (header.count < 0 || header.count > m_maxParticles || header.paletteCount < 0 || header.paletteCount > MaxPaletteColors)
+    {
+        return false;
+    }
+    if (size < (int)(sizeof(header) + (header.paletteCount * sizeof(XMFLOAT4)) + (header.count * sizeof(CompactParticle))))
+    {
+        return false;
+    }
+
+    m_count = header.count;
+    m_paletteCount = header.paletteCount;
+    m_lifeTimeRemainder = header.lifeTimeRemainder;
+    memcpy(m_palette, buffer, m_paletteCount * sizeof(XMFLOAT4));
+    buffer += m_paletteCount * sizeof(XMFLOAT4);
+    memcpy(m_particles, buffer, m_count * sizeof(CompactParticle));
+    return true;
+}
+
+
+void CompactParticlePool::SortByDepth()
+{
+    CompactParticle particle;
+    int j;
+    long long moveBudget;
+
+    // far to near like PlaceNodeInZSortedList. New particles are added at the end and can belong anywhere, so after a
+    // few moves per particle the insertion sort gives up and the rest is done with a full sort
+    moveBudget = 8ll * m_count;
+    for (auto i = 1; i < m_count; ++i)
+    {
+        if (m_particles[i - 1].positionZ >= m_particles[i].positionZ)
+        {
+            continue;
+        }
+
+        particle = m_particles[i];
+        j = i - 1;
+        while (j >= 0 && m_particles[j].positionZ < particle.positionZ)
+        {
+            m_particles[j + 1] = m_particles[j];
+            j--;
+        }
+        m_particles[j + 1] = particle;
+
+        moveBudget -= i - 1 - j;
+        if (moveBudget < 0)
+        {
+            std::sort(m_particles, m_particles + m_count, [](const CompactParticle& a, const CompactParticle& b)
+            {
+                return a.positionZ > b.positionZ;
+            });
+            return;
+        }
+    }
+    return;
+}
+
+
+int CompactParticlePool::FindPaletteColor(float red, float green, float blue)
+{
+    float distance, bestDistance;
+    int best = 0;
+
+    for (auto i = 0; i < m_paletteCount; ++i)
+    {
+        if (m_palette[i].x == red && m_palette[i].y == green && m_palette[i].z == blue)
+        {
+            return i;
+        }
+    }
+
+    if (m_paletteCount < MaxPaletteColors)
+    {
+        m_palette[m_paletteCount] = XMFLOAT4(red, green, blue, 1.0f);
+        m_paletteCount++;
+        return m_paletteCount - 1;
+    }
+
+    bestDistance = 1e30f;
+    for (auto i = 0; i < m_paletteCount; ++i)
+    {
+        distance = ((m_palette[i].x - red) * (m_palette[i].x - red)) + ((m_palette[i].y - green) * (m_palette[i].y - green)) +
+            ((m_palette[i].z - blue) * (m_palette[i].z - blue));
+        if (distance < bestDistance)
+        {
+            bestDistance = distance;
+            best = i;
+        }
+    }
+    return best;
+}
+
+
+const XMFLOAT4& CompactParticlePool::GetPaletteColor(int palette)
+{
+    return m_palette[palette];
+}
+
+
+const CompactParticle* CompactParticlePool::GetParticles()
+{
+    return m_particles;
+}
+
+
+int CompactParticlePool::GetCount()
+{
+    return m_count;
+}
+
+
+int CompactParticlePool::GetMaxParticles()
+{
+    return m_maxParticles;
+}
+
+
+int CompactParticlePool::GetMemoryUsage()
+{
+    return m_maxParticles * (int)sizeof(CompactParticle);
+}
@@ -0,0 +1,88 @@
+#pragma once
+#include <DirectXMath.h>
+
+#include <cstdint>
+
+using namespace DirectX;
+
+// 24 byte particle state for the short lived general particles (splashes, bursts). Velocity and lifetime are fixed point,
+// the color is an index into a small palette since every particle of an effect shares it, and the particles are kept in
+// a dense array so there are no links. Dead particles are packed out in order and a per frame insertion sort keeps the
+// array ordered by z for alpha blending, which is close to linear as particles barely move between frames.
+struct CompactParticle
+{
+    float positionX, positionY, positionZ;
+    //units per second in 1/VelocityScale steps
+    int16_t velocityX, velocityY, velocityZ;
+    //seconds in 1/LifeTimeScale steps, 0 once the particle has expired
+    uint16_t remainingLifeTime;
+    uint8_t palette;
+    uint8_t padding[3];
+};
+
+static_assert(sizeof(CompactParticle) == 24, "CompactParticle must stay 24 bytes");
+
+class CompactParticlePool
+{
+public:
+    static const int MaxPaletteColors = 256;
+    //gives a velocity range of +-128 units per second and a lifetime of up to 64 seconds
+    static const float VelocityScale;
+    static const float LifeTimeScale;
+
+    CompactParticlePool();
+    ~CompactParticlePool();
+
+    bool Initialize(int maxParticles);
+    void Shutdown();
+
+    //returns false when the pool is full
+    bool Spawn(const XMFLOAT3& position, const XMFLOAT3& velocity, float lifeTime, int palette);
+
+    //applies gravity above the ground, moves, bounces off the ground and ages the particles, same rules as the general list
+    void Update(float frameTime, float gravity);
+    //removes expired particles, the rest keep their order
+    void Kill();
+    //puts the particles back in far to near order after spawns and moves, close to linear when little has changed.
+    //Indices from before the sort no longer refer to the same particles
+    void SortByDepth();
+
+    //moves a particle after a collision, the velocity is quantized the same way as in Spawn
+    void SetParticleMotion(int index, const XMFLOAT3& position, const XMFLOAT3& velocity);
+    //the particle is removed by the next Kill
+    void ExpireParticle(int index);
+
+    //particles, palette and lifetime remainder as a flat block for snapshots
+    int GetStateSize();
+    int GetMaxStateSize();
+    void SaveState(unsigned char* buffer);
+    //returns false if the block does not fit this pool
+    bool RestoreState(const unsigned char* buffer, int size);
+
+    //returns the palette index of the color, adding it if needed. When the palette is full the closest color is returned
+    int FindPaletteColor(float red, float green, float blue);
+    const XMFLOAT4& GetPaletteColor(int palette);
+
+    const CompactParticle* GetParticles();
+    int GetCount();
+    int GetMaxParticles();
+    //bytes of particle state, for comparison with the linked list particles
+    int GetMemoryUsage();
+
+private:
+    struct StateHeader
+    {
+        int32_t count;
+        int32_t paletteCount;
+        float lifeTimeRemainder;
+    };
+
+    CompactParticle* m_particles;
+    int m_count, m_maxParticles;
+
+    XMFLOAT4 m_palette[MaxPaletteColors];
+    int m_paletteCount;
+
+    //part of a lifetime step left over by the last update so rounding does not build up over many frames
+    float m_lifeTimeRemainder;
+};
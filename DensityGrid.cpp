@@ -0,0 +1,232 @@
+#include "DensityGrid.h"
+
+#include <string.h>
+
+//cells summed by one task of Resolve
+static const int ResolveBlockSize = 4096;
+
+
+DensityGrid::DensityGrid()
+{
+    m_minimum = XMFLOAT3(0.0f, 0.0f, 0.0f);
+    m_inverseCellSize = XMFLOAT3(0.0f, 0.0f, 0.0f);
+    m_resolutionX = 0;
+    m_resolutionY = 0;
+    m_resolutionZ = 0;
+    m_cellCount = 0;
+    m_inverseCellVolume = 0.0f;
+    m_cells = nullptr;
+    m_slices = nullptr;
+    m_sliceCount = 0;
+}
+
+
+DensityGrid::~DensityGrid()
+{
+}
+
+
+bool DensityGrid::Initialize(const XMFLOAT3& minimum, const XMFLOAT3& maximum, int resolutionX, int resolutionY, int resolutionZ, int sliceCount)
+{
+    XMFLOAT3 size(maximum.x - minimum.x, maximum.y - minimum.y, maximum.z - minimum.z);
+
+    if (resolutionX <= 0 || resolutionY <= 0 || resolutionZ <= 0 || sliceCount <= 0)
+    {
+        return false;
+    }
+    if (size.x <= 0.0f || size.y <= 0.0f || size.z <= 0.0f)
+    {
+        return false;
+    }
+
+    m_minimum = minimum;
+    m_inverseCellSize = XMFLOAT3(resolutionX / size.x, resolutionY / size.y, resolutionZ / size.z);
+    m_resolutionX = resolutionX;
+    m_resolutionY = resolutionY;
+    m_resolutionZ = resolutionZ;
+    m_cellCount = resolutionX * resolutionY * resolutionZ;
+    m_inverseCellVolume = m_inverseCellSize.x * m_inverseCellSize.y * m_inverseCellSize.z;
+    m_sliceCount = sliceCount;
+
+    m_cells = new XMFLOAT4[m_cellCount];
+    if (!m_cells)
+    {
+        return false;
+    }
+    memset(m_cells, 0, sizeof(XMFLOAT4) * m_cellCount);
+
+    m_slices = new XMFLOAT4[(size_t)m_cellCount * m_sliceCount];
+    if (!m_slices)
+    {
+        return false;
+    }
+    memset(m_slices, 0, sizeof(XMFLOAT4) * m_cellCount * m_sliceCount);
+    return true;
+}
+
+
+void DensityGrid::Shutdown()
+{
+    if (m_cells)
+    {
+        delete[] m_cells;
+        m_cells = nullptr;
+    }
+    if (m_slices)
+    {
+        delete[] m_slices;
+        m_slices = nullptr;
+    }
+    m_cellCount = 0;
+    m_sliceCount = 0;
+    return;
+}
+
+
+void DensityGrid::Splat(TaskPool* taskPool, const XMFLOAT3* positions, const XMFLOAT4* colors, int stride, int count, float densityWeight, float emissionWeight)
+{
+    int perSlice;
+
+    if (count <= 0)
+    {
+        return;
+    }
+
+    // weights are per unit of volume so the values do not change with the resolution
+    densityWeight *= m_inverseCellVolume;
+    emissionWeight *= m_inverseCellVolume;
+
+    // every task owns one slice, particles are split into contiguous runs so each task reads memory in order
+    perSlice = (count + m_sliceCount - 1) / m_sliceCount;
+    taskPool->ParallelFor(m_sliceCount, [=](int slice)
+    {
+        XMFLOAT4* cells = &m_slices[(size_t)slice * m_cellCount];
+        const char* positionBytes = (const char*)positions;
+        const char* colorBytes = (const char*)colors;
+        int first = slice * perSlice;
+        int last = (first + perSlice < count) ? first + perSlice : count;
+        int cellIndex;
+
+        for (auto i = first; i < last; ++i)
+        {
+            const XMFLOAT3& position = *(const XMFLOAT3*)(positionBytes + ((size_t)i * stride));
+            cellIndex = GetCellIndex(position);
+            if (cellIndex < 0)
+            {
+                continue;
+            }
+
+            const XMFLOAT4& color = *(const XMFLOAT4*)(colorBytes + ((size_t)i * stride));
+            cells[cellIndex].x += color.x * emissionWeight;
+            cells[cellIndex].y += color.y * emissionWeight;
+            cells[cellIndex].z += color.z * emissionWeight;
+            cells[cellIndex].w += densityWeight;
+        }
+    });
+    return;
+}
+
+
+void DensityGrid::Resolve(TaskPool* taskPool)
+{
+    int blockCount = (m_cellCount + ResolveBlockSize - 1) / ResolveBlockSize;
+
+    // split by cells rather than slices so every task writes its own part of the grid
+    taskPool->ParallelFor(blockCount, [this](int block)
+    {
+        int first = block * ResolveBlockSize;
+        int last = (first + ResolveBlockSize < m_cellCount) ? first + ResolveBlockSize : m_cellCount;
+
+        memset(&m_cells[first], 0, sizeof(XMFLOAT4) * (last - first));
+        for (auto slice = 0; slice < m_sliceCount; ++slice)
+        {
+            XMFLOAT4* cells = &m_slices[(size_t)slice * m_cellCount];
+            for (auto i = first; i < last; ++i)
+            {
+                m_cells[i].x += cells[i].x;
+                m_cells[i].y += cells[i].y;
+                m_cells[i].z += cells[i].z;
+                m_cells[i].w += cells[i].w;
+            }
+            memset(&cells[first], 0, sizeof(XMFLOAT4) * (last - first));
+        }
+    });
+    return;
+}
+
+
+float DensityGrid::SampleDensity(const XMFLOAT3& position)
+{
+    int cellIndex = GetCellIndex(position);
+    if (cellIndex < 0)
+    {
+        return 0.0f;
+    }
+    return m_cells[cellIndex].w;
+}
+
+
+XMFLOAT3 DensityGrid::SampleEmission(const XMFLOAT3& position)
+{
+    int cellIndex = GetCellIndex(position);
+    if (cellIndex < 0)
+    {
+        return XMFLOAT3(0.0f, 0.0f, 0.0f);
+    }
+    return XMFLOAT3(m_cells[cellIndex].x, m_cells[cellIndex].y, m_cells[cellIndex].z);
+}
+
+
+bool DensityGrid::IsInSmoke(const XMFLOAT3& position, float densityThreshold)
+{
+    return SampleDensity(position) > densityThreshold;
+}
+
+
+const XMFLOAT4* DensityGrid::GetCells()
+{
+    return m_cells;
+}
+
+
+int DensityGrid::GetResolutionX()
+{
+    return m_resolutionX;
+}
+
+
+int DensityGrid::GetResolutionY()
+{
+    return m_resolutionY;
+}
+
+
+int DensityGrid::GetResolutionZ()
+{
+    return m_resolutionZ;
+}
+
+
+int DensityGrid::GetCellCount()
+{
+    return m_cellCount;
+}
+
+
+int DensityGrid::GetCellIndex(const XMFLOAT3& position)
+{
+    float x = (position.x - m_minimum.x) * m_inverseCellSize.x;
+    float y = (position.y - m_minimum.y) * m_inverseCellSize.y;
+    float z = (position.z - m_minimum.z) * m_inverseCellSize.z;
+
+    // the comparisons also throw out nan positions
+    if (!(x >= 0.0f && y >= 0.0f && z >= 0.0f))
+    {
+        return -1;
+    }
+    if (x >= (float)m_resolutionX || y >= (float)m_resolutionY || z >= (float)m_resolutionZ)
+    {
+        return -1;
+    }
+    return (int)x + (m_resolutionX * ((int)y + (m_resolutionY * (int)z)));
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include <DirectXMath.h>
+
+#include "TaskPool.h"
+
+using namespace DirectX;
+
+// Coarse voxel grid of particle density and emitted light, rebuilt every frame so lighting, fog and gameplay can look up
+// how much smoke or fire is around a point in constant time instead of walking the particles. Particles are binned into
+// a private copy of the grid per task and the copies are summed afterwards, so no cell is ever written by two threads.
+// Each cell is (emission red, emission green, emission blue, density) per unit of volume, x fastest then y then z,
+// which can be copied straight into an R32G32B32A32_FLOAT volume texture.
+class DensityGrid
+{
+public:
+    DensityGrid();
+    ~DensityGrid();
+
+    //@param sliceCount: private copies of the grid, particles are split into this many tasks
+    bool Initialize(const XMFLOAT3& minimum, const XMFLOAT3& maximum, int resolutionX, int resolutionY, int resolutionZ, int sliceCount);
+    void Shutdown();
+
+    //bins particles into the private copies, can be called several times per frame with different weights
+    //@param stride: bytes from one particle to the next, so positions and colors can be read out of interleaved data
+    //@param emissionWeight: light added per particle is its rgb times this
+    void Splat(TaskPool* taskPool, const XMFLOAT3* positions, const XMFLOAT4* colors, int stride, int count, float densityWeight, float emissionWeight);
+    //sums the private copies into the grid and clears them for the next frame
+    void Resolve(TaskPool* taskPool);
+
+    //nearest cell lookups, 0 outside the grid
+    float SampleDensity(const XMFLOAT3& position);
+    XMFLOAT3 SampleEmission(const XMFLOAT3& position);
+    bool IsInSmoke(const XMFLOAT3& position, float densityThreshold);
+
+    const XMFLOAT4* GetCells();
+    int GetResolutionX();
+    int GetResolutionY();
+    int GetResolutionZ();
+    int GetCellCount();
+
+private:
+    //@return index of the cell holding the position, -1 outside the grid
+    int GetCellIndex(const XMFLOAT3& position);
+
+    XMFLOAT3 m_minimum;
+    //cells per world unit along each axis
+    XMFLOAT3 m_inverseCellSize;
+    int m_resolutionX, m_resolutionY, m_resolutionZ;
+    int m_cellCount;
+    float m_inverseCellVolume;
+
+    XMFLOAT4* m_cells;
+    //m_sliceCount grids of m_cellCount cells back to back
+    XMFLOAT4* m_slices;
+    int m_sliceCount;
+};
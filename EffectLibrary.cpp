@@ -0,0 +1,596 @@
+#include "EffectLibrary.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <ctime>
+#include <vector>
+#include <sys/stat.h>
+
+namespace
+{
+    // describes where a key from the text format is written inside the effect record
+    struct EffectField
+    {
+        EffectType type;
+        const char* key;
+        size_t offset;
+        int count;
+        bool isInteger;
+    };
+
+    const EffectField s_effectFields[] =
+    {
+        { EFFECT_WORLD, "gravity",            offsetof(WorldEffectDesc, gravity),           1, false },
+
+        { EFFECT_RAIN,  "spawnHeight",        offsetof(RainEffectDesc, spawnHeight),        1, false },
+        { EFFECT_RAIN,  "spawnYVelocity",     offsetof(RainEffectDesc, spawnYVelocity),     1, false },
+        { EFFECT_RAIN,  "box",                offsetof(RainEffectDesc, box),                4, false },
+        { EFFECT_RAIN,  "dropCount",          offsetof(RainEffectDesc, dropCount),          1, true  },
+        { EFFECT_RAIN,  "splashParticles",    offsetof(RainEffectDesc, splashParticles),    1, true  },
+
+        { EFFECT_FIRE,  "particlesPerSecond", offsetof(FireEffectDesc, particlesPerSecond), 1, false },
+        { EFFECT_FIRE,  "riseVelocity",       offsetof(FireEffectDesc, riseVelocity),       1, false },
+        { EFFECT_FIRE,  "baseLifeTime",       offsetof(FireEffectDesc, baseLifeTime),       1, false },
+        { EFFECT_FIRE,  "lifeTimeJitter",     offsetof(FireEffectDesc, lifeTimeJitter),     1, false },
+        { EFFECT_FIRE,  "smokeLifeTime",      offsetof(FireEffectDesc, smokeLifeTime),      1, false },
+        { EFFECT_FIRE,  "spreadX",            offsetof(FireEffectDesc, spreadX),            1, false },
+        { EFFECT_FIRE,  "spreadZ",            offsetof(FireEffectDesc, spreadZ),            1, false },
+        { EFFECT_FIRE,  "coneVelocity",       offsetof(FireEffectDesc, coneVelocity),       1, false },
+        { EFFECT_FIRE,  "color",              offsetof(FireEffectDesc, color),              3, false },
+        { EFFECT_FIRE,  "smokeColor",         offsetof(FireEffectDesc, smokeColor),         3, false },
+
+        { EFFECT_RING,  "velocity",           offsetof(RingEffectDesc, velocity),           1, false },
+        { EFFECT_RING,  "lifeTime",           offsetof(RingEffectDesc, lifeTime),           1, false },
+        { EFFECT_RING,  "color",              offsetof(RingEffectDesc, color),              3, false },
+    };
+
+    const char* s_effectTypeNames[EFFECT_TYPE_COUNT] = { "world", "rain", "fire", "ring" };
+
+    //removes leading and trailing whitespace in place
+    char* TrimText(char* text)
+    {
+        while (*text == ' ' || *text == '\t')
+        {
+            text++;
+        }
+
+        char* end = text + strlen(text);
+        while (end > text && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r' || end[-1] == '\n'))
+        {
+            end--;
+        }
+        (*end) = '\0';
+        return text;
+    }
+
+    //copies up to size - 1 characters and always terminates, the rest of the destination is left alone
+    void CopyName(char* destination, const char* source, size_t size)
+    {
+        size_t length = strlen(source);
+        if (length > size - 1)
+        {
+            length = size - 1;
+        }
+        memcpy(destination, source, length);
+        destination[length] = '\0';
+    }
+}
+
+
+EffectLibrary::EffectLibrary()
+{
+    m_currentFile = 0;
+    m_header = nullptr;
+    m_records = nullptr;
+    m_filename = nullptr;
+    m_modifiedTime = 0;
+    m_fileSize = 0;
+    m_contentHash = 0;
+    m_checkContents = false;
+    m_lastLoadTime = 0.0;
+}
+
+
+EffectLibrary::~EffectLibrary()
+{
+    Shutdown();
+}
+
+
+bool EffectLibrary::CompileText(const char* textFilename, const char* binaryFilename, int* errorLine)
+{
+    char line[512];
+    char typeName[MaxNameLength], effectName[MaxNameLength];
+    int lineNumber = 0;
+    std::vector<EffectRecord> records;
+    //the line each record started on, only used to report duplicates
+    std::vector<int> recordLines;
+    EffectRecord* currentRecord = nullptr;
+
+    (*errorLine) = 0;
+
+    FILE* textFile = fopen(textFilename, "r");
+    if (!textFile)
+    {
+        return false;
+    }
+
+    while (fgets(line, sizeof(line), textFile))
+    {
+        lineNumber++;
+        char* text = TrimText(line);
+
+        if (text[0] == '\0' || text[0] == '#')
+        {
+            continue;
+        }
+
+        //new effect section, [type name]
+        if (text[0] == '[')
+        {
+            char* close = strchr(text, ']');
+            if (!close)
+            {
+                fclose(textFile);
+                (*errorLine) = lineNumber;
+                return false;
+            }
+            (*close) = '\0';
+
+            if (sscanf(text + 1, "%31s %31s", typeName, effectName) != 2)
+            {
+                fclose(textFile);
+                (*errorLine) = lineNumber;
+                return false;
+            }
+
+            int type = -1;
+            for (auto i = 0; i < EFFECT_TYPE_COUNT; ++i)
+            {
+                if (strcmp(typeName, s_effectTypeNames[i]) == 0)
+                {
+                    type = i;
+                }
+            }
+            if (type < 0)
+            {
+                fclose(textFile);
+                (*errorLine) = lineNumber;
+                return false;
+            }
+
+            records.push_back(EffectRecord());
+            recordLines.push_back(lineNumber);
+            currentRecord = &records.back();
+            memset(currentRecord, 0, sizeof(EffectRecord));
+            currentRecord->type = type;
+            CopyName(currentRecord->name, effectName, MaxNameLength);
+            currentRecord->nameHash = HashName(currentRecord->name);
+
+            switch (type)
+            {
+            case EFFECT_WORLD: GetDefaultWorld(&currentRecord->world); break;
+            case EFFECT_RAIN:  GetDefaultRain(&currentRecord->rain);   break;
+            case EFFECT_FIRE:  GetDefaultFire(&currentRecord->fire);   break;
+            case EFFECT_RING:  GetDefaultRing(&currentRecord->ring);   break;
+            }
+            continue;
+        }
+
+        // key = value value ...
+        char* equals = strchr(text, '=');
+        if (!equals || !currentRecord)
+        {
+            fclose(textFile);
+            (*errorLine) = lineNumber;
+            return false;
+        }
+        (*equals) = '\0';
+        char* key = TrimText(text);
+        char* value = equals + 1;
+
+        const EffectField* field = nullptr;
+        for (auto i = 0; i < (int)(sizeof(s_effectFields) / sizeof(s_effectFields[0])); ++i)
+        {
+            if (s_effectFields[i].type == (EffectType)currentRecord->type && strcmp(s_effectFields[i].key, key) == 0)
+            {
+                field = &s_effectFields[i];
+                break;
+            }
+        }
+        if (!field)
+        {
+            fclose(textFile);
+            (*errorLine) = lineNumber;
+            return false;
+        }
+
+        unsigned char* destination = (unsigned char*)currentRecord->values + field->offset;
+        for (auto i = 0; i < field->count; ++i)
+        {
+            char* end = nullptr;
+            float number = strtof(value, &end);
+            if (end == value)
+            {
+                fclose(textFile);
+                (*errorLine) = lineNumber;
+                return false;
+            }
+            value = end;
+
+            if (field->isInteger)
+            {
+                int integer = (int)number;
+                memcpy(destination + (i * sizeof(int)), &integer, sizeof(int));
+            }
+            else
+            {
+                memcpy(destination + (i * sizeof(float)), &number, sizeof(float));
+            }
+        }
+        if (TrimText(value)[0] != '\0')
+        {
+            //more values than the key takes
+            fclose(textFile);
+            (*errorLine) = lineNumber;
+            return false;
+        }
+    }
+    fclose(textFile);
+
+    //sort an order instead of the records so each one keeps its line, equal records stay in file order
+    std::vector<int> order(records.size());
+    for (auto i = 0; i < (int)order.size(); ++i)
+    {
+        order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [&records](int a, int b)
+    {
+        if (records[a].nameHash != records[b].nameHash)
+        {
+            return records[a].nameHash < records[b].nameHash;
+        }
+        return records[a].type < records[b].type;
+    });
+
+    //the same name may be used once per effect type, the later definition is the one reported
+    for (auto i = 1; i < (int)order.size(); ++i)
+    {
+        const EffectRecord& previous = records[order[i - 1]];
+        const EffectRecord& record = records[order[i]];
+        if (record.type == previous.type && strcmp(record.name, previous.name) == 0)
+        {
+            (*errorLine) = recordLines[order[i]];
+            return false;
+        }
+    }
+
+    std::vector<EffectRecord> sortedRecords(records.size());
+    for (auto i = 0; i < (int)order.size(); ++i)
+    {
+        sortedRecords[i] = records[order[i]];
+    }
+    records.swap(sortedRecords);
+
+    FileHeader header;
+    header.magic = FileMagic;
+    header.version = FileVersion;
+    header.recordCount = (uint32_t)records.size();
+    header.recordSize = sizeof(EffectRecord);
+
+    // write to a temporary file first, a running game may have the old file mapped and must never see a half written one
+    std::string temporaryFilename = std::string(binaryFilename) + ".tmp";
+    FILE* binaryFile = fopen(temporaryFilename.c_str(), "wb");
+    if (!binaryFile)
+    {
+        return false;
+    }
+
+    bool written = fwrite(&header, sizeof(header), 1, binaryFile) == 1;
+    if (written && !records.empty())
+    {
+        written = fwrite(records.data(), sizeof(EffectRecord), records.size(), binaryFile) == records.size();
+    }
+    written = (fclose(binaryFile) == 0) && written;
+    if (!written)
+    {
+        remove(temporaryFilename.c_str());
+        return false;
+    }
+
+#ifdef _WIN32
+    remove(binaryFilename);
+#endif
+    if (rename(temporaryFilename.c_str(), binaryFilename) != 0)
+    {
+        remove(temporaryFilename.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+
+bool EffectLibrary::Load(const char* binaryFilename)
+{
+    bool result;
+
+    Shutdown();
+
+    result = MapLibrary(binaryFilename);
+    if (!result)
+    {
+        return false;
+    }
+
+    size_t length = strlen(binaryFilename) + 1;
+    m_filename = new char[length];
+    memcpy(m_filename, binaryFilename, length);
+
+    long long modifiedTime, fileSize;
+    if (GetFileStatus(binaryFilename, &modifiedTime, &fileSize))
+    {
+        RecordFileStatus(modifiedTime, fileSize);
+    }
+
+    return true;
+}
+
+
+void EffectLibrary::Shutdown()
+{
+    m_files[0].Close();
+    m_files[1].Close();
+    m_header = nullptr;
+    m_records = nullptr;
+
+    if (m_filename)
+    {
+        delete[] m_filename;
+        m_filename = nullptr;
+    }
+    m_modifiedTime = 0;
+    m_fileSize = 0;
+    m_contentHash = 0;
+    m_checkContents = false;
+
+    return;
+}
+
+
+bool EffectLibrary::CheckForReload()
+{
+    if (!m_filename)
+    {
+        return false;
+    }
+
+    long long modifiedTime, fileSize;
+    if (!GetFileStatus(m_filename, &modifiedTime, &fileSize))
+    {
+        return false;
+    }
+
+    if (modifiedTime == m_modifiedTime && fileSize == m_fileSize)
+    {
+        //a rewrite in the same second as the loaded file keeps its time and, with fixed size records, often its size
+        if (!m_checkContents)
+        {
+            return false;
+        }
+        if (HashFile(m_filename) == m_contentHash)
+        {
+            m_checkContents = IsRecent(modifiedTime);
+            return false;
+        }
+    }
+
+    //if the new file is broken, keep running on the old data and try again once it changes
+    RecordFileStatus(modifiedTime, fileSize);
+    return MapLibrary(m_filename);
+}
+
+
+const EffectLibrary::EffectRecord* EffectLibrary::FindEffect(const char* name, EffectType type)
+{
+    if (!m_records)
+    {
+        return nullptr;
+    }
+
+    uint32_t hash = HashName(name);
+
+    //binary search for the first record with this hash, then check the few records that share it
+    int low = 0;
+    int high = (int)m_header->recordCount;
+    while (low < high)
+    {
+        int middle = (low + high) / 2;
+        if (m_records[middle].nameHash < hash)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    for (auto i = low; i < (int)m_header->recordCount && m_records[i].nameHash == hash; ++i)
+    {
+        if (m_records[i].type == (uint32_t)type && strncmp(m_records[i].name, name, MaxNameLength) == 0)
+        {
+            return &m_records[i];
+        }
+    }
+
+    return nullptr;
+}
+
+
+int EffectLibrary::GetEffectCount()
+{
+    return m_header ? (int)m_header->recordCount : 0;
+}
+
+
+double EffectLibrary::GetLastLoadTime()
+{
+    return m_lastLoadTime;
+}
+
+
+void EffectLibrary::GetDefaultWorld(WorldEffectDesc* desc)
+{
+    desc->gravity = -3.5f;
+}
+
+
+void EffectLibrary::GetDefaultRain(RainEffectDesc* desc)
+{
+    desc->spawnHeight = 20.0f;
+    desc->spawnYVelocity = -3.0f;
+    desc->box[0] = -10.0f;
+    desc->box[1] = 20.0f;
+    desc->box[2] = 15.0f;
+    desc->box[3] = 50.0f;
+    desc->dropCount = 1000;
+    desc->splashParticles = 8;
+}
+
+
+void EffectLibrary::GetDefaultFire(FireEffectDesc* desc)
+{
+    desc->particlesPerSecond = 150.0f;
+    desc->riseVelocity = 1.5f;
+    desc->baseLifeTime = 6.0f;
+    desc->lifeTimeJitter = 1.5f;
+    desc->smokeLifeTime = 3.0f;
+    desc->spreadX = 0.8f;
+    desc->spreadZ = 1.0f;
+    desc->coneVelocity = 0.15f;
+    desc->color[0] = 2.0f;
+    desc->color[1] = 0.8f;
+    desc->color[2] = 0.1f;
+    desc->smokeColor[0] = 0.1f;
+    desc->smokeColor[1] = 0.1f;
+    desc->smokeColor[2] = 0.1f;
+}
+
+
+void EffectLibrary::GetDefaultRing(RingEffectDesc* desc)
+{
+    desc->velocity = 0.35f;
+    desc->lifeTime = 0.5f;
+    desc->color[0] = 0.5f;
+    desc->color[1] = 0.5f;
+    desc->color[2] = 1.0f;
+}
+
+
+uint32_t EffectLibrary::HashName(const char* name)
+{
+    // FNV-1a
+    uint32_t hash = 2166136261U;
+    for (auto i = 0; i < MaxNameLength && name[i] != '\0'; ++i)
+    {
+        hash ^= (unsigned char)name[i];
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+
+bool EffectLibrary::MapLibrary(const char* binaryFilename)
+{
+    auto startTime = std::chrono::high_resolution_clock::now();
+
+    int nextFile = 1 - m_currentFile;
+    MappedFile& file = m_files[nextFile];
+
+    if (!file.Open(binaryFilename))
+    {
+        return false;
+    }
+
+    const FileHeader* header = (const FileHeader*)file.GetData();
+    if (file.GetSize() < sizeof(FileHeader) || header->magic != FileMagic || header->version != FileVersion ||
+        header->recordSize != sizeof(EffectRecord) ||
+        file.GetSize() < sizeof(FileHeader) + ((size_t)header->recordCount * sizeof(EffectRecord)))
+    {
+        file.Close();
+        return false;
+    }
+
+    // swap over to the new mapping, anything holding a record pointer from the old file has to look it up again
+    m_files[m_currentFile].Close();
+    m_currentFile = nextFile;
+    m_header = header;
+    m_records = (const EffectRecord*)(file.GetData() + sizeof(FileHeader));
+
+    auto endTime = std::chrono::high_resolution_clock::now();
+    m_lastLoadTime = std::chrono::duration<double, std::micro>(endTime - startTime).count();
+
+    return true;
+}
+
+
+bool EffectLibrary::GetFileStatus(const char* filename, long long* modifiedTime, long long* fileSize)
+{
+    struct stat fileStatus;
+    if (stat(filename, &fileStatus) != 0)
+    {
+        return false;
+    }
+    (*modifiedTime) = (long long)fileStatus.st_mtime;
+    (*fileSize) = (long long)fileStatus.st_size;
+    return true;
+}
+
+
+void EffectLibrary::RecordFileStatus(long long modifiedTime, long long fileSize)
+{
+    m_modifiedTime = modifiedTime;
+    m_fileSize = fileSize;
+
+    //only hash while the time stamp can not tell a new write apart, which is at most a couple of checks after a save
+    m_checkContents = IsRecent(modifiedTime);
+    m_contentHash = m_checkContents ? HashFile(m_filename) : 0;
+
+    return;
+}
+
+
+bool EffectLibrary::IsRecent(long long modifiedTime)
+{
+    //one second of slack for file systems whose clock is not quite ours
+    return (long long)time(nullptr) <= modifiedTime + 1;
+}
+
+
+uint32_t EffectLibrary::HashFile(const char* filename)
+{
+    MappedFile file;
+    if (!file.Open(filename))
+    {
+        return 0;
+    }
+
+    // FNV-1a
+    const unsigned char* data = file.GetData();
+    size_t size = file.GetSize();
+    uint32_t hash = 2166136261U;
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash ^= data[i];
+        hash *= 16777619U;
+    }
+
+    file.Close();
+    return hash;
+}
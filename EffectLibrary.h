@@ -0,0 +1,145 @@
+#pragma once
+#include <cstdint>
+
+#include "MappedFile.h"
+
+// Effect parameters that used to be compiled into the particle manager. An effect library is written as text, compiled
+// into a versioned binary file of fixed size records and read at runtime straight out of a memory mapping.
+//
+// text format, one effect per section, values are separated by spaces:
+//   # comment
+//   [fire campfire]
+//   particlesPerSecond = 150
+//   color = 2.0 0.8 0.1
+
+enum EffectType
+{
+    EFFECT_WORLD = 0,
+    EFFECT_RAIN = 1,
+    EFFECT_FIRE = 2,
+    EFFECT_RING = 3,
+    EFFECT_TYPE_COUNT
+};
+
+// shared values that are not owned by a single effect
+struct WorldEffectDesc
+{
+    float gravity;
+};
+
+struct RainEffectDesc
+{
+    float spawnHeight;
+    float spawnYVelocity;
+    // (xleft boundry, xright boundry, zclose boundry, zfar boundry)
+    float box[4];
+    int dropCount;
+    int splashParticles;
+};
+
+struct FireEffectDesc
+{
+    float particlesPerSecond;
+    float riseVelocity;
+    float baseLifeTime;
+    //a random amount up to lifeTimeJitter is added to each particle's lifetime
+    float lifeTimeJitter;
+    //particles turn to smoke when their remaining lifetime drops below this
+    float smokeLifeTime;
+    // particles are spread over (0..spreadX, -spreadZ..0) from the emitter and given an x velocity of up to +-coneVelocity
+    float spreadX, spreadZ;
+    float coneVelocity;
+    float color[3];
+    float smokeColor[3];
+};
+
+struct RingEffectDesc
+{
+    float velocity;
+    float lifeTime;
+    float color[3];
+};
+
+class EffectLibrary
+{
+public:
+    static const uint32_t FileMagic = 0x58464550; // "PEFX"
+    static const uint32_t FileVersion = 1;
+    static const int MaxNameLength = 32;
+
+    struct FileHeader
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t recordCount;
+        uint32_t recordSize;
+    };
+
+    // records are stored sorted by nameHash so lookups are a binary search over the mapped file
+    struct EffectRecord
+    {
+        uint32_t nameHash;
+        uint32_t type;
+        char name[MaxNameLength];
+        union
+        {
+            WorldEffectDesc world;
+            RainEffectDesc rain;
+            FireEffectDesc fire;
+            RingEffectDesc ring;
+            float values[24];
+        };
+    };
+
+public:
+    EffectLibrary();
+    ~EffectLibrary();
+
+    //compiles a text effect description into the binary format
+    //@param errorLine: out, the line of the text file that failed to compile, for a duplicate name the line of its second
+    //                  definition. 0 if the file could not be opened or written
+    static bool CompileText(const char* textFilename, const char* binaryFilename, int* errorLine);
+
+    bool Load(const char* binaryFilename);
+    void Shutdown();
+
+    //checks the modification time and size of the loaded file and reloads it if either changed. Returns true if new data
+    //was loaded. The time only has a resolution of a second, so for a moment after a save the contents are hashed as well
+    bool CheckForReload();
+
+    //returns nullptr if no effect of this type and name is in the library
+    const EffectRecord* FindEffect(const char* name, EffectType type);
+    int GetEffectCount();
+    //time taken by the last Load or reload, in microseconds
+    double GetLastLoadTime();
+
+    //values used for anything a text file or library does not set, these match the original hard coded effects
+    static void GetDefaultWorld(WorldEffectDesc* desc);
+    static void GetDefaultRain(RainEffectDesc* desc);
+    static void GetDefaultFire(FireEffectDesc* desc);
+    static void GetDefaultRing(RingEffectDesc* desc);
+
+private:
+    static uint32_t HashName(const char* name);
+
+    //maps the file and checks the header, the current mapping is only replaced if the new file is valid
+    bool MapLibrary(const char* binaryFilename);
+    static bool GetFileStatus(const char* filename, long long* modifiedTime, long long* fileSize);
+    //remembers the file as it is on disk now, hashing it if a write could still land within the same second
+    void RecordFileStatus(long long modifiedTime, long long fileSize);
+    static bool IsRecent(long long modifiedTime);
+    static uint32_t HashFile(const char* filename);
+
+    //the new file is mapped next to the current one so a failed reload keeps the old data
+    MappedFile m_files[2];
+    int m_currentFile;
+    const FileHeader* m_header;
+    const EffectRecord* m_records;
+
+    char* m_filename;
+    long long m_modifiedTime;
+    long long m_fileSize;
+    uint32_t m_contentHash;
+    bool m_checkContents;
+    double m_lastLoadTime;
+};
@@ -0,0 +1,221 @@
+#include "InstanceRingBackend.h"
+
+
+D3D11InstanceRingBackend::D3D11InstanceRingBackend(ID3D11Device* device, ID3D11DeviceContext* deviceContext)
+{
+    m_device = device;
+    m_deviceContext = deviceContext;
+    m_buffer = nullptr;
+    for (auto i = 0; i < MaxFences; ++i)
+    {
+        m_queries[i] = nullptr;
+    }
+}
+
+
+D3D11InstanceRingBackend::~D3D11InstanceRingBackend()
+{
+}
+
+
+bool D3D11InstanceRingBackend::Create(int sizeInBytes)
+{
+    D3D11_BUFFER_DESC bufferDesc;
+    D3D11_QUERY_DESC queryDesc;
+    HRESULT result;
+
+    bufferDesc.Usage = D3D11_USAGE_DYNAMIC;
+    bufferDesc.ByteWidth = sizeInBytes;
+    bufferDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+    bufferDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+    bufferDesc.MiscFlags = 0;
+    bufferDesc.StructureByteStride = 0;
+
+    result = m_device->CreateBuffer(&bufferDesc, nullptr, &m_buffer);
+    if (FAILED(result))
+    {
+        return false;
+    }
+
+    queryDesc.Query = D3D11_QUERY_EVENT;
+    queryDesc.MiscFlags = 0;
+    for (auto i = 0; i < MaxFences; ++i)
+    {
+        result = m_device->CreateQuery(&queryDesc, &m_queries[i]);
+        if (FAILED(result))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+void D3D11InstanceRingBackend::Destroy()
+{
+    for (auto i = 0; i < MaxFences; ++i)
+    {
+        if (m_queries[i])
+        {
+            m_queries[i]->Release();
+            m_queries[i] = nullptr;
+        }
+    }
+    if (m_buffer)
+    {
+        m_buffer->Release();
+        m_buffer = nullptr;
+    }
+    return;
+}
+
+
+unsigned char* D3D11InstanceRingBackend::Map(bool discard)
+{
+    D3D11_MAPPED_SUBRESOURCE mappedResource;
+    HRESULT result;
+
+    result = m_deviceContext->Map(m_buffer, 0, discard ? D3D11_MAP_WRITE_DISCARD : D3D11_MAP_WRITE_NO_OVERWRITE, 0, &mappedResource);
+    if (FAILED(result))
+    {
+        return nullptr;
+    }
+    return (unsigned char*)mappedResource.pData;
+}
+
+
+void D3D11InstanceRingBackend::Unmap()
+{
+    m_deviceContext->Unmap(m_buffer, 0);
+    return;
+}
+
+
+ID3D11Buffer* D3D11InstanceRingBackend::GetBuffer()
+{
+    return m_buffer;
+}
+
+
+void D3D11InstanceRingBackend::IssueFence(int fence)
+{
+    m_deviceContext->End(m_queries[fence]);
+    return;
+}
+
+
+bool D3D11InstanceRingBackend::IsFenceComplete(int fence)
+{
+    // an event query has no data, S_OK means the gpu got there. Polling must not flush or every frame would sync
+    return m_deviceContext->GetData(m_queries[fence], nullptr, 0, D3D11_ASYNC_GETDATA_DONOTFLUSH) == S_OK;
+}
+
+
+CpuInstanceRingBackend::CpuInstanceRingBackend()
+{
+    for (auto i = 0; i < MaxFences; ++i)
+    {
+        m_fenceSerials[i] = 0;
+    }
+    m_issuedSerial = 0;
+    m_completedSerial = 0;
+    m_latency = 2;
+    m_mapCount = 0;
+    m_discardCount = 0;
+    m_mapped = false;
+}
+
+
+CpuInstanceRingBackend::~CpuInstanceRingBackend()
+{
+}
+
+
+bool CpuInstanceRingBackend::Create(int sizeInBytes)
+{
+    m_memory.assign(sizeInBytes, 0);
+    return true;
+}
+
+
+void CpuInstanceRingBackend::Destroy()
+{
+    m_memory.clear();
+    return;
+}
+
+
+unsigned char* CpuInstanceRingBackend::Map(bool discard)
+{
+    if (m_mapped || m_memory.empty())
+    {
+        return nullptr;
+    }
+
+    m_mapped = true;
+    m_mapCount++;
+    if (discard)
+    {
+        m_discardCount++;
+    }
+    return m_memory.data();
+}
+
+
+void CpuInstanceRingBackend::Unmap()
+{
+    m_mapped = false;
+    return;
+}
+
+
+ID3D11Buffer* CpuInstanceRingBackend::GetBuffer()
+{
+    return nullptr;
+}
+
+
+void CpuInstanceRingBackend::IssueFence(int fence)
+{
+    m_issuedSerial++;
+    m_fenceSerials[fence] = m_issuedSerial;
+    return;
+}
+
+
+bool CpuInstanceRingBackend::IsFenceComplete(int fence)
+{
+    return m_fenceSerials[fence] <= m_completedSerial || m_issuedSerial - m_fenceSerials[fence] >= m_latency;
+}
+
+
+void CpuInstanceRingBackend::SetLatency(int fences)
+{
+    m_latency = fences;
+    return;
+}
+
+
+void CpuInstanceRingBackend::CompleteAllFences()
+{
+    m_completedSerial = m_issuedSerial;
+    return;
+}
+
+
+int CpuInstanceRingBackend::GetMapCount()
+{
+    return m_mapCount;
+}
+
+
+int CpuInstanceRingBackend::GetDiscardCount()
+{
+    return m_discardCount;
+}
+
+
+bool CpuInstanceRingBackend::IsMapped()
+{
+    return m_mapped;
+}
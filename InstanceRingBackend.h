@@ -0,0 +1,89 @@
+#pragma once
+#include <d3d11.h>
+
+#include <vector>
+
+// The buffer and fences behind an InstanceRingBuffer. The ring only decides which bytes can be written, the backend
+// owns the memory and knows when the gpu is done with it, so the allocation and fence logic can be run against the cpu
+// backend without a device.
+class InstanceRingBackend
+{
+public:
+    //one fence per allocation the ring can have in flight
+    static const int MaxFences = 64;
+
+    virtual ~InstanceRingBackend() {}
+
+    virtual bool Create(int sizeInBytes) = 0;
+    virtual void Destroy() = 0;
+
+    //@param discard: the old contents may be thrown away, otherwise ranges the gpu may still read must be left alone
+    //@return start of the buffer, nullptr on failure
+    virtual unsigned char* Map(bool discard) = 0;
+    virtual void Unmap() = 0;
+    //nullptr for backends without a gpu buffer
+    virtual ID3D11Buffer* GetBuffer() = 0;
+
+    //marks the point in the command stream reached so far
+    virtual void IssueFence(int fence) = 0;
+    //true once the gpu has passed the point the fence was last issued at
+    virtual bool IsFenceComplete(int fence) = 0;
+};
+
+
+// dynamic vertex buffer mapped with WRITE_NO_OVERWRITE, fenced with event queries on the immediate context
+class D3D11InstanceRingBackend : public InstanceRingBackend
+{
+public:
+    D3D11InstanceRingBackend(ID3D11Device* device, ID3D11DeviceContext* deviceContext);
+    ~D3D11InstanceRingBackend();
+
+    bool Create(int sizeInBytes);
+    void Destroy();
+    unsigned char* Map(bool discard);
+    void Unmap();
+    ID3D11Buffer* GetBuffer();
+    void IssueFence(int fence);
+    bool IsFenceComplete(int fence);
+
+private:
+    ID3D11Device* m_device;
+    ID3D11DeviceContext* m_deviceContext;
+    ID3D11Buffer* m_buffer;
+    ID3D11Query* m_queries[MaxFences];
+};
+
+
+// cpu memory with fences that complete a set number of fences after they were issued, for running the ring headless
+class CpuInstanceRingBackend : public InstanceRingBackend
+{
+public:
+    CpuInstanceRingBackend();
+    ~CpuInstanceRingBackend();
+
+    bool Create(int sizeInBytes);
+    void Destroy();
+    unsigned char* Map(bool discard);
+    void Unmap();
+    ID3D11Buffer* GetBuffer();
+    void IssueFence(int fence);
+    bool IsFenceComplete(int fence);
+
+    //@param fences: a fence completes once this many later fences have been issued, 0 completes straight away
+    void SetLatency(int fences);
+    //completes every fence issued so far, like waiting for the gpu to go idle
+    void CompleteAllFences();
+
+    int GetMapCount();
+    int GetDiscardCount();
+    bool IsMapped();
+
+private:
+    std::vector<unsigned char> m_memory;
+    //serial number each fence was last issued with
+    long long m_fenceSerials[MaxFences];
+    long long m_issuedSerial, m_completedSerial;
+    int m_latency;
+    int m_mapCount, m_discardCount;
+    bool m_mapped;
+};
@@ -0,0 +1,190 @@
+#include "InstanceRingBuffer.h"
+
+//start of every range, keeps instances aligned for the input assembler and the copies aligned for memcpy
+static const int RangeAlignment = 16;
+
+
+InstanceRingBuffer::InstanceRingBuffer()
+{
+    m_backend = nullptr;
+    m_size = 0;
+    m_head = 0;
+    m_tail = 0;
+    m_oldestAllocation = 0;
+    m_allocationCount = 0;
+    m_firstMap = true;
+    m_fullCount = 0;
+}
+
+
+InstanceRingBuffer::~InstanceRingBuffer()
+{
+}
+
+
+bool InstanceRingBuffer::Initialize(InstanceRingBackend* backend, int sizeInBytes)
+{
+    bool result;
+
+    m_backend = backend;
+    if (!m_backend || sizeInBytes <= 0)
+    {
+        return false;
+    }
+
+    m_size = (sizeInBytes / RangeAlignment) * RangeAlignment;
+    result = m_backend->Create(m_size);
+    if (!result)
+    {
+        return false;
+    }
+
+    m_head = 0;
+    m_tail = 0;
+    m_oldestAllocation = 0;
+    m_allocationCount = 0;
+    m_firstMap = true;
+    m_fullCount = 0;
+    return true;
+}
+
+
+void InstanceRingBuffer::Shutdown()
+{
+    if (m_backend)
+    {
+        m_backend->Destroy();
+        delete m_backend;
+        m_backend = nullptr;
+    }
+    m_size = 0;
+    m_allocationCount = 0;
+    return;
+}
+
+
+unsigned char* InstanceRingBuffer::Map(int bytes, int* offset, int* allocation)
+{
+    unsigned char* memory;
+    long long start, padding;
+    int slot;
+
+    //a range larger than the ring never fits, however long the caller waits
+    if (bytes <= 0 || bytes > m_size)
+    {
+        return nullptr;
+    }
+    bytes = ((bytes + RangeAlignment - 1) / RangeAlignment) * RangeAlignment;
+
+    RetireAllocations();
+
+    // a range never wraps, the end of the buffer is skipped instead
+    start = m_head;
+    padding = 0;
+    if ((start % m_size) + bytes > m_size)
+    {
+        padding = m_size - (start % m_size);
+    }
+
+    if (m_allocationCount == MaxAllocations || (m_head - m_tail) + padding + bytes > m_size)
+    {
+        m_fullCount++;
+        return nullptr;
+    }
+
+    memory = m_backend->Map(m_firstMap);
+    if (!memory)
+    {
+        return nullptr;
+    }
+    m_firstMap = false;
+
+    start += padding;
+    m_head = start + bytes;
+
+    slot = (m_oldestAllocation + m_allocationCount) % MaxAllocations;
+    m_allocations[slot].end = m_head;
+    m_allocations[slot].released = false;
+    m_allocationCount++;
+
+    (*offset) = (int)(start % m_size);
+    (*allocation) = slot;
+    return memory + (*offset);
+}
+
+
+void InstanceRingBuffer::Unmap()
+{
+    m_backend->Unmap();
+    return;
+}
+
+
+void InstanceRingBuffer::Release(int allocation)
+{
+    m_backend->IssueFence(allocation);
+    m_allocations[allocation].released = true;
+    return;
+}
+
+
+ID3D11Buffer* InstanceRingBuffer::GetBuffer()
+{
+    return m_backend ? m_backend->GetBuffer() : nullptr;
+}
+
+
+InstanceRingBackend* InstanceRingBuffer::GetBackend()
+{
+    return m_backend;
+}
+
+
+int InstanceRingBuffer::GetSize()
+{
+    return m_size;
+}
+
+
+int InstanceRingBuffer::GetUsedBytes()
+{
+    return (int)(m_head - m_tail);
+}
+
+
+int InstanceRingBuffer::GetAllocationsInFlight()
+{
+    return m_allocationCount;
+}
+
+
+int InstanceRingBuffer::GetFullCount()
+{
+    return m_fullCount;
+}
+
+
+void InstanceRingBuffer::RetireAllocations()
+{
+    // an allocation that is still held keeps everything after it alive too, ranges are only reused in order
+    while (m_allocationCount > 0)
+    {
+        const Allocation& oldest = m_allocations[m_oldestAllocation];
+        if (!oldest.released || !m_backend->IsFenceComplete(m_oldestAllocation))
+        {
+            break;
+        }
+
+        m_tail = oldest.end;
+        m_oldestAllocation = (m_oldestAllocation + 1) % MaxAllocations;
+        m_allocationCount--;
+    }
+
+    // nothing in flight, start again from the beginning so large ranges do not have to skip the end of the buffer
+    if (m_allocationCount == 0)
+    {
+        m_head = ((m_head + m_size - 1) / m_size) * m_size;
+        m_tail = m_head;
+    }
+    return;
+}
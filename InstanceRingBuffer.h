@@ -0,0 +1,60 @@
+#pragma once
+#include "InstanceRingBackend.h"
+
+// One large instance buffer shared by every particle manager. Each upload takes the next range of the ring and maps it
+// with no overwrite, so the driver neither renames the buffer nor waits for draws still reading older ranges. A range
+// is handed back with Release once the draws reading it have been issued, which fences it, and the space is reused once
+// the gpu has passed the fence. Ranges are reused in the order they were taken.
+// Not thread safe, use it from the thread that owns the immediate context.
+class InstanceRingBuffer
+{
+public:
+    //allocations that can be waiting for their fence at once
+    static const int MaxAllocations = InstanceRingBackend::MaxFences;
+
+    InstanceRingBuffer();
+    ~InstanceRingBuffer();
+
+    //@param backend: owned by the ring from here on, deleted by Shutdown
+    bool Initialize(InstanceRingBackend* backend, int sizeInBytes);
+    void Shutdown();
+
+    //@param offset: out, byte offset of the range in the buffer, for IASetVertexBuffers
+    //@param allocation: out, handle for Release
+    //@return start of the mapped range, or nullptr when the ring has no room until the gpu catches up or the range is
+    //larger than the whole ring. The caller should then fall back to a buffer of its own
+    unsigned char* Map(int bytes, int* offset, int* allocation);
+    void Unmap();
+
+    //call after the draws that read the allocation, every allocation must be released before the ring can pass it
+    void Release(int allocation);
+
+    ID3D11Buffer* GetBuffer();
+    InstanceRingBackend* GetBackend();
+    int GetSize();
+    //bytes between the oldest allocation still in flight and the newest one, including padding skipped at the wrap
+    int GetUsedBytes();
+    int GetAllocationsInFlight();
+    //Map calls that failed because the ring was full
+    int GetFullCount();
+
+private:
+    //frees allocations from the oldest one while their fences have completed
+    void RetireAllocations();
+
+    //ranges are bytes since Initialize, taken modulo m_size, so used space is m_head - m_tail even across the wrap
+    struct Allocation
+    {
+        long long end;
+        bool released;
+    };
+
+    InstanceRingBackend* m_backend;
+    int m_size;
+    long long m_head, m_tail;
+    Allocation m_allocations[MaxAllocations];
+    int m_oldestAllocation, m_allocationCount;
+    //the first map of a new buffer discards so the driver starts from a clean buffer
+    bool m_firstMap;
+    int m_fullCount;
+};
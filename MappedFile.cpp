@@ -0,0 +1,173 @@
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+
+MappedFile::MappedFile()
+{
+    m_data = nullptr;
+    m_size = 0;
+
+#ifdef _WIN32
+    m_fileHandle = INVALID_HANDLE_VALUE;
+    m_mappingHandle = nullptr;
+#else
+    m_fileDescriptor = -1;
+#endif
+}
+
+
+MappedFile::~MappedFile()
+{
+    Close();
+}
+
+
+bool MappedFile::Open(const char* filename)
+{
+    Close();
+
+#ifdef _WIN32
+    LARGE_INTEGER fileSize;
+
+    // share write and delete so the file can still be replaced while it is mapped
+    m_fileHandle = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (m_fileHandle == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+
+    if (!GetFileSizeEx(m_fileHandle, &fileSize) || fileSize.QuadPart == 0)
+    {
+        Close();
+        return false;
+    }
+    m_size = (size_t)fileSize.QuadPart;
+
+    m_mappingHandle = CreateFileMappingA(m_fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!m_mappingHandle)
+    {
+        Close();
+        return false;
+    }
+
+    m_data = (const unsigned char*)MapViewOfFile(m_mappingHandle, FILE_MAP_READ, 0, 0, 0);
+    if (!m_data)
+    {
+        Close();
+        return false;
+    }
+#else
+    struct stat fileStatus;
+
+    m_fileDescriptor = open(filename, O_RDONLY);
+    if (m_fileDescriptor < 0)
+    {
+        return false;
+    }
+
+    if (fstat(m_fileDescriptor, &fileStatus) != 0 || fileStatus.st_size == 0)
+    {
+        Close();
+        return false;
+    }
+    m_size = (size_t)fileStatus.st_size;
+
+    void* mapping = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, m_fileDescriptor, 0);
+    if (mapping == MAP_FAILED)
+    {
+        Close();
+        return false;
+    }
+    m_data = (const unsigned char*)mapping;
+#endif
+
+    return true;
+}
+
+
+void MappedFile::Close()
+{
+#ifdef _WIN32
+    if (m_data)
+    {
+        UnmapViewOfFile(m_data);
+    }
+    if (m_mappingHandle)
+    {
+        CloseHandle(m_mappingHandle);
+        m_mappingHandle = nullptr;
+    }
+    if (m_fileHandle != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(m_fileHandle);
+        m_fileHandle = INVALID_HANDLE_VALUE;
+    }
+#else
+    if (m_data)
+    {
+        munmap((void*)m_data, m_size);
+    }
+    if (m_fileDescriptor >= 0)
+    {
+        close(m_fileDescriptor);
+        m_fileDescriptor = -1;
+    }
+#endif
+
+    m_data = nullptr;
+    m_size = 0;
+    return;
+}
+
+
+const unsigned char* MappedFile::GetData()
+{
+    return m_data;
+}
+
+
+size_t MappedFile::GetSize()
+{
+    return m_size;
+}
+
+
+bool MappedFile::IsOpen()
+{
+    return m_data != nullptr;
+}
+
+
+void MappedFile::Prefetch(size_t offset, size_t size)
+{
+    if (!m_data || offset >= m_size)
+    {
+        return;
+    }
+    if (offset + size > m_size)
+    {
+        size = m_size - offset;
+    }
+
+#ifdef _WIN32
+    WIN32_MEMORY_RANGE_ENTRY range;
+    range.VirtualAddress = (void*)(m_data + offset);
+    range.NumberOfBytes = size;
+    PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#else
+    // madvise needs a page aligned start
+    size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+    size_t alignedOffset = offset - (offset % pageSize);
+    madvise((void*)(m_data + alignedOffset), size + (offset - alignedOffset), MADV_WILLNEED);
+#endif
+    return;
+}
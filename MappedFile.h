@@ -0,0 +1,31 @@
+#pragma once
+#include <cstddef>
+
+// Read only memory mapping of a whole file, used to read baked data without copying it into our own buffers
+class MappedFile
+{
+public:
+    MappedFile();
+    ~MappedFile();
+
+    bool Open(const char* filename);
+    void Close();
+
+    const unsigned char* GetData();
+    size_t GetSize();
+    bool IsOpen();
+
+    //asks the os to start reading the given range in so a later access does not fault
+    void Prefetch(size_t offset, size_t size);
+
+private:
+    const unsigned char* m_data;
+    size_t m_size;
+
+#ifdef _WIN32
+    void* m_fileHandle;
+    void* m_mappingHandle;
+#else
+    int m_fileDescriptor;
+#endif
+};
@@ -0,0 +1,411 @@
+#include "OcclusionCuller.h"
+
+#include <math.h>
+#include <string.h>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE2__)
+#include <emmintrin.h>
+#define OCCLUSION_USE_SSE 1
+#endif
+
+//vertices closer to the camera plane than this are not projected
+static const float NearClipW = 1e-4f;
+
+
+OcclusionCuller::OcclusionCuller()
+{
+    m_width = 0;
+    m_height = 0;
+    m_depthBuffer = nullptr;
+    m_levelCount = 0;
+    m_occludedCount = 0;
+    m_visibleCount = 0;
+
+    for (auto i = 0; i < MaxLevels; ++i)
+    {
+        m_minLevels[i] = nullptr;
+        m_maxLevels[i] = nullptr;
+        m_levelWidths[i] = 0;
+        m_levelHeights[i] = 0;
+    }
+    memset(&m_viewProjection, 0, sizeof(m_viewProjection));
+}
+
+
+OcclusionCuller::~OcclusionCuller()
+{
+}
+
+
+bool OcclusionCuller::Initialize(int width, int height)
+{
+    if (width <= 0 || height <= 0)
+    {
+        return false;
+    }
+
+    // rows are processed four pixels at a time so the width is padded to a multiple of 4
+    m_width = (width + 3) & ~3;
+    m_height = height;
+
+    m_depthBuffer = new float[m_width * m_height];
+    if (!m_depthBuffer)
+    {
+        return false;
+    }
+
+    m_minLevels[0] = m_depthBuffer;
+    m_maxLevels[0] = m_depthBuffer;
+    m_levelWidths[0] = m_width;
+    m_levelHeights[0] = m_height;
+    m_levelCount = 1;
+
+    while (m_levelCount < MaxLevels && (m_levelWidths[m_levelCount - 1] > 1 || m_levelHeights[m_levelCount - 1] > 1))
+    {
+        int levelWidth = (m_levelWidths[m_levelCount - 1] + 1) / 2;
+        int levelHeight = (m_levelHeights[m_levelCount - 1] + 1) / 2;
+
+        m_minLevels[m_levelCount] = new float[levelWidth * levelHeight];
+        m_maxLevels[m_levelCount] = new float[levelWidth * levelHeight];
+        if (!m_minLevels[m_levelCount] || !m_maxLevels[m_levelCount])
+        {
+            return false;
+        }
+        m_levelWidths[m_levelCount] = levelWidth;
+        m_levelHeights[m_levelCount] = levelHeight;
+        m_levelCount++;
+    }
+
+    return true;
+}
+
+
+void OcclusionCuller::Shutdown()
+{
+    for (auto i = 1; i < m_levelCount; ++i)
+    {
+        delete[] m_minLevels[i];
+        delete[] m_maxLevels[i];
+        m_minLevels[i] = nullptr;
+        m_maxLevels[i] = nullptr;
+    }
+    m_minLevels[0] = nullptr;
+    m_maxLevels[0] = nullptr;
+    m_levelCount = 0;
+
+    if (m_depthBuffer)
+    {
+        delete[] m_depthBuffer;
+        m_depthBuffer = nullptr;
+    }
+    return;
+}
+
+
+void OcclusionCuller::BeginFrame(const XMFLOAT4X4& viewProjection)
+{
+    m_viewProjection = viewProjection;
+
+    for (auto i = 0; i < m_width * m_height; ++i)
+    {
+        m_depthBuffer[i] = 1.0f;
+    }
+
+    m_occludedCount = 0;
+    m_visibleCount = 0;
+    return;
+}
+
+
+void OcclusionCuller::RasterizeOccluder(const XMFLOAT3* vertices, int vertexCount, const unsigned int* indices, int indexCount)
+{
+    const XMFLOAT4X4& m = m_viewProjection;
+    float screen[3][3];
+
+    for (auto i = 0; i + 2 < indexCount; i += 3)
+    {
+        bool clipped = false;
+
+        for (auto corner = 0; corner < 3; ++corner)
+        {
+            unsigned int vertexIndex = indices[i + corner];
+            if (vertexIndex >= (unsigned int)vertexCount)
+            {
+                clipped = true;
+                break;
+            }
+            const XMFLOAT3& v = vertices[vertexIndex];
+
+            float clipX = (v.x * m._11) + (v.y * m._21) + (v.z * m._31) + m._41;
+            float clipY = (v.x * m._12) + (v.y * m._22) + (v.z * m._32) + m._42;
+            float clipZ = (v.x * m._13) + (v.y * m._23) + (v.z * m._33) + m._43;
+            float clipW = (v.x * m._14) + (v.y * m._24) + (v.z * m._34) + m._44;
+
+            // dropping a triangle that crosses the camera plane only makes the culling less aggressive, never wrong
+            if (clipW < NearClipW)
+            {
+                clipped = true;
+                break;
+            }
+
+            float inverseW = 1.0f / clipW;
+            screen[corner][0] = ((clipX * inverseW * 0.5f) + 0.5f) * m_width;
+            screen[corner][1] = (0.5f - (clipY * inverseW * 0.5f)) * m_height;
+            screen[corner][2] = clipZ * inverseW;
+        }
+
+        if (!clipped)
+        {
+            RasterizeTriangle(screen[0], screen[1], screen[2]);
+        }
+    }
+    return;
+}
+
+
+void OcclusionCuller::RasterizeTriangle(const float* v0, const float* v1, const float* v2)
+{
+    float area = ((v1[0] - v0[0]) * (v2[1] - v0[1])) - ((v1[1] - v0[1]) * (v2[0] - v0[0]));
+    if (fabsf(area) < 1e-8f)
+    {
+        return;
+    }
+
+    //occluders are double sided, flip clockwise triangles so inside is always positive
+    if (area < 0.0f)
+    {
+        const float* swap = v1;
+        v1 = v2;
+        v2 = swap;
+        area = -area;
+    }
+
+    float minX = fminf(v0[0], fminf(v1[0], v2[0]));
+    float maxX = fmaxf(v0[0], fmaxf(v1[0], v2[0]));
+    float minY = fminf(v0[1], fminf(v1[1], v2[1]));
+    float maxY = fmaxf(v0[1], fmaxf(v1[1], v2[1]));
+
+    int startX = (int)fmaxf(0.0f, floorf(minX)) & ~3;
+    int endX = (int)fminf((float)(m_width - 1), ceilf(maxX));
+    int startY = (int)fmaxf(0.0f, floorf(minY));
+    int endY = (int)fminf((float)(m_height - 1), ceilf(maxY));
+    if (startX > endX || startY > endY)
+    {
+        return;
+    }
+
+    // edge functions w(x, y) = a * x + b * y + c, each one is the weight of the vertex opposite the edge
+    const float* edgeStart[3] = { v1, v2, v0 };
+    const float* edgeEnd[3] = { v2, v0, v1 };
+    float a[3], b[3], c[3];
+    for (auto e = 0; e < 3; ++e)
+    {
+        a[e] = -(edgeEnd[e][1] - edgeStart[e][1]);
+        b[e] = edgeEnd[e][0] - edgeStart[e][0];
+        c[e] = -(b[e] * edgeStart[e][1]) - (a[e] * edgeStart[e][0]);
+    }
+
+    float inverseArea = 1.0f / area;
+    float z0 = v0[2] * inverseArea;
+    float z1 = v1[2] * inverseArea;
+    float z2 = v2[2] * inverseArea;
+
+#ifdef OCCLUSION_USE_SSE
+    __m128 zero = _mm_setzero_ps();
+    __m128 pixelOffsets = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+    __m128 a0 = _mm_set1_ps(a[0]), a1 = _mm_set1_ps(a[1]), a2 = _mm_set1_ps(a[2]);
+    __m128 depth0 = _mm_set1_ps(z0), depth1 = _mm_set1_ps(z1), depth2 = _mm_set1_ps(z2);
+
+    for (auto y = startY; y <= endY; ++y)
+    {
+        float pixelY = y + 0.5f;
+        __m128 row0 = _mm_set1_ps((b[0] * pixelY) + c[0]);
+        __m128 row1 = _mm_set1_ps((b[1] * pixelY) + c[1]);
+        __m128 row2 = _mm_set1_ps((b[2] * pixelY) + c[2]);
+        float* depthRow = m_depthBuffer + (y * m_width);
+
+        for (auto x = startX; x <= endX; x += 4)
+        {
+            __m128 pixelX = _mm_add_ps(_mm_set1_ps((float)x), pixelOffsets);
+            __m128 w0 = _mm_add_ps(_mm_mul_ps(a0, pixelX), row0);
+            __m128 w1 = _mm_add_ps(_mm_mul_ps(a1, pixelX), row1);
+            __m128 w2 = _mm_add_ps(_mm_mul_ps(a2, pixelX), row2);
+
+            __m128 inside = _mm_and_ps(_mm_cmpge_ps(w0, zero), _mm_and_ps(_mm_cmpge_ps(w1, zero), _mm_cmpge_ps(w2, zero)));
+            if (_mm_movemask_ps(inside) == 0)
+            {
+                continue;
+            }
+
+            __m128 depth = _mm_add_ps(_mm_mul_ps(w0, depth0), _mm_add_ps(_mm_mul_ps(w1, depth1), _mm_mul_ps(w2, depth2)));
+            __m128 stored = _mm_loadu_ps(depthRow + x);
+            __m128 closer = _mm_min_ps(stored, depth);
+            _mm_storeu_ps(depthRow + x, _mm_or_ps(_mm_and_ps(inside, closer), _mm_andnot_ps(inside, stored)));
+        }
+    }
+#else
+    for (auto y = startY; y <= endY; ++y)
+    {
+        float pixelY = y + 0.5f;
+        float* depthRow = m_depthBuffer + (y * m_width);
+
+        for (auto x = startX; x <= endX; ++x)
+        {
+            float pixelX = x + 0.5f;
+            float w0 = (a[0] * pixelX) + (b[0] * pixelY) + c[0];
+            float w1 = (a[1] * pixelX) + (b[1] * pixelY) + c[1];
+            float w2 = (a[2] * pixelX) + (b[2] * pixelY) + c[2];
+            if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f)
+            {
+                continue;
+            }
+
+            float depth = (w0 * z0) + (w1 * z1) + (w2 * z2);
+            if (depth < depthRow[x])
+            {
+                depthRow[x] = depth;
+            }
+        }
+    }
+#endif
+    return;
+}
+
+
+void OcclusionCuller::BuildDepthPyramid()
+{
+    for (auto level = 1; level < m_levelCount; ++level)
+    {
+        int sourceWidth = m_levelWidths[level - 1];
+        int sourceHeight = m_levelHeights[level - 1];
+        const float* sourceMin = m_minLevels[level - 1];
+        const float* sourceMax = m_maxLevels[level - 1];
+
+        for (auto y = 0; y < m_levelHeights[level]; ++y)
+        {
+            // odd sized levels repeat their last row and column
+            int y0 = y * 2;
+            int y1 = (y0 + 1 < sourceHeight) ? y0 + 1 : y0;
+
+            for (auto x = 0; x < m_levelWidths[level]; ++x)
+            {
+                int x0 = x * 2;
+                int x1 = (x0 + 1 < sourceWidth) ? x0 + 1 : x0;
+
+                float minDepth = fminf(fminf(sourceMin[(y0 * sourceWidth) + x0], sourceMin[(y0 * sourceWidth) + x1]),
+                    fminf(sourceMin[(y1 * sourceWidth) + x0], sourceMin[(y1 * sourceWidth) + x1]));
+                float maxDepth = fmaxf(fmaxf(sourceMax[(y0 * sourceWidth) + x0], sourceMax[(y0 * sourceWidth) + x1]),
+                    fmaxf(sourceMax[(y1 * sourceWidth) + x0], sourceMax[(y1 * sourceWidth) + x1]));
+
+                m_minLevels[level][(y * m_levelWidths[level]) + x] = minDepth;
+                m_maxLevels[level][(y * m_levelWidths[level]) + x] = maxDepth;
+            }
+        }
+    }
+    return;
+}
+
+
+bool OcclusionCuller::IsBoxVisible(const XMFLOAT3& boxMin, const XMFLOAT3& boxMax)
+{
+    const XMFLOAT4X4& m = m_viewProjection;
+    float minX = 1e30f, minY = 1e30f, maxX = -1e30f, maxY = -1e30f;
+    float nearestDepth = 1e30f;
+
+    for (auto corner = 0; corner < 8; ++corner)
+    {
+        float x = (corner & 1) ? boxMax.x : boxMin.x;
+        float y = (corner & 2) ? boxMax.y : boxMin.y;
+        float z = (corner & 4) ? boxMax.z : boxMin.z;
+
+        float clipX = (x * m._11) + (y * m._21) + (z * m._31) + m._41;
+        float clipY = (x * m._12) + (y * m._22) + (z * m._32) + m._42;
+        float clipZ = (x * m._13) + (y * m._23) + (z * m._33) + m._43;
+        float clipW = (x * m._14) + (y * m._24) + (z * m._34) + m._44;
+
+        //boxes that reach behind the camera can not be tested against the depth buffer
+        if (clipW < NearClipW)
+        {
+            m_visibleCount++;
+            return true;
+        }
+
+        float inverseW = 1.0f / clipW;
+        float screenX = ((clipX * inverseW * 0.5f) + 0.5f) * m_width;
+        float screenY = (0.5f - (clipY * inverseW * 0.5f)) * m_height;
+
+        minX = fminf(minX, screenX);
+        maxX = fmaxf(maxX, screenX);
+        minY = fminf(minY, screenY);
+        maxY = fmaxf(maxY, screenY);
+        nearestDepth = fminf(nearestDepth, clipZ * inverseW);
+    }
+
+    // off screen boxes are left to frustum culling, this stage only answers whether something on screen is covered
+    if (maxX < 0.0f || maxY < 0.0f || minX >= m_width || minY >= m_height || nearestDepth < 0.0f)
+    {
+        m_visibleCount++;
+        return true;
+    }
+
+    int left = (int)fmaxf(0.0f, minX);
+    int right = (int)fminf((float)(m_width - 1), maxX);
+    int top = (int)fmaxf(0.0f, minY);
+    int bottom = (int)fminf((float)(m_height - 1), maxY);
+
+    //go up the pyramid until the box covers at most 4x4 texels, small enough to read them all and fine enough to keep
+    //boxes near the edge of an occluder from picking up the far plane
+    int level = 0;
+    while (level < m_levelCount - 1 && (((right >> level) - (left >> level)) > 3 || ((bottom >> level) - (top >> level)) > 3))
+    {
+        level++;
+    }
+
+    float farthestOccluder = 0.0f;
+    for (auto y = (top >> level); y <= (bottom >> level); ++y)
+    {
+        for (auto x = (left >> level); x <= (right >> level); ++x)
+        {
+            farthestOccluder = fmaxf(farthestOccluder, m_maxLevels[level][(y * m_levelWidths[level]) + x]);
+        }
+    }
+
+    if (nearestDepth > farthestOccluder)
+    {
+        m_occludedCount++;
+        return false;
+    }
+
+    m_visibleCount++;
+    return true;
+}
+
+
+int OcclusionCuller::GetOccludedCount()
+{
+    return m_occludedCount;
+}
+
+
+int OcclusionCuller::GetVisibleCount()
+{
+    return m_visibleCount;
+}
+
+
+float OcclusionCuller::GetMinDepth(int level, int x, int y)
+{
+    return m_minLevels[level][(y * m_levelWidths[level]) + x];
+}
+
+
+float OcclusionCuller::GetMaxDepth(int level, int x, int y)
+{
+    return m_maxLevels[level][(y * m_levelWidths[level]) + x];
+}
+
+
+int OcclusionCuller::GetLevelCount()
+{
+    return m_levelCount;
+}
@@ -0,0 +1,58 @@
+#pragma once
+#include <DirectXMath.h>
+
+using namespace DirectX;
+
+// CPU occlusion culling against a small software depth buffer. Occluder triangles are rasterized four pixels at a time
+// with SSE, the depth buffer is reduced into a min/max pyramid and boxes are tested against the coarsest pyramid level
+// that still covers them with a few texels. Depth follows the d3d convention, 0 at the near plane and 1 at the far.
+// Nothing here touches the gpu so the culler can be run and tested without a device.
+class OcclusionCuller
+{
+public:
+    OcclusionCuller();
+    ~OcclusionCuller();
+
+    //@param width: width of the depth buffer in pixels, rounded up to a multiple of 4
+    bool Initialize(int width, int height);
+    void Shutdown();
+
+    //clears the depth buffer and sets the camera used by the following rasterize and test calls
+    //@param viewProjection: world to clip space transform, row vector convention like the rest of DirectXMath
+    void BeginFrame(const XMFLOAT4X4& viewProjection);
+
+    //rasterizes a world space triangle list into the depth buffer
+    void RasterizeOccluder(const XMFLOAT3* vertices, int vertexCount, const unsigned int* indices, int indexCount);
+
+    //must be called after the last occluder and before the first test of a frame
+    void BuildDepthPyramid();
+
+    //returns false only when the box is certainly hidden behind the rasterized occluders
+    bool IsBoxVisible(const XMFLOAT3& boxMin, const XMFLOAT3& boxMax);
+
+    //number of boxes tested since BeginFrame
+    int GetOccludedCount();
+    int GetVisibleCount();
+
+    //depth of a pyramid texel, for debugging and tests
+    float GetMinDepth(int level, int x, int y);
+    float GetMaxDepth(int level, int x, int y);
+    int GetLevelCount();
+
+private:
+    void RasterizeTriangle(const float* v0, const float* v1, const float* v2);
+
+    static const int MaxLevels = 16;
+
+    int m_width, m_height;
+    float* m_depthBuffer;
+
+    // level 0 of both pyramids is m_depthBuffer itself
+    float* m_minLevels[MaxLevels];
+    float* m_maxLevels[MaxLevels];
+    int m_levelWidths[MaxLevels], m_levelHeights[MaxLevels];
+    int m_levelCount;
+
+    XMFLOAT4X4 m_viewProjection;
+    int m_occludedCount, m_visibleCount;
+};
@@ -0,0 +1,483 @@
+#include "ParticleArena.h"
+
+#include <string.h>
+
+
+ParticleArena::ParticleArena()
+{
+    m_capacity = 0;
+    m_blockCount = 0;
+    m_freeBlockHead = -1;
+    m_freeBlockCount = 0;
+}
+
+
+ParticleArena::~ParticleArena()
+{
+}
+
+
+bool ParticleArena::Initialize(int capacity, int sliceCount)
+{
+    std::vector<int> noParticles;
+
+    if (capacity <= 0 || sliceCount <= 0)
+    {
+        return false;
+    }
+
+    m_capacity = capacity;
+    m_blockCount = (capacity + BlockSize - 1) / BlockSize;
+    m_slices.resize(sliceCount);
+    m_blockNext.resize(m_blockCount);
+    m_nextFree.assign(capacity, -1);
+
+    //an empty layout puts every block in the free pool in order
+    noParticles.assign(sliceCount, 0);
+    return Rebuild(noParticles.data());
+}
+
+
+void ParticleArena::Shutdown()
+{
+    std::vector<Slice>().swap(m_slices);
+    std::vector<int>().swap(m_blockNext);
+    std::vector<int>().swap(m_nextFree);
+    m_capacity = 0;
+    m_blockCount = 0;
+    m_freeBlockHead = -1;
+    m_freeBlockCount = 0;
+    return;
+}
+
+
+int ParticleArena::Allocate(int slice)
+{
+    Slice& owner = m_slices[slice];
+    int index, block;
+
+    if (owner.freeHead >= 0)
+    {
+        index = owner.freeHead;
+        owner.freeHead = m_nextFree[index];
+        owner.liveCount++;
+        return index;
+    }
+
+    if (owner.lastBlock < 0 || owner.lastBlockUsed == GetBlockCapacity(owner.lastBlock))
+    {
+        if (m_freeBlockHead < 0)
+        {
+            return -1;
+        }
+
+        block = m_freeBlockHead;
+        m_freeBlockHead = m_blockNext[block];
+        m_freeBlockCount--;
+
+        m_blockNext[block] = -1;
+        if (owner.lastBlock >= 0)
+        {
+            m_blockNext[owner.lastBlock] = block;
+        }
+        else
+        {
+            owner.firstBlock = block;
+        }
+        owner.lastBlock = block;
+        owner.blockCount++;
+        owner.lastBlockUsed = 0;
+    }
+
+    index = (owner.lastBlock * BlockSize) + owner.lastBlockUsed;
+    owner.lastBlockUsed++;
+    owner.liveCount++;
+    return index;
+}
+
+
+void ParticleArena::Free(int slice, int index)
+{
+    Slice& owner = m_slices[slice];
+
+    m_nextFree[index] = owner.freeHead;
+    owner.freeHead = index;
+    owner.liveCount--;
+    return;
+}
+
+
+void ParticleArena::ReleaseSlice(int slice)
+{
+    Slice& owner = m_slices[slice];
+
+    // the whole chain goes to the front of the free pool, the particles in it need no visit
+    if (owner.firstBlock >= 0)
+    {
+        m_blockNext[owner.lastBlock] = m_freeBlockHead;
+        m_freeBlockHead = owner.firstBlock;
+        m_freeBlockCount += owner.blockCount;
+    }
+
+    owner.firstBlock = -1;
+    owner.lastBlock = -1;
+    owner.blockCount = 0;
+    owner.lastBlockUsed = 0;
+    owner.freeHead = -1;
+    owner.liveCount = 0;
+    return;
+}
+
+
+bool ParticleArena::Rebuild(const int* liveCounts)
+{
+    int block = 0;
+
+    //lay the slices out on paper first, the last block of the pool can be short
+    for (auto i = 0; i < (int)m_slices.size(); ++i)
+    {
+        int remaining = liveCounts[i];
+
+        while (remaining > 0)
+        {
+            if (block >= m_blockCount)
+            {
+                return false;
+            }
+            remaining -= GetBlockCapacity(block);
+            block++;
+        }
+    }
+
+    block = 0;
+    for (auto i = 0; i < (int)m_slices.size(); ++i)
+    {
+        Slice& owner = m_slices[i];
+        int remaining = liveCounts[i];
+
+        owner.firstBlock = -1;
+        owner.lastBlock = -1;
+        owner.blockCount = 0;
+        owner.lastBlockUsed = 0;
+        owner.freeHead = -1;
+        owner.liveCount = remaining;
+
+        while (remaining > 0)
+        {
+            int taken = remaining < GetBlockCapacity(block) ? remaining : GetBlockCapacity(block);
+
+            m_blockNext[block] = -1;
+            if (owner.lastBlock >= 0)
+            {
+                m_blockNext[owner.lastBlock] = block;
+            }
+            else
+            {
+                owner.firstBlock = block;
+            }
+            owner.lastBlock = block;
+            owner.blockCount++;
+            owner.lastBlockUsed = taken;
+            remaining -= taken;
+            block++;
+        }
+    }
+
+    //whatever is left over is free, in order so new blocks are taken from low addresses first
+    m_freeBlockHead = (block < m_blockCount) ? block : -1;
+    m_freeBlockCount = m_blockCount - block;
+    for (auto i = block; i < m_blockCount; ++i)
+    {
+        m_blockNext[i] = (i + 1 < m_blockCount) ? i + 1 : -1;
+    }
+    return true;
+}
+
+
+int ParticleArena::GetSliceStart(int slice)
+{
+    return m_slices[slice].firstBlock >= 0 ? m_slices[slice].firstBlock * BlockSize : 0;
+}
+
+
+void ParticleArena::GetSliceRanges(int slice, int maxCount, std::vector<int>* starts, std::vector<int>* counts)
+{
+    const Slice& owner = m_slices[slice];
+    int start = 0;
+    int count = 0;
+
+    starts->clear();
+    counts->clear();
+    for (auto block = owner.firstBlock; block >= 0; block = m_blockNext[block])
+    {
+        int blockStart = block * BlockSize;
+        int used = (block == owner.lastBlock) ? owner.lastBlockUsed : GetBlockCapacity(block);
+
+        //only a block straight after the current range can extend it
+        if (count > 0 && start + count != blockStart)
+        {
+            starts->push_back(start);
+            counts->push_back(count);
+            count = 0;
+        }
+        if (count == 0)
+        {
+            start = blockStart;
+        }
+        count += used;
+
+        while (count > maxCount)
+        {
+            starts->push_back(start);
+            counts->push_back(maxCount);
+            start += maxCount;
+            count -= maxCount;
+        }
+    }
+
+    if (count > 0)
+    {
+        starts->push_back(start);
+        counts->push_back(count);
+    }
+    return;
+}
+
+
+int ParticleArena::GetFragmentation()
+{
+    int fragmentation = 0;
+
+    for (auto i = 0; i < (int)m_slices.size(); ++i)
+    {
+        const Slice& owner = m_slices[i];
+        int neededBlocks = (owner.liveCount + BlockSize - 1) / BlockSize;
+
+        fragmentation += owner.blockCount - neededBlocks;
+        for (auto block = owner.firstBlock; block >= 0 && m_blockNext[block] >= 0; block = m_blockNext[block])
+        {
+            if (m_blockNext[block] != block + 1)
+            {
+                fragmentation++;
+            }
+        }
+    }
+    return fragmentation;
+}
+
+
+int ParticleArena::GetLiveCount(int slice)
+{
+    return m_slices[slice].liveCount;
+}
+
+
+int ParticleArena::GetBlockCount(int slice)
+{
+    return m_slices[slice].blockCount;
+}
+
+
+int ParticleArena::GetFreeBlockCount()
+{
+    return m_freeBlockCount;
+}
+
+
+int ParticleArena::GetMemoryUsage()
+{
+    return (int)((m_slices.size() * sizeof(Slice)) + (m_blockNext.size() * sizeof(int)) + (m_nextFree.size() * sizeof(int)));
+}
+
+
+int ParticleArena::GetStateSize()
+{
+    return (2 * (int)sizeof(int)) + GetMemoryUsage();
+}
+
+
+void ParticleArena::SaveState(unsigned char* buffer)
+{
+    memcpy(buffer, &m_freeBlockHead, sizeof(int));
+    buffer += sizeof(int);
+    memcpy(buffer, &m_freeBlockCount, sizeof(int));
+    buffer += sizeof(int);
+    memcpy(buffer, m_slices.data(), m_slices.size() * sizeof(Slice));
+    buffer += m_slices.size() * sizeof(Slice);
+    memcpy(buffer, m_blockNext.data(), m_blockNext.size() * sizeof(int));
+    buffer += m_blockNext.size() * sizeof(int);
+    memcpy(buffer, m_nextFree.data(), m_nextFree.size() * sizeof(int));
+    return;
+}
+
+
+bool ParticleArena::ValidateState(const unsigned char* buffer, int size, const int* particleSlices)
+{
+    int freeBlockHead, freeBlockCount;
+    std::vector<Slice> slices;
+    std::vector<int> blockNext, nextFree;
+    std::vector<unsigned char> blockSeen, particleSeen;
+    int blocksInChains;
+
+    //the layout depends only on the capacity and the slice count, which the caller has already matched
+    if (size != GetStateSize())
+    {
+        return false;
+    }
+
+    slices.resize(m_slices.size());
+    blockNext.resize(m_blockCount);
+    nextFree.resize(m_capacity);
+    memcpy(&freeBlockHead, buffer, sizeof(int));
+    buffer += sizeof(int);
+    memcpy(&freeBlockCount, buffer, sizeof(int));
+    buffer += sizeof(int);
+    memcpy(slices.data(), buffer, slices.size() * sizeof(Slice));
+    buffer += slices.size() * sizeof(Slice);
+    memcpy(blockNext.data(), buffer, blockNext.size() * sizeof(int));
+    buffer += blockNext.size() * sizeof(int);
+    memcpy(nextFree.data(), buffer, nextFree.size() * sizeof(int));
+
+    for (auto i = 0; i < m_blockCount; ++i)
+    {
+        if (blockNext[i] < -1 || blockNext[i] >= m_blockCount)
+        {
+            return false;
+        }
+    }
+    for (auto i = 0; i < m_capacity; ++i)
+    {
+        if (nextFree[i] < -1 || nextFree[i] >= m_capacity)
+        {
+            return false;
+        }
+    }
+
+    //every block belongs to exactly one slice chain or the free pool, and each chain is as long as its count says
+    blockSeen.assign(m_blockCount, 0);
+    blocksInChains = 0;
+    for (auto i = 0; i <= (int)slices.size(); ++i)
+    {
+        bool isFreePool = (i == (int)slices.size());
+        int block = isFreePool ? freeBlockHead : slices[i].firstBlock;
+        int blockCount = isFreePool ? freeBlockCount : slices[i].blockCount;
+        int lastBlock = -1;
+
+        if (block < -1 || block >= m_blockCount || blockCount < 0 || blockCount > m_blockCount)
+        {
+            return false;
+        }
+        for (auto j = 0; j < blockCount; ++j)
+        {
+            if (block < 0 || blockSeen[block])
+            {
+                return false;
+            }
+            blockSeen[block] = 1;
+            lastBlock = block;
+            block = blockNext[block];
+        }
+        if (block >= 0)
+        {
+            return false;
+        }
+        blocksInChains += blockCount;
+
+        if (!isFreePool && slices[i].lastBlock != lastBlock)
+        {
+            return false;
+        }
+    }
+    if (blocksInChains != m_blockCount)
+    {
+        return false;
+    }
+
+    //particles on a slice's free list sit in the slice's handed out part of its blocks, once each
+    particleSeen.assign(m_capacity, 0);
+    for (auto i = 0; i < (int)slices.size(); ++i)
+    {
+        const Slice& owner = slices[i];
+        int handedOut = 0;
+        int freeCount = 0;
+
+        if (owner.freeHead < -1 || owner.liveCount < 0)
+        {
+            return false;
+        }
+        if (owner.lastBlock >= 0 && (owner.lastBlockUsed < 0 || owner.lastBlockUsed > GetBlockCapacity(owner.lastBlock)))
+        {
+            return false;
+        }
+        if (owner.lastBlock < 0 && owner.lastBlockUsed != 0)
+        {
+            return false;
+        }
+
+        for (auto block = owner.firstBlock; block >= 0; block = blockNext[block])
+        {
+            int used = (block == owner.lastBlock) ? owner.lastBlockUsed : GetBlockCapacity(block);
+            for (auto j = 0; j < used; ++j)
+            {
+                particleSeen[(block * BlockSize) + j] = (unsigned char)(i + 1);
+            }
+            handedOut += used;
+        }
+
+        for (auto index = owner.freeHead; index >= 0; index = nextFree[index])
+        {
+            if (index >= m_capacity || particleSeen[index] != (unsigned char)(i + 1))
+            {
+                return false;
+            }
+            //taken off so a second visit fails
+            particleSeen[index] = 0;
+            freeCount++;
+        }
+
+        //a slice holds its live particles plus its freed ones
+        if (owner.liveCount + freeCount != handedOut)
+        {
+            return false;
+        }
+    }
+
+    if (particleSlices)
+    {
+        for (auto i = 0; i < m_capacity; ++i)
+        {
+            if (particleSlices[i] != (int)particleSeen[i] - 1)
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+
+bool ParticleArena::RestoreState(const unsigned char* buffer, int size)
+{
+    if (!ValidateState(buffer, size, nullptr))
+    {
+        return false;
+    }
+
+    memcpy(&m_freeBlockHead, buffer, sizeof(int));
+    buffer += sizeof(int);
+    memcpy(&m_freeBlockCount, buffer, sizeof(int));
+    buffer += sizeof(int);
+    memcpy(m_slices.data(), buffer, m_slices.size() * sizeof(Slice));
+    buffer += m_slices.size() * sizeof(Slice);
+    memcpy(m_blockNext.data(), buffer, m_blockNext.size() * sizeof(int));
+    buffer += m_blockNext.size() * sizeof(int);
+    memcpy(m_nextFree.data(), buffer, m_nextFree.size() * sizeof(int));
+    return true;
+}
+
+
+int ParticleArena::GetBlockCapacity(int block)
+{
+    int remaining = m_capacity - (block * BlockSize);
+    return remaining < BlockSize ? remaining : BlockSize;
+}
@@ -0,0 +1,82 @@
+#pragma once
+#include <vector>
+
+// Hands out particle indices from one pool to several slices, one for each emitter, so the particles of an effect sit
+// together in memory instead of interleaving with every other effect. The pool is split into blocks of BlockSize
+// particles and a slice grows a block at a time, taking particles from its newest block in order and reusing the ones
+// freed inside its own blocks. Releasing a slice hands all of its blocks back in constant time, and Rebuild lays the
+// slices out again one after the other from the start of the pool with their live particles packed together.
+class ParticleArena
+{
+public:
+    static const int BlockSize = 256;
+
+    ParticleArena();
+    ~ParticleArena();
+
+    bool Initialize(int capacity, int sliceCount);
+    void Shutdown();
+
+    //@return index of a free particle for the slice, -1 when the slice is full and the pool has no free block left
+    int Allocate(int slice);
+    //the particle can only be reused by the same slice until the slice is released or rebuilt
+    void Free(int slice, int index);
+    //every particle of the slice becomes free and its blocks go back to the pool
+    void ReleaseSlice(int slice);
+
+    //moves every slice to the start of the pool in slice order, each one packed into as few blocks as its particles
+    //need. The caller moves the particles to match, the nth live particle of a slice goes to GetSliceStart(slice) + n
+    //@param liveCounts: live particles of each slice
+    //@return false and nothing changes when the slices do not fit. Each slice starts on a block of its own, so a pool
+    //that is close to full can need more blocks packed than it holds now
+    bool Rebuild(const int* liveCounts);
+    //first index of the slice, only meaningful straight after Rebuild
+    int GetSliceStart(int slice);
+
+    //blocks held by slices beyond what their live particles need, plus the places where a slice's next block is not
+    //the one straight after it in memory. 0 means every slice is one packed run of blocks
+    int GetFragmentation();
+
+    //index ranges covering every particle handed out to the slice, in block order with neighbouring blocks joined and
+    //none longer than maxCount. Particles the slice freed inside its blocks are part of the ranges
+    void GetSliceRanges(int slice, int maxCount, std::vector<int>* starts, std::vector<int>* counts);
+
+    int GetLiveCount(int slice);
+    int GetBlockCount(int slice);
+    int GetFreeBlockCount();
+    int GetMemoryUsage();
+
+    //snapshot support, the state is a flat copy of the bookkeeping and always GetStateSize bytes
+    int GetStateSize();
+    void SaveState(unsigned char* buffer);
+    //checks that every block and particle index in the state is in range and that the block chains and free lists
+    //end without sharing an entry, without changing anything
+    //@param particleSlices: slice each particle is live in according to the caller, -1 for particles not in use. The
+    //state must agree on every particle, nullptr skips this check
+    bool ValidateState(const unsigned char* buffer, int size, const int* particleSlices);
+    //returns false and keeps the current state when the state does not pass ValidateState
+    bool RestoreState(const unsigned char* buffer, int size);
+
+private:
+    struct Slice
+    {
+        //chain of blocks through m_blockNext, -1 when the slice holds none
+        int firstBlock, lastBlock;
+        int blockCount;
+        //particles handed out from the last block so far
+        int lastBlockUsed;
+        //particles freed inside the slice's blocks, linked through m_nextFree
+        int freeHead;
+        int liveCount;
+    };
+    //capacity of the block, only the last block of the pool can be short
+    int GetBlockCapacity(int block);
+
+    int m_capacity;
+    int m_blockCount;
+    std::vector<Slice> m_slices;
+    //next block in a slice or in the free pool, -1 at the end
+    std::vector<int> m_blockNext;
+    int m_freeBlockHead, m_freeBlockCount;
+    std::vector<int> m_nextFree;
+};
@@ -0,0 +1,343 @@
+#include "ParticleAutoTuner.h"
+
+#include <stdio.h>
+
+const int ParticleAutoTuner::ChunkSizes[ChunkSizeCount] = {256, 1024, 4096, 16384};
+
+static const char* UpdateOptionNames[1 + ParticleAutoTuner::ChunkSizeCount] = {"serial", "parallel 256", "parallel 1024", "parallel 4096", "parallel 16384"};
+static const char* SortOptionNames[3] = {"insertion", "radix", "none"};
+
+//weight of a new timing in the smoothed estimate
+static const double Smoothing = 0.2;
+//timings needed before an estimate is trusted
+static const int MinSamples = 4;
+static const int SettleFrames = 2;
+//long enough to settle and then take MinSamples timings
+static const int TrialFrames = SettleFrames + MinSamples;
+static const int ExploreInterval = 60;
+static const int MinDwellFrames = 30;
+//a strategy has to be this much faster than the current one to replace it
+static const double Hysteresis = 0.15;
+//estimates older than this are measured again, the rest of the frame may have changed how fast they are
+static const int StaleFrames = 1800;
+//an option this many times slower than the current one is not tried again, costs only grow with the count
+static const double TrialCostLimit = 2.0;
+
+
+ParticleAutoTuner::ParticleAutoTuner()
+{
+    m_threadCount = 0;
+    m_sortRequired = true;
+    m_frame = 0;
+    ResetDimension(&m_update, "update", UpdateOptionCount, 0);
+    ResetDimension(&m_sort, "sort", SortOptionCount, SORT_INSERTION);
+    for (auto i = 0; i < TUNED_WORK_COUNT; ++i)
+    {
+        m_frameTimes[i] = 0.0;
+    }
+}
+
+
+ParticleAutoTuner::~ParticleAutoTuner()
+{
+}
+
+
+bool ParticleAutoTuner::Initialize(int threadCount)
+{
+    m_threadCount = threadCount;
+    m_frame = 0;
+
+    //the manager's own strategies are the starting point
+    ResetDimension(&m_update, "update", UpdateOptionCount, 0);
+    ResetDimension(&m_sort, "sort", SortOptionCount, SORT_INSERTION);
+    // the two are explored on different frames so a trial of one does not disturb the timings of the other
+    m_sort.lastExploreFrame = -(ExploreInterval / 2);
+
+    for (auto i = 0; i < TUNED_WORK_COUNT; ++i)
+    {
+        m_frameTimes[i] = 0.0;
+    }
+    return true;
+}
+
+
+void ParticleAutoTuner::Shutdown()
+{
+    return;
+}
+
+
+void ParticleAutoTuner::SetSortRequired(bool required)
+{
+    m_sortRequired = required;
+    return;
+}
+
+
+void ParticleAutoTuner::BeginTiming(TunedWork work)
+{
+    m_timingStart[work] = std::chrono::steady_clock::now();
+    return;
+}
+
+
+void ParticleAutoTuner::EndTiming(TunedWork work)
+{
+    m_frameTimes[work] += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - m_timingStart[work]).count();
+    return;
+}
+
+
+bool ParticleAutoTuner::EndFrame(int liveParticles, ParticleStats* stats)
+{
+    int bucket;
+    bool changed;
+
+    bucket = 0;
+    while (bucket < BucketCount - 1 && (liveParticles >> (bucket + 1)) > 0)
+    {
+        bucket++;
+    }
+
+    RecordSample(&m_update, bucket, m_frameTimes[TUNED_UPDATE]);
+    RecordSample(&m_sort, bucket, m_frameTimes[TUNED_SORT]);
+
+    changed = Decide(&m_update, bucket, GetUpdateCandidates(liveParticles), liveParticles, stats);
+    changed = Decide(&m_sort, bucket, GetSortCandidates(), liveParticles, stats) || changed;
+
+    for (auto i = 0; i < TUNED_WORK_COUNT; ++i)
+    {
+        m_frameTimes[i] = 0.0;
+    }
+    m_frame++;
+    return changed;
+}
+
+
+UpdateStrategy ParticleAutoTuner::GetUpdateStrategy()
+{
+    return m_update.option == 0 ? UPDATE_SERIAL : UPDATE_PARALLEL;
+}
+
+
+int ParticleAutoTuner::GetChunkSize()
+{
+    return m_update.option == 0 ? 0 : ChunkSizes[m_update.option - 1];
+}
+
+
+SortStrategy ParticleAutoTuner::GetSortStrategy()
+{
+    return (SortStrategy)m_sort.option;
+}
+
+
+void ParticleAutoTuner::ResetDimension(Dimension* dimension, const char* name, int optionCount, int option)
+{
+    dimension->name = name;
+    dimension->optionCount = optionCount;
+    for (auto bucket = 0; bucket < BucketCount; ++bucket)
+    {
+        for (auto i = 0; i < MaxOptionCount; ++i)
+        {
+            dimension->estimates[bucket][i].time = 0.0;
+            dimension->estimates[bucket][i].samples = 0;
+            dimension->estimates[bucket][i].lastFrame = 0;
+        }
+    }
+    dimension->option = option;
+    dimension->trialReturnOption = -1;
+    dimension->trialFramesLeft = 0;
+    dimension->settleFramesLeft = 0;
+    dimension->lastSwitchFrame = 0;
+    dimension->lastExploreFrame = 0;
+    return;
+}
+
+
+void ParticleAutoTuner::RecordSample(Dimension* dimension, int bucket, double time)
+{
+    if (dimension->settleFramesLeft > 0)
+    {
+        dimension->settleFramesLeft--;
+        return;
+    }
+
+    Estimate& estimate = dimension->estimates[bucket][dimension->option];
+    if (estimate.samples == 0)
+    {
+        estimate.time = time;
+    }
+    else
+    {
+        estimate.time += (time - estimate.time) * Smoothing;
+    }
+    estimate.samples++;
+    estimate.lastFrame = m_frame;
+    return;
+}
+
+
+bool ParticleAutoTuner::Decide(Dimension* dimension, int bucket, unsigned int candidates, int liveParticles, ParticleStats* stats)
+{
+    const Estimate* row = dimension->estimates[bucket];
+    const Estimate* smallerRow = dimension->estimates[bucket > 0 ? bucket - 1 : 0];
+    int current, best;
+
+    current = dimension->option;
+
+    // the count fell below what the option needs or sorting was turned off, take the best option that is left
+    if ((candidates & (1u << current)) == 0)
+    {
+        best = -1;
+        for (auto i = 0; i < dimension->optionCount; ++i)
+        {
+            if ((candidates & (1u << i)) == 0)
+            {
+                continue;
+            }
+            if (best < 0 || (row[i].samples >= MinSamples && (row[best].samples < MinSamples || row[i].time < row[best].time)))
+            {
+                best = i;
+            }
+        }
+        dimension->trialReturnOption = -1;
+        SwitchOption(dimension, best, "no longer suited", liveParticles, stats);
+        return true;
+    }
+
+    if (dimension->trialReturnOption >= 0)
+    {
+        if (dimension->trialFramesLeft > 0)
+        {
+            dimension->trialFramesLeft--;
+            return false;
+        }
+
+        // the trial is kept when it beat the option it replaced by the hysteresis margin
+        int previous = dimension->trialReturnOption;
+        dimension->trialReturnOption = -1;
+        if ((candidates & (1u << previous)) == 0 || row[previous].samples < MinSamples || row[current].samples < MinSamples ||
+            row[current].time < row[previous].time * (1.0 - Hysteresis))
+        {
+            SwitchOption(dimension, current, "kept after trial", liveParticles, stats);
+            return false;
+        }
+        SwitchOption(dimension, previous, "trial was slower", liveParticles, stats);
+        return true;
+    }
+
+    if (m_frame - dimension->lastExploreFrame >= ExploreInterval)
+    {
+        dimension->lastExploreFrame = m_frame;
+        for (auto i = 0; i < dimension->optionCount; ++i)
+        {
+            if (i == current || (candidates & (1u << i)) == 0)
+            {
+                continue;
+            }
+
+            // options that were already far behind at this count or half of it are not worth the frames
+            if (row[i].samples >= MinSamples && row[current].samples >= MinSamples && row[i].time > row[current].time * TrialCostLimit)
+            {
+                continue;
+            }
+            if (smallerRow[i].samples >= MinSamples && smallerRow[current].samples >= MinSamples &&
+                smallerRow[i].time > smallerRow[current].time * TrialCostLimit)
+            {
+                continue;
+            }
+
+            if (row[i].samples < MinSamples || m_frame - row[i].lastFrame > StaleFrames)
+            {
+                dimension->trialReturnOption = current;
+                dimension->trialFramesLeft = TrialFrames;
+                SwitchOption(dimension, i, "trial", liveParticles, stats);
+                return true;
+            }
+        }
+    }
+
+    if (m_frame - dimension->lastSwitchFrame < MinDwellFrames || row[current].samples < MinSamples)
+    {
+        return false;
+    }
+
+    best = current;
+    for (auto i = 0; i < dimension->optionCount; ++i)
+    {
+        if ((candidates & (1u << i)) != 0 && row[i].samples >= MinSamples && row[i].time < row[best].time)
+        {
+            best = i;
+        }
+    }
+    if (best != current && row[best].time < row[current].time * (1.0 - Hysteresis))
+    {
+        SwitchOption(dimension, best, "faster", liveParticles, stats);
+        return true;
+    }
+    return false;
+}
+
+
+void ParticleAutoTuner::SwitchOption(Dimension* dimension, int option, const char* reason, int liveParticles, ParticleStats* stats)
+{
+    char message[160];
+
+    if (stats && option == dimension->option)
+    {
+        snprintf(message, sizeof(message), "%s: staying with %s (%s, %d particles)", dimension->name, GetOptionName(dimension, option),
+                 reason, liveParticles);
+        stats->Log(message);
+    }
+    else if (stats)
+    {
+        snprintf(message, sizeof(message), "%s: %s -> %s (%s, %d particles)", dimension->name, GetOptionName(dimension, dimension->option),
+                 GetOptionName(dimension, option), reason, liveParticles);
+        stats->Log(message);
+    }
+
+    if (option != dimension->option)
+    {
+        dimension->option = option;
+        dimension->settleFramesLeft = SettleFrames;
+    }
+    dimension->lastSwitchFrame = m_frame;
+    return;
+}
+
+
+unsigned int ParticleAutoTuner::GetUpdateCandidates(int liveParticles)
+{
+    unsigned int candidates = 1u;
+
+    // a chunked update needs at least two chunks and a worker to hand one to
+    if (m_threadCount > 0)
+    {
+        for (auto i = 0; i < ChunkSizeCount; ++i)
+        {
+            if (liveParticles >= ChunkSizes[i] * 2)
+            {
+                candidates |= 1u << (1 + i);
+            }
+        }
+    }
+    return candidates;
+}
+
+
+unsigned int ParticleAutoTuner::GetSortCandidates()
+{
+    if (!m_sortRequired)
+    {
+        return 1u << SORT_NONE;
+    }
+    return (1u << SORT_INSERTION) | (1u << SORT_RADIX);
+}
+
+
+const char* ParticleAutoTuner::GetOptionName(const Dimension* dimension, int option)
+{
+    return dimension == &m_update ? UpdateOptionNames[option] : SortOptionNames[option];
+}
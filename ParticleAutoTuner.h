@@ -0,0 +1,119 @@
+#pragma once
+#include "ParticleStats.h"
+
+//how the particle lists are updated
+enum UpdateStrategy
+{
+    UPDATE_SERIAL,
+    //each list's particles are split into chunks by where they sit in the pool and updated on the task pool
+    UPDATE_PARALLEL
+};
+
+//how the particle lists are kept in back to front order
+enum SortStrategy
+{
+    //every new particle is placed in order as it is spawned
+    SORT_INSERTION,
+    //new particles go to the front and every list is radix sorted once a frame
+    SORT_RADIX,
+    //new particles go to the front and the lists are never sorted, for effects drawn without depth order
+    SORT_NONE
+};
+
+//work the tuner times to compare strategies
+enum TunedWork
+{
+    //updating the particle lists
+    TUNED_UPDATE,
+    //killing and spawning, which includes insertion sorting, plus the radix sort pass
+    TUNED_SORT,
+    TUNED_WORK_COUNT
+};
+
+// Picks the update and sort strategies of a particle manager while it runs. The time of the work each strategy affects
+// is measured every frame and kept per strategy and per size of the particle count, in powers of two, so the best choice
+// for the current count is known once each strategy has run at that size. Strategies that have not been measured at a
+// size are tried for a few frames now and then. A strategy only replaces the current one when it is clearly faster and
+// the current one has been in use for a while, so the choice does not flip between two strategies of similar cost.
+// Every change is written to the stats log.
+class ParticleAutoTuner
+{
+public:
+    static const int ChunkSizeCount = 4;
+    //particles in each chunk of a parallel update
+    static const int ChunkSizes[ChunkSizeCount];
+
+    ParticleAutoTuner();
+    ~ParticleAutoTuner();
+
+    //@param threadCount: worker threads of the task pool, parallel updates are never tried without any
+    bool Initialize(int threadCount);
+    void Shutdown();
+
+    //@param required: false when the particles do not have to be drawn in order, the lists are then never sorted
+    void SetSortRequired(bool required);
+
+    //times add up when a piece of work is measured in several parts during a frame
+    void BeginTiming(TunedWork work);
+    void EndTiming(TunedWork work);
+
+    //records the frame's timings and makes the decisions for the next frame
+    //@param liveParticles: particles in the lists
+    //@param stats: decisions are logged here, may be nullptr
+    //@return true when a strategy changed
+    bool EndFrame(int liveParticles, ParticleStats* stats);
+
+    UpdateStrategy GetUpdateStrategy();
+    //particles per chunk of a parallel update
+    int GetChunkSize();
+    SortStrategy GetSortStrategy();
+
+private:
+    //update option 0 is serial and option 1 + i is parallel with ChunkSizes[i], sort options are the SortStrategy values
+    static const int UpdateOptionCount = 1 + ChunkSizeCount;
+    static const int SortOptionCount = 3;
+    static const int MaxOptionCount = UpdateOptionCount;
+    //log2 of the particle count
+    static const int BucketCount = 32;
+
+    struct Estimate
+    {
+        //smoothed milliseconds a frame
+        double time;
+        int samples;
+        long long lastFrame;
+    };
+
+    //one strategy choice, the update and the sort are tuned separately
+    struct Dimension
+    {
+        const char* name;
+        int optionCount;
+        Estimate estimates[BucketCount][MaxOptionCount];
+        int option;
+        //option to go back to when a trial does not pay off, -1 outside of a trial
+        int trialReturnOption;
+        int trialFramesLeft;
+        //frames after a change that are not measured, caches and threads need to settle
+        int settleFramesLeft;
+        long long lastSwitchFrame, lastExploreFrame;
+    };
+
+    void ResetDimension(Dimension* dimension, const char* name, int optionCount, int option);
+    void RecordSample(Dimension* dimension, int bucket, double time);
+    //returns true when the option changed
+    bool Decide(Dimension* dimension, int bucket, unsigned int candidates, int liveParticles, ParticleStats* stats);
+    void SwitchOption(Dimension* dimension, int option, const char* reason, int liveParticles, ParticleStats* stats);
+    //options that make sense for the current count
+    unsigned int GetUpdateCandidates(int liveParticles);
+    unsigned int GetSortCandidates();
+    const char* GetOptionName(const Dimension* dimension, int option);
+
+    Dimension m_update, m_sort;
+    int m_threadCount;
+    bool m_sortRequired;
+    long long m_frame;
+
+    std::chrono::steady_clock::time_point m_timingStart[TUNED_WORK_COUNT];
+    double m_frameTimes[TUNED_WORK_COUNT];
+};
@@ -0,0 +1,532 @@
+#include "ParticleCache.h"
+
+#include <cstring>
+
+using namespace ParticleCacheFormat;
+
+namespace
+{
+    //byte plane split, byte b of word w goes to plane b. Used on the xor delta so equal exponents line up into zero runs
+    void SplitBytePlanes(const unsigned char* source, unsigned char* destination, int byteCount)
+    {
+        int wordCount = byteCount / 4;
+        for (auto word = 0; word < wordCount; ++word)
+        {
+            destination[word] = source[(word * 4) + 0];
+            destination[wordCount + word] = source[(word * 4) + 1];
+            destination[(wordCount * 2) + word] = source[(word * 4) + 2];
+            destination[(wordCount * 3) + word] = source[(word * 4) + 3];
+        }
+    }
+
+    // run length encoding of zero bytes. A control byte with the top bit set is a run of (n & 0x7f) + 1 zeros,
+    // otherwise it is followed by n + 1 literal bytes
+    int CompressZeroRuns(const unsigned char* source, int byteCount, unsigned char* destination)
+    {
+        int read = 0;
+        int written = 0;
+
+        while (read < byteCount)
+        {
+            if (source[read] == 0)
+            {
+                int run = 1;
+                while (read + run < byteCount && run < 128 && source[read + run] == 0)
+                {
+                    run++;
+                }
+                destination[written++] = (unsigned char)(0x80 | (run - 1));
+                read += run;
+            }
+            else
+            {
+                //literals end at the first pair of zeros, a single zero is cheaper to keep as a literal
+                int run = 1;
+                while (read + run < byteCount && run < 128 &&
+                    !(source[read + run] == 0 && (read + run + 1 >= byteCount || source[read + run + 1] == 0)))
+                {
+                    run++;
+                }
+                destination[written++] = (unsigned char)(run - 1);
+                memcpy(destination + written, source + read, run);
+                written += run;
+                read += run;
+            }
+        }
+
+        return written;
+    }
+
+    bool DecompressZeroRuns(const unsigned char* source, int compressedSize, unsigned char* destination, int byteCount)
+    {
+        int read = 0;
+        int written = 0;
+
+        while (read < compressedSize)
+        {
+            unsigned char control = source[read++];
+            int run = (control & 0x7f) + 1;
+            if (written + run > byteCount)
+            {
+                return false;
+            }
+
+            if (control & 0x80)
+            {
+                memset(destination + written, 0, run);
+            }
+            else
+            {
+                if (read + run > compressedSize)
+                {
+                    return false;
+                }
+                memcpy(destination + written, source + read, run);
+                read += run;
+            }
+            written += run;
+        }
+
+        return written == byteCount;
+    }
+}
+
+
+ParticleCacheWriter::ParticleCacheWriter()
+{
+    m_file = nullptr;
+    memset(&m_header, 0, sizeof(m_header));
+    m_bytesWritten = 0;
+    m_time = 0.0f;
+    m_previousFrame = nullptr;
+    m_deltaFrame = nullptr;
+    m_compressedFrame = nullptr;
+    m_frameOffsets = nullptr;
+    m_frameOffsetCapacity = 0;
+}
+
+
+ParticleCacheWriter::~ParticleCacheWriter()
+{
+    Close();
+}
+
+
+bool ParticleCacheWriter::Open(const char* filename, int instanceStride, int maxInstances, int framesPerChunk)
+{
+    Close();
+
+    if (instanceStride <= 0 || (instanceStride % 4) != 0 || instanceStride > (int)MaxInstanceStride || maxInstances <= 0 ||
+        maxInstances > (int)(MaxFrameBytes / instanceStride) || framesPerChunk <= 0)
+    {
+        return false;
+    }
+
+    m_file = fopen(filename, "wb");
+    if (!m_file)
+    {
+        return false;
+    }
+
+    m_header.magic = FileMagic;
+    m_header.version = FileVersion;
+    m_header.instanceStride = instanceStride;
+    m_header.maxInstances = maxInstances;
+    m_header.frameCount = 0;
+    m_header.framesPerChunk = framesPerChunk;
+    m_header.frameTableOffset = 0;
+
+    //the header is written again with the final counts in Close
+    if (fwrite(&m_header, sizeof(m_header), 1, m_file) != 1)
+    {
+        Close();
+        return false;
+    }
+    m_bytesWritten = sizeof(m_header);
+    m_time = 0.0f;
+
+    int frameBytes = instanceStride * maxInstances;
+    m_previousFrame = new unsigned char[frameBytes];
+    m_deltaFrame = new unsigned char[frameBytes];
+    // worst case is one control byte for every 128 literals
+    m_compressedFrame = new unsigned char[frameBytes + (frameBytes / 128) + 1];
+    memset(m_previousFrame, 0, frameBytes);
+
+    m_frameOffsetCapacity = 1024;
+    m_frameOffsets = new uint64_t[m_frameOffsetCapacity];
+
+    return true;
+}
+
+
+bool ParticleCacheWriter::Close()
+{
+    bool result = true;
+
+    if (m_file)
+    {
+        m_header.frameTableOffset = m_bytesWritten;
+        result = fwrite(m_frameOffsets, sizeof(uint64_t), m_header.frameCount, m_file) == m_header.frameCount;
+
+        if (result && fseek(m_file, 0, SEEK_SET) == 0)
+        {
+            result = fwrite(&m_header, sizeof(m_header), 1, m_file) == 1;
+        }
+        else
+        {
+            result = false;
+        }
+
+        result = (fclose(m_file) == 0) && result;
+        m_file = nullptr;
+    }
+
+    if (m_previousFrame)
+    {
+        delete[] m_previousFrame;
+        m_previousFrame = nullptr;
+    }
+    if (m_deltaFrame)
+    {
+        delete[] m_deltaFrame;
+        m_deltaFrame = nullptr;
+    }
+    if (m_compressedFrame)
+    {
+        delete[] m_compressedFrame;
+        m_compressedFrame = nullptr;
+    }
+    if (m_frameOffsets)
+    {
+        delete[] m_frameOffsets;
+        m_frameOffsets = nullptr;
+    }
+    m_frameOffsetCapacity = 0;
+
+    return result;
+}
+
+
+bool ParticleCacheWriter::WriteFrame(const void* instances, int instanceCount, int rainCount, int fireCount, float frameTime)
+{
+    FrameHeader frameHeader;
+
+    if (!m_file || instanceCount < 0 || instanceCount > (int)m_header.maxInstances)
+    {
+        return false;
+    }
+
+    int frameBytes = instanceCount * m_header.instanceStride;
+    const unsigned char* frame = (const unsigned char*)instances;
+
+    //a new chunk starts from an empty frame so it can be decoded on its own
+    if ((m_header.frameCount % m_header.framesPerChunk) == 0)
+    {
+        memset(m_previousFrame, 0, m_header.maxInstances * m_header.instanceStride);
+    }
+
+    //xor against the previous frame, then keep the current frame for the next delta. The compressed buffer is free
+    //until the delta is encoded so it holds the unsplit xor
+    for (auto i = 0; i < frameBytes; ++i)
+    {
+        m_compressedFrame[i] = frame[i] ^ m_previousFrame[i];
+    }
+    SplitBytePlanes(m_compressedFrame, m_deltaFrame, frameBytes);
+
+    memcpy(m_previousFrame, frame, frameBytes);
+    memset(m_previousFrame + frameBytes, 0, (m_header.maxInstances * m_header.instanceStride) - frameBytes);
+
+    frameHeader.time = m_time;
+    frameHeader.rainCount = rainCount;
+    frameHeader.fireCount = fireCount;
+    frameHeader.instanceCount = instanceCount;
+    frameHeader.compressedSize = CompressZeroRuns(m_deltaFrame, frameBytes, m_compressedFrame);
+
+    if (m_header.frameCount >= (uint32_t)m_frameOffsetCapacity)
+    {
+        uint64_t* frameOffsets = new uint64_t[m_frameOffsetCapacity * 2];
+        memcpy(frameOffsets, m_frameOffsets, sizeof(uint64_t) * m_frameOffsetCapacity);
+        delete[] m_frameOffsets;
+        m_frameOffsets = frameOffsets;
+        m_frameOffsetCapacity *= 2;
+    }
+    m_frameOffsets[m_header.frameCount] = m_bytesWritten;
+
+    if (fwrite(&frameHeader, sizeof(frameHeader), 1, m_file) != 1 ||
+        fwrite(m_compressedFrame, 1, frameHeader.compressedSize, m_file) != frameHeader.compressedSize)
+    {
+        return false;
+    }
+
+    m_bytesWritten += sizeof(frameHeader) + frameHeader.compressedSize;
+    m_header.frameCount++;
+    m_time += frameTime;
+
+    return true;
+}
+
+
+int ParticleCacheWriter::GetFrameCount()
+{
+    return (int)m_header.frameCount;
+}
+
+
+uint64_t ParticleCacheWriter::GetBytesWritten()
+{
+    return m_bytesWritten;
+}
+
+
+ParticleCachePlayer::ParticleCachePlayer()
+{
+    m_header = nullptr;
+    m_frameTable = nullptr;
+    m_currentFrame = nullptr;
+    m_deltaFrame = nullptr;
+    m_decodedFrame = -1;
+    m_prefetchedChunk = -1;
+}
+
+
+ParticleCachePlayer::~ParticleCachePlayer()
+{
+    Close();
+}
+
+
+bool ParticleCachePlayer::Open(const char* filename)
+{
+    Close();
+
+    if (!m_file.Open(filename))
+    {
+        return false;
+    }
+
+    const FileHeader* header = (const FileHeader*)m_file.GetData();
+    size_t fileSize = m_file.GetSize();
+    if (fileSize < sizeof(FileHeader) || header->magic != FileMagic || header->version != FileVersion ||
+        header->instanceStride == 0 || (header->instanceStride % 4) != 0 || header->instanceStride > MaxInstanceStride ||
+        header->maxInstances == 0 || header->maxInstances > MaxFrameBytes / header->instanceStride || header->framesPerChunk == 0 ||
+        header->frameTableOffset + ((uint64_t)header->frameCount * sizeof(uint64_t)) > fileSize)
+    {
+        m_file.Close();
+        return false;
+    }
+
+    m_header = header;
+    m_frameTable = m_file.GetData() + header->frameTableOffset;
+
+    //every frame header has to be inside the frame data, DecodeFrame checks the compressed data that follows it
+    for (auto i = 0; i < (int)m_header->frameCount; ++i)
+    {
+        if (GetFrameOffset(i) + sizeof(FrameHeader) > m_header->frameTableOffset)
+        {
+            Close();
+            return false;
+        }
+    }
+
+    //the header limits keep this inside an int, it is still worked out in size_t before anything is allocated
+    size_t frameBytes = (size_t)m_header->maxInstances * m_header->instanceStride;
+    m_currentFrame = new unsigned char[frameBytes];
+    m_deltaFrame = new unsigned char[frameBytes];
+    m_decodedFrame = -1;
+    m_prefetchedChunk = -1;
+
+    return true;
+}
+
+
+void ParticleCachePlayer::Close()
+{
+    m_file.Close();
+    m_header = nullptr;
+    m_frameTable = nullptr;
+
+    if (m_currentFrame)
+    {
+        delete[] m_currentFrame;
+        m_currentFrame = nullptr;
+    }
+    if (m_deltaFrame)
+    {
+        delete[] m_deltaFrame;
+        m_deltaFrame = nullptr;
+    }
+    m_decodedFrame = -1;
+    m_prefetchedChunk = -1;
+
+    return;
+}
+
+
+bool ParticleCachePlayer::ReadFrame(int frameIndex, void* instances, int* instanceCount, int* rainCount, int* fireCount)
+{
+    if (!m_header || frameIndex < 0 || frameIndex >= (int)m_header->frameCount)
+    {
+        return false;
+    }
+
+    if (frameIndex != m_decodedFrame)
+    {
+        int chunkStart = frameIndex - (frameIndex % m_header->framesPerChunk);
+
+        //only step forward from the decoded frame when it is in the same chunk, otherwise start over at the chunk
+        int firstFrame = chunkStart;
+        if (m_decodedFrame >= chunkStart && m_decodedFrame < frameIndex)
+        {
+            firstFrame = m_decodedFrame + 1;
+        }
+
+        for (auto i = firstFrame; i <= frameIndex; ++i)
+        {
+            if (!DecodeFrame(i))
+            {
+                m_decodedFrame = -1;
+                return false;
+            }
+        }
+    }
+
+    FrameHeader frameHeader;
+    GetFrameHeader(frameIndex, &frameHeader);
+    (*instanceCount) = frameHeader.instanceCount;
+    (*rainCount) = frameHeader.rainCount;
+    (*fireCount) = frameHeader.fireCount;
+    memcpy(instances, m_currentFrame, frameHeader.instanceCount * m_header->instanceStride);
+
+    // ask the os for the next chunk while this one is being played
+    int nextChunk = (frameIndex / m_header->framesPerChunk) + 1;
+    if (nextChunk != m_prefetchedChunk && (uint32_t)(nextChunk * m_header->framesPerChunk) < m_header->frameCount)
+    {
+        uint64_t chunkStart = GetFrameOffset(nextChunk * m_header->framesPerChunk);
+        uint64_t chunkEnd = m_header->frameTableOffset;
+        if ((uint32_t)((nextChunk + 1) * m_header->framesPerChunk) < m_header->frameCount)
+        {
+            chunkEnd = GetFrameOffset((nextChunk + 1) * m_header->framesPerChunk);
+        }
+        m_file.Prefetch((size_t)chunkStart, (size_t)(chunkEnd - chunkStart));
+        m_prefetchedChunk = nextChunk;
+    }
+
+    return true;
+}
+
+
+int ParticleCachePlayer::GetFrameAtTime(float time)
+{
+    if (!m_header || m_header->frameCount == 0)
+    {
+        return -1;
+    }
+
+    // frame times only go up, binary search for the last frame that started at or before the time
+    FrameHeader frameHeader;
+    int low = 0;
+    int high = (int)m_header->frameCount - 1;
+    while (low < high)
+    {
+        int middle = (low + high + 1) / 2;
+        GetFrameHeader(middle, &frameHeader);
+        if (frameHeader.time <= time)
+        {
+            low = middle;
+        }
+        else
+        {
+            high = middle - 1;
+        }
+    }
+    return low;
+}
+
+
+int ParticleCachePlayer::GetFrameCount()
+{
+    return m_header ? (int)m_header->frameCount : 0;
+}
+
+
+int ParticleCachePlayer::GetMaxInstances()
+{
+    return m_header ? (int)m_header->maxInstances : 0;
+}
+
+
+int ParticleCachePlayer::GetInstanceStride()
+{
+    return m_header ? (int)m_header->instanceStride : 0;
+}
+
+
+float ParticleCachePlayer::GetDuration()
+{
+    if (!m_header || m_header->frameCount == 0)
+    {
+        return 0.0f;
+    }
+
+    FrameHeader frameHeader;
+    GetFrameHeader(m_header->frameCount - 1, &frameHeader);
+    return frameHeader.time;
+}
+
+
+bool ParticleCachePlayer::DecodeFrame(int frameIndex)
+{
+    FrameHeader frameHeader;
+    GetFrameHeader(frameIndex, &frameHeader);
+    uint64_t frameOffset = GetFrameOffset(frameIndex);
+    int frameBytes = frameHeader.instanceCount * m_header->instanceStride;
+    int maxFrameBytes = m_header->maxInstances * m_header->instanceStride;
+
+    if (frameHeader.instanceCount > m_header->maxInstances ||
+        frameOffset + sizeof(FrameHeader) + frameHeader.compressedSize > m_header->frameTableOffset)
+    {
+        return false;
+    }
+
+    if ((frameIndex % m_header->framesPerChunk) == 0)
+    {
+        memset(m_currentFrame, 0, maxFrameBytes);
+    }
+
+    const unsigned char* compressed = m_file.GetData() + frameOffset + sizeof(FrameHeader);
+    if (!DecompressZeroRuns(compressed, frameHeader.compressedSize, m_deltaFrame, frameBytes))
+    {
+        return false;
+    }
+
+    //undo the plane split and apply the xor to the previous frame in one pass
+    int wordCount = frameBytes / 4;
+    for (auto word = 0; word < wordCount; ++word)
+    {
+        m_currentFrame[(word * 4) + 0] ^= m_deltaFrame[word];
+        m_currentFrame[(word * 4) + 1] ^= m_deltaFrame[wordCount + word];
+        m_currentFrame[(word * 4) + 2] ^= m_deltaFrame[(wordCount * 2) + word];
+        m_currentFrame[(word * 4) + 3] ^= m_deltaFrame[(wordCount * 3) + word];
+    }
+
+    //the writer treats everything past the instance count as zero for the next delta
+    memset(m_currentFrame + frameBytes, 0, maxFrameBytes - frameBytes);
+
+    m_decodedFrame = frameIndex;
+    return true;
+}
+
+
+void ParticleCachePlayer::GetFrameHeader(int frameIndex, FrameHeader* frameHeader)
+{
+    memcpy(frameHeader, m_file.GetData() + GetFrameOffset(frameIndex), sizeof(FrameHeader));
+    return;
+}
+
+
+uint64_t ParticleCachePlayer::GetFrameOffset(int frameIndex)
+{
+    uint64_t offset;
+    memcpy(&offset, m_frameTable + (frameIndex * sizeof(uint64_t)), sizeof(uint64_t));
+    return offset;
+}
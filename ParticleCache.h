@@ -0,0 +1,111 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+
+#include "MappedFile.h"
+
+// Baked particle caches. The writer records the instance data produced each frame into a chunked file and the player
+// memory maps that file and hands the frames back, so a baked effect costs only i/o, decoding and the buffer upload.
+//
+// Each frame is stored as the xor against the previous frame with the bytes of every 4 byte word split into planes,
+// which turns the slowly changing float data into long runs of zero bytes that are then run length encoded.
+// The first frame of every chunk is stored against an empty frame so playback can start at any chunk.
+
+namespace ParticleCacheFormat
+{
+    const uint32_t FileMagic = 0x48434350; // "PCCH"
+    const uint32_t FileVersion = 1;
+    //largest instance and frame a cache can hold, a frame is decoded with int sizes and has to stay well inside them
+    const uint32_t MaxInstanceStride = 256;
+    const uint32_t MaxFrameBytes = 1u << 30;
+
+    struct FileHeader
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t instanceStride;
+        uint32_t maxInstances;
+        uint32_t frameCount;
+        uint32_t framesPerChunk;
+        //offset of the table of uint64_t frame offsets written after the last frame
+        uint64_t frameTableOffset;
+    };
+
+    struct FrameHeader
+    {
+        //seconds since the capture started
+        float time;
+        uint32_t rainCount;
+        uint32_t fireCount;
+        uint32_t instanceCount;
+        uint32_t compressedSize;
+    };
+}
+
+class ParticleCacheWriter
+{
+public:
+    ParticleCacheWriter();
+    ~ParticleCacheWriter();
+
+    //@param instanceStride: size of one instance in bytes, must be a multiple of 4. Open fails when the stride or a
+    //full frame is larger than the format allows
+    bool Open(const char* filename, int instanceStride, int maxInstances, int framesPerChunk);
+    //writes the frame table and finishes the header, the file is not valid for playback until this is called
+    bool Close();
+
+    bool WriteFrame(const void* instances, int instanceCount, int rainCount, int fireCount, float frameTime);
+
+    int GetFrameCount();
+    uint64_t GetBytesWritten();
+
+private:
+    FILE* m_file;
+    ParticleCacheFormat::FileHeader m_header;
+    uint64_t m_bytesWritten;
+    float m_time;
+
+    unsigned char* m_previousFrame;
+    unsigned char* m_deltaFrame;
+    unsigned char* m_compressedFrame;
+    uint64_t* m_frameOffsets;
+    int m_frameOffsetCapacity;
+};
+
+class ParticleCachePlayer
+{
+public:
+    ParticleCachePlayer();
+    ~ParticleCachePlayer();
+
+    bool Open(const char* filename);
+    void Close();
+
+    //decodes the frame into instances, which must hold GetMaxInstances instances. Stepping forward one frame at a
+    //time only decodes that frame, any other jump decodes from the start of the frame's chunk
+    bool ReadFrame(int frameIndex, void* instances, int* instanceCount, int* rainCount, int* fireCount);
+
+    //returns the last frame captured at or before the given time
+    int GetFrameAtTime(float time);
+
+    int GetFrameCount();
+    int GetMaxInstances();
+    int GetInstanceStride();
+    float GetDuration();
+
+private:
+    bool DecodeFrame(int frameIndex);
+    //frames are variable sized, so the frame headers and the table after them are at unaligned offsets in the mapping
+    //and are copied out rather than read in place
+    void GetFrameHeader(int frameIndex, ParticleCacheFormat::FrameHeader* frameHeader);
+    uint64_t GetFrameOffset(int frameIndex);
+
+    MappedFile m_file;
+    const ParticleCacheFormat::FileHeader* m_header;
+    const unsigned char* m_frameTable;
+
+    unsigned char* m_currentFrame;
+    unsigned char* m_deltaFrame;
+    int m_decodedFrame;
+    int m_prefetchedChunk;
+};
@@ -0,0 +1,186 @@
+#pragma once
+
+// Per effect update kernels put together from small policies at compile time. A kernel is one loop over a particle list
+// that applies its force, moves, ages and collides each particle, and every policy is inlined into it so an effect only
+// pays for the behaviour it has. Conditional behaviour is written as selects rather than branches so the loop has no
+// data dependent jumps. The runtime configured kernel at the bottom does the same work with a flag check per behaviour,
+// it is kept for effects built from data and to compare against the specialized kernels.
+//
+// Particle types need positionX/Y/Z, velocityX/Y/Z, red/green/blue, remainingLifeTime and, for the list kernels, next.
+
+struct ParticleKernelParams
+{
+    float frameTime;
+    float gravity;
+    //particles take the smoke color once their remaining lifetime drops below smokeLifeTime
+    float smokeLifeTime;
+    float smokeColor[3];
+};
+
+//force policies, applied before the move
+
+struct NoForce
+{
+    template <class ParticleT> static void Apply(ParticleT*, const ParticleKernelParams&) {}
+};
+
+struct Gravity
+{
+    template <class ParticleT> static void Apply(ParticleT* particle, const ParticleKernelParams& params)
+    {
+        particle->velocityY += params.gravity * params.frameTime;
+    }
+};
+
+//gravity only while the particle is off the ground
+struct GravityAboveGround
+{
+    template <class ParticleT> static void Apply(ParticleT* particle, const ParticleKernelParams& params)
+    {
+        particle->velocityY += (particle->positionY > 0.0f) ? params.gravity * params.frameTime : 0.0f;
+    }
+};
+
+//lifetime policies, applied after the move
+
+struct Immortal
+{
+    template <class ParticleT> static void Apply(ParticleT*, const ParticleKernelParams&) {}
+};
+
+struct Ageing
+{
+    template <class ParticleT> static void Apply(ParticleT* particle, const ParticleKernelParams& params)
+    {
+        particle->remainingLifeTime -= params.frameTime;
+    }
+};
+
+//ages and turns to smoke near the end of the lifetime
+struct AgeingWithSmoke
+{
+    template <class ParticleT> static void Apply(ParticleT* particle, const ParticleKernelParams& params)
+    {
+        particle->remainingLifeTime -= params.frameTime;
+        bool smoke = particle->remainingLifeTime < params.smokeLifeTime;
+        particle->red = smoke ? params.smokeColor[0] : particle->red;
+        particle->green = smoke ? params.smokeColor[1] : particle->green;
+        particle->blue = smoke ? params.smokeColor[2] : particle->blue;
+    }
+};
+
+//collision policies, applied last
+
+struct NoCollision
+{
+    template <class ParticleT> static void Apply(ParticleT*, const ParticleKernelParams&) {}
+};
+
+// bounces off the ground, with some reduction in non-veritcal velocity
+struct GroundBounce
+{
+    template <class ParticleT> static void Apply(ParticleT* particle, const ParticleKernelParams&)
+    {
+        bool below = particle->positionY < 0.0f;
+        particle->positionY = below ? 0.1f : particle->positionY;
+        particle->velocityY = below ? particle->velocityY * -0.4f : particle->velocityY;
+        particle->velocityX = below ? particle->velocityX * 0.6f : particle->velocityX;
+        particle->velocityZ = below ? particle->velocityZ * 0.6f : particle->velocityZ;
+    }
+};
+
+
+template <class Force, class Lifetime, class Collision, class ParticleT>
+inline void UpdateParticle(ParticleT* particle, const ParticleKernelParams& params)
+{
+    Force::Apply(particle, params);
+
+    particle->positionX += particle->velocityX * params.frameTime;
+    particle->positionY += particle->velocityY * params.frameTime;
+    particle->positionZ += particle->velocityZ * params.frameTime;
+
+    Lifetime::Apply(particle, params);
+    Collision::Apply(particle, params);
+}
+
+template <class Force, class Lifetime, class Collision, class ParticleT>
+void UpdateParticleKernel(ParticleT* headNode, const ParticleKernelParams& params)
+{
+    for (ParticleT* particle = headNode; particle; particle = particle->next)
+    {
+        UpdateParticle<Force, Lifetime, Collision>(particle, params);
+    }
+}
+
+//the same update over particles stored one after the other, for callers that know where a list's particles are
+template <class Force, class Lifetime, class Collision, class ParticleT>
+void UpdateParticleRangeKernel(ParticleT* particles, int count, const ParticleKernelParams& params)
+{
+    for (auto i = 0; i < count; ++i)
+    {
+        UpdateParticle<Force, Lifetime, Collision>(&particles[i], params);
+    }
+}
+
+
+//behaviour of the runtime configured kernel
+struct ParticleKernelConfig
+{
+    bool gravity;
+    bool gravityOnlyAboveGround;
+    bool ageing;
+    bool smoke;
+    bool groundBounce;
+};
+
+template <class ParticleT>
+inline void UpdateParticleGeneric(ParticleT* particle, const ParticleKernelParams& params, const ParticleKernelConfig& config)
+{
+    if (config.gravity)
+    {
+        if (!config.gravityOnlyAboveGround || particle->positionY > 0.0f)
+        {
+            particle->velocityY += params.gravity * params.frameTime;
+        }
+    }
+
+    particle->positionX += particle->velocityX * params.frameTime;
+    particle->positionY += particle->velocityY * params.frameTime;
+    particle->positionZ += particle->velocityZ * params.frameTime;
+
+    if (config.ageing)
+    {
+        particle->remainingLifeTime -= params.frameTime;
+    }
+    if (config.smoke && particle->remainingLifeTime < params.smokeLifeTime)
+    {
+        particle->red = params.smokeColor[0];
+        particle->green = params.smokeColor[1];
+        particle->blue = params.smokeColor[2];
+    }
+    if (config.groundBounce && particle->positionY < 0.0f)
+    {
+        particle->positionY = 0.1f;
+        particle->velocityY = particle->velocityY * -0.4f;
+        particle->velocityX = particle->velocityX * 0.6f;
+        particle->velocityZ = particle->velocityZ * 0.6f;
+    }
+}
+
+template <class ParticleT>
+void UpdateParticleGenericKernel(ParticleT* headNode, const ParticleKernelParams& params, const ParticleKernelConfig& config)
+{
+    for (ParticleT* particle = headNode; particle; particle = particle->next)
+    {
+        UpdateParticleGeneric(particle, params, config);
+    }
+}
+
+template <class ParticleT>
+void UpdateParticleGenericRangeKernel(ParticleT* particles, int count, const ParticleKernelParams& params, const ParticleKernelConfig& config)
+{
+    for (auto i = 0; i < count; ++i)
+    {
+        UpdateParticleGeneric(&particles[i], params, config);
+    }
+}
@@ -1,19 +1,262 @@
 #include "ParticleManager.h"
 
+#include <algorithm>
+#include <float.h>
+#include <stddef.h>
+#include <string.h>
+
+std::vector<ParticleManager::SharedTextureCache> ParticleManager::s_textureCaches;
+TaskPool* ParticleManager::s_taskPool = nullptr;
+int ParticleManager::s_taskPoolUsers = 0;
+std::vector<ParticleManager::SharedInstanceRing> ParticleManager::s_instanceRings;
+const float ParticleManager::PrewarmStepTime = 0.05f;
+const float ParticleManager::AnalyticRainSplashShare = 0.5f;
+//rain falls until KillParticles respawns it, fire rises and turns to smoke, rings and bursts fall and bounce
+const ParticleManager::ParticleKernel ParticleManager::s_particleKernels[EFFECT_TYPE_COUNT] =
+{
+    nullptr,
+    UpdateParticleKernel<Gravity, Immortal, NoCollision, ParticleManager::Particle>,
+    UpdateParticleKernel<NoForce, AgeingWithSmoke, NoCollision, ParticleManager::Particle>,
+    UpdateParticleKernel<GravityAboveGround, Ageing, GroundBounce, ParticleManager::Particle>
+};
+const ParticleManager::ParticleRangeKernel ParticleManager::s_particleRangeKernels[EFFECT_TYPE_COUNT] =
+{
+    nullptr,
+    UpdateParticleRangeKernel<Gravity, Immortal, NoCollision, ParticleManager::Particle>,
+    UpdateParticleRangeKernel<NoForce, AgeingWithSmoke, NoCollision, ParticleManager::Particle>,
+    UpdateParticleRangeKernel<GravityAboveGround, Ageing, GroundBounce, ParticleManager::Particle>
+};
+//the same behaviour for the runtime configured kernel: gravity, only above ground, ageing, smoke, ground bounce
+const ParticleKernelConfig ParticleManager::s_genericKernelConfigs[EFFECT_TYPE_COUNT] =
+{
+    { false, false, false, false, false },
+    { true, false, false, false, false },
+    { false, false, true, true, false },
+    { true, true, true, false, true }
+};
+//flat snapshot layout: header, the whole particle array with its next pointers cleared, one link per particle as the
+//index of the next particle or -1, the arena bookkeeping, then the compact pool state
+static const uint32_t SnapshotMagic = 0x53534D50; // "PMSS"
+static const uint32_t SnapshotVersion = 3;
+struct SnapshotHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    int32_t maxParticles;
+    int32_t particleSize;
+    //list heads as indices into the particle array, -1 for an empty list
+    int32_t headOfAllocatedList, headOfRainAllocatedList, headOfFireAllocatedList;
+    int32_t arenaStateSize;
+    uint32_t randomState;
+    double rainTime;
+    float firePosition[3];
+    float fireDormantTime, rainDormantTime;
+    //the pool is repacked on a timer, which changes where particles live and so has to match for an exact resume
+    float defragmentTimer;
+    uint8_t fireEnabled, fireDormant, rainDormant, hasCompactParticles;
+    int32_t compactStateSize;
+};
+//seed used until SetRandomSeed, xorshift needs a state other than 0
+static const unsigned int DefaultRandomSeed = 0x2545F491;
+
+//how often the pool is checked for fragmentation, and how fragmented it has to be before the slices are packed again
+static const float DefragmentInterval = 1.0f;
+static const int DefragmentThreshold = 2;
+
+//distance a bounced particle is placed off the surface it hit so the next frame's segment does not start inside it
+static const float CollisionSurfaceOffset = 0.01f;
+
+//integer hash used by the stateless effects, the same input always gives the same output so no per particle state is needed
+static unsigned int HashParticle(unsigned int value)
+{
+    value ^= value >> 16;
+    value *= 0x7feb352dU;
+    value ^= value >> 15;
+    value *= 0x846ca68bU;
+    value ^= value >> 16;
+    return value;
+}
+
+//solves height + (velocity * t) + (0.5 * gravity * t^2) = 0 for the first time a falling particle reaches the ground
+static bool SolveGroundTime(float height, float velocity, float gravity, float* time)
+{
+    float a = 0.5f * gravity;
+    float b = velocity;
+    float c = height;
+
+    if (a == 0.0f)
+    {
+        if (b >= 0.0f)
+        {
+            //never reaches the ground
+            return false;
+        }
+        (*time) = -c / b;
+    }
+    else
+    {
+        float discriminant = (b * b) - (4.0f * a * c);
+        if (discriminant < 0.0f)
+        {
+            return false;
+        }
+        //the larger root is the first time the particle moves below the ground, as it starts above it
+        float rootA = (-b + sqrtf(discriminant)) / (2.0f * a);
+        float rootB = (-b - sqrtf(discriminant)) / (2.0f * a);
+        (*time) = (rootA > rootB) ? rootA : rootB;
+    }
+
+    return (*time) >= 0.0f;
+}
+
+//frustum planes from the columns of a row vector view projection, normalized so they give distances. The d3d near plane is z = 0
+static void ExtractFrustumPlanes(const XMFLOAT4X4& m, XMFLOAT4* planes)
+{
+    planes[0] = XMFLOAT4(m._14 + m._11, m._24 + m._21, m._34 + m._31, m._44 + m._41);
+    planes[1] = XMFLOAT4(m._14 - m._11, m._24 - m._21, m._34 - m._31, m._44 - m._41);
+    planes[2] = XMFLOAT4(m._14 + m._12, m._24 + m._22, m._34 + m._32, m._44 + m._42);
+    planes[3] = XMFLOAT4(m._14 - m._12, m._24 - m._22, m._34 - m._32, m._44 - m._42);
+    planes[4] = XMFLOAT4(m._13, m._23, m._33, m._43);
+    planes[5] = XMFLOAT4(m._14 - m._13, m._24 - m._23, m._34 - m._33, m._44 - m._43);
+    for (auto i = 0; i < 6; ++i)
+    {
+        float length = sqrtf((planes[i].x * planes[i].x) + (planes[i].y * planes[i].y) + (planes[i].z * planes[i].z));
+        if (length > 0.0f)
+        {
+            planes[i].x /= length;
+            planes[i].y /= length;
+            planes[i].z /= length;
+            planes[i].w /= length;
+        }
+    }
+}
+
+//returns false when the sphere is entirely outside one of the planes
+static bool IsSphereInFrustum(const XMFLOAT4* planes, const XMFLOAT3& center, float radius)
+{
+    for (auto i = 0; i < 6; ++i)
+    {
+        if ((planes[i].x * center.x) + (planes[i].y * center.y) + (planes[i].z * center.z) + planes[i].w < -radius)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+//splits the velocity into the part along the normal and the part along the surface and bounces it like the ground does
+static void ReflectVelocity(const XMFLOAT3& normal, XMFLOAT3* velocity)
+{
+    float along = (velocity->x * normal.x) + (velocity->y * normal.y) + (velocity->z * normal.z);
+    XMFLOAT3 normalPart(normal.x * along, normal.y * along, normal.z * along);
+
+    velocity->x = ((velocity->x - normalPart.x) * 0.6f) + (normalPart.x * -0.4f);
+    velocity->y = ((velocity->y - normalPart.y) * 0.6f) + (normalPart.y * -0.4f);
+    velocity->z = ((velocity->z - normalPart.z) * 0.6f) + (normalPart.z * -0.4f);
+}
+
+//returns a value in the range [0, 1) from the hash of the given values
+static float HashParticleToUnitFloat(unsigned int seed, unsigned int index, unsigned int salt)
+{
+    unsigned int hash = HashParticle(seed ^ HashParticle(index ^ HashParticle(salt)));
+    return (hash >> 8) * (1.0f / 16777216.0f);
+}
 
 
 ParticleManager::ParticleManager()
 {
-    m_rainTexture = nullptr;
-    m_fireTexture = nullptr;
-    m_defaultTexture = nullptr;
+    m_rainTexture = -1;
+    m_fireTexture = -1;
+    m_defaultTexture = -1;
+    m_textureCacheAcquired = false;
+    m_textureCache = nullptr;
+    m_buildTextureAtlas = false;
+    m_atlasSize = 0;
+    m_atlasMaxTextureSize = 0;
     m_particleList = nullptr;
-    m_vertices = nullptr;
     m_Instances = nullptr;
     m_vertexBuffer = nullptr;
     m_indexBuffer = nullptr;
     m_instanceBuffer = nullptr;
-
+    m_useVertexPulling = false;
+    m_useGenericKernels = false;
+    m_randomState = DefaultRandomSeed;
+    m_taskPoolAcquired = false;
+    m_instanceRingAcquired = false;
+    m_instanceRing = nullptr;
+    m_instanceRingSize = 0;
+    m_instanceRingOffset = 0;
+    m_instanceRingAllocation = -1;
+    m_stats = nullptr;
+    m_autoTuner = nullptr;
+    m_updateStrategy = UPDATE_SERIAL;
+    m_updateChunkSize = 0;
+    m_sortStrategy = SORT_INSERTION;
+    m_defragmentTimer = 0.0f;
+
+    m_useAnalyticRain = false;
+    m_analyticRainDropCount = 0;
+    m_rainSeed = 0;
+    m_rainTime = 0.0;
+    m_rainCycleTime = 0.0f;
+    m_analyticRainSplashStride = 1;
+
+    m_useEffectLibrary = false;
+    m_effectReloadTimer = 0.0f;
+
+    m_cacheWriter = nullptr;
+    m_cachePlayer = nullptr;
+    m_cachePlaybackTime = 0.0f;
+    m_cacheLoop = false;
+    m_rainRenderCount = 0;
+
+    m_occlusionCuller = nullptr;
+    m_occlusionClusterCount = 0;
+    m_occlusionClusterSize = 2.0f;
+    m_unculledRainCount = 0;
+    m_unculledFireCount = 0;
+    m_unculledCount = 0;
+    m_keepUnculledInstances = false;
+    m_occludedParticles = 0;
+    m_visibleParticles = 0;
+
+    m_spawnQueueCapacity = 1024;
+    m_spawnQueuePolicy = SPAWN_POLICY_COALESCE;
+    m_firePosition = XMFLOAT3(3.0f, 0.0f, 28.0f);
+
+    m_compactParticles = nullptr;
+    m_compactParticleCapacity = 0;
+
+    m_densityGrid = nullptr;
+    m_densityWeights[DENSITY_RAIN] = 0.02f;
+    m_emissionWeights[DENSITY_RAIN] = 0.0f;
+    m_densityWeights[DENSITY_FIRE] = 1.0f;
+    m_emissionWeights[DENSITY_FIRE] = 1.0f;
+    m_densityWeights[DENSITY_GENERAL] = 0.25f;
+    m_emissionWeights[DENSITY_GENERAL] = 0.0f;
+
+    m_collisionRainCount = 0;
+    m_collisionFireCount = 0;
+    m_collisionCompactCount = 0;
+
+    m_useDormantEmitters = false;
+    m_relevanceCameraSet = false;
+    m_relevanceDistance = 0.0f;
+    m_fireEmitter.dormant = false;
+    m_fireEmitter.dormantTime = 0.0f;
+    m_rainEmitter.dormant = false;
+    m_rainEmitter.dormantTime = 0.0f;
+    m_fireEnabled = true;
+
+    m_useFireInstancing = false;
+    m_fireCopies = nullptr;
+    m_fireCopyOrder = nullptr;
+    m_fireCopyCount = 0;
+    m_maxFireCopies = 0;
+    m_fireHistoryHead = 0;
+    m_fireHistoryCount = 0;
+    m_recordFireHistory = false;
+    m_fireRenderCount = 0;
 }
 
 
@@ -26,48 +269,89 @@ bool ParticleManager::Initialize(ID3D11Device* device, ID3D11DeviceContext* devi
 {
     bool result;
 
-    //texture loads
-    result = LoadTexture(device, deviceContext, fireTextureFilename, &m_fireTexture);
-    if (!result)
+    //texture loads, these return straight away and the textures become available in a later frame. Without a device
+    //the manager only simulates, so there is nothing to load
+    if (device)
     {
-       return false;
+        result = AcquireTextures(device, defaultTextureFilename, rainTextureFilename, fireTextureFilename);
+        if (!result)
+        {
+           return false;
+        }
     }
 
-    result = LoadTexture(device, deviceContext, defaultTextureFilename, &m_defaultTexture);
+    result = AcquireTaskPool();
     if (!result)
     {
         return false;
     }
 
-    result = LoadTexture(device, deviceContext, rainTextureFilename, &m_rainTexture);
+    result = InitializeParticleSystem();
     if (!result)
     {
         return false;
     }
 
-    result = InitializeParticleSystem();
+    result = InitializeBuffers(device);
     if (!result)
     {
         return false;
     }
 
-    result = InitializeBuffers(device);
-    if (!result)
+    if (m_instanceRingSize > 0 && !m_useVertexPulling && device)
     {
-        return false;
+        result = AcquireInstanceRing(device, deviceContext);
+        if (!result)
+        {
+            return false;
+        }
     }
 
     //start the rain particles in motion
-    InitiateRainEffects();
+    if (m_useAnalyticRain)
+    {
+        result = InitiateAnalyticRainEffects();
+        if (!result)
+        {
+            return false;
+        }
+    }
+    else
+    {
+        InitiateRainEffects();
+    }
     return true;
 }
 
 
 void ParticleManager::Shutdown()
 {
+    EndCacheCapture();
+    EndCachePlayback();
+    if (m_occlusionCuller)
+    {
+        m_occlusionCuller->Shutdown();
+        delete m_occlusionCuller;
+        m_occlusionCuller = nullptr;
+    }
+    m_occluders.clear();
+    std::vector<InstanceType>().swap(m_unculledInstances);
+    m_keepUnculledInstances = false;
+    if (m_densityGrid)
+    {
+        m_densityGrid->Shutdown();
+        delete m_densityGrid;
+        m_densityGrid = nullptr;
+    }
+    ClearCollisionMeshes();
+    ClearViews();
+    ReleaseInstanceRing();
     ShutdownBuffers();
     ShutdownParticleSystem();
+    DisableAutoTuner();
+    ReleaseTaskPool();
     ReleaseTextures();
+    DisableStats();
 
     return;
 }
@@ -77,14 +361,162 @@ bool ParticleManager::Frame(ID3D11DeviceContext* deviceContext, float frameTime)
 {
     bool result;
 
-    // deallocate or repeat particles
+    //last frame's draws have been issued by now, so its range of the ring is fenced and handed back even when this
+    //frame uploads nothing. Ranges retire in order, one held on to would push every other manager off the ring
+    if (m_instanceRingAllocation >= 0)
+    {
+        m_instanceRing->Release(m_instanceRingAllocation);
+        m_instanceRingAllocation = -1;
+    }
+
+    //pick up effect library changes a couple of times a second, this only swaps parameters and leaves live particles alone
+    if (m_useEffectLibrary)
+    {
+        m_effectReloadTimer += frameTime;
+        if (m_effectReloadTimer > 0.5f)
+        {
+            m_effectReloadTimer = 0.0f;
+            if (m_effectLibrary.CheckForReload())
+            {
+                ApplyEffectLibrary(false);
+            }
+        }
+    }
+
+    //hand over any textures the loader finished since the last frame
+    if (m_textureCacheAcquired && deviceContext)
+    {
+        m_textureCache->Update(deviceContext);
+    }
+
+    //a playing cache replaces the whole simulation, spawn requests made meanwhile are thrown away
+    if (m_cachePlayer)
+    {
+        m_spawnQueue.Discard();
+        return PlayCacheFrame(deviceContext, frameTime);
+    }
+
+    if (m_stats)
+    {
+        m_stats->BeginFrame();
+    }
+
+    //kills and respawns leave holes in the slices over time, every so often they are packed again. A pool too full to
+    //pack is left as it is until the next check
+    m_defragmentTimer += frameTime;
+    if (m_defragmentTimer >= DefragmentInterval)
+    {
+        m_defragmentTimer = 0.0f;
+        if (m_particleArena.GetFragmentation() >= DefragmentThreshold)
+        {
+            DefragmentParticles();
+        }
+    }
+
+    //emitters nobody can see stop here and ones that came back into view catch up
+    BeginStage(STAGE_EMITTERS);
+    if (m_useDormantEmitters)
+    {
+        UpdateEmitterRelevance(frameTime);
+    }
+    EndStage(STAGE_EMITTERS);
+
+    // deallocate or repeat particles, new particles are placed in their lists during kill and spawn
+    BeginTunedWork(TUNED_SORT);
+    BeginStage(STAGE_KILL);
     KillParticles();
+    EndStage(STAGE_KILL);
+
+    BeginStage(STAGE_SPAWN);
+
+    //stateless rain only needs its clock advanced, drops that landed this frame create their splashes here
+    if (m_useAnalyticRain)
+    {
+        if (m_rainEmitter.dormant)
+        {
+            m_rainTime += frameTime;
+        }
+        else
+        {
+            UpdateAnalyticRain(frameTime);
+        }
+    }
+
+    //spawn everything the gameplay threads asked for since the last frame
+    ProcessSpawnCommands();
+
+    //create additional fire particles, an instanced fire is simulated at the origin and placed by its copies
+    if (!m_fireEmitter.dormant)
+    {
+        if (m_useFireInstancing)
+        {
+            MakeFireEffect(XMFLOAT3(0.0f, 0.0f, 0.0f), frameTime);
+        }
+        else if (m_fireEnabled)
+        {
+            MakeFireEffect(m_firePosition, frameTime);
+        }
+    }
+    EndStage(STAGE_SPAWN);
+    EndTunedWork(TUNED_SORT);
 
-    //create additional fire particles
-    MakeFireEffect(XMFLOAT3(3.0f, 0.0f, 28.0f), frameTime);
+    //particles are tested against the scene along the whole of this frame's move
+    m_impacts.clear();
+    if (!m_collisionWorld.IsEmpty())
+    {
+        BeginStage(STAGE_COLLISION);
+        BeginSceneCollision();
+        EndStage(STAGE_COLLISION);
+    }
 
     // Update the position of the particles.
+    BeginStage(STAGE_UPDATE);
+    BeginTunedWork(TUNED_UPDATE);
     UpdateParticles(frameTime);
+    EndTunedWork(TUNED_UPDATE);
+    EndStage(STAGE_UPDATE);
+
+    if (!m_collisionWorld.IsEmpty())
+    {
+        BeginStage(STAGE_COLLISION);
+        ResolveSceneCollisions();
+        EndStage(STAGE_COLLISION);
+    }
+
+    //everything spawned this frame went to the front of its list, one pass puts the lists back in order. The compact
+    //pool appends its new particles and is sorted after the move either way, it is merged with the general list by
+    //depth when the instances are written
+    if (m_sortStrategy != SORT_NONE)
+    {
+        BeginStage(STAGE_SORT);
+        BeginTunedWork(TUNED_SORT);
+        if (m_sortStrategy == SORT_RADIX)
+        {
+            SortParticleLists();
+        }
+        if (m_compactParticles)
+        {
+            m_compactParticles->SortByDepth();
+        }
+        if (m_useAnalyticRain && !m_rainEmitter.dormant)
+        {
+            SortAnalyticRain();
+        }
+        EndTunedWork(TUNED_SORT);
+        EndStage(STAGE_SORT);
+    }
+
+    BeginStage(STAGE_INSTANCES);
+    if (m_recordFireHistory)
+    {
+        RecordFireHistory(frameTime);
+    }
+
+    //rasterize the occluders for this frame's camera before any instance is written
+    if (m_occlusionCuller)
+    {
+        PrepareOcclusion();
+    }
 
     // Update the dynamic vertex buffer with the new position of each particle.
     result = UpdateBuffers(deviceContext);
@@ -93,816 +525,3616 @@ bool ParticleManager::Frame(ID3D11DeviceContext* deviceContext, float frameTime)
         return false;
     }
 
+    //culled particles were still simulated
+    if (m_stats)
+    {
+        m_stats->EndFrame((int)m_activeParticles + m_occludedParticles);
+    }
+    if (m_autoTuner && m_autoTuner->EndFrame((int)m_activeParticles + m_occludedParticles, m_stats))
+    {
+        ApplyTunerStrategies();
+    }
+
+    if (m_cacheWriter)
+    {
+        result = m_cacheWriter->WriteFrame(m_Instances, (int)m_activeParticles, m_rainRenderCount, m_fireRenderCount, frameTime);
+        if (!result)
+        {
+            return false;
+        }
+    }
+
     return true;
 }
 
 
 void ParticleManager::Render(ID3D11DeviceContext* deviceContext)
 {
-    RenderBuffers(deviceContext);
+    if (m_instanceRingAllocation >= 0)
+    {
+        RenderBuffers(deviceContext, m_instanceRing->GetBuffer(), m_instanceRingOffset, &m_billboardBuffer);
+        return;
+    }
+    RenderBuffers(deviceContext, m_instanceBuffer, 0, &m_billboardBuffer);
     return;
 }
 
 
-ID3D11ShaderResourceView * ParticleManager::GetDefaultTexture()
+void ParticleManager::EnableAnalyticRain(int dropCount, unsigned int seed)
 {
-    return m_defaultTexture->GetTexture();
+    m_useAnalyticRain = true;
+    m_analyticRainDropCount = dropCount;
+    m_rainSeed = seed;
+    return;
 }
 
-ID3D11ShaderResourceView * ParticleManager::GetRainTexture()
-{
-    return m_rainTexture->GetTexture();
-}
 
-ID3D11ShaderResourceView * ParticleManager::GetFireTexture()
+bool ParticleManager::LoadEffectLibrary(const char* filename)
 {
-    return m_fireTexture->GetTexture();
-}
+    bool result;
 
-int ParticleManager::GetIndexCount()
-{
-    return m_indexCount;
-}
+    result = m_effectLibrary.Load(filename);
+    if (!result)
+    {
+        return false;
+    }
+    m_useEffectLibrary = true;
 
-int ParticleManager::GetVertexCount()
-{
-    return m_vertexCount;
+    // when the particle system is already running only the runtime values can change
+    if (m_particleList)
+    {
+        ApplyEffectLibrary(false);
+    }
+    return true;
 }
 
-int ParticleManager::GetRainInstanceCount()
-{
-    return m_rainInstanceCount;
-}
 
-int ParticleManager::GetFireInstanceCount()
+bool ParticleManager::BeginCacheCapture(const char* filename)
 {
-    return m_fireInstanceCount;
-}
+    bool result;
 
+    EndCacheCapture();
 
-int ParticleManager::GetTotalInstanceCount()
-{
-    return m_totalInstanceCount;
+    m_cacheWriter = new ParticleCacheWriter;
+    if (!m_cacheWriter)
+    {
+        return false;
+    }
+
+    // one second chunks at 60 frames per second
+    result = m_cacheWriter->Open(filename, sizeof(InstanceType), m_totalInstanceCount, 60);
+    if (!result)
+    {
+        delete m_cacheWriter;
+        m_cacheWriter = nullptr;
+        return false;
+    }
+    return true;
 }
 
-int ParticleManager::GetActiveInstanceCount()
+
+bool ParticleManager::EndCacheCapture()
 {
-    return m_activeParticles;
+    bool result = true;
+
+    if (m_cacheWriter)
+    {
+        result = m_cacheWriter->Close();
+        delete m_cacheWriter;
+        m_cacheWriter = nullptr;
+    }
+    return result;
 }
 
-bool ParticleManager::LoadTexture(ID3D11Device * device, ID3D11DeviceContext * deviceContext, const char * filename, TextureClass **texture)
+
+bool ParticleManager::BeginCachePlayback(const char* filename, bool loop)
 {
     bool result;
-    (*texture) = new TextureClass;
-    if (!(*texture))
+
+    EndCachePlayback();
+
+    m_cachePlayer = new ParticleCachePlayer;
+    if (!m_cachePlayer)
     {
         return false;
     }
-    result = (*texture)->Initialize(device, deviceContext, filename);
-    if (!result)
+
+    //the cache has to have been captured with the same instance layout and fit in our instance buffer
+    result = m_cachePlayer->Open(filename);
+    if (!result || m_cachePlayer->GetInstanceStride() != sizeof(InstanceType) || m_cachePlayer->GetMaxInstances() > m_totalInstanceCount ||
+        m_cachePlayer->GetFrameCount() == 0)
     {
+        delete m_cachePlayer;
+        m_cachePlayer = nullptr;
         return false;
     }
 
+    m_cachePlaybackTime = 0.0f;
+    m_cacheLoop = loop;
     return true;
 }
 
-void ParticleManager::ReleaseTextures()
+
+void ParticleManager::EndCachePlayback()
 {
-    if (m_defaultTexture)
-    {
-        m_defaultTexture->Shutdown();
-        delete m_defaultTexture;
-        m_defaultTexture = 0;
-    }
-    if (m_rainTexture)
+    if (m_cachePlayer)
     {
-        m_rainTexture->Shutdown();
-        delete m_rainTexture;
-        m_rainTexture = 0;
+        delete m_cachePlayer;
+        m_cachePlayer = nullptr;
     }
-    if (m_fireTexture)
-    {
-        m_fireTexture->Shutdown();
-        delete m_fireTexture;
-        m_fireTexture = 0;
-    }
-
-   return;
+    return;
 }
 
 
-bool ParticleManager::InitializeParticleSystem()
+void ParticleManager::EnableFireInstancing(int maxCopies)
 {
-    // Set the default size of Particles
-    m_particleSize = 0.10f;
+    m_useFireInstancing = true;
+    m_maxFireCopies = maxCopies;
+    return;
+}
 
-    // Set the maximum number of particles allowed
-    m_maxParticles = 10000;
-    m_activeParticles = 0;
 
-    m_rainInstanceCount = 1000;
-    m_fireInstanceCount = 0;
-    m_fireParticlesPerSecond = 150;
-    m_rainSpawnInHeight = 20.0f;
-    m_rainSpawnYVelocity = -3.0f;
-    m_smokeLifeTime = 3.0f;
+int ParticleManager::AddFireInstance(const XMFLOAT4X4& transform, float timeOffset)
+{
+    if (!m_fireCopies || m_fireCopyCount >= m_maxFireCopies)
+    {
+        return -1;
+    }
 
-    m_rainBoxCoordinates[0] = -10.0f;
-    m_rainBoxCoordinates[1] =  20.0f;
-    m_rainBoxCoordinates[2] =  15.0f;
-    m_rainBoxCoordinates[3] =  50.0f;
+    m_fireCopies[m_fireCopyCount].transform = transform;
+    m_fireCopies[m_fireCopyCount].timeOffset = timeOffset;
 
-    //set the value of gravity
-    m_gravityConstant = -3.5f;
+    // the history is only kept once a copy actually needs to look back in time
+    if (timeOffset > 0.0f)
+    {
+        m_recordFireHistory = true;
+    }
 
-    //List heads set to null
-    m_headOfFreeList = nullptr;
-    m_headOfAllocatedList = nullptr;
-    m_headOfRainAllocatedList = nullptr;
-    m_headOfFireAllocatedList = nullptr;
+    return m_fireCopyCount++;
+}
 
 
-    // Create the particle list.
-    m_particleList = new Particle[m_maxParticles];
-    if (!m_particleList)
+void ParticleManager::SetFireInstanceTransform(int copyIndex, const XMFLOAT4X4& transform)
+{
+    if (copyIndex < 0 || copyIndex >= m_fireCopyCount)
     {
-        return false;
+        return;
     }
-    m_headOfFreeList = &m_particleList[0]; // pointer to memory adress
+    m_fireCopies[copyIndex].transform = transform;
+    return;
+}
+
 
-    // Each particle points to the next. this will setup the default connections of the free particle list
-    for (auto i = 0; i < m_maxParticles - 1; ++i)
+void ParticleManager::ClearFireInstances()
+{
+    m_fireCopyCount = 0;
+    m_recordFireHistory = false;
+    m_fireHistoryCount = 0;
+    for (auto i = 0; i < MaxFireHistoryFrames; ++i)
     {
-        m_particleList[i].next = &m_particleList[i + 1];
+        std::vector<InstanceType>().swap(m_fireHistory[i].instances);
     }
-    m_particleList[m_maxParticles - 1].next = nullptr; // last node
-
-    return true;
+    return;
 }
 
-void ParticleManager::ShutdownParticleSystem()
+
+int ParticleManager::GetInstancedFireMemorySaved()
 {
-    if (m_particleList)
+    if (m_fireCopyCount <= 1)
     {
-        delete[] m_particleList;
-        m_particleList = 0;
+        return 0;
     }
-    return;
+
+    int historyBytes = 0;
+    for (auto i = 0; i < MaxFireHistoryFrames; ++i)
+    {
+        historyBytes += (int)(m_fireHistory[i].instances.capacity() * sizeof(InstanceType));
+    }
+    int copyBytes = (m_fireCopyCount * sizeof(EffectCopy)) + (m_fireCopyCount * sizeof(int));
+
+    return ((m_fireCopyCount - 1) * m_fireInstanceCount * (int)sizeof(Particle)) - historyBytes - copyBytes;
 }
 
 
-bool ParticleManager::InitializeBuffers(ID3D11Device* device)
+bool ParticleManager::EnableOcclusionCulling(int depthWidth, int depthHeight)
 {
-    D3D11_BUFFER_DESC vertexBufferDesc, indexBufferDesc, instanceBufferDesc;
-    D3D11_SUBRESOURCE_DATA vertexData, indexData, instanceData;
-    HRESULT result;
-
+    bool result;
 
-    // Max vertex is set to 6 times the number of different vertex setups
-    m_vertexCount = 18;
-    m_indexCount = m_vertexCount;
+    if (m_occlusionCuller)
+    {
+        m_occlusionCuller->Shutdown();
+        delete m_occlusionCuller;
+        m_occlusionCuller = nullptr;
+    }
 
-    m_vertices = new VertexType[m_vertexCount];
-    if (!m_vertices)
+    m_occlusionCuller = new OcclusionCuller;
+    if (!m_occlusionCuller)
     {
         return false;
     }
 
-    unsigned long* indices = new unsigned long[m_indexCount];
-    if (!indices)
+    result = m_occlusionCuller->Initialize(depthWidth, depthHeight);
+    if (!result)
     {
+        m_occlusionCuller->Shutdown();
+        delete m_occlusionCuller;
+        m_occlusionCuller = nullptr;
         return false;
     }
 
-    memset(m_vertices, 0, (sizeof(VertexType) * m_vertexCount));
-
-    // Initialize the index array.
-    for (auto i = 0; i < 12; i++)
-    {
-        indices[i] = i;
-    }
+    //nothing is occluded until a camera is set, an all zero matrix puts every box behind the camera
+    memset(&m_occlusionViewProjection, 0, sizeof(m_occlusionViewProjection));
+    m_occlusionClusterCount = 0;
+    return true;
+}
 
-    //default values should not be used as per instance data will replace it per frame
-    float positionX = 0.0f;
-    float positionY = 0.0f;
-    float positionZ = 0.0f;
-    float red = 0.5f;
-    float green = 0.5f;
-    float blue = 0.5f;
-    int index = 0;
 
-    // default particles, currently used be rain droplets
-    m_particleSize = 0.015f;
-        
-        // Bottom left.
-        m_vertices[index].position = XMFLOAT3(positionX - m_particleSize, (positionY - m_particleSize), positionZ);
-        m_vertices[index].texture = XMFLOAT2(0.0f, 1.0f);
-        m_vertices[index].color = XMFLOAT4(red, green, blue, 1.0f);
-        index++;
+void ParticleManager::SetOcclusionCamera(const XMFLOAT4X4& viewProjection)
+{
+    m_occlusionViewProjection = viewProjection;
+    return;
+}
 
-        // Top left.
-        m_vertices[index].position = XMFLOAT3(positionX - m_particleSize, (positionY + m_particleSize), positionZ);
-        m_vertices[index].texture = XMFLOAT2(0.0f, 0.0f);
-        m_vertices[index].color = XMFLOAT4(red,green, blue, 1.0f);
-        index++;
 
-        // Bottom right.
-        m_vertices[index].position = XMFLOAT3(positionX + m_particleSize, (positionY - m_particleSize), positionZ);
-        m_vertices[index].texture = XMFLOAT2(1.0f, 1.0f);
-        m_vertices[index].color = XMFLOAT4(red, green, blue, 1.0f);
-        index++;
+void ParticleManager::AddOccluderMesh(const XMFLOAT3* vertices, int vertexCount, const unsigned int* indices, int indexCount)
+{
+    OccluderMesh mesh;
+    mesh.vertices.assign(vertices, vertices + vertexCount);
+    mesh.indices.assign(indices, indices + indexCount);
+    m_occluders.push_back(mesh);
+    return;
+}
 
-        // Bottom right.
-        m_vertices[index].position = XMFLOAT3(positionX + m_particleSize, (positionY - m_particleSize), positionZ);
-        m_vertices[index].texture = XMFLOAT2(1.0f, 1.0f);
-        m_vertices[index].color = XMFLOAT4(red, green, blue, 1.0f);
-        index++;
 
-        // Top left.
-        m_vertices[index].position = XMFLOAT3(positionX - m_particleSize, (positionY + m_particleSize), positionZ);
-        m_vertices[index].texture = XMFLOAT2(0.0f, 0.0f);
-        m_vertices[index].color = XMFLOAT4(red, green, blue, 1.0f);
-        index++;
+void ParticleManager::ClearOccluderMeshes()
+{
+    m_occluders.clear();
+    return;
+}
 
-        // Top right.
-        m_vertices[index].position = XMFLOAT3(positionX + m_particleSize, (positionY + m_particleSize), positionZ);
-        m_vertices[index].texture = XMFLOAT2(1.0f, 0.0f);
-        m_vertices[index].color = XMFLOAT4(red, green, blue, 1.0f);
-        index++;
 
+int ParticleManager::GetOccludedParticleCount()
+{
+    return m_occludedParticles;
+}
 
-        //rain, long rectangle shape made of 2 triangles
 
-        m_particleSize = 0.010f;
-        // Bottom left.
-        m_vertices[index].position = XMFLOAT3(positionX - m_particleSize, (positionY - (m_particleSize * 16)), positionZ);
-        m_vertices[index].texture = XMFLOAT2(0.0f, 1.0f);
-        m_vertices[index].color = XMFLOAT4(red, green, blue, 1.0f);
-        index++;
+int ParticleManager::GetVisibleParticleCount()
+{
+    return m_visibleParticles;
+}
 
-        // Top left.
-        m_vertices[index].position = XMFLOAT3(positionX - m_particleSize, (positionY + (m_particleSize * 16)), positionZ);
-        m_vertices[index].texture = XMFLOAT2(0.0f, 0.0f);
-        m_vertices[index].color = XMFLOAT4(red, green, blue, 1.0f);
-        index++;
 
-        // Bottom right.
-        m_vertices[index].position = XMFLOAT3(positionX + m_particleSize, (positionY - (m_particleSize * 16)), positionZ);
-        m_vertices[index].texture = XMFLOAT2(1.0f, 1.0f);
-        m_vertices[index].color = XMFLOAT4(red, green, blue, 1.0f);
-        index++;
+bool ParticleManager::EnableDensityGrid(const XMFLOAT3& minimum, const XMFLOAT3& maximum, int resolutionX, int resolutionY, int resolutionZ)
+{
+    bool result;
 
-        // Bottom right.
-        m_vertices[index].position = XMFLOAT3(positionX + m_particleSize, (positionY - (m_particleSize * 16)), positionZ);
-        m_vertices[index].texture = XMFLOAT2(1.0f, 1.0f);
-        m_vertices[index].color = XMFLOAT4(red, green, blue, 1.0f);
-        index++;
+    if (!s_taskPool)
+    {
+        return false;
+    }
 
-        // Top left.
-        m_vertices[index].position = XMFLOAT3(positionX - m_particleSize, (positionY + (m_particleSize * 16)), positionZ);
-        m_vertices[index].texture = XMFLOAT2(0.0f, 0.0f);
-        m_vertices[index].color = XMFLOAT4(red, green, blue, 1.0f);
-        index++;
+    if (m_densityGrid)
+    {
+        m_densityGrid->Shutdown();
+        delete m_densityGrid;
+        m_densityGrid = nullptr;
+    }
 
-        // Top right.
-        m_vertices[index].position = XMFLOAT3(positionX + m_particleSize, (positionY + (m_particleSize * 16)), positionZ);
-        m_vertices[index].texture = XMFLOAT2(1.0f, 0.0f);
-        m_vertices[index].color = XMFLOAT4(red, green, blue, 1.0f);
-        index++;
+    m_densityGrid = new DensityGrid;
+    if (!m_densityGrid)
+    {
+        return false;
+    }
 
-        //fire uses basic square shape but with a large particle size
+    //one private grid for each thread that can take part in a ParallelFor
+    result = m_densityGrid->Initialize(minimum, maximum, resolutionX, resolutionY, resolutionZ, s_taskPool->GetThreadCount() + 1);
+    if (!result)
+    {
+        m_densityGrid->Shutdown();
+        delete m_densityGrid;
+        m_densityGrid = nullptr;
+        return false;
+    }
+    return true;
+}
 
-        m_particleSize = 0.20f;
-        // Bottom left.
-        m_vertices[index].position = XMFLOAT3(positionX - m_particleSize, (positionY - (m_particleSize * 1)), positionZ);
-        m_vertices[index].texture = XMFLOAT2(0.0f, 1.0f);
-        m_vertices[index].color = XMFLOAT4(red, green, blue, 1.0f);
-        index++;
 
-        // Top left.
-        m_vertices[index].position = XMFLOAT3(positionX - m_particleSize, (positionY + (m_particleSize * 1)), positionZ);
-        m_vertices[index].texture = XMFLOAT2(0.0f, 0.0f);
-        m_vertices[index].color = XMFLOAT4(red, green, blue, 1.0f);
-        index++;
+void ParticleManager::SetDensityWeights(DensitySource source, float densityWeight, float emissionWeight)
+{
+    m_densityWeights[source] = densityWeight;
+    m_emissionWeights[source] = emissionWeight;
+    return;
+}
 
-        // Bottom right.
-        m_vertices[index].position = XMFLOAT3(positionX + m_particleSize, (positionY - (m_particleSize * 1)), positionZ);
-        m_vertices[index].texture = XMFLOAT2(1.0f, 1.0f);
-        m_vertices[index].color = XMFLOAT4(red, green, blue, 1.0f);
-        index++;
 
-        // Bottom right.
-        m_vertices[index].position = XMFLOAT3(positionX + m_particleSize, (positionY - (m_particleSize * 1)), positionZ);
-        m_vertices[index].texture = XMFLOAT2(1.0f, 1.0f);
-        m_vertices[index].color = XMFLOAT4(red, green, blue, 1.0f);
-        index++;
+DensityGrid* ParticleManager::GetDensityGrid()
+{
+    return m_densityGrid;
+}
 
-        // Top left.
-        m_vertices[index].position = XMFLOAT3(positionX - m_particleSize, (positionY + (m_particleSize * 1)), positionZ);
-        m_vertices[index].texture = XMFLOAT2(0.0f, 0.0f);
-        m_vertices[index].color = XMFLOAT4(red, green, blue, 1.0f);
-        index++;
 
-        // Top right.
-        m_vertices[index].position = XMFLOAT3(positionX + m_particleSize, (positionY + (m_particleSize * 1)), positionZ);
-        m_vertices[index].texture = XMFLOAT2(1.0f, 0.0f);
-        m_vertices[index].color = XMFLOAT4(red, green, blue, 1.0f);
-        index++;
+int ParticleManager::AddCollisionMesh(const XMFLOAT3* vertices, int vertexCount, const unsigned int* indices, int indexCount, CollisionResponse response)
+{
+    return m_collisionWorld.AddMesh(vertices, vertexCount, indices, indexCount, response);
+}
 
-    // Vertex buffer description
-    vertexBufferDesc.Usage = D3D11_USAGE_DYNAMIC;
-    vertexBufferDesc.ByteWidth = sizeof(VertexType) * m_vertexCount;
-    vertexBufferDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
-    vertexBufferDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
-    vertexBufferDesc.MiscFlags = 0;
-    vertexBufferDesc.StructureByteStride = 0;
 
-    // Give the subresource structure a pointer to the vertex data.
-    vertexData.pSysMem = m_vertices;
-    vertexData.SysMemPitch = 0;
-    vertexData.SysMemSlicePitch = 0;
+bool ParticleManager::BuildSceneCollision()
+{
+    return m_collisionWorld.Build();
+}
 
-    result = device->CreateBuffer(&vertexBufferDesc, &vertexData, &m_vertexBuffer);
-    if (FAILED(result))
-    {
-        return false;
-    }
 
-    // Static index buffer description
-    indexBufferDesc.Usage = D3D11_USAGE_DEFAULT;
-    indexBufferDesc.ByteWidth = sizeof(unsigned long) * m_indexCount;
-    indexBufferDesc.BindFlags = D3D11_BIND_INDEX_BUFFER;
-    indexBufferDesc.CPUAccessFlags = 0;
-    indexBufferDesc.MiscFlags = 0;
-    indexBufferDesc.StructureByteStride = 0;
+void ParticleManager::ClearCollisionMeshes()
+{
+    m_collisionWorld.Clear();
+    m_collisionStarts.clear();
+    m_collisionEnds.clear();
+    m_collisionHits.clear();
+    m_collisionParticles.clear();
+    m_impacts.clear();
+    return;
+}
 
-    // Give the subresource structure a pointer to the index data.
-    indexData.pSysMem = indices;
-    indexData.SysMemPitch = 0;
-    indexData.SysMemSlicePitch = 0;
 
-    result = device->CreateBuffer(&indexBufferDesc, &indexData, &m_indexBuffer);
-    if (FAILED(result))
-    {
-        return false;
-    }
+int ParticleManager::GetImpactCount()
+{
+    return (int)m_impacts.size();
+}
 
-    delete[] indices;
-    indices = 0;
 
-    //set instance total count to the max number of particles
-    m_totalInstanceCount = m_maxParticles;
+const ParticleImpact* ParticleManager::GetImpacts()
+{
+    return m_impacts.empty() ? nullptr : &m_impacts[0];
+}
 
-    // Create the instance array.
-    m_Instances = new InstanceType[m_totalInstanceCount];
-    if (!m_Instances)
-    {
-        return false;
-    }
 
-    // Initialize vertex array to zeros at first.
-    memset(m_Instances, 0, (sizeof(InstanceType) * m_totalInstanceCount));
+void ParticleManager::SetSpawnQueueCapacity(int capacity, SpawnQueuePolicy policy)
+{
+    m_spawnQueueCapacity = capacity;
+    m_spawnQueuePolicy = policy;
+    return;
+}
 
-    // instance buffer description
-    instanceBufferDesc.Usage = D3D11_USAGE_DYNAMIC;
-    instanceBufferDesc.ByteWidth = sizeof(InstanceType) * m_totalInstanceCount;
-    instanceBufferDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
-    instanceBufferDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
-    instanceBufferDesc.MiscFlags = 0;
-    instanceBufferDesc.StructureByteStride = 0;
 
-    instanceData.pSysMem = m_Instances;
-    instanceData.SysMemPitch = 0;
-    instanceData.SysMemSlicePitch = 0;
+bool ParticleManager::QueueRing(const XMFLOAT3& position, int numberOfParticles)
+{
+    SpawnCommand command;
+
+    command.type = SPAWN_RING;
+    command.position = position;
+    command.count = numberOfParticles;
+    command.speed = 0.0f;
+    command.lifeTime = 0.0f;
+    command.color[0] = 1.0f;
+    command.color[1] = 1.0f;
+    command.color[2] = 1.0f;
+    return m_spawnQueue.Push(command);
+}
 
-    result = device->CreateBuffer(&instanceBufferDesc, &instanceData, &m_instanceBuffer);
-    if (FAILED(result))
-    {
-        return false;
-    }
-    return true;
+
+bool ParticleManager::QueueFire(const XMFLOAT3& position, int numberOfParticles)
+{
+    SpawnCommand command;
+
+    command.type = SPAWN_FIRE;
+    command.position = position;
+    command.count = numberOfParticles;
+    command.speed = 0.0f;
+    command.lifeTime = 0.0f;
+    command.color[0] = 1.0f;
+    command.color[1] = 1.0f;
+    command.color[2] = 1.0f;
+    return m_spawnQueue.Push(command);
 }
 
 
-void ParticleManager::ShutdownBuffers()
+bool ParticleManager::QueueBurst(const XMFLOAT3& position, int numberOfParticles, float speed, float lifeTime, const XMFLOAT3& color)
 {
-    if (m_instanceBuffer)
-    {
-        m_instanceBuffer->Release();
-        m_instanceBuffer = 0;
-    }
+    SpawnCommand command;
+
+    command.type = SPAWN_BURST;
+    command.position = position;
+    command.count = numberOfParticles;
+    command.speed = speed;
+    command.lifeTime = lifeTime;
+    command.color[0] = color.x;
+    command.color[1] = color.y;
+    command.color[2] = color.z;
+    return m_spawnQueue.Push(command);
+}
 
-    if (m_indexBuffer)
+
+SpawnCommandQueue* ParticleManager::GetSpawnQueue()
+{
+    return &m_spawnQueue;
+}
+
+
+void ParticleManager::SetFirePosition(const XMFLOAT3& position)
+{
+    m_firePosition = position;
+    return;
+}
+
+
+void ParticleManager::SetFireEnabled(bool enabled)
+{
+    m_fireEnabled = enabled;
+    return;
+}
+
+
+void ParticleManager::ResetEffect(EffectType effect)
+{
+    if (!m_particleList)
     {
-        m_indexBuffer->Release();
-        m_indexBuffer = 0;
+        return;
     }
 
-    if (m_vertexBuffer)
+    switch (effect)
     {
-        m_vertexBuffer->Release();
-        m_vertexBuffer = 0;
+    case EFFECT_RAIN:
+        FreeParticleList(&m_headOfRainAllocatedList, SLICE_RAIN);
+        if (!m_useAnalyticRain && !m_rainEmitter.dormant)
+        {
+            InitiateRainEffects();
+        }
+        break;
+    case EFFECT_FIRE:
+        FreeParticleList(&m_headOfFireAllocatedList, SLICE_FIRE);
+        m_fireInstanceCount = 0;
+        m_fireHistoryHead = 0;
+        m_fireHistoryCount = 0;
+        break;
+    case EFFECT_RING:
+        FreeParticleList(&m_headOfAllocatedList, SLICE_GENERAL);
+        break;
+    default:
+        break;
     }
-
     return;
 }
 
-void ParticleManager::UpdateParticles(float frameTime)
+
+bool ParticleManager::DefragmentParticles()
 {
-    Particle* currentNode = m_headOfAllocatedList;
+    Particle** heads[SLICE_COUNT];
+    int counts[SLICE_COUNT];
+    int total, start, copied;
+    bool result;
 
-    while (currentNode)
+    if (!m_particleList)
     {
-        //if particle is off the ground, increase y velocity by gravity constant
-        if (currentNode->positionY > 0.0f)
-        {
-            currentNode->velocityY += (m_gravityConstant * frameTime);
-        }
+        return false;
+    }
 
-        //update particles position due to velocity
-        MoveParticles(frameTime, currentNode);
-        currentNode->remainingLifeTime -= frameTime;
+    heads[SLICE_RAIN] = &m_headOfRainAllocatedList;
+    heads[SLICE_FIRE] = &m_headOfFireAllocatedList;
+    heads[SLICE_GENERAL] = &m_headOfAllocatedList;
 
-        if (currentNode->positionY < 0.0f)
+    total = 0;
+    for (auto slice = 0; slice < SLICE_COUNT; ++slice)
+    {
+        counts[slice] = 0;
+        for (auto currentNode = (*heads[slice]); currentNode; currentNode = currentNode->next)
         {
-            currentNode->positionY = 0.1f;
-
-            // change particle velocity to simulate bouncing off the ground, with some reduction in non-veritcal velocity
-            currentNode->velocityY = (currentNode->velocityY * -0.4f);
-            currentNode->velocityX = (currentNode->velocityX * 0.6f);
-            currentNode->velocityZ = (currentNode->velocityZ * 0.6f);
+            counts[slice]++;
         }
+        total += counts[slice];
+    }
 
-        currentNode = currentNode->next;
+    //the lists stay where they are until there is room to pack them
+    result = m_particleArena.Rebuild(counts);
+    if (!result)
+    {
+        return false;
     }
 
-    //update rain
-    currentNode = m_headOfRainAllocatedList;
-    while (currentNode)
+    //each list is copied out in its own order and back to the start of its slice, so walking a list walks memory forwards
+    m_defragmentParticles.resize(total);
+    copied = 0;
+    for (auto slice = 0; slice < SLICE_COUNT; ++slice)
     {
-        currentNode->velocityY += (m_gravityConstant * frameTime);
-        //update particles position due to velocity
-        MoveParticles(frameTime, currentNode);
-        currentNode = currentNode->next;
+        for (auto currentNode = (*heads[slice]); currentNode; currentNode = currentNode->next)
+        {
+            m_defragmentParticles[copied] = (*currentNode);
+            copied++;
+        }
     }
 
-    //update fire
-    currentNode = m_headOfFireAllocatedList;
-    while (currentNode)
+    copied = 0;
+    for (auto slice = 0; slice < SLICE_COUNT; ++slice)
     {
-        //note that fire particles are not affected by gravity constant
+        if (counts[slice] == 0)
+        {
+            continue;
+        }
 
-        //update particles position due to velocity
-        MoveParticles(frameTime, currentNode);
-        currentNode->remainingLifeTime -= frameTime;
-        currentNode = currentNode->next;
+        start = m_particleArena.GetSliceStart(slice);
+        memcpy(&m_particleList[start], &m_defragmentParticles[copied], sizeof(Particle) * counts[slice]);
+        for (auto i = 0; i < counts[slice] - 1; ++i)
+        {
+            m_particleList[start + i].next = &m_particleList[start + i + 1];
+        }
+        m_particleList[start + counts[slice] - 1].next = nullptr;
+        (*heads[slice]) = &m_particleList[start];
+        copied += counts[slice];
     }
+    return true;
 }
 
-void ParticleManager::MoveParticles(float frameTime, Particle* currentNode)
+
+void ParticleManager::EnableCompactParticles(int maxParticles)
 {
-    if (currentNode)
+    m_compactParticleCapacity = maxParticles;
+    return;
+}
+
+
+int ParticleManager::GetParticleStateMemory()
+{
+    int bytes = (m_maxParticles * (int)sizeof(Particle)) + m_particleArena.GetMemoryUsage();
+    if (m_compactParticles)
     {
-        currentNode->positionX = currentNode->positionX + (currentNode->velocityX * frameTime);
-        currentNode->positionY = currentNode->positionY + (currentNode->velocityY * frameTime);
-        currentNode->positionZ = currentNode->positionZ + (currentNode->velocityZ * frameTime);
+        bytes += m_compactParticles->GetMemoryUsage();
     }
+    return bytes;
 }
 
 
-void ParticleManager::KillParticles()
+void ParticleManager::EnableDormantEmitters(float maxDistance)
 {
-    //iterate through the allocated list and check for those to kill
-    //if kill, delete from allocated list, add to front of free list
-    Particle* currentNode = m_headOfAllocatedList;
-    Particle* tempNode = nullptr;
+    m_useDormantEmitters = true;
+    m_relevanceDistance = maxDistance;
+    return;
+}
 
-    //check head of node last to avoid the need to reassign head node
-    if (currentNode)
-    {
-        while (currentNode->next)
-        {
 
-            if (currentNode->next->remainingLifeTime < 0.0f)
-            {
-                tempNode = currentNode->next;
-                currentNode->next = tempNode->next;
+void ParticleManager::SetRelevanceCamera(const XMFLOAT4X4& viewProjection, const XMFLOAT3& cameraPosition)
+{
+    m_relevanceViewProjection = viewProjection;
+    m_relevanceCameraPosition = cameraPosition;
+    m_relevanceCameraSet = true;
+    return;
+}
 
-                //place in front of of free list
-                tempNode->next = m_headOfFreeList;
-                m_headOfFreeList = tempNode;
+
+bool ParticleManager::IsFireDormant()
+{
+    return m_fireEmitter.dormant;
+}
+
+
+bool ParticleManager::IsRainDormant()
+{
+    return m_rainEmitter.dormant;
+}
+
+
+void ParticleManager::EnableInstanceRing(int sizeInBytes)
+{
+    m_instanceRingSize = sizeInBytes;
+    return;
+}
+
+
+InstanceRingBuffer* ParticleManager::GetInstanceRing()
+{
+    return m_instanceRing;
+}
+
+
+int ParticleManager::GetMaxSnapshotSize()
+{
+    int size = sizeof(SnapshotHeader) + (m_maxParticles * (sizeof(Particle) + sizeof(int32_t))) + m_particleArena.GetStateSize();
+    if (m_compactParticles)
+    {
+        size += m_compactParticles->GetMaxStateSize();
+    }
+    return size;
+}
+
+
+bool ParticleManager::SaveSnapshot(void* buffer, int bufferSize, int* bytesWritten)
+{
+    SnapshotHeader header;
+    unsigned char* bytes = (unsigned char*)buffer;
+    int size;
+
+    if (!m_particleList)
+    {
+        return false;
+    }
+
+    memset(&header, 0, sizeof(header));
+    header.magic = SnapshotMagic;
+    header.version = SnapshotVersion;
+    header.maxParticles = m_maxParticles;
+    header.particleSize = sizeof(Particle);
+    header.headOfAllocatedList = GetParticleIndex(m_headOfAllocatedList);
+    header.headOfRainAllocatedList = GetParticleIndex(m_headOfRainAllocatedList);
+    header.headOfFireAllocatedList = GetParticleIndex(m_headOfFireAllocatedList);
+    header.randomState = m_randomState;
+    header.rainTime = m_rainTime;
+    header.firePosition[0] = m_firePosition.x;
+    header.firePosition[1] = m_firePosition.y;
+    header.firePosition[2] = m_firePosition.z;
+    header.fireDormantTime = m_fireEmitter.dormantTime;
+    header.rainDormantTime = m_rainEmitter.dormantTime;
+    header.defragmentTimer = m_defragmentTimer;
+    header.fireEnabled = m_fireEnabled ? 1 : 0;
+    header.fireDormant = m_fireEmitter.dormant ? 1 : 0;
+    header.rainDormant = m_rainEmitter.dormant ? 1 : 0;
+    header.hasCompactParticles = m_compactParticles ? 1 : 0;
+    header.compactStateSize = m_compactParticles ? m_compactParticles->GetStateSize() : 0;
+    header.arenaStateSize = m_particleArena.GetStateSize();
+
+    size = sizeof(header) + (m_maxParticles * (sizeof(Particle) + sizeof(int32_t))) + header.arenaStateSize + header.compactStateSize;
+    if (size > bufferSize)
+    {
+        return false;
+    }
+
+    //the pool is copied whole, free nodes included, so the lists come back exactly as they were. Pointers mean nothing
+    //outside this manager so the links are written separately as indices
+    memcpy(bytes, &header, sizeof(header));
+    bytes += sizeof(header);
+    memcpy(bytes, m_particleList, m_maxParticles * sizeof(Particle));
+    for (auto i = 0; i < m_maxParticles; ++i)
+    {
+        memset(bytes + (i * sizeof(Particle)) + offsetof(Particle, next), 0, sizeof(Particle*));
+    }
+    bytes += m_maxParticles * sizeof(Particle);
+    for (auto i = 0; i < m_maxParticles; ++i)
+    {
+        int32_t link = GetParticleIndex(m_particleList[i].next);
+        memcpy(bytes + (i * sizeof(int32_t)), &link, sizeof(int32_t));
+    }
+    bytes += m_maxParticles * sizeof(int32_t);
+    m_particleArena.SaveState(bytes);
+    bytes += header.arenaStateSize;
+    if (m_compactParticles)
+    {
+        m_compactParticles->SaveState(bytes);
+    }
+
+    (*bytesWritten) = size;
+    return true;
+}
+
+
+bool ParticleManager::RestoreSnapshot(const void* buffer, int bufferSize)
+{
+    SnapshotHeader header;
+    const unsigned char* bytes = (const unsigned char*)buffer;
+    const unsigned char* particles;
+    const unsigned char* arenaState;
+    const unsigned char* compactState;
+    std::vector<int32_t> links;
+    std::vector<int> particleSlices;
+    int32_t heads[3];
+    int headSlices[3];
+    long long size;
+    bool result;
+
+    if (!m_particleList || bufferSize < (int)sizeof(header))
+    {
+        return false;
+    }
+
+    memcpy(&header, bytes, sizeof(header));
+    if (header.magic != SnapshotMagic || header.version != SnapshotVersion)
+    {
+        return false;
+    }
+    if (header.maxParticles != m_maxParticles || header.particleSize != (int)sizeof(Particle))
+    {
+        return false;
+    }
+    if ((header.hasCompactParticles != 0) != (m_compactParticles != nullptr))
+    {
+        return false;
+    }
+    if (header.arenaStateSize != m_particleArena.GetStateSize() || header.compactStateSize < 0)
+    {
+        return false;
+    }
+    size = (long long)sizeof(header) + ((long long)m_maxParticles * (sizeof(Particle) + sizeof(int32_t))) + header.arenaStateSize + header.compactStateSize;
+    if (size > bufferSize)
+    {
+        return false;
+    }
+
+    particles = bytes + sizeof(header);
+    arenaState = particles + (m_maxParticles * (sizeof(Particle) + sizeof(int32_t)));
+    compactState = arenaState + header.arenaStateSize;
+
+    //nothing is changed until the links are known to be good
+    links.resize(m_maxParticles);
+    memcpy(links.data(), particles + (m_maxParticles * sizeof(Particle)), m_maxParticles * sizeof(int32_t));
+    heads[0] = header.headOfAllocatedList;
+    heads[1] = header.headOfRainAllocatedList;
+    heads[2] = header.headOfFireAllocatedList;
+    headSlices[0] = SLICE_GENERAL;
+    headSlices[1] = SLICE_RAIN;
+    headSlices[2] = SLICE_FIRE;
+    particleSlices.resize(m_maxParticles);
+    result = ValidateSnapshotLinks(links.data(), heads, headSlices, 3, particleSlices.data());
+    if (!result)
+    {
+        return false;
+    }
+    //the arena has to hand out exactly the particles on the lists, or a free particle could be given out twice
+    result = m_particleArena.ValidateState(arenaState, header.arenaStateSize, particleSlices.data());
+    if (!result)
+    {
+        return false;
+    }
+
+    //the compact pool checks its own block before changing anything, after it nothing can fail
+    if (m_compactParticles)
+    {
+        result = m_compactParticles->RestoreState(compactState, header.compactStateSize);
+        if (!result)
+        {
+            return false;
+        }
+    }
+    result = m_particleArena.RestoreState(arenaState, header.arenaStateSize);
+    if (!result)
+    {
+        return false;
+    }
+
+    memcpy(m_particleList, particles, m_maxParticles * sizeof(Particle));
+    for (auto i = 0; i < m_maxParticles; ++i)
+    {
+        m_particleList[i].next = (links[i] < 0) ? nullptr : &m_particleList[links[i]];
+    }
+
+    m_headOfAllocatedList = (header.headOfAllocatedList < 0) ? nullptr : &m_particleList[header.headOfAllocatedList];
+    m_headOfRainAllocatedList = (header.headOfRainAllocatedList < 0) ? nullptr : &m_particleList[header.headOfRainAllocatedList];
+    m_headOfFireAllocatedList = (header.headOfFireAllocatedList < 0) ? nullptr : &m_particleList[header.headOfFireAllocatedList];
+
+    //the fire count is not stored, it is the length of the fire list
+    m_fireInstanceCount = m_particleArena.GetLiveCount(SLICE_FIRE);
+    m_randomState = header.randomState;
+    m_rainTime = header.rainTime;
+    m_firePosition = XMFLOAT3(header.firePosition[0], header.firePosition[1], header.firePosition[2]);
+    m_fireEnabled = header.fireEnabled != 0;
+    m_fireEmitter.dormant = header.fireDormant != 0;
+    m_fireEmitter.dormantTime = header.fireDormantTime;
+    m_rainEmitter.dormant = header.rainDormant != 0;
+    m_rainEmitter.dormantTime = header.rainDormantTime;
+    m_defragmentTimer = header.defragmentTimer;
+
+    //the history belongs to the timeline that was left
+    m_fireHistoryHead = 0;
+    m_fireHistoryCount = 0;
+    m_impacts.clear();
+    return true;
+}
+
+
+bool ParticleManager::ValidateSnapshotLinks(const int32_t* links, const int32_t* heads, const int* headSlices, int headCount, int* particleSlices)
+{
+    for (auto i = 0; i < m_maxParticles; ++i)
+    {
+        if (links[i] < -1 || links[i] >= m_maxParticles)
+        {
+            return false;
+        }
+        particleSlices[i] = -1;
+    }
+
+    //every list is walked once, a particle reached twice means a cycle or two lists sharing a tail
+    for (auto i = 0; i < headCount; ++i)
+    {
+        if (heads[i] < -1 || heads[i] >= m_maxParticles)
+        {
+            return false;
+        }
+
+        for (auto index = heads[i]; index >= 0; index = links[index])
+        {
+            if (particleSlices[index] >= 0)
+            {
+                return false;
+            }
+            particleSlices[index] = headSlices[i];
+        }
+    }
+    return true;
+}
+
+
+void ParticleManager::SetRandomSeed(unsigned int seed)
+{
+    m_randomState = (seed != 0) ? seed : DefaultRandomSeed;
+    return;
+}
+
+
+void ParticleManager::SetGenericKernels(bool enabled)
+{
+    m_useGenericKernels = enabled;
+    return;
+}
+
+
+void ParticleManager::SetUpdateStrategy(UpdateStrategy strategy, int chunkSize)
+{
+    m_updateStrategy = strategy;
+    m_updateChunkSize = (strategy == UPDATE_PARALLEL) ? chunkSize : 0;
+    return;
+}
+
+
+bool ParticleManager::EnableStats(bool hardwareCounters)
+{
+    bool result;
+
+    DisableStats();
+
+    m_stats = new ParticleStats;
+    if (!m_stats)
+    {
+        return false;
+    }
+
+    result = m_stats->Initialize(hardwareCounters);
+    if (!result)
+    {
+        delete m_stats;
+        m_stats = nullptr;
+        return false;
+    }
+    return true;
+}
+
+
+void ParticleManager::DisableStats()
+{
+    if (m_stats)
+    {
+        m_stats->Shutdown();
+        delete m_stats;
+        m_stats = nullptr;
+    }
+    return;
+}
+
+
+ParticleStats* ParticleManager::GetStats()
+{
+    return m_stats;
+}
+
+
+void ParticleManager::BeginStage(ParticleStage stage)
+{
+    if (m_stats)
+    {
+        m_stats->BeginStage(stage);
+    }
+    return;
+}
+
+
+void ParticleManager::EndStage(ParticleStage stage)
+{
+    if (m_stats)
+    {
+        m_stats->EndStage(stage);
+    }
+    return;
+}
+
+
+void ParticleManager::MarkStageParallel(ParticleStage stage)
+{
+    if (m_stats && s_taskPool->GetThreadCount() > 0)
+    {
+        m_stats->MarkStageParallel(stage);
+    }
+    return;
+}
+
+
+void ParticleManager::CountAllocations(int allocated, int dropped)
+{
+    if (m_stats)
+    {
+        m_stats->AddAllocations(allocated, dropped);
+    }
+    return;
+}
+
+
+void ParticleManager::CountDroppedInstances(int dropped)
+{
+    if (m_stats)
+    {
+        m_stats->AddDroppedInstances(dropped);
+    }
+    return;
+}
+
+
+bool ParticleManager::EnableAutoTuner()
+{
+    bool result;
+
+    if (!s_taskPool)
+    {
+        return false;
+    }
+
+    DisableAutoTuner();
+
+    m_autoTuner = new ParticleAutoTuner;
+    if (!m_autoTuner)
+    {
+        return false;
+    }
+
+    result = m_autoTuner->Initialize(s_taskPool->GetThreadCount());
+    if (!result)
+    {
+        delete m_autoTuner;
+        m_autoTuner = nullptr;
+        return false;
+    }
+
+    ApplyTunerStrategies();
+    return true;
+}
+
+
+void ParticleManager::DisableAutoTuner()
+{
+    if (m_autoTuner)
+    {
+        m_autoTuner->Shutdown();
+        delete m_autoTuner;
+        m_autoTuner = nullptr;
+    }
+
+    m_updateStrategy = UPDATE_SERIAL;
+    m_updateChunkSize = 0;
+    if (m_sortStrategy != SORT_INSERTION && m_particleList)
+    {
+        SortParticleLists();
+    }
+    m_sortStrategy = SORT_INSERTION;
+    return;
+}
+
+
+ParticleAutoTuner* ParticleManager::GetAutoTuner()
+{
+    return m_autoTuner;
+}
+
+
+void ParticleManager::BeginTunedWork(TunedWork work)
+{
+    if (m_autoTuner)
+    {
+        m_autoTuner->BeginTiming(work);
+    }
+    return;
+}
+
+
+void ParticleManager::EndTunedWork(TunedWork work)
+{
+    if (m_autoTuner)
+    {
+        m_autoTuner->EndTiming(work);
+    }
+    return;
+}
+
+
+void ParticleManager::ApplyTunerStrategies()
+{
+    SortStrategy sortStrategy;
+
+    m_updateStrategy = m_autoTuner->GetUpdateStrategy();
+    m_updateChunkSize = m_autoTuner->GetChunkSize();
+
+    //insertion only keeps a list in order if it already is
+    sortStrategy = m_autoTuner->GetSortStrategy();
+    if (sortStrategy == SORT_INSERTION && m_sortStrategy != SORT_INSERTION)
+    {
+        SortParticleLists();
+    }
+    m_sortStrategy = sortStrategy;
+    return;
+}
+
+
+void ParticleManager::EnableVertexPulling()
+{
+    m_useVertexPulling = true;
+    return;
+}
+
+
+bool ParticleManager::IsVertexPulling()
+{
+    return m_useVertexPulling;
+}
+
+
+void ParticleManager::EnableTextureAtlas(int atlasSize, int maxTextureSize)
+{
+    m_buildTextureAtlas = true;
+    m_atlasSize = atlasSize;
+    m_atlasMaxTextureSize = maxTextureSize;
+    return;
+}
+
+
+ID3D11ShaderResourceView * ParticleManager::GetDefaultTexture()
+{
+    return m_textureCacheAcquired ? m_textureCache->GetTexture(m_defaultTexture) : nullptr;
+}
+
+ID3D11ShaderResourceView * ParticleManager::GetRainTexture()
+{
+    return m_textureCacheAcquired ? m_textureCache->GetTexture(m_rainTexture) : nullptr;
+}
+
+ID3D11ShaderResourceView * ParticleManager::GetFireTexture()
+{
+    return m_textureCacheAcquired ? m_textureCache->GetTexture(m_fireTexture) : nullptr;
+}
+
+ID3D11ShaderResourceView * ParticleManager::GetTextureAtlas()
+{
+    return m_textureCacheAcquired ? m_textureCache->GetAtlasTexture() : nullptr;
+}
+
+bool ParticleManager::GetDefaultAtlasRegion(XMFLOAT4* uvRect)
+{
+    return m_textureCacheAcquired && m_textureCache->GetAtlasRegion(m_defaultTexture, uvRect);
+}
+
+bool ParticleManager::GetRainAtlasRegion(XMFLOAT4* uvRect)
+{
+    return m_textureCacheAcquired && m_textureCache->GetAtlasRegion(m_rainTexture, uvRect);
+}
+
+bool ParticleManager::GetFireAtlasRegion(XMFLOAT4* uvRect)
+{
+    return m_textureCacheAcquired && m_textureCache->GetAtlasRegion(m_fireTexture, uvRect);
+}
+
+bool ParticleManager::AreTexturesLoaded()
+{
+    return m_textureCacheAcquired && m_textureCache->IsLoaded(m_defaultTexture) && m_textureCache->IsLoaded(m_rainTexture) && m_textureCache->IsLoaded(m_fireTexture);
+}
+
+bool ParticleManager::HaveTexturesFailed()
+{
+    return m_textureCacheAcquired && (m_textureCache->HasFailed(m_defaultTexture) || m_textureCache->HasFailed(m_rainTexture) || m_textureCache->HasFailed(m_fireTexture));
+}
+
+int ParticleManager::GetIndexCount()
+{
+    return m_indexCount;
+}
+
+int ParticleManager::GetVertexCount()
+{
+    return m_vertexCount;
+}
+
+int ParticleManager::GetRainInstanceCount()
+{
+    return m_rainRenderCount;
+}
+
+int ParticleManager::GetFireInstanceCount()
+{
+    return m_fireRenderCount;
+}
+
+
+int ParticleManager::GetTotalInstanceCount()
+{
+    return m_totalInstanceCount;
+}
+
+int ParticleManager::GetActiveInstanceCount()
+{
+    return m_activeParticles;
+}
+
+bool ParticleManager::AcquireTextures(ID3D11Device * device, const char * defaultTextureFilename, const char * rainTextureFilename, const char * fireTextureFilename)
+{
+    bool result;
+    int cacheIndex = -1;
+
+    //textures only work with the device that created them, so every device gets a cache of its own
+    for (auto i = 0; i < (int)s_textureCaches.size(); ++i)
+    {
+        if (s_textureCaches[i].device == device)
+        {
+            cacheIndex = i;
+        }
+    }
+
+    if (cacheIndex < 0)
+    {
+        SharedTextureCache sharedCache;
+        sharedCache.device = device;
+        sharedCache.users = 0;
+        sharedCache.cache = new TextureCache;
+        if (!sharedCache.cache)
+        {
+            return false;
+        }
+        result = sharedCache.cache->Initialize(device);
+        if (!result)
+        {
+            delete sharedCache.cache;
+            return false;
+        }
+        cacheIndex = (int)s_textureCaches.size();
+        s_textureCaches.push_back(sharedCache);
+    }
+    s_textureCaches[cacheIndex].users++;
+    m_textureCache = s_textureCaches[cacheIndex].cache;
+    m_textureCacheAcquired = true;
+
+    //the first manager on the device to ask for the atlas decides its sizes, it then covers every manager's textures
+    if (m_buildTextureAtlas && !m_textureCache->IsAtlasEnabled())
+    {
+        m_textureCache->SetAtlasEnabled(true, m_atlasSize, m_atlasMaxTextureSize);
+    }
+
+    m_fireTexture = m_textureCache->AcquireTexture(fireTextureFilename);
+    m_defaultTexture = m_textureCache->AcquireTexture(defaultTextureFilename);
+    m_rainTexture = m_textureCache->AcquireTexture(rainTextureFilename);
+    if (m_fireTexture < 0 || m_defaultTexture < 0 || m_rainTexture < 0)
+    {
+        return false;
+    }
+
+    return true;
+}
+
+void ParticleManager::ReleaseTextures()
+{
+    if (!m_textureCacheAcquired)
+    {
+        return;
+    }
+    m_textureCacheAcquired = false;
+
+    m_textureCache->ReleaseTexture(m_defaultTexture);
+    m_textureCache->ReleaseTexture(m_rainTexture);
+    m_textureCache->ReleaseTexture(m_fireTexture);
+    m_defaultTexture = -1;
+    m_rainTexture = -1;
+    m_fireTexture = -1;
+
+    //last manager on the device shuts its cache down
+    for (auto i = 0; i < (int)s_textureCaches.size(); ++i)
+    {
+        if (s_textureCaches[i].cache != m_textureCache)
+        {
+            continue;
+        }
+
+        s_textureCaches[i].users--;
+        if (s_textureCaches[i].users <= 0)
+        {
+            m_textureCache->Shutdown();
+            delete m_textureCache;
+            s_textureCaches.erase(s_textureCaches.begin() + i);
+        }
+        break;
+    }
+    m_textureCache = nullptr;
+
+   return;
+}
+
+
+bool ParticleManager::InitializeParticleSystem()
+{
+    // Set the default size of Particles
+    m_particleSize = 0.10f;
+
+    // Set the maximum number of particles allowed
+    m_maxParticles = 10000;
+    m_activeParticles = 0;
+
+    m_fireInstanceCount = 0;
+    m_rainTime = 0.0;
+
+    //effect parameters, built in defaults first then anything the effect library overrides
+    WorldEffectDesc worldEffect;
+    RainEffectDesc rainEffect;
+    EffectLibrary::GetDefaultWorld(&worldEffect);
+    EffectLibrary::GetDefaultRain(&rainEffect);
+    EffectLibrary::GetDefaultFire(&m_fireEffect);
+    EffectLibrary::GetDefaultRing(&m_ringEffect);
+
+    m_rainInstanceCount = rainEffect.dropCount;
+    m_rainSplashParticles = rainEffect.splashParticles;
+    m_rainSpawnInHeight = rainEffect.spawnHeight;
+    m_rainSpawnYVelocity = rainEffect.spawnYVelocity;
+    for (auto i = 0; i < 4; ++i)
+    {
+        m_rainBoxCoordinates[i] = rainEffect.box[i];
+    }
+
+    //set the value of gravity
+    m_gravityConstant = worldEffect.gravity;
+
+    if (m_useEffectLibrary)
+    {
+        ApplyEffectLibrary(true);
+    }
+
+    if (m_useAnalyticRain)
+    {
+        m_rainInstanceCount = m_analyticRainDropCount;
+    }
+
+    if (m_useFireInstancing)
+    {
+        m_fireCopies = new EffectCopy[m_maxFireCopies];
+        m_fireCopyOrder = new int[m_maxFireCopies];
+        if (!m_fireCopies || !m_fireCopyOrder)
+        {
+            return false;
+        }
+        m_fireCopyCount = 0;
+        m_fireHistoryHead = 0;
+        m_fireHistoryCount = 0;
+        m_recordFireHistory = false;
+    }
+
+    if (m_compactParticleCapacity > 0)
+    {
+        m_compactParticles = new CompactParticlePool;
+        if (!m_compactParticles)
+        {
+            return false;
+        }
+
+        if (!m_compactParticles->Initialize(m_compactParticleCapacity))
+        {
+            return false;
+        }
+    }
+
+    //the batch holds everything one drain can return so draining never allocates
+    if (!m_spawnQueue.Initialize(m_spawnQueueCapacity, m_spawnQueuePolicy))
+    {
+        return false;
+    }
+    m_spawnBatch.resize(m_spawnQueue.GetMaxDrainCount());
+
+    //List heads set to null
+    m_headOfAllocatedList = nullptr;
+    m_headOfRainAllocatedList = nullptr;
+    m_headOfFireAllocatedList = nullptr;
+
+
+    // Create the particle list.
+    m_particleList = new Particle[m_maxParticles];
+    if (!m_particleList)
+    {
+        return false;
+    }
+    memset(m_particleList, 0, sizeof(Particle) * m_maxParticles);
+
+    //free particles are tracked by the arena, a list only ever links particles of its own slice
+    if (!m_particleArena.Initialize(m_maxParticles, SLICE_COUNT))
+    {
+        return false;
+    }
+    m_defragmentTimer = 0.0f;
+
+    return true;
+}
+
+void ParticleManager::ShutdownParticleSystem()
+{
+    m_spawnQueue.Shutdown();
+    std::vector<SpawnCommand>().swap(m_spawnBatch);
+
+    if (m_compactParticles)
+    {
+        m_compactParticles->Shutdown();
+        delete m_compactParticles;
+        m_compactParticles = nullptr;
+    }
+
+    if (m_fireCopies)
+    {
+        delete[] m_fireCopies;
+        m_fireCopies = 0;
+    }
+    if (m_fireCopyOrder)
+    {
+        delete[] m_fireCopyOrder;
+        m_fireCopyOrder = 0;
+    }
+    ClearFireInstances();
+
+    if (m_particleList)
+    {
+        delete[] m_particleList;
+        m_particleList = 0;
+    }
+    m_particleArena.Shutdown();
+    std::vector<Particle>().swap(m_defragmentParticles);
+    return;
+}
+
+
+bool ParticleManager::InitializeBuffers(ID3D11Device* device)
+{
+    D3D11_BUFFER_DESC instanceBufferDesc;
+    D3D11_SUBRESOURCE_DATA instanceData;
+    HRESULT result;
+    bool initialized;
+
+    //vertex pulling builds the quads in the vertex shader so there is no vertex or index buffer, and a headless
+    //manager draws nothing at all
+    if (m_useVertexPulling || !device)
+    {
+        m_vertexCount = 0;
+        m_indexCount = 0;
+    }
+    else
+    {
+        initialized = InitializeQuadBuffers(device);
+        if (!initialized)
+        {
+            return false;
+        }
+    }
+
+    //set instance total count to the max number of particles, analytic rain and compact particles do not come from the pool so they need their own space
+    m_totalInstanceCount = m_maxParticles + m_compactParticleCapacity;
+    if (m_useAnalyticRain)
+    {
+        m_totalInstanceCount += m_rainInstanceCount;
+    }
+
+    // every fire copy past the first needs room for a steady state fire, with some slack for the lifetime jitter
+    if (m_useFireInstancing && m_maxFireCopies > 1)
+    {
+        int fireEstimate = (int)ceilf(m_fireEffect.particlesPerSecond * (m_fireEffect.baseLifeTime + m_fireEffect.lifeTimeJitter) * 1.1f);
+        m_totalInstanceCount += (m_maxFireCopies - 1) * fireEstimate;
+    }
+
+    // Create the instance array.
+    m_Instances = new InstanceType[m_totalInstanceCount];
+    if (!m_Instances)
+    {
+        return false;
+    }
+
+    // Initialize vertex array to zeros at first.
+    memset(m_Instances, 0, (sizeof(InstanceType) * m_totalInstanceCount));
+
+    if (!device)
+    {
+        return true;
+    }
+
+    if (m_useVertexPulling)
+    {
+        return m_billboardBuffer.Initialize(device, m_totalInstanceCount);
+    }
+
+    // instance buffer description
+    instanceBufferDesc.Usage = D3D11_USAGE_DYNAMIC;
+    instanceBufferDesc.ByteWidth = sizeof(InstanceType) * m_totalInstanceCount;
+    instanceBufferDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+    instanceBufferDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+    instanceBufferDesc.MiscFlags = 0;
+    instanceBufferDesc.StructureByteStride = 0;
+
+    instanceData.pSysMem = m_Instances;
+    instanceData.SysMemPitch = 0;
+    instanceData.SysMemSlicePitch = 0;
+
+    result = device->CreateBuffer(&instanceBufferDesc, &instanceData, &m_instanceBuffer);
+    if (FAILED(result))
+    {
+        return false;
+    }
+    return true;
+}
+
+
+bool ParticleManager::InitializeQuadBuffers(ID3D11Device* device)
+{
+    D3D11_BUFFER_DESC vertexBufferDesc, indexBufferDesc;
+    D3D11_SUBRESOURCE_DATA vertexData, indexData;
+    HRESULT result;
+
+
+    // Max vertex is set to 6 times the number of different vertex setups
+    m_vertexCount = 18;
+    m_indexCount = m_vertexCount;
+
+    // the quads never change after creation so the cpu copies only live until the buffers are made
+    VertexType* vertices = new VertexType[m_vertexCount];
+    if (!vertices)
+    {
+        return false;
+    }
+
+    unsigned short* indices = new unsigned short[m_indexCount];
+    if (!indices)
+    {
+        delete[] vertices;
+        return false;
+    }
+
+    memset(vertices, 0, (sizeof(VertexType) * m_vertexCount));
+
+    // Initialize the index array.
+    for (auto i = 0; i < m_indexCount; i++)
+    {
+        indices[i] = (unsigned short)i;
+    }
+
+    //default values should not be used as per instance data will replace it per frame
+    float positionX = 0.0f;
+    float positionY = 0.0f;
+    float positionZ = 0.0f;
+    float red = 0.5f;
+    float green = 0.5f;
+    float blue = 0.5f;
+    int index = 0;
+
+    // default particles, currently used be rain droplets
+    m_particleSize = 0.015f;
+        
+        // Bottom left.
+        vertices[index].position = XMFLOAT3(positionX - m_particleSize, (positionY - m_particleSize), positionZ);
+        vertices[index].texture = XMFLOAT2(0.0f, 1.0f);
+        vertices[index].color = XMFLOAT4(red, green, blue, 1.0f);
+        index++;
+
+        // Top left.
+        vertices[index].position = XMFLOAT3(positionX - m_particleSize, (positionY + m_particleSize), positionZ);
+        vertices[index].texture = XMFLOAT2(0.0f, 0.0f);
+        vertices[index].color = XMFLOAT4(red,green, blue, 1.0f);
+        index++;
+
+        // Bottom right.
+        vertices[index].position = XMFLOAT3(positionX + m_particleSize, (positionY - m_particleSize), positionZ);
+        vertices[index].texture = XMFLOAT2(1.0f, 1.0f);
+        vertices[index].color = XMFLOAT4(red, green, blue, 1.0f);
+        index++;
+
+        // Bottom right.
+        vertices[index].position = XMFLOAT3(positionX + m_particleSize, (positionY - m_particleSize), positionZ);
+        vertices[index].texture = XMFLOAT2(1.0f, 1.0f);
+        vertices[index].color = XMFLOAT4(red, green, blue, 1.0f);
+        index++;
+
+        // Top left.
+        vertices[index].position = XMFLOAT3(positionX - m_particleSize, (positionY + m_particleSize), positionZ);
+        vertices[index].texture = XMFLOAT2(0.0f, 0.0f);
+        vertices[index].color = XMFLOAT4(red, green, blue, 1.0f);
+        index++;
+
+        // Top right.
+        vertices[index].position = XMFLOAT3(positionX + m_particleSize, (positionY + m_particleSize), positionZ);
+        vertices[index].texture = XMFLOAT2(1.0f, 0.0f);
+        vertices[index].color = XMFLOAT4(red, green, blue, 1.0f);
+        index++;
+
+
+        //rain, long rectangle shape made of 2 triangles
+
+        m_particleSize = 0.010f;
+        // Bottom left.
+        vertices[index].position = XMFLOAT3(positionX - m_particleSize, (positionY - (m_particleSize * 16)), positionZ);
+        vertices[index].texture = XMFLOAT2(0.0f, 1.0f);
+        vertices[index].color = XMFLOAT4(red, green, blue, 1.0f);
+        index++;
+
+        // Top left.
+        vertices[index].position = XMFLOAT3(positionX - m_particleSize, (positionY + (m_particleSize * 16)), positionZ);
+        vertices[index].texture = XMFLOAT2(0.0f, 0.0f);
+        vertices[index].color = XMFLOAT4(red, green, blue, 1.0f);
+        index++;
+
+        // Bottom right.
+        vertices[index].position = XMFLOAT3(positionX + m_particleSize, (positionY - (m_particleSize * 16)), positionZ);
+        vertices[index].texture = XMFLOAT2(1.0f, 1.0f);
+        vertices[index].color = XMFLOAT4(red, green, blue, 1.0f);
+        index++;
+
+        // Bottom right.
+        vertices[index].position = XMFLOAT3(positionX + m_particleSize, (positionY - (m_particleSize * 16)), positionZ);
+        vertices[index].texture = XMFLOAT2(1.0f, 1.0f);
+        vertices[index].color = XMFLOAT4(red, green, blue, 1.0f);
+        index++;
+
+        // Top left.
+        vertices[index].position = XMFLOAT3(positionX - m_particleSize, (positionY + (m_particleSize * 16)), positionZ);
+        vertices[index].texture = XMFLOAT2(0.0f, 0.0f);
+        vertices[index].color = XMFLOAT4(red, green, blue, 1.0f);
+        index++;
+
+        // Top right.
+        vertices[index].position = XMFLOAT3(positionX + m_particleSize, (positionY + (m_particleSize * 16)), positionZ);
+        vertices[index].texture = XMFLOAT2(1.0f, 0.0f);
+        vertices[index].color = XMFLOAT4(red, green, blue, 1.0f);
+        index++;
+
+        //fire uses basic square shape but with a large particle size
+
+        m_particleSize = 0.20f;
+        // Bottom left.
+        vertices[index].position = XMFLOAT3(positionX - m_particleSize, (positionY - (m_particleSize * 1)), positionZ);
+        vertices[index].texture = XMFLOAT2(0.0f, 1.0f);
+        vertices[index].color = XMFLOAT4(red, green, blue, 1.0f);
+        index++;
+
+        // Top left.
+        vertices[index].position = XMFLOAT3(positionX - m_particleSize, (positionY + (m_particleSize * 1)), positionZ);
+        vertices[index].texture = XMFLOAT2(0.0f, 0.0f);
+        vertices[index].color = XMFLOAT4(red, green, blue, 1.0f);
+        index++;
+
+        // Bottom right.
+        vertices[index].position = XMFLOAT3(positionX + m_particleSize, (positionY - (m_particleSize * 1)), positionZ);
+        vertices[index].texture = XMFLOAT2(1.0f, 1.0f);
+        vertices[index].color = XMFLOAT4(red, green, blue, 1.0f);
+        index++;
+
+        // Bottom right.
+        vertices[index].position = XMFLOAT3(positionX + m_particleSize, (positionY - (m_particleSize * 1)), positionZ);
+        vertices[index].texture = XMFLOAT2(1.0f, 1.0f);
+        vertices[index].color = XMFLOAT4(red, green, blue, 1.0f);
+        index++;
+
+        // Top left.
+        vertices[index].position = XMFLOAT3(positionX - m_particleSize, (positionY + (m_particleSize * 1)), positionZ);
+        vertices[index].texture = XMFLOAT2(0.0f, 0.0f);
+        vertices[index].color = XMFLOAT4(red, green, blue, 1.0f);
+        index++;
+
+        // Top right.
+        vertices[index].position = XMFLOAT3(positionX + m_particleSize, (positionY + (m_particleSize * 1)), positionZ);
+        vertices[index].texture = XMFLOAT2(1.0f, 0.0f);
+        vertices[index].color = XMFLOAT4(red, green, blue, 1.0f);
+        index++;
+
+    // Vertex buffer description
+    vertexBufferDesc.Usage = D3D11_USAGE_IMMUTABLE;
+    vertexBufferDesc.ByteWidth = sizeof(VertexType) * m_vertexCount;
+    vertexBufferDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+    vertexBufferDesc.CPUAccessFlags = 0;
+    vertexBufferDesc.MiscFlags = 0;
+    vertexBufferDesc.StructureByteStride = 0;
+
+    // Give the subresource structure a pointer to the vertex data.
+    vertexData.pSysMem = vertices;
+    vertexData.SysMemPitch = 0;
+    vertexData.SysMemSlicePitch = 0;
+
+    result = device->CreateBuffer(&vertexBufferDesc, &vertexData, &m_vertexBuffer);
+    delete[] vertices;
+    vertices = 0;
+    if (FAILED(result))
+    {
+        delete[] indices;
+        return false;
+    }
+
+    // Static index buffer description
+    indexBufferDesc.Usage = D3D11_USAGE_IMMUTABLE;
+    indexBufferDesc.ByteWidth = sizeof(unsigned short) * m_indexCount;
+    indexBufferDesc.BindFlags = D3D11_BIND_INDEX_BUFFER;
+    indexBufferDesc.CPUAccessFlags = 0;
+    indexBufferDesc.MiscFlags = 0;
+    indexBufferDesc.StructureByteStride = 0;
+
+    // Give the subresource structure a pointer to the index data.
+    indexData.pSysMem = indices;
+    indexData.SysMemPitch = 0;
+    indexData.SysMemSlicePitch = 0;
+
+    result = device->CreateBuffer(&indexBufferDesc, &indexData, &m_indexBuffer);
+    delete[] indices;
+    indices = 0;
+    if (FAILED(result))
+    {
+        return false;
+    }
+    return true;
+}
+
+
+void ParticleManager::ShutdownBuffers()
+{
+    m_billboardBuffer.Shutdown();
+
+    if (m_Instances)
+    {
+        delete [] m_Instances;
+        m_Instances = 0;
+    }
+
+    if (m_instanceBuffer)
+    {
+        m_instanceBuffer->Release();
+        m_instanceBuffer = 0;
+    }
+
+    if (m_indexBuffer)
+    {
+        m_indexBuffer->Release();
+        m_indexBuffer = 0;
+    }
+
+    if (m_vertexBuffer)
+    {
+        m_vertexBuffer->Release();
+        m_vertexBuffer = 0;
+    }
+
+    return;
+}
+
+void ParticleManager::UpdateParticles(float frameTime)
+{
+    UpdateGeneralParticles(frameTime);
+    RunParticleKernel(EFFECT_RAIN, SLICE_RAIN, m_headOfRainAllocatedList, frameTime);
+    RunParticleKernel(EFFECT_FIRE, SLICE_FIRE, m_headOfFireAllocatedList, frameTime);
+}
+
+void ParticleManager::UpdateGeneralParticles(float frameTime)
+{
+    if (m_compactParticles)
+    {
+        m_compactParticles->Update(frameTime, m_gravityConstant);
+    }
+
+    RunParticleKernel(EFFECT_RING, SLICE_GENERAL, m_headOfAllocatedList, frameTime);
+}
+
+void ParticleManager::RunParticleKernel(EffectType effect, ParticleSlice slice, Particle* headNode, float frameTime)
+{
+    ParticleKernelParams params;
+
+    params.frameTime = frameTime;
+    params.gravity = m_gravityConstant;
+    params.smokeLifeTime = m_fireEffect.smokeLifeTime;
+    params.smokeColor[0] = m_fireEffect.smokeColor[0];
+    params.smokeColor[1] = m_fireEffect.smokeColor[1];
+    params.smokeColor[2] = m_fireEffect.smokeColor[2];
+
+    if (m_updateStrategy == UPDATE_PARALLEL && m_updateChunkSize > 0 && headNode)
+    {
+        RunParticleKernelChunks(effect, slice, params);
+        return;
+    }
+    RunParticleKernelOnList(effect, headNode, params);
+}
+
+void ParticleManager::RunParticleKernelOnList(EffectType effect, Particle* headNode, const ParticleKernelParams& params)
+{
+    if (m_useGenericKernels)
+    {
+        UpdateParticleGenericKernel(headNode, params, s_genericKernelConfigs[effect]);
+    }
+    else if (s_particleKernels[effect])
+    {
+        s_particleKernels[effect](headNode, params);
+    }
+}
+
+void ParticleManager::RunParticleKernelOnRange(EffectType effect, int start, int count, const ParticleKernelParams& params)
+{
+    if (m_useGenericKernels)
+    {
+        UpdateParticleGenericRangeKernel(&m_particleList[start], count, params, s_genericKernelConfigs[effect]);
+    }
+    else if (s_particleRangeKernels[effect])
+    {
+        s_particleRangeKernels[effect](&m_particleList[start], count, params);
+    }
+}
+
+void ParticleManager::RunParticleKernelChunks(EffectType effect, ParticleSlice slice, const ParticleKernelParams& params)
+{
+    // the slice holds exactly the list's particles, so the chunks come from its blocks without walking the list. The
+    // particles freed inside the blocks are dead and get updated too, every field a kernel touches is set again when
+    // the slot is handed out
+    m_particleArena.GetSliceRanges(slice, m_updateChunkSize, &m_kernelChunkStarts, &m_kernelChunkCounts);
+
+    if (m_kernelChunkStarts.size() == 1)
+    {
+        RunParticleKernelOnRange(effect, m_kernelChunkStarts[0], m_kernelChunkCounts[0], params);
+    }
+    else if (m_kernelChunkStarts.size() > 1)
+    {
+        MarkStageParallel(STAGE_UPDATE);
+        s_taskPool->ParallelFor((int)m_kernelChunkStarts.size(), [this, effect, &params](int chunk)
+        {
+            RunParticleKernelOnRange(effect, m_kernelChunkStarts[chunk], m_kernelChunkCounts[chunk], params);
+        });
+    }
+}
+
+void ParticleManager::MoveParticles(float frameTime, Particle* currentNode)
+{
+    if (currentNode)
+    {
+        currentNode->positionX = currentNode->positionX + (currentNode->velocityX * frameTime);
+        currentNode->positionY = currentNode->positionY + (currentNode->velocityY * frameTime);
+        currentNode->positionZ = currentNode->positionZ + (currentNode->velocityZ * frameTime);
+    }
+}
+
+
+void ParticleManager::BeginSceneCollision()
+{
+    Particle* currentNode = nullptr;
+    const CompactParticle* compactParticles;
+
+    m_collisionStarts.clear();
+    m_collisionParticles.clear();
+
+    for (currentNode = m_headOfRainAllocatedList; currentNode; currentNode = currentNode->next)
+    {
+        m_collisionParticles.push_back(currentNode);
+        m_collisionStarts.push_back(XMFLOAT3(currentNode->positionX, currentNode->positionY, currentNode->positionZ));
+    }
+    m_collisionRainCount = (int)m_collisionParticles.size();
+
+    //an instanced fire is simulated around the origin and only placed by its copies, its particles are not where the
+    //scene is so they are left out
+    currentNode = m_useFireInstancing ? nullptr : m_headOfFireAllocatedList;
+    for (; currentNode; currentNode = currentNode->next)
+    {
+        m_collisionParticles.push_back(currentNode);
+        m_collisionStarts.push_back(XMFLOAT3(currentNode->positionX, currentNode->positionY, currentNode->positionZ));
+    }
+    m_collisionFireCount = (int)m_collisionParticles.size() - m_collisionRainCount;
+
+    for (currentNode = m_headOfAllocatedList; currentNode; currentNode = currentNode->next)
+    {
+        m_collisionParticles.push_back(currentNode);
+        m_collisionStarts.push_back(XMFLOAT3(currentNode->positionX, currentNode->positionY, currentNode->positionZ));
+    }
+
+    // the compact pool only grows by appending until the next Kill, so its first particles keep their indices
+    m_collisionCompactCount = 0;
+    if (m_compactParticles)
+    {
+        compactParticles = m_compactParticles->GetParticles();
+        m_collisionCompactCount = m_compactParticles->GetCount();
+        for (auto i = 0; i < m_collisionCompactCount; ++i)
+        {
+            m_collisionStarts.push_back(XMFLOAT3(compactParticles[i].positionX, compactParticles[i].positionY, compactParticles[i].positionZ));
+        }
+    }
+    return;
+}
+
+
+void ParticleManager::ResolveSceneCollisions()
+{
+    Particle* particle;
+    const CompactParticle* compactParticles = nullptr;
+    XMFLOAT3 position, normal, velocity;
+    CollisionResponse response;
+    ImpactParticleType particleType;
+    int listCount, segmentCount, batchCount, triangle, index;
+
+    listCount = (int)m_collisionParticles.size();
+    segmentCount = listCount + m_collisionCompactCount;
+    if (segmentCount == 0)
+    {
+        return;
+    }
+
+    m_collisionEnds.resize(segmentCount);
+    m_collisionHits.resize(segmentCount);
+    for (auto i = 0; i < listCount; ++i)
+    {
+        particle = m_collisionParticles[i];
+        m_collisionEnds[i] = XMFLOAT3(particle->positionX, particle->positionY, particle->positionZ);
+    }
+    if (m_collisionCompactCount > 0)
+    {
+        compactParticles = m_compactParticles->GetParticles();
+        for (auto i = 0; i < m_collisionCompactCount; ++i)
+        {
+            m_collisionEnds[listCount + i] = XMFLOAT3(compactParticles[i].positionX, compactParticles[i].positionY, compactParticles[i].positionZ);
+        }
+    }
+
+    // the queries only read the tree, so batches of segments are spread over the task pool
+    batchCount = (segmentCount + CollisionBatchSize - 1) / CollisionBatchSize;
+    if (batchCount > 1)
+    {
+        MarkStageParallel(STAGE_COLLISION);
+    }
+    s_taskPool->ParallelFor(batchCount, [this, segmentCount](int batch)
+    {
+        int first = batch * CollisionBatchSize;
+        int count = (segmentCount - first < CollisionBatchSize) ? segmentCount - first : CollisionBatchSize;
+        m_collisionWorld.IntersectSegments(&m_collisionStarts[first], &m_collisionEnds[first], count, &m_collisionHits[first]);
+    });
+
+    for (auto i = 0; i < segmentCount; ++i)
+    {
+        triangle = m_collisionHits[i].triangle;
+        if (triangle < 0)
+        {
+            continue;
+        }
+
+        GetCollisionPoint(i, &position, &normal);
+        response = m_collisionWorld.GetTriangleResponse(triangle);
+
+        //rain splashes on anything it hits and starts falling again, the same as on the ground
+        if (i < m_collisionRainCount)
+        {
+            particle = m_collisionParticles[i];
+            AddImpact(position, normal, IMPACT_RAIN, triangle);
+            MakeRingEffect(position, m_rainSplashParticles);
+
+            particle->positionY = m_rainSpawnInHeight;
+            particle->velocityY = m_rainSpawnYVelocity;
+            continue;
+        }
+
+        particleType = (i < m_collisionRainCount + m_collisionFireCount) ? IMPACT_FIRE : IMPACT_GENERAL;
+        AddImpact(position, normal, particleType, triangle);
+
+        if (i < listCount)
+        {
+            particle = m_collisionParticles[i];
+            if (response == COLLISION_KILL)
+            {
+                //removed by the next KillParticles
+                particle->remainingLifeTime = -1.0f;
+                continue;
+            }
+
+            velocity = XMFLOAT3(particle->velocityX, particle->velocityY, particle->velocityZ);
+            ReflectVelocity(normal, &velocity);
+            particle->positionX = position.x;
+            particle->positionY = position.y;
+            particle->positionZ = position.z;
+            particle->velocityX = velocity.x;
+            particle->velocityY = velocity.y;
+            particle->velocityZ = velocity.z;
+        }
+        else
+        {
+            index = i - listCount;
+            if (response == COLLISION_KILL)
+            {
+                m_compactParticles->ExpireParticle(index);
+                continue;
+            }
+
+            velocity = XMFLOAT3(compactParticles[index].velocityX / CompactParticlePool::VelocityScale,
+                compactParticles[index].velocityY / CompactParticlePool::VelocityScale,
+                compactParticles[index].velocityZ / CompactParticlePool::VelocityScale);
+            ReflectVelocity(normal, &velocity);
+            m_compactParticles->SetParticleMotion(index, position, velocity);
+        }
+    }
+    return;
+}
+
+
+void ParticleManager::GetCollisionPoint(int segment, XMFLOAT3* position, XMFLOAT3* normal)
+{
+    const XMFLOAT3& start = m_collisionStarts[segment];
+    const XMFLOAT3& end = m_collisionEnds[segment];
+    const CollisionHit& hit = m_collisionHits[segment];
+    XMFLOAT3 direction(end.x - start.x, end.y - start.y, end.z - start.z);
+
+    (*normal) = m_collisionWorld.GetTriangleNormal(hit.triangle);
+    if ((direction.x * normal->x) + (direction.y * normal->y) + (direction.z * normal->z) > 0.0f)
+    {
+        normal->x = -normal->x;
+        normal->y = -normal->y;
+        normal->z = -normal->z;
+    }
+
+    position->x = start.x + (direction.x * hit.t) + (normal->x * CollisionSurfaceOffset);
+    position->y = start.y + (direction.y * hit.t) + (normal->y * CollisionSurfaceOffset);
+    position->z = start.z + (direction.z * hit.t) + (normal->z * CollisionSurfaceOffset);
+    return;
+}
+
+
+void ParticleManager::AddImpact(const XMFLOAT3& position, const XMFLOAT3& normal, ImpactParticleType particleType, int triangle)
+{
+    ParticleImpact impact;
+
+    if ((int)m_impacts.size() >= MaxImpactsPerFrame)
+    {
+        return;
+    }
+
+    impact.position = position;
+    impact.normal = normal;
+    impact.particleType = particleType;
+    impact.mesh = m_collisionWorld.GetTriangleMesh(triangle);
+    m_impacts.push_back(impact);
+    return;
+}
+
+
+void ParticleManager::KillParticles()
+{
+    //iterate through the allocated list and check for those to kill
+    //if kill, delete from allocated list, add to front of free list
+    Particle* currentNode = m_headOfAllocatedList;
+    Particle* tempNode = nullptr;
+
+    //check head of node last to avoid the need to reassign head node
+    if (currentNode)
+    {
+        while (currentNode->next)
+        {
+
+            if (currentNode->next->remainingLifeTime < 0.0f)
+            {
+                tempNode = currentNode->next;
+                currentNode->next = tempNode->next;
+
+                FreeParticle(SLICE_GENERAL, tempNode);
                 //No need to iterate to the next node its already at currentNode->next
                 continue;
             }
-            currentNode = currentNode->next;
+            currentNode = currentNode->next;
+        }
+
+        //check head of allocated
+        if (m_headOfAllocatedList->remainingLifeTime < 0.0f)
+        {
+            tempNode = m_headOfAllocatedList;
+            m_headOfAllocatedList = m_headOfAllocatedList->next;
+
+            FreeParticle(SLICE_GENERAL, tempNode);
+        }
+    }
+
+    //Reset Rain Particles that hit the ground
+    currentNode = m_headOfRainAllocatedList;
+    tempNode = nullptr;
+
+    if (currentNode)
+    {
+        while (currentNode)
+        {   // reset all rain particles that are at the ground or lower
+            if (currentNode->positionY < 0.0f)
+            {
+                //create a ring effect to simulate splash particles
+                MakeRingEffect(XMFLOAT3(currentNode->positionX, 0.0f, currentNode->positionZ), m_rainSplashParticles);
+
+                currentNode->positionY = m_rainSpawnInHeight;
+                currentNode->velocityY = m_rainSpawnYVelocity;
+                continue;
+            }
+            currentNode = currentNode->next;
+        }
+    }
+    //old smoke gets deleted and added to the free list, the fire kernel turns old fire into smoke
+    currentNode = m_headOfFireAllocatedList;
+    tempNode = nullptr;
+    if (currentNode)
+    {
+        while (currentNode->next)
+        {
+            if (currentNode->next->remainingLifeTime < 0.0f)
+            {
+                tempNode = currentNode->next;
+                currentNode->next = tempNode->next;
+
+                FreeParticle(SLICE_FIRE, tempNode);
+                m_fireInstanceCount--;
+                continue;
+            } 
+            currentNode = currentNode->next;
+        }
+        //check head of allocated
+        if (m_headOfFireAllocatedList->remainingLifeTime < 0.0f)
+        {
+            tempNode = m_headOfFireAllocatedList;
+            m_headOfFireAllocatedList = m_headOfFireAllocatedList->next;
+
+            FreeParticle(SLICE_FIRE, tempNode);
+            m_fireInstanceCount--;
+        } 
+    }
+
+    if (m_compactParticles)
+    {
+        m_compactParticles->Kill();
+    }
+    return;
+}
+
+
+bool ParticleManager::UpdateBuffers(ID3D11DeviceContext* deviceContext)
+{
+    int index = 0;
+    bool result;
+
+    // Initialize vertex array to zeros
+    memset(m_Instances, 0, (sizeof(InstanceType) * m_totalInstanceCount));
+    m_occludedParticles = 0;
+    m_visibleParticles = 0;
+
+    //the views see the scene from other cameras and the density grid from none, so they get a copy of the instances
+    //from before the occlusion test
+    m_keepUnculledInstances = m_occlusionCuller && (!m_views.empty() || m_densityGrid);
+    if (m_keepUnculledInstances && (int)m_unculledInstances.size() < m_totalInstanceCount)
+    {
+        m_unculledInstances.resize(m_totalInstanceCount);
+    }
+    m_unculledCount = 0;
+
+    //rain updates, sorted analytic drops are merged with the rain list far to near the same way as the general range
+    auto currentNode = m_headOfRainAllocatedList;
+    if (m_useAnalyticRain && !m_rainEmitter.dormant)
+    {
+        XMFLOAT3 position;
+        long long cycle;
+        bool sorted = m_sortStrategy != SORT_NONE && (int)m_analyticRainOrder.size() == m_rainInstanceCount;
+        for (auto i = 0; i < m_rainInstanceCount; ++i)
+        {
+            if (sorted)
+            {
+                position = m_analyticRainPositions[m_analyticRainOrder[i]];
+                while (currentNode && currentNode->positionZ >= position.z)
+                {
+                    WriteInstance(&index, XMFLOAT3(currentNode->positionX, currentNode->positionY, currentNode->positionZ), XMFLOAT4(currentNode->red, currentNode->green, currentNode->blue, 1.0f));
+                    currentNode = currentNode->next;
+                }
+            }
+            else
+            {
+                GetAnalyticRainDrop(i, m_rainTime, &position, &cycle);
+            }
+            WriteInstance(&index, position, XMFLOAT4(0.5f, 0.5f, 1.0f, 1.0f));
+        }
+    }
+
+    while (currentNode)
+    {
+        WriteInstance(&index, XMFLOAT3(currentNode->positionX, currentNode->positionY, currentNode->positionZ), XMFLOAT4(currentNode->red, currentNode->green, currentNode->blue, 1.0f));
+        currentNode = currentNode->next;
+    }
+    FlushOcclusionCluster(&index);
+    m_rainRenderCount = index;
+    m_unculledRainCount = m_unculledCount;
+
+    //Fire updates
+    if (m_useFireInstancing)
+    {
+        index = WriteFireCopyInstances(index);
+    }
+    else
+    {
+        currentNode = m_headOfFireAllocatedList;
+        while (currentNode)
+        {
+            WriteInstance(&index, XMFLOAT3(currentNode->positionX, currentNode->positionY, currentNode->positionZ), XMFLOAT4(currentNode->red, currentNode->green, currentNode->blue, 1.0f));
+            currentNode = currentNode->next;
+        }
+    }
+    FlushOcclusionCluster(&index);
+    m_fireRenderCount = index - m_rainRenderCount;
+    m_unculledFireCount = m_unculledCount - m_unculledRainCount;
+
+    //general update, the list and the compact pool are each far to near so merging them keeps the range back to front
+    const CompactParticle* compactParticles = m_compactParticles ? m_compactParticles->GetParticles() : nullptr;
+    int compactCount = m_compactParticles ? m_compactParticles->GetCount() : 0;
+    int compactIndex = 0;
+    currentNode = m_headOfAllocatedList;
+    while (currentNode || compactIndex < compactCount)
+    {
+        if (currentNode && (compactIndex == compactCount || currentNode->positionZ >= compactParticles[compactIndex].positionZ))
+        {
+            WriteInstance(&index, XMFLOAT3(currentNode->positionX, currentNode->positionY, currentNode->positionZ), XMFLOAT4(currentNode->red, currentNode->green, currentNode->blue, 1.0f));
+            currentNode = currentNode->next;
+            continue;
+        }
+
+        const CompactParticle& particle = compactParticles[compactIndex];
+        WriteInstance(&index, XMFLOAT3(particle.positionX, particle.positionY, particle.positionZ), m_compactParticles->GetPaletteColor(particle.palette));
+        compactIndex++;
+    }
+    FlushOcclusionCluster(&index);
+    m_activeParticles = index;
+    EndStage(STAGE_INSTANCES);
+
+    BeginStage(STAGE_UPLOAD);
+    result = UploadInstances(deviceContext);
+    EndStage(STAGE_UPLOAD);
+    return result;
+}
+
+
+void ParticleManager::WriteInstance(int* index, const XMFLOAT3& position, const XMFLOAT4& color)
+{
+    if (!m_occlusionCuller)
+    {
+        if ((*index) < m_totalInstanceCount)
+        {
+            m_Instances[(*index)].position = position;
+            m_Instances[(*index)].color = color;
+            (*index)++;
+        }
+        return;
+    }
+
+    if (m_keepUnculledInstances && m_unculledCount < m_totalInstanceCount)
+    {
+        m_unculledInstances[m_unculledCount].position = position;
+        m_unculledInstances[m_unculledCount].color = color;
+        m_unculledCount++;
+    }
+
+    //particles are gathered into small clusters that are tested as one box, a cluster ends when it is full or
+    //when the next particle would stretch it past m_occlusionClusterSize
+    if (m_occlusionClusterCount > 0)
+    {
+        float extentX = fmaxf(m_occlusionClusterMax.x, position.x) - fminf(m_occlusionClusterMin.x, position.x);
+        float extentY = fmaxf(m_occlusionClusterMax.y, position.y) - fminf(m_occlusionClusterMin.y, position.y);
+        float extentZ = fmaxf(m_occlusionClusterMax.z, position.z) - fminf(m_occlusionClusterMin.z, position.z);
+        if (m_occlusionClusterCount == MaxOcclusionClusterSize || extentX > m_occlusionClusterSize ||
+            extentY > m_occlusionClusterSize || extentZ > m_occlusionClusterSize)
+        {
+            FlushOcclusionCluster(index);
+        }
+    }
+
+    if (m_occlusionClusterCount == 0)
+    {
+        m_occlusionClusterMin = position;
+        m_occlusionClusterMax = position;
+    }
+    else
+    {
+        m_occlusionClusterMin = XMFLOAT3(fminf(m_occlusionClusterMin.x, position.x), fminf(m_occlusionClusterMin.y, position.y), fminf(m_occlusionClusterMin.z, position.z));
+        m_occlusionClusterMax = XMFLOAT3(fmaxf(m_occlusionClusterMax.x, position.x), fmaxf(m_occlusionClusterMax.y, position.y), fmaxf(m_occlusionClusterMax.z, position.z));
+    }
+
+    m_occlusionCluster[m_occlusionClusterCount].position = position;
+    m_occlusionCluster[m_occlusionClusterCount].color = color;
+    m_occlusionClusterCount++;
+    return;
+}
+
+
+const ParticleManager::InstanceType* ParticleManager::GetUnculledInstances(int* rainCount, int* fireCount, int* count)
+{
+    if (!m_keepUnculledInstances)
+    {
+        (*rainCount) = m_rainRenderCount;
+        (*fireCount) = m_fireRenderCount;
+        (*count) = (int)m_activeParticles;
+        return m_Instances;
+    }
+
+    (*rainCount) = m_unculledRainCount;
+    (*fireCount) = m_unculledFireCount;
+    (*count) = m_unculledCount;
+    return m_unculledInstances.data();
+}
+
+
+void ParticleManager::FlushOcclusionCluster(int* index)
+{
+    if (!m_occlusionCuller || m_occlusionClusterCount == 0)
+    {
+        return;
+    }
+
+    // grow the box by the largest particle quad so particles on the edge of an occluder are not cut off
+    float margin = 0.2f;
+    XMFLOAT3 boxMin(m_occlusionClusterMin.x - margin, m_occlusionClusterMin.y - margin, m_occlusionClusterMin.z - margin);
+    XMFLOAT3 boxMax(m_occlusionClusterMax.x + margin, m_occlusionClusterMax.y + margin, m_occlusionClusterMax.z + margin);
+
+    if (m_occlusionCuller->IsBoxVisible(boxMin, boxMax))
+    {
+        int count = m_occlusionClusterCount;
+        if ((*index) + count > m_totalInstanceCount)
+        {
+            count = m_totalInstanceCount - (*index);
+        }
+        memcpy(&m_Instances[(*index)], m_occlusionCluster, sizeof(InstanceType) * count);
+        (*index) += count;
+        m_visibleParticles += m_occlusionClusterCount;
+    }
+    else
+    {
+        m_occludedParticles += m_occlusionClusterCount;
+    }
+
+    m_occlusionClusterCount = 0;
+    return;
+}
+
+
+void ParticleManager::PrepareOcclusion()
+{
+    m_occlusionCuller->BeginFrame(m_occlusionViewProjection);
+    for (auto i = 0; i < (int)m_occluders.size(); ++i)
+    {
+        m_occlusionCuller->RasterizeOccluder(m_occluders[i].vertices.data(), (int)m_occluders[i].vertices.size(),
+            m_occluders[i].indices.data(), (int)m_occluders[i].indices.size());
+    }
+    m_occlusionCuller->BuildDepthPyramid();
+    return;
+}
+
+
+bool ParticleManager::UploadInstances(ID3D11DeviceContext* deviceContext)
+{
+    HRESULT result;
+    D3D11_MAPPED_SUBRESOURCE mappedResource;
+    InstanceType* instanceptr;
+    bool uploaded;
+
+    if (m_useVertexPulling && deviceContext)
+    {
+        uploaded = UploadBillboards(deviceContext, &m_billboardBuffer, m_Instances, (int)m_activeParticles, m_rainRenderCount, m_fireRenderCount);
+        if (!uploaded)
+        {
+            return false;
+        }
+    }
+    else if (!deviceContext)
+    {
+        //headless, the instances stay on the cpu
+    }
+    else if (!UploadInstancesToRing())
+    {
+        // Lock the vertex buffer.
+        result = deviceContext->Map(m_instanceBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedResource);
+        if (FAILED(result))
+        {
+            return false;
+        }
+
+        instanceptr = (InstanceType*)mappedResource.pData;
+        memcpy(instanceptr, (void*)m_Instances, (sizeof(InstanceType) * m_totalInstanceCount));
+
+        deviceContext->Unmap(m_instanceBuffer, 0);
+    }
+
+    if (m_densityGrid)
+    {
+        UpdateDensityGrid();
+    }
+
+    //the extra views are built from the finished instances so the simulation only ever runs once
+    if (!m_views.empty())
+    {
+        return UpdateViews(deviceContext);
+    }
+    return true;
+}
+
+
+void ParticleManager::UpdateDensityGrid()
+{
+    int rainCount, fireCount, count;
+    const InstanceType* instances;
+
+    //smoke hidden from the camera still fogs and lights the scene, so the grid is filled from before the occlusion
+    //test. The instances are already split into rain, fire and general ranges
+    instances = GetUnculledInstances(&rainCount, &fireCount, &count);
+    int fireEnd = rainCount + fireCount;
+    int generalCount = count - fireEnd;
+
+    m_densityGrid->Splat(s_taskPool, &instances[0].position, &instances[0].color, sizeof(InstanceType), rainCount,
+        m_densityWeights[DENSITY_RAIN], m_emissionWeights[DENSITY_RAIN]);
+    m_densityGrid->Splat(s_taskPool, &instances[rainCount].position, &instances[rainCount].color, sizeof(InstanceType), fireCount,
+        m_densityWeights[DENSITY_FIRE], m_emissionWeights[DENSITY_FIRE]);
+    m_densityGrid->Splat(s_taskPool, &instances[fireEnd].position, &instances[fireEnd].color, sizeof(InstanceType), generalCount,
+        m_densityWeights[DENSITY_GENERAL], m_emissionWeights[DENSITY_GENERAL]);
+    m_densityGrid->Resolve(s_taskPool);
+    return;
+}
+
+
+bool ParticleManager::UploadInstancesToRing()
+{
+    unsigned char* memory;
+    int bytes;
+
+    if (!m_instanceRingAcquired)
+    {
+        return false;
+    }
+
+    //only the instances written this frame are copied, the range is sized to them
+    bytes = sizeof(InstanceType) * (int)m_activeParticles;
+    memory = m_instanceRing->Map(bytes, &m_instanceRingOffset, &m_instanceRingAllocation);
+    if (!memory)
+    {
+        m_instanceRingAllocation = -1;
+        return false;
+    }
+
+    memcpy(memory, m_Instances, bytes);
+    m_instanceRing->Unmap();
+    return true;
+}
+
+
+bool ParticleManager::UploadBillboards(ID3D11DeviceContext* deviceContext, BillboardBuffer* billboardBuffer, const InstanceType* instances, int count, int rainCount, int fireCount)
+{
+    BillboardBuffer::BillboardInstance* billboards;
+    BillboardBuffer::BillboardType type;
+    int fireEnd;
+
+    billboards = billboardBuffer->Map(deviceContext);
+    if (!billboards)
+    {
+        return false;
+    }
+
+    // only the active instances are packed, the draw never reads past them
+    fireEnd = rainCount + fireCount;
+    for (auto i = 0; i < count; ++i)
+    {
+        if (i < rainCount)
+        {
+            type = BillboardBuffer::BILLBOARD_RAIN;
+        }
+        else if (i < fireEnd)
+        {
+            type = BillboardBuffer::BILLBOARD_FIRE;
+        }
+        else
+        {
+            type = BillboardBuffer::BILLBOARD_DEFAULT;
+        }
+        BillboardBuffer::PackInstance(instances[i].position, instances[i].color, type, &billboards[i]);
+    }
+
+    billboardBuffer->Unmap(deviceContext);
+    return true;
+}
+
+
+bool ParticleManager::UpdateViews(ID3D11DeviceContext* deviceContext)
+{
+    D3D11_MAPPED_SUBRESOURCE mappedResource;
+    HRESULT result;
+    bool uploaded;
+
+    //culling and sorting of each view only reads the frame's instances so the views are built side by side
+    if (m_views.size() > 1)
+    {
+        MarkStageParallel(STAGE_UPLOAD);
+    }
+    s_taskPool->ParallelFor((int)m_views.size(), [this](int viewIndex)
+    {
+        BuildViewStream(m_views[viewIndex]);
+    });
+    if (!deviceContext)
+    {
+        return true;
+    }
+
+    //buffer uploads have to stay on the thread that owns the immediate context
+    for (auto i = 0; i < (int)m_views.size(); ++i)
+    {
+        ViewStream* view = m_views[i];
+        if (!view->enabled)
+        {
+            continue;
+        }
+
+        if (m_useVertexPulling)
+        {
+            uploaded = UploadBillboards(deviceContext, view->billboardBuffer, view->instances.data(), view->instanceCount, view->rainCount, view->fireCount);
+            if (!uploaded)
+            {
+                return false;
+            }
+            continue;
+        }
+
+        result = deviceContext->Map(view->instanceBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedResource);
+        if (FAILED(result))
+        {
+            return false;
+        }
+        memcpy(mappedResource.pData, view->instances.data(), sizeof(InstanceType) * view->instanceCount);
+        deviceContext->Unmap(view->instanceBuffer, 0);
+    }
+    return true;
+}
+
+
+void ParticleManager::BuildViewStream(ViewStream* view)
+{
+    XMFLOAT4 planes[6];
+    int segmentStart[3], segmentEnd[3];
+    int rainCount, fireCount, count;
+    const InstanceType* instances;
+    int index = 0;
+
+    if (!view->enabled)
+    {
+        view->instanceCount = 0;
+        view->rainCount = 0;
+        view->fireCount = 0;
+        return;
+    }
+
+    ExtractFrustumPlanes(view->viewProjection, planes);
+    instances = GetUnculledInstances(&rainCount, &fireCount, &count);
+
+    // rain, fire and the general particles are sorted separately so each type stays one contiguous draw
+    segmentStart[0] = 0;
+    segmentEnd[0] = rainCount;
+    segmentStart[1] = rainCount;
+    segmentEnd[1] = rainCount + fireCount;
+    segmentStart[2] = segmentEnd[1];
+    segmentEnd[2] = count;
+
+    for (auto segment = 0; segment < 3; ++segment)
+    {
+        view->keys.clear();
+        for (auto i = segmentStart[segment]; i < segmentEnd[segment]; ++i)
+        {
+            const XMFLOAT3& position = instances[i].position;
+            // the margin covers the largest particle quad
+            if (!IsSphereInFrustum(planes, position, 0.2f))
+            {
+                continue;
+            }
+
+            ViewSortKey key;
+            key.depth = (position.x * view->viewMatrix._13) + (position.y * view->viewMatrix._23) + (position.z * view->viewMatrix._33) + view->viewMatrix._43;
+            key.index = i;
+            view->keys.push_back(key);
+        }
+
+        //back to front
+        std::sort(view->keys.begin(), view->keys.end(), [](const ViewSortKey& a, const ViewSortKey& b)
+        {
+            return a.depth > b.depth;
+        });
+
+        for (auto i = 0; i < (int)view->keys.size(); ++i)
+        {
+            view->instances[index] = instances[view->keys[i].index];
+            index++;
+        }
+
+        if (segment == 0)
+        {
+            view->rainCount = index;
+        }
+        else if (segment == 1)
+        {
+            view->fireCount = index - view->rainCount;
+        }
+    }
+    view->instanceCount = index;
+    return;
+}
+
+
+int ParticleManager::AddView(ID3D11Device* device)
+{
+    D3D11_BUFFER_DESC instanceBufferDesc;
+    HRESULT result;
+    ViewStream* view;
+
+    if (!m_Instances)
+    {
+        return -1;
+    }
+
+    view = new ViewStream;
+    if (!view)
+    {
+        return -1;
+    }
+
+    XMStoreFloat4x4(&view->viewMatrix, XMMatrixIdentity());
+    XMStoreFloat4x4(&view->viewProjection, XMMatrixIdentity());
+    view->enabled = true;
+    view->instances.resize(m_totalInstanceCount);
+    view->keys.reserve(m_totalInstanceCount);
+    view->rainCount = 0;
+    view->fireCount = 0;
+    view->instanceCount = 0;
+    view->instanceBuffer = nullptr;
+    view->billboardBuffer = nullptr;
+
+    if (!device)
+    {
+        //headless, the view's instances stay on the cpu
+    }
+    else if (m_useVertexPulling)
+    {
+        view->billboardBuffer = new BillboardBuffer;
+        if (!view->billboardBuffer || !view->billboardBuffer->Initialize(device, m_totalInstanceCount))
+        {
+            ShutdownView(view);
+            return -1;
+        }
+    }
+    else
+    {
+        instanceBufferDesc.Usage = D3D11_USAGE_DYNAMIC;
+        instanceBufferDesc.ByteWidth = sizeof(InstanceType) * m_totalInstanceCount;
+        instanceBufferDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+        instanceBufferDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+        instanceBufferDesc.MiscFlags = 0;
+        instanceBufferDesc.StructureByteStride = 0;
+
+        result = device->CreateBuffer(&instanceBufferDesc, nullptr, &view->instanceBuffer);
+        if (FAILED(result))
+        {
+            ShutdownView(view);
+            return -1;
+        }
+    }
+
+    m_views.push_back(view);
+    return (int)m_views.size() - 1;
+}
+
+
+void ParticleManager::SetViewCamera(int viewIndex, const XMFLOAT4X4& viewMatrix, const XMFLOAT4X4& projectionMatrix)
+{
+    ViewStream* view = m_views[viewIndex];
+
+    view->viewMatrix = viewMatrix;
+    XMStoreFloat4x4(&view->viewProjection, XMMatrixMultiply(XMLoadFloat4x4(&viewMatrix), XMLoadFloat4x4(&projectionMatrix)));
+    return;
+}
+
+
+void ParticleManager::SetViewEnabled(int viewIndex, bool enabled)
+{
+    m_views[viewIndex]->enabled = enabled;
+    return;
+}
+
+
+void ParticleManager::ClearViews()
+{
+    for (auto i = 0; i < (int)m_views.size(); ++i)
+    {
+        ShutdownView(m_views[i]);
+    }
+    m_views.clear();
+    return;
+}
+
+
+void ParticleManager::ShutdownView(ViewStream* view)
+{
+    if (view->billboardBuffer)
+    {
+        view->billboardBuffer->Shutdown();
+        delete view->billboardBuffer;
+        view->billboardBuffer = nullptr;
+    }
+
+    if (view->instanceBuffer)
+    {
+        view->instanceBuffer->Release();
+        view->instanceBuffer = nullptr;
+    }
+
+    delete view;
+    return;
+}
+
+
+void ParticleManager::RenderView(ID3D11DeviceContext* deviceContext, int viewIndex)
+{
+    RenderBuffers(deviceContext, m_views[viewIndex]->instanceBuffer, 0, m_views[viewIndex]->billboardBuffer);
+    return;
+}
+
+
+int ParticleManager::GetViewCount()
+{
+    return (int)m_views.size();
+}
+
+
+int ParticleManager::GetViewRainInstanceCount(int viewIndex)
+{
+    return m_views[viewIndex]->rainCount;
+}
+
+
+int ParticleManager::GetViewFireInstanceCount(int viewIndex)
+{
+    return m_views[viewIndex]->fireCount;
+}
+
+
+int ParticleManager::GetViewInstanceCount(int viewIndex)
+{
+    return m_views[viewIndex]->instanceCount;
+}
+
+
+bool ParticleManager::AcquireTaskPool()
+{
+    bool result;
+
+    if (!s_taskPool)
+    {
+        s_taskPool = new TaskPool;
+        if (!s_taskPool)
+        {
+            return false;
+        }
+        result = s_taskPool->Initialize(-1);
+        if (!result)
+        {
+            delete s_taskPool;
+            s_taskPool = nullptr;
+            return false;
+        }
+    }
+    s_taskPoolUsers++;
+    m_taskPoolAcquired = true;
+    return true;
+}
+
+
+bool ParticleManager::AcquireInstanceRing(ID3D11Device* device, ID3D11DeviceContext* deviceContext)
+{
+    bool result;
+    int ringIndex = -1;
+
+    //the ring is mapped and fenced through the context it was created with, so every context gets a ring of its own
+    for (auto i = 0; i < (int)s_instanceRings.size(); ++i)
+    {
+        if (s_instanceRings[i].deviceContext == deviceContext)
+        {
+            ringIndex = i;
+        }
+    }
+
+    if (ringIndex < 0)
+    {
+        SharedInstanceRing sharedRing;
+        sharedRing.deviceContext = deviceContext;
+        sharedRing.users = 0;
+        sharedRing.ring = new InstanceRingBuffer;
+        if (!sharedRing.ring)
+        {
+            return false;
+        }
+        result = sharedRing.ring->Initialize(new D3D11InstanceRingBackend(device, deviceContext), m_instanceRingSize);
+        if (!result)
+        {
+            sharedRing.ring->Shutdown();
+            delete sharedRing.ring;
+            return false;
+        }
+        ringIndex = (int)s_instanceRings.size();
+        s_instanceRings.push_back(sharedRing);
+    }
+    s_instanceRings[ringIndex].users++;
+    m_instanceRing = s_instanceRings[ringIndex].ring;
+    m_instanceRingAcquired = true;
+    m_instanceRingAllocation = -1;
+    return true;
+}
+
+
+void ParticleManager::ReleaseInstanceRing()
+{
+    if (!m_instanceRingAcquired)
+    {
+        return;
+    }
+    m_instanceRingAcquired = false;
+
+    //the other managers keep using the ring, so the last range has to be handed back
+    if (m_instanceRingAllocation >= 0)
+    {
+        m_instanceRing->Release(m_instanceRingAllocation);
+        m_instanceRingAllocation = -1;
+    }
+
+    //last manager on the context frees its ring
+    for (auto i = 0; i < (int)s_instanceRings.size(); ++i)
+    {
+        if (s_instanceRings[i].ring != m_instanceRing)
+        {
+            continue;
+        }
+
+        s_instanceRings[i].users--;
+        if (s_instanceRings[i].users <= 0)
+        {
+            m_instanceRing->Shutdown();
+            delete m_instanceRing;
+            s_instanceRings.erase(s_instanceRings.begin() + i);
+        }
+        break;
+    }
+    m_instanceRing = nullptr;
+    return;
+}
+
+
+void ParticleManager::ReleaseTaskPool()
+{
+    if (!m_taskPoolAcquired)
+    {
+        return;
+    }
+    m_taskPoolAcquired = false;
+
+    //last manager out stops the workers
+    s_taskPoolUsers--;
+    if (s_taskPoolUsers <= 0)
+    {
+        s_taskPool->Shutdown();
+        delete s_taskPool;
+        s_taskPool = nullptr;
+        s_taskPoolUsers = 0;
+    }
+    return;
+}
+
+
+void ParticleManager::RecordFireHistory(float frameTime)
+{
+    FireHistoryFrame& frame = m_fireHistory[m_fireHistoryHead];
+    InstanceType instance;
+
+    frame.instances.clear();
+    frame.frameTime = frameTime;
+
+    Particle* currentNode = m_headOfFireAllocatedList;
+    while (currentNode)
+    {
+        instance.position = XMFLOAT3(currentNode->positionX, currentNode->positionY, currentNode->positionZ);
+        instance.color = XMFLOAT4(currentNode->red, currentNode->green, currentNode->blue, 1.0f);
+        frame.instances.push_back(instance);
+        currentNode = currentNode->next;
+    }
+
+    m_fireHistoryHead = (m_fireHistoryHead + 1) % MaxFireHistoryFrames;
+    if (m_fireHistoryCount < MaxFireHistoryFrames)
+    {
+        m_fireHistoryCount++;
+    }
+    return;
+}
+
+int ParticleManager::WriteFireCopyInstances(int index)
+{
+    // draw the copies back to front along z like the particles inside each list, insertion sort as there are few copies
+    for (auto i = 0; i < m_fireCopyCount; ++i)
+    {
+        int copy = i;
+        int position = i;
+        while (position > 0 && m_fireCopies[m_fireCopyOrder[position - 1]].transform._43 < m_fireCopies[copy].transform._43)
+        {
+            m_fireCopyOrder[position] = m_fireCopyOrder[position - 1];
+            position--;
+        }
+        m_fireCopyOrder[position] = copy;
+    }
+
+    // the copies only have room for a steady fire, the general particles written after them keep theirs and the
+    // farthest copies are left out until the rest fit
+    int liveFireCount = m_particleArena.GetLiveCount(SLICE_FIRE);
+    int generalCount = m_particleArena.GetLiveCount(SLICE_GENERAL) + (m_compactParticles ? m_compactParticles->GetCount() : 0);
+    int available = m_totalInstanceCount - index - generalCount;
+    int needed = 0;
+    for (auto i = 0; i < m_fireCopyCount; ++i)
+    {
+        const std::vector<InstanceType>* historyInstances = FindFireCopyHistory(m_fireCopies[i]);
+        needed += historyInstances ? (int)historyInstances->size() : liveFireCount;
+    }
+
+    int firstCopy = 0;
+    int dropped = 0;
+    while (needed > available && firstCopy < m_fireCopyCount)
+    {
+        const std::vector<InstanceType>* historyInstances = FindFireCopyHistory(m_fireCopies[m_fireCopyOrder[firstCopy]]);
+        int copyCount = historyInstances ? (int)historyInstances->size() : liveFireCount;
+        needed -= copyCount;
+        dropped += copyCount;
+        firstCopy++;
+    }
+    if (dropped > 0)
+    {
+        CountDroppedInstances(dropped);
+    }
+
+    for (auto i = firstCopy; i < m_fireCopyCount; ++i)
+    {
+        const EffectCopy& copy = m_fireCopies[m_fireCopyOrder[i]];
+        const XMFLOAT4X4& m = copy.transform;
+        const std::vector<InstanceType>* historyInstances = FindFireCopyHistory(copy);
+
+        if (historyInstances)
+        {
+            for (auto j = 0; j < (int)historyInstances->size(); ++j)
+            {
+                const XMFLOAT3& local = (*historyInstances)[j].position;
+                WriteInstance(&index, XMFLOAT3(
+                    (local.x * m._11) + (local.y * m._21) + (local.z * m._31) + m._41,
+                    (local.x * m._12) + (local.y * m._22) + (local.z * m._32) + m._42,
+                    (local.x * m._13) + (local.y * m._23) + (local.z * m._33) + m._43), (*historyInstances)[j].color);
+            }
+            continue;
+        }
+
+        Particle* currentNode = m_headOfFireAllocatedList;
+        while (currentNode)
+        {
+            WriteInstance(&index, XMFLOAT3(
+                (currentNode->positionX * m._11) + (currentNode->positionY * m._21) + (currentNode->positionZ * m._31) + m._41,
+                (currentNode->positionX * m._12) + (currentNode->positionY * m._22) + (currentNode->positionZ * m._32) + m._42,
+                (currentNode->positionX * m._13) + (currentNode->positionY * m._23) + (currentNode->positionZ * m._33) + m._43),
+                XMFLOAT4(currentNode->red, currentNode->green, currentNode->blue, 1.0f));
+            currentNode = currentNode->next;
+        }
+    }
+
+    return index;
+}
+
+const std::vector<ParticleManager::InstanceType>* ParticleManager::FindFireCopyHistory(const EffectCopy& copy)
+{
+    if (copy.timeOffset <= 0.0f || m_fireHistoryCount <= 0)
+    {
+        return nullptr;
+    }
+
+    // find the newest recorded frame that is at least timeOffset old, the newest frame is the live simulation
+    float age = 0.0f;
+    int frame = (m_fireHistoryHead + MaxFireHistoryFrames - 1) % MaxFireHistoryFrames;
+    for (auto back = 1; back < m_fireHistoryCount && age < copy.timeOffset; ++back)
+    {
+        age += m_fireHistory[frame].frameTime;
+        frame = (frame + MaxFireHistoryFrames - 1) % MaxFireHistoryFrames;
+    }
+    return &m_fireHistory[frame].instances;
+}
+
+bool ParticleManager::PlayCacheFrame(ID3D11DeviceContext* deviceContext, float frameTime)
+{
+    bool result;
+    int instanceCount, rainCount, fireCount;
+
+    m_cachePlaybackTime += frameTime;
+    if (m_cacheLoop && m_cachePlaybackTime > m_cachePlayer->GetDuration())
+    {
+        m_cachePlaybackTime = 0.0f;
+    }
+
+    int frameIndex = m_cachePlayer->GetFrameAtTime(m_cachePlaybackTime);
+
+    //frames shrink and grow, clear what the last frame left past this one's instances
+    memset(m_Instances, 0, (sizeof(InstanceType) * m_totalInstanceCount));
+    result = m_cachePlayer->ReadFrame(frameIndex, m_Instances, &instanceCount, &rainCount, &fireCount);
+    if (!result)
+    {
+        return false;
+    }
+
+    m_rainRenderCount = rainCount;
+    m_fireRenderCount = fireCount;
+    m_activeParticles = instanceCount;
+    //cached frames are not occlusion culled
+    m_keepUnculledInstances = false;
+
+    return UploadInstances(deviceContext);
+}
+
+
+void ParticleManager::RenderBuffers(ID3D11DeviceContext* deviceContext, ID3D11Buffer* instanceBuffer, unsigned int instanceOffset, BillboardBuffer* billboardBuffer)
+{
+    if (m_useVertexPulling)
+    {
+        billboardBuffer->Render(deviceContext);
+        return;
+    }
+
+    unsigned int stride;
+    unsigned int offset;
+    unsigned int strides[2];
+    unsigned int offsets[2];
+    ID3D11Buffer* bufferPointers[2];
+
+    // Set the buffer strides.
+    strides[0] = sizeof(VertexType);
+    strides[1] = sizeof(InstanceType);
+
+    // Set the buffer offsets.
+    offsets[0] = 0;
+    offsets[1] = instanceOffset;
+
+    // Set the array of pointers to the vertex and instance buffers.
+    bufferPointers[0] = m_vertexBuffer;
+    bufferPointers[1] = instanceBuffer;
+    // Set the index buffer to active in the input assembler so it can be rendered.
+    deviceContext->IASetIndexBuffer(m_indexBuffer, DXGI_FORMAT_R16_UINT, 0);
+
+    // Set the vertex buffer to active in the input assembler so it can be rendered.
+    deviceContext->IASetVertexBuffers(0, 2, bufferPointers, strides, offsets);
+
+    // Set the type of primitive that should be rendered from this vertex buffer.
+    deviceContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+
+    return;
+}
+
+int ParticleManager::RandomInteger(int min, int max)
+{
+    //xorshift32
+    m_randomState ^= m_randomState << 13;
+    m_randomState ^= m_randomState >> 17;
+    m_randomState ^= m_randomState << 5;
+    return min + (int)(m_randomState % (unsigned int)(max - min + 1));
+}
+
+
+int ParticleManager::GetParticleIndex(Particle* particle)
+{
+    return particle ? (int)(particle - m_particleList) : -1;
+}
+
+
+void ParticleManager::MakeRingEffect(XMFLOAT3 targetPosition, int numberOfParticles)
+{
+    bool found;
+    float velocityX, velocityZ;
+
+    float circlePosition = 0.0f;
+    float radianToDegreeConstant = (3.141592 / 180);
+
+    Particle* currentNode = m_headOfAllocatedList;
+    Particle* tempNode = nullptr;
+
+    float OverallVelocity = m_ringEffect.velocity;
+    float LifeTime = m_ringEffect.lifeTime;
+    float red = m_ringEffect.color[0];
+    float green = m_ringEffect.color[1];
+    float blue = m_ringEffect.color[2];
+
+    int palette = 0;
+    if (m_compactParticles)
+    {
+        palette = m_compactParticles->FindPaletteColor(red, green, blue);
+    }
+
+    for (auto i = 0; i < numberOfParticles; i++)
+    {
+        //calculate the particle's position in the circle
+        circlePosition = (360 * ((float)(i) / numberOfParticles));
+
+        velocityX = (OverallVelocity * cos(circlePosition * radianToDegreeConstant));
+        velocityZ = (OverallVelocity * sin(circlePosition  * radianToDegreeConstant));
+
+        if (m_compactParticles)
+        {
+            if (!m_compactParticles->Spawn(targetPosition, XMFLOAT3(velocityX, 0.0f, velocityZ), LifeTime, palette))
+            {
+                CountAllocations(0, numberOfParticles - i);
+                return;
+            }
+            CountAllocations(1, 0);
+            continue;
         }
 
-        //check head of allocated
-        if (m_headOfAllocatedList->remainingLifeTime < 0.0f)
+        found = false;
+        //find first free particle
+        tempNode = AllocateParticle(SLICE_GENERAL);
+        if (tempNode != nullptr)
         {
-            tempNode = m_headOfAllocatedList;
-            m_headOfAllocatedList = m_headOfAllocatedList->next;
+            //pre set it to the data we want for the new node
+            tempNode->next == nullptr;
+            tempNode->positionX = targetPosition.x;
+            tempNode->positionY = targetPosition.y;
+            tempNode->positionZ = targetPosition.z;
+            tempNode->red = red;
+            tempNode->green = green;
+            tempNode->blue = blue;
+            tempNode->remainingLifeTime = LifeTime;
+            tempNode->velocityX = velocityX;
+            tempNode->velocityY = 0.0f;
+            tempNode->velocityZ = velocityZ;
 
-            tempNode->next = m_headOfFreeList;
-            m_headOfFreeList = tempNode;
+            InsertParticle(tempNode, &m_headOfAllocatedList);
+            CountAllocations(1, 0);
+        }
+        else
+        {
+            //no more free particles
+            CountAllocations(0, numberOfParticles - i);
+            return;
         }
     }
+    return;
+}
 
-    //Reset Rain Particles that hit the ground
-    currentNode = m_headOfRainAllocatedList;
-    tempNode = nullptr;
+void ParticleManager::MakeFireEffect(XMFLOAT3 targetPosition, float frameTime)
+{
+    //calculate total fire particles to emit this frame
+    MakeFireParticles(targetPosition, (int)(m_fireEffect.particlesPerSecond * frameTime), 0.0f);
+    return;
+}
 
-    if (currentNode)
+void ParticleManager::MakeFireParticles(XMFLOAT3 targetPosition, int numberOfParticles, float maxAge)
+{
+    float age;
+    bool found;
+    float positionX, positionY, positionZ ;
+
+    float velocityX = 0.0f;
+    float velocityY = m_fireEffect.riseVelocity;
+    float velocityZ = 0.0f;
+
+    float baseLifeTime = m_fireEffect.baseLifeTime;
+    float lifeTime = baseLifeTime; // used to hold random lifetime
+
+    float red = m_fireEffect.color[0];
+    float green = m_fireEffect.color[1];
+    float blue = m_fireEffect.color[2];
+
+    Particle* currentNode = m_headOfFireAllocatedList;
+    Particle* tempNode = nullptr;
+
+    for (auto i = 0; i < numberOfParticles; ++i)
     {
-        while (currentNode)
-        {   // reset all rain particles that are at the ground or lower
-            if (currentNode->positionY < 0.0f)
-            {
-                //create a ring effect to simulate splash particles
-                MakeRingEffect(XMFLOAT3(currentNode->positionX, 0.0f, currentNode->positionZ), 8);
+        // x and z coordiantes are randomized in an area to give the fire depth and width
+        positionX = targetPosition.x + (m_fireEffect.spreadX * (RandomInteger(0, 20) / 20.0f));
+        positionY = targetPosition.y;
+        positionZ = targetPosition.z - (m_fireEffect.spreadZ * (RandomInteger(0, 80) / 80.0f));
 
-                currentNode->positionY = m_rainSpawnInHeight;
-                currentNode->velocityY = m_rainSpawnYVelocity;
+        //velocityX is set to a random range to give the fire a cone shape as the particles rise
+        velocityX = (m_fireEffect.coneVelocity * (RandomInteger(-10, 10) / 10.0f));
+
+        //randomized additional lifetime for each particle gives the top of the fire a flickering effect
+        lifeTime = baseLifeTime + (m_fireEffect.lifeTimeJitter * (RandomInteger(0, 15) / 15.0f));
+
+        //prewarmed particles are placed as if they were emitted up to maxAge seconds ago, fire ignores gravity so
+        //the particle has simply moved along its velocity
+        if (maxAge > 0.0f)
+        {
+            age = maxAge * (RandomInteger(0, 1000) / 1000.0f);
+            if (age >= lifeTime)
+            {
+                //already burned out
                 continue;
             }
-            currentNode = currentNode->next;
+            positionX += velocityX * age;
+            positionY += velocityY * age;
+            positionZ += velocityZ * age;
+            lifeTime -= age;
         }
-    }
-    //old Fire gets turned into smoke, old smoke gets deleted and added to the free list
-    currentNode = m_headOfFireAllocatedList;
-    tempNode = nullptr;
-    if (currentNode)
-    {
-        while (currentNode->next)
+
+        found = false;
+        //find first free particle
+        tempNode = AllocateParticle(SLICE_FIRE);
+        if (tempNode != nullptr)
         {
-            if (currentNode->next->remainingLifeTime < 0.0f)
-            {
-                tempNode = currentNode->next;
-                currentNode->next = tempNode->next;
+            //pre set it to the data we want for the new node
+            tempNode->next == nullptr;
+            tempNode->positionX = positionX;
+            tempNode->positionY = positionY;
+            tempNode->positionZ = positionZ;
+            tempNode->red = red;
+            tempNode->green = green;
+            tempNode->blue = blue;
+            tempNode->remainingLifeTime = lifeTime;
+            tempNode->velocityX = velocityX;
+            tempNode->velocityY = velocityY;
+            tempNode->velocityZ = velocityZ;
 
-                if (m_headOfFreeList)
-                {
-                    tempNode->next = m_headOfFreeList->next;
-                    m_headOfFreeList->next = tempNode;
-                }
-                else
-                {
-                    tempNode->next = nullptr;
-                    m_headOfFreeList = tempNode;
-                }
+            InsertParticle(tempNode, &m_headOfFireAllocatedList);
+            m_fireInstanceCount++;
+            CountAllocations(1, 0);
+        }
+        else
+        {
+            //no more free particles
+            CountAllocations(0, numberOfParticles - i);
+            return;
+        }
+    }
+}
 
+void ParticleManager::MakeBurstEffect(XMFLOAT3 targetPosition, int numberOfParticles, float speed, float lifeTime, const float* color)
+{
+    Particle* tempNode = nullptr;
+    float directionX, directionY, directionZ, length;
 
-                m_fireInstanceCount--;
-                continue;
-            } 
-            else if (currentNode->next->remainingLifeTime < m_smokeLifeTime)
-            {// turn to smoke
-                currentNode->next->red = 0.1f;
-                currentNode->next->green = 0.1f;
-                currentNode->next->blue = 0.1f;
+    int palette = 0;
+    if (m_compactParticles)
+    {
+        palette = m_compactParticles->FindPaletteColor(color[0], color[1], color[2]);
+    }
+
+    for (auto i = 0; i < numberOfParticles; ++i)
+    {
+        //no more free particles
+        if (!m_compactParticles)
+        {
+            tempNode = AllocateParticle(SLICE_GENERAL);
+            if (!tempNode)
+            {
+                CountAllocations(0, numberOfParticles - i);
+                return;
             }
-            currentNode = currentNode->next;
         }
-        //check head of allocated
-        if (m_headOfFireAllocatedList->remainingLifeTime < 0.0f)
+
+        //random direction, rejected when it is too short to normalize
+        directionX = RandomInteger(-100, 100) / 100.0f;
+        directionY = RandomInteger(-100, 100) / 100.0f;
+        directionZ = RandomInteger(-100, 100) / 100.0f;
+        length = sqrtf((directionX * directionX) + (directionY * directionY) + (directionZ * directionZ));
+        if (length < 0.01f)
         {
-            tempNode = m_headOfFireAllocatedList;
-            m_headOfFireAllocatedList = m_headOfFireAllocatedList->next;
+            directionX = 0.0f;
+            directionY = 1.0f;
+            directionZ = 0.0f;
+            length = 1.0f;
+        }
 
-            if (m_headOfFreeList)
+        if (m_compactParticles)
+        {
+            XMFLOAT3 velocity(speed * directionX / length, speed * directionY / length, speed * directionZ / length);
+            if (!m_compactParticles->Spawn(targetPosition, velocity, lifeTime, palette))
             {
-                tempNode->next = m_headOfFreeList->next;
-                m_headOfFreeList->next = tempNode;
+                CountAllocations(0, numberOfParticles - i);
+                return;
             }
-            else
+            CountAllocations(1, 0);
+            continue;
+        }
+
+        tempNode->positionX = targetPosition.x;
+        tempNode->positionY = targetPosition.y;
+        tempNode->positionZ = targetPosition.z;
+        tempNode->red = color[0];
+        tempNode->green = color[1];
+        tempNode->blue = color[2];
+        tempNode->remainingLifeTime = lifeTime;
+        tempNode->velocityX = speed * directionX / length;
+        tempNode->velocityY = speed * directionY / length;
+        tempNode->velocityZ = speed * directionZ / length;
+
+        InsertParticle(tempNode, &m_headOfAllocatedList);
+        CountAllocations(1, 0);
+    }
+    return;
+}
+
+void ParticleManager::ProcessSpawnCommands()
+{
+    int commandCount;
+
+    //only the commands queued when the drain starts are handled, later ones wait for the next frame
+    commandCount = m_spawnQueue.Drain(m_spawnBatch.data(), (int)m_spawnBatch.size());
+    for (auto i = 0; i < commandCount; ++i)
+    {
+        const SpawnCommand& command = m_spawnBatch[i];
+        switch (command.type)
+        {
+        case SPAWN_RING:
+            MakeRingEffect(command.position, command.count);
+            break;
+        case SPAWN_FIRE:
+            //a dormant fire holds no particles, it wakes up so the new ones are simulated and judged with the rest
+            if (m_fireEmitter.dormant)
             {
-                tempNode->next = nullptr;
-                m_headOfFreeList = tempNode;
+                WakeFireEmitter();
             }
-            m_fireInstanceCount--;
-        } 
-        else if (m_headOfFireAllocatedList->remainingLifeTime < m_smokeLifeTime)
-        {// turn to smoke
-            m_headOfFireAllocatedList->red = 0.1f;
-            m_headOfFireAllocatedList->green = 0.1f;
-            m_headOfFireAllocatedList->blue = 0.1f;
+            //an instanced fire is simulated at the origin like the continuous one, the copies place it
+            MakeFireParticles(m_useFireInstancing ? XMFLOAT3(0.0f, 0.0f, 0.0f) : command.position, command.count, 0.0f);
+            break;
+        case SPAWN_BURST:
+            MakeBurstEffect(command.position, command.count, command.speed, command.lifeTime, command.color);
+            break;
+        default:
+            break;
         }
     }
     return;
 }
 
+bool ParticleManager::Prewarm(float seconds)
+{
+    if (seconds <= 0.0f || !m_particleList)
+    {
+        return false;
+    }
 
-bool ParticleManager::UpdateBuffers(ID3D11DeviceContext* deviceContext)
+    PrewarmRain(seconds);
+    PrewarmGeneralParticles(seconds);
+    PrewarmFire(seconds);
+
+    //drops the particles that burned out during the skipped time, the new fire turns to smoke in its first update
+    KillParticles();
+    return true;
+}
+
+void ParticleManager::PrewarmFire(float seconds)
 {
-    int index = 0;
-    HRESULT result;
-    D3D11_MAPPED_SUBRESOURCE mappedResource;
-    InstanceType* instanceptr;
+    float window;
+
+    //existing fire moves in a straight line so it is aged in one step, KillParticles removes what burned out
+    RunParticleKernel(EFFECT_FIRE, SLICE_FIRE, m_headOfFireAllocatedList, seconds);
+
+    if (!m_useFireInstancing && !m_fireEnabled)
+    {
+        return;
+    }
+
+    //a fire that has burned for longer than the longest lifetime is in its steady state, where the particles alive are
+    //the ones emitted during the last lifetime with their ages spread evenly over it
+    window = m_fireEffect.baseLifeTime + m_fireEffect.lifeTimeJitter;
+    if (seconds < window)
+    {
+        window = seconds;
+    }
+
+    if (m_useFireInstancing)
+    {
+        MakeFireParticles(XMFLOAT3(0.0f, 0.0f, 0.0f), (int)(m_fireEffect.particlesPerSecond * window), window);
+    }
+    else
+    {
+        MakeFireParticles(m_firePosition, (int)(m_fireEffect.particlesPerSecond * window), window);
+    }
+    return;
+}
+
+void ParticleManager::PrewarmRain(float seconds)
+{
+    float groundTime, remainingTime;
+    Particle* currentNode = m_headOfRainAllocatedList;
+
+    //stateless rain only needs its clock moved, the splashes of the skipped time are not made
+    if (m_useAnalyticRain)
+    {
+        m_rainTime += seconds;
+        return;
+    }
+
+    //the fall from the spawn height gives the length of one drop cycle
+    if (!InitiateAnalyticRainEffects())
+    {
+        return;
+    }
 
-    // Initialize vertex array to zeros
-    memset(m_Instances, 0, (sizeof(InstanceType) * m_totalInstanceCount));
-   
-    //rain updates
-    auto currentNode = m_headOfRainAllocatedList;
     while (currentNode)
     {
-        m_Instances[index].position = XMFLOAT3(currentNode->positionX, currentNode->positionY, currentNode->positionZ);
-        m_Instances[index].color = XMFLOAT4(currentNode->red, currentNode->green, currentNode->blue, 1.0f);
+        if (SolveGroundTime(currentNode->positionY, currentNode->velocityY, m_gravityConstant, &groundTime) && groundTime <= seconds)
+        {
+            //the drop has landed and restarted at least once, only the time since its last restart matters
+            remainingTime = fmodf(seconds - groundTime, m_rainCycleTime);
+            currentNode->positionY = m_rainSpawnInHeight;
+            currentNode->velocityY = m_rainSpawnYVelocity;
+        }
+        else
+        {
+            remainingTime = seconds;
+        }
+
+        //a restart only puts the drop back at the spawn height, it keeps drifting sideways through every cycle
+        currentNode->positionX += currentNode->velocityX * seconds;
+        currentNode->positionY += (currentNode->velocityY * remainingTime) + (0.5f * m_gravityConstant * remainingTime * remainingTime);
+        currentNode->positionZ += currentNode->velocityZ * seconds;
+        currentNode->velocityY += m_gravityConstant * remainingTime;
+        if (currentNode->positionY < 0.0f)
+        {
+            currentNode->positionY = 0.0f;
+        }
         currentNode = currentNode->next;
-        index++;
     }
+    return;
+}
 
-    //Fire updates
-    index = m_rainInstanceCount;
-    currentNode = m_headOfFireAllocatedList;
+void ParticleManager::PrewarmGeneralParticles(float seconds)
+{
+    float simulatedTime, step;
+    int steps;
+
+    //bouncing particles have no closed form so they are stepped, but only for as long as the oldest of them lives and
+    //with steps much larger than a frame
+    simulatedTime = 0.0f;
+    Particle* currentNode = m_headOfAllocatedList;
     while (currentNode)
     {
-        m_Instances[index].position = XMFLOAT3(currentNode->positionX, currentNode->positionY, currentNode->positionZ);
-        m_Instances[index].color = XMFLOAT4(currentNode->red, currentNode->green, currentNode->blue, 1.0f);
+        if (currentNode->remainingLifeTime > simulatedTime)
+        {
+            simulatedTime = currentNode->remainingLifeTime;
+        }
         currentNode = currentNode->next;
-        index++;
     }
 
-    //general update
-    index = m_rainInstanceCount + m_fireInstanceCount;
-
-    currentNode = m_headOfAllocatedList;
-    while (currentNode)
+    if (m_compactParticles)
+    {
+        const CompactParticle* compactParticles = m_compactParticles->GetParticles();
+        for (auto i = 0; i < m_compactParticles->GetCount(); ++i)
+        {
+            float remainingLifeTime = compactParticles[i].remainingLifeTime / CompactParticlePool::LifeTimeScale;
+            if (remainingLifeTime > simulatedTime)
+            {
+                simulatedTime = remainingLifeTime;
+            }
+        }
+    }
+
+    if (simulatedTime <= 0.0f)
     {
-        m_Instances[index].position = XMFLOAT3(currentNode->positionX, currentNode->positionY, currentNode->positionZ);
-        m_Instances[index].color = XMFLOAT4(currentNode->red, currentNode->green, currentNode->blue, 1.0f);
-            currentNode = currentNode->next;
-            index++;
+        return;
     }
-    m_activeParticles = index;
 
-    // Lock the vertex buffer.
-    result = deviceContext->Map(m_instanceBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mappedResource);
-    if (FAILED(result))
+    //past the oldest lifetime everything is dead, one more step makes sure the lifetimes run out
+    if (simulatedTime + PrewarmStepTime < seconds)
     {
-        return false;
+        seconds = simulatedTime + PrewarmStepTime;
     }
 
-    instanceptr = (InstanceType*)mappedResource.pData;
-    memcpy(instanceptr, (void*)m_Instances, (sizeof(InstanceType) * m_totalInstanceCount));
-
-    deviceContext->Unmap(m_instanceBuffer, 0);
-    return true;
+    steps = (int)ceilf(seconds / PrewarmStepTime);
+    step = seconds / steps;
+    for (auto i = 0; i < steps; ++i)
+    {
+        UpdateGeneralParticles(step);
+    }
+    return;
 }
 
-
-void ParticleManager::RenderBuffers(ID3D11DeviceContext* deviceContext)
+void ParticleManager::UpdateEmitterRelevance(float frameTime)
 {
-    unsigned int stride;
-    unsigned int offset;
-    unsigned int strides[2];
-    unsigned int offsets[2];
-    ID3D11Buffer* bufferPointers[2];
-
-    // Set the buffer strides.
-    strides[0] = sizeof(VertexType);
-    strides[1] = sizeof(InstanceType);
-
-    // Set the buffer offsets.
-    offsets[0] = 0;
-    offsets[1] = 0;
+    XMFLOAT4 planes[6];
+    XMFLOAT3 center;
+    float radius, scale;
+    bool fireRelevant, rainRelevant;
 
-    // Set the array of pointers to the vertex and instance buffers.
-    bufferPointers[0] = m_vertexBuffer;
-    bufferPointers[1] = m_instanceBuffer;
-    // Set the index buffer to active in the input assembler so it can be rendered.
-    deviceContext->IASetIndexBuffer(m_indexBuffer, DXGI_FORMAT_R32_UINT, 0);
+    if (!m_relevanceCameraSet)
+    {
+        return;
+    }
+    ExtractFrustumPlanes(m_relevanceViewProjection, planes);
+
+    //fire bounds, the emission area grown by how far the particles rise and drift during the longest lifetime
+    float longestLifeTime = m_fireEffect.baseLifeTime + m_fireEffect.lifeTimeJitter;
+    float halfX = (0.5f * m_fireEffect.spreadX) + (fabsf(m_fireEffect.coneVelocity) * longestLifeTime);
+    float halfY = 0.5f * fabsf(m_fireEffect.riseVelocity) * longestLifeTime;
+    float halfZ = 0.5f * m_fireEffect.spreadZ;
+    XMFLOAT3 fireOffset(0.5f * m_fireEffect.spreadX, halfY, -0.5f * m_fireEffect.spreadZ);
+    float fireRadius = sqrtf((halfX * halfX) + (halfY * halfY) + (halfZ * halfZ)) + 0.2f;
+
+    fireRelevant = false;
+    if (m_useFireInstancing)
+    {
+        //the one simulation is kept alive while any copy can be seen
+        for (auto i = 0; i < m_fireCopyCount && !fireRelevant; ++i)
+        {
+            const XMFLOAT4X4& m = m_fireCopies[i].transform;
+            center = XMFLOAT3(
+                (fireOffset.x * m._11) + (fireOffset.y * m._21) + (fireOffset.z * m._31) + m._41,
+                (fireOffset.x * m._12) + (fireOffset.y * m._22) + (fireOffset.z * m._32) + m._42,
+                (fireOffset.x * m._13) + (fireOffset.y * m._23) + (fireOffset.z * m._33) + m._43);
+            scale = fmaxf(sqrtf((m._11 * m._11) + (m._12 * m._12) + (m._13 * m._13)),
+                fmaxf(sqrtf((m._21 * m._21) + (m._22 * m._22) + (m._23 * m._23)), sqrtf((m._31 * m._31) + (m._32 * m._32) + (m._33 * m._33))));
+            fireRelevant = IsEmitterRelevant(planes, center, fireRadius * scale, m_fireEmitter.dormant);
+        }
+    }
+    else
+    {
+        if (m_fireEnabled)
+        {
+            center = XMFLOAT3(m_firePosition.x + fireOffset.x, m_firePosition.y + fireOffset.y, m_firePosition.z + fireOffset.z);
+            fireRelevant = IsEmitterRelevant(planes, center, fireRadius, m_fireEmitter.dormant);
+        }
 
-    // Set the vertex buffer to active in the input assembler so it can be rendered.
-    deviceContext->IASetVertexBuffers(0, 2, bufferPointers, strides, offsets);
+        //queued fire shares the slice with the continuous fire but burns anywhere, going dormant would take it too, so
+        //the fire stays awake while any of its particles can be seen
+        if (!fireRelevant && !m_fireEmitter.dormant && m_headOfFireAllocatedList)
+        {
+            XMFLOAT3 minimum(FLT_MAX, FLT_MAX, FLT_MAX);
+            XMFLOAT3 maximum(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+            for (auto currentNode = m_headOfFireAllocatedList; currentNode; currentNode = currentNode->next)
+            {
+                minimum = XMFLOAT3(fminf(minimum.x, currentNode->positionX), fminf(minimum.y, currentNode->positionY), fminf(minimum.z, currentNode->positionZ));
+                maximum = XMFLOAT3(fmaxf(maximum.x, currentNode->positionX), fmaxf(maximum.y, currentNode->positionY), fmaxf(maximum.z, currentNode->positionZ));
+            }
+            halfX = 0.5f * (maximum.x - minimum.x);
+            halfY = 0.5f * (maximum.y - minimum.y);
+            halfZ = 0.5f * (maximum.z - minimum.z);
+            center = XMFLOAT3(minimum.x + halfX, minimum.y + halfY, minimum.z + halfZ);
+            fireRelevant = IsEmitterRelevant(planes, center, sqrtf((halfX * halfX) + (halfY * halfY) + (halfZ * halfZ)) + 0.2f, false);
+        }
+    }
 
-    // Set the type of primitive that should be rendered from this vertex buffer.
-    deviceContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+    //rain bounds, the spawn box from the ground up to the spawn height
+    center = XMFLOAT3(0.5f * (m_rainBoxCoordinates[0] + m_rainBoxCoordinates[1]), 0.5f * m_rainSpawnInHeight, 0.5f * (m_rainBoxCoordinates[2] + m_rainBoxCoordinates[3]));
+    halfX = 0.5f * fabsf(m_rainBoxCoordinates[1] - m_rainBoxCoordinates[0]);
+    halfY = 0.5f * fabsf(m_rainSpawnInHeight);
+    halfZ = 0.5f * fabsf(m_rainBoxCoordinates[3] - m_rainBoxCoordinates[2]);
+    radius = sqrtf((halfX * halfX) + (halfY * halfY) + (halfZ * halfZ));
+    rainRelevant = IsEmitterRelevant(planes, center, radius, m_rainEmitter.dormant);
+
+    //fire, nothing is simulated on the frame an emitter goes dormant so its time counts as away. The frame it wakes is
+    //simulated as usual after the catch up
+    if (!fireRelevant && !m_fireEmitter.dormant)
+    {
+        FreeParticleList(&m_headOfFireAllocatedList, SLICE_FIRE);
+        m_fireInstanceCount = 0;
+        m_fireEmitter.dormant = true;
+        m_fireEmitter.dormantTime = frameTime;
+    }
+    else if (fireRelevant && m_fireEmitter.dormant)
+    {
+        WakeFireEmitter();
+    }
+    else if (m_fireEmitter.dormant)
+    {
+        m_fireEmitter.dormantTime += frameTime;
+    }
 
+    //rain, the stateless rain keeps its clock running while dormant so it needs no catch up
+    if (!rainRelevant && !m_rainEmitter.dormant)
+    {
+        FreeParticleList(&m_headOfRainAllocatedList, SLICE_RAIN);
+        m_rainEmitter.dormant = true;
+        m_rainEmitter.dormantTime = frameTime;
+    }
+    else if (rainRelevant && m_rainEmitter.dormant)
+    {
+        m_rainEmitter.dormant = false;
+        if (!m_useAnalyticRain)
+        {
+            InitiateRainEffects();
+            PrewarmRain(m_rainEmitter.dormantTime);
+        }
+    }
+    else if (m_rainEmitter.dormant)
+    {
+        m_rainEmitter.dormantTime += frameTime;
+    }
     return;
 }
 
-void ParticleManager::MakeRingEffect(XMFLOAT3 targetPosition, int numberOfParticles)
+void ParticleManager::WakeFireEmitter()
 {
-    bool found;
-    float velocityX, velocityZ;
-
-    float circlePosition = 0.0f;
-    float radianToDegreeConstant = (3.141592 / 180);
-
-    Particle* currentNode = m_headOfAllocatedList;
-    Particle* tempNode = nullptr;
+    m_fireEmitter.dormant = false;
+    PrewarmFire(m_fireEmitter.dormantTime);
+    m_fireEmitter.dormantTime = 0.0f;
+    return;
+}
 
-    float OverallVelocity = 0.35f;
-    float LifeTime = 0.5f;
-    float red = 0.5f;
-    float green = 0.5f;
-    float blue = 1.0f;
+bool ParticleManager::IsEmitterRelevant(const XMFLOAT4* planes, const XMFLOAT3& center, float radius, bool dormant)
+{
+    float distanceX, distanceY, distanceZ, distance;
 
-    for (auto i = 0; i < numberOfParticles; i++)
+    //a running emitter gets some slack before it goes dormant so one on the edge of the view does not flip every frame
+    if (!dormant)
     {
-        //calculate the particle's position in the circle
-        circlePosition = (360 * ((float)(i) / numberOfParticles));
-
-        velocityX = (OverallVelocity * cos(circlePosition * radianToDegreeConstant));
-        velocityZ = (OverallVelocity * sin(circlePosition  * radianToDegreeConstant));
-
-        found = false;
-        //find first free particle
-        if (m_headOfFreeList != nullptr)
-        {
-            // break off the head of the free list
-            tempNode = m_headOfFreeList;
-            m_headOfFreeList = m_headOfFreeList->next;
-            //pre set it to the data we want for the new node
-            tempNode->next == nullptr;
-            tempNode->positionX = targetPosition.x;
-            tempNode->positionY = targetPosition.y;
-            tempNode->positionZ = targetPosition.z;
-            tempNode->red = red;
-            tempNode->green = green;
-            tempNode->blue = blue;
-            tempNode->remainingLifeTime = LifeTime;
-            tempNode->velocityX = velocityX;
-            tempNode->velocityY = 0.0f;
-            tempNode->velocityZ = velocityZ;
+        radius *= 1.25f;
+    }
 
-            PlaceNodeInZSortedList(tempNode, &m_headOfAllocatedList);
-        }
-        else
+    if (m_relevanceDistance > 0.0f)
+    {
+        distanceX = center.x - m_relevanceCameraPosition.x;
+        distanceY = center.y - m_relevanceCameraPosition.y;
+        distanceZ = center.z - m_relevanceCameraPosition.z;
+        distance = sqrtf((distanceX * distanceX) + (distanceY * distanceY) + (distanceZ * distanceZ)) - radius;
+        if (distance > m_relevanceDistance)
         {
-            //no more free particles
-            return;
+            return false;
         }
     }
-    return;
+
+    return IsSphereInFrustum(planes, center, radius);
 }
 
-void ParticleManager::MakeFireEffect(XMFLOAT3 targetPosition, float frameTime)
+void ParticleManager::FreeParticleList(Particle** headNode, ParticleSlice slice)
 {
-    bool found;
-    float positionX, positionY, positionZ ;
-
-    float velocityX = 0.0f;
-    float velocityY = 1.5f;
-    float velocityZ = 0.0f;
+    //the slice holds exactly the list's particles, so none of them need a visit
+    m_particleArena.ReleaseSlice(slice);
+    (*headNode) = nullptr;
+    return;
+}
 
-    float baseLifeTime = 6.0f;
-    float lifeTime = baseLifeTime; // used to hold random lifetime
+ParticleManager::Particle* ParticleManager::AllocateParticle(ParticleSlice slice)
+{
+    int index = m_particleArena.Allocate(slice);
+    return (index < 0) ? nullptr : &m_particleList[index];
+}
 
-    float red = 2.0f;
-    float green = 0.8f;
-    float blue = 0.1f;
+void ParticleManager::FreeParticle(ParticleSlice slice, Particle* particle)
+{
+    m_particleArena.Free(slice, (int)(particle - m_particleList));
+}
 
-    Particle* currentNode = m_headOfFireAllocatedList;
-    Particle* tempNode = nullptr;
+void ParticleManager::ApplyEffectLibrary(bool initializing)
+{
+    const EffectLibrary::EffectRecord* record;
 
-    //calculate total fire particles to emit this frame
-    int TotalFireEffects = (int)(m_fireParticlesPerSecond * frameTime);
+    record = m_effectLibrary.FindEffect("default", EFFECT_WORLD);
+    if (record)
+    {
+        m_gravityConstant = record->world.gravity;
+    }
 
-    for (auto i = 0; i < TotalFireEffects; ++i)
+    record = m_effectLibrary.FindEffect("default", EFFECT_RAIN);
+    if (record)
     {
-        // x and z coordiantes are randomized in an area to give the fire depth and width
-        positionX = targetPosition.x + (0.04f * (RNGClass::GetRandomInteger(0, 20)));
-        positionY = targetPosition.y;
-        positionZ = targetPosition.z - (0.0125f * (RNGClass::GetRandomInteger(0, 80)));
+        m_rainSpawnInHeight = record->rain.spawnHeight;
+        m_rainSpawnYVelocity = record->rain.spawnYVelocity;
+        m_rainSplashParticles = record->rain.splashParticles;
+        for (auto i = 0; i < 4; ++i)
+        {
+            m_rainBoxCoordinates[i] = record->rain.box[i];
+        }
 
-        //velocityX is set to a random range to give the fire a cone shape as the particles rise
-        velocityX = (0.015f * (RNGClass::GetRandomInteger(-10, 10)));
+        // the drop count sizes the pool usage and the instance buffer so it can not change on a reload
+        if (initializing)
+        {
+            m_rainInstanceCount = record->rain.dropCount;
+        }
+    }
 
-        //randomized additional lifetime for each particle gives the top of the fire a flickering effect
-        lifeTime = baseLifeTime + (0.1 * RNGClass::GetRandomInteger(0, 15));
+    record = m_effectLibrary.FindEffect("default", EFFECT_FIRE);
+    if (record)
+    {
+        m_fireEffect = record->fire;
+    }
 
-        found = false;
-        //find first free particle
-        if (m_headOfFreeList != nullptr)
-        {
-            // break off the head of the free list
-            tempNode = m_headOfFreeList;
-            m_headOfFreeList = m_headOfFreeList->next;
-            //pre set it to the data we want for the new node
-            tempNode->next == nullptr;
-            tempNode->positionX = positionX;
-            tempNode->positionY = positionY;
-            tempNode->positionZ = positionZ;
-            tempNode->red = red;
-            tempNode->green = green;
-            tempNode->blue = blue;
-            tempNode->remainingLifeTime = lifeTime;
-            tempNode->velocityX = velocityX;
-            tempNode->velocityY = velocityY;
-            tempNode->velocityZ = velocityZ;
+    record = m_effectLibrary.FindEffect("default", EFFECT_RING);
+    if (record)
+    {
+        m_ringEffect = record->ring;
+    }
 
-            PlaceNodeInZSortedList(tempNode, &m_headOfFireAllocatedList);
-            m_fireInstanceCount++;
-        }
-        else
+    //the fall time of the stateless rain depends on the values above, a failed solve keeps the previous fall time
+    if (!initializing && m_useAnalyticRain)
+    {
+        float previousCycleTime = m_rainCycleTime;
+        if (!InitiateAnalyticRainEffects())
         {
-            //no more free particles
-            return;
+            m_rainCycleTime = previousCycleTime;
         }
     }
+    return;
 }
 
 void ParticleManager::InitiateRainEffects()
@@ -932,9 +4164,9 @@ void ParticleManager::InitiateRainEffects()
     {
         //y differential is simply a height between the spawn height and the ground
         // x and z differential is a random integer between 0 and the range of the specific coordiante multiplied by a factor of 10 to give more diversity
-        rainXDifferential = (0.1 * (RNGClass::GetRandomInteger(0, (int)(m_rainBoxCoordinates[1] - m_rainBoxCoordinates[0]) * 10)));
-        rainYDifferential = (0.1 * (RNGClass::GetRandomInteger(0, (int)m_rainSpawnInHeight * 10)));
-        rainZDifferential = (0.1 * (RNGClass::GetRandomInteger(0, (int)(m_rainBoxCoordinates[3] - m_rainBoxCoordinates[2])  * 10)));
+        rainXDifferential = (0.1 * (RandomInteger(0, (int)(m_rainBoxCoordinates[1] - m_rainBoxCoordinates[0]) * 10)));
+        rainYDifferential = (0.1 * (RandomInteger(0, (int)m_rainSpawnInHeight * 10)));
+        rainZDifferential = (0.1 * (RandomInteger(0, (int)(m_rainBoxCoordinates[3] - m_rainBoxCoordinates[2])  * 10)));
         positionX = m_rainBoxCoordinates[0] + rainXDifferential;
         positionY = m_rainSpawnInHeight - rainYDifferential;
         positionZ = m_rainBoxCoordinates[2] + rainZDifferential;
@@ -942,10 +4174,9 @@ void ParticleManager::InitiateRainEffects()
 
         found = false;
         //find first free list
-        if (m_headOfFreeList != nullptr)
+        tempNode = AllocateParticle(SLICE_RAIN);
+        if (tempNode != nullptr)
         {
-            tempNode = m_headOfFreeList;
-            m_headOfFreeList = m_headOfFreeList->next;
 
             tempNode->next == nullptr;
             tempNode->positionX = positionX;
@@ -959,16 +4190,233 @@ void ParticleManager::InitiateRainEffects()
             tempNode->velocityY = velocityY;
             tempNode->velocityZ = velocityZ;
 
-            PlaceNodeInZSortedList(tempNode, &m_headOfRainAllocatedList);
-
+            InsertParticle(tempNode, &m_headOfRainAllocatedList);
+            CountAllocations(1, 0);
         }
         else
         {//no more free particles
+            CountAllocations(0, m_rainInstanceCount - i);
             return;
         }
     }
 }
 
+bool ParticleManager::InitiateAnalyticRainEffects()
+{
+    // the time a drop takes to fall from the spawn height to the ground
+    float cycleTime;
+    if (!SolveGroundTime(m_rainSpawnInHeight, m_rainSpawnYVelocity, m_gravityConstant, &cycleTime) || cycleTime <= 0.0f)
+    {
+        return false;
+    }
+
+    m_rainCycleTime = cycleTime;
+
+    //a dense rain lands far more drops than the pool can hold splashes for, so only every stride'th landing splashes
+    //and the rest of the pool is left to everything else
+    float splashCapacity = (float)(m_compactParticles ? m_compactParticleCapacity : m_maxParticles) * AnalyticRainSplashShare;
+    float liveSplashParticles = ((float)m_rainInstanceCount / m_rainCycleTime) * m_rainSplashParticles * m_ringEffect.lifeTime;
+    m_analyticRainSplashStride = 1;
+    if (splashCapacity > 0.0f && liveSplashParticles > splashCapacity)
+    {
+        m_analyticRainSplashStride = (int)ceilf(liveSplashParticles / splashCapacity);
+    }
+    return true;
+}
+
+void ParticleManager::UpdateAnalyticRain(float frameTime)
+{
+    float positionX, positionZ;
+    double phase;
+    long long previousCycle, currentCycle;
+    double previousTime = m_rainTime;
+
+    m_rainTime += frameTime;
+
+    //only the cycles are compared, a drop's column is hashed just for the landings that splash
+    for (auto i = 0; i < m_rainInstanceCount; ++i)
+    {
+        phase = GetAnalyticRainDropPhase(i);
+        previousCycle = (long long)floor((previousTime + phase) / m_rainCycleTime);
+        currentCycle = (long long)floor((m_rainTime + phase) / m_rainCycleTime);
+
+        //the drop landed during this frame, splash where it fell during the cycle that just ended. Each drop takes its
+        //turn at splashing so the thinned out splashes do not always come from the same drops
+        if (currentCycle != previousCycle && ((i + currentCycle) % m_analyticRainSplashStride) == 0)
+        {
+            GetAnalyticRainDropColumn(i, currentCycle - 1, &positionX, &positionZ);
+            MakeRingEffect(XMFLOAT3(positionX, 0.0f, positionZ), m_rainSplashParticles);
+        }
+    }
+}
+
+double ParticleManager::GetAnalyticRainDropPhase(int dropIndex)
+{
+    // each drop has its own phase so the drops are spread over the whole fall instead of landing together
+    return HashParticleToUnitFloat(m_rainSeed, dropIndex, 0) * (double)m_rainCycleTime;
+}
+
+void ParticleManager::GetAnalyticRainDrop(int dropIndex, double time, XMFLOAT3* position, long long* cycle)
+{
+    double dropTime = time + GetAnalyticRainDropPhase(dropIndex);
+
+    (*cycle) = (long long)floor(dropTime / m_rainCycleTime);
+    float cycleTime = (float)(dropTime - ((*cycle) * (double)m_rainCycleTime));
+
+    GetAnalyticRainDropColumn(dropIndex, (*cycle), &position->x, &position->z);
+    position->y = m_rainSpawnInHeight + (m_rainSpawnYVelocity * cycleTime) + (0.5f * m_gravityConstant * cycleTime * cycleTime);
+}
+
+void ParticleManager::GetAnalyticRainDropColumn(int dropIndex, long long cycle, float* positionX, float* positionZ)
+{
+    // x and z are picked again on every cycle so the drops do not keep falling down the same columns, list rain that
+    // KillParticles resets only gets its height and fall speed back and keeps its column
+    unsigned int salt = (unsigned int)cycle + 1;
+    (*positionX) = m_rainBoxCoordinates[0] + ((m_rainBoxCoordinates[1] - m_rainBoxCoordinates[0]) * HashParticleToUnitFloat(m_rainSeed, dropIndex, salt));
+    (*positionZ) = m_rainBoxCoordinates[2] + ((m_rainBoxCoordinates[3] - m_rainBoxCoordinates[2]) * HashParticleToUnitFloat(m_rainSeed, dropIndex, salt * 2654435761U));
+}
+
+void ParticleManager::InsertParticle(Particle* insertNode, Particle** headNode)
+{
+    if (m_sortStrategy == SORT_INSERTION)
+    {
+        PlaceNodeInZSortedList(insertNode, headNode);
+        return;
+    }
+
+    //the radix pass orders the list later in the frame, or the order does not matter
+    insertNode->next = (*headNode);
+    (*headNode) = insertNode;
+}
+
+void ParticleManager::SortParticleLists()
+{
+    RadixSortList(&m_headOfRainAllocatedList);
+    RadixSortList(&m_headOfFireAllocatedList);
+    RadixSortList(&m_headOfAllocatedList);
+}
+
+void ParticleManager::RadixSortList(Particle** headNode)
+{
+    unsigned int count;
+
+    m_sortNodes.clear();
+    m_sortKeys.clear();
+    for (auto currentNode = (*headNode); currentNode; currentNode = currentNode->next)
+    {
+        SortKey key;
+        key.key = GetDepthSortKey(currentNode->positionZ);
+        key.index = (unsigned int)m_sortNodes.size();
+        m_sortNodes.push_back(currentNode);
+        m_sortKeys.push_back(key);
+    }
+
+    count = (unsigned int)m_sortKeys.size();
+    if (count < 2)
+    {
+        return;
+    }
+    const SortKey* sorted = RadixSortKeys();
+
+    (*headNode) = m_sortNodes[sorted[0].index];
+    for (unsigned int i = 0; i + 1 < count; ++i)
+    {
+        m_sortNodes[sorted[i].index]->next = m_sortNodes[sorted[i + 1].index];
+    }
+    m_sortNodes[sorted[count - 1].index]->next = nullptr;
+}
+
+void ParticleManager::SortAnalyticRain()
+{
+    XMFLOAT3 position;
+    long long cycle;
+
+    //the drops move on every frame and change column when they land, so the order is built again from the positions
+    m_analyticRainPositions.resize(m_rainInstanceCount);
+    m_analyticRainOrder.resize(m_rainInstanceCount);
+    m_sortKeys.clear();
+    for (auto i = 0; i < m_rainInstanceCount; ++i)
+    {
+        SortKey key;
+
+        GetAnalyticRainDrop(i, m_rainTime, &position, &cycle);
+        m_analyticRainPositions[i] = position;
+        key.key = GetDepthSortKey(position.z);
+        key.index = (unsigned int)i;
+        m_sortKeys.push_back(key);
+    }
+
+    if (m_sortKeys.empty())
+    {
+        return;
+    }
+    const SortKey* sorted = RadixSortKeys();
+    for (auto i = 0; i < m_rainInstanceCount; ++i)
+    {
+        m_analyticRainOrder[i] = (int)sorted[i].index;
+    }
+}
+
+unsigned int ParticleManager::GetDepthSortKey(float positionZ)
+{
+    unsigned int bits;
+
+    //flipping the sign bit, or every bit of a negative float, makes floats compare as unsigned integers, and
+    //inverting that puts the largest z first
+    memcpy(&bits, &positionZ, sizeof(bits));
+    bits ^= (bits & 0x80000000u) ? 0xFFFFFFFFu : 0x80000000u;
+    return ~bits;
+}
+
+const ParticleManager::SortKey* ParticleManager::RadixSortKeys()
+{
+    unsigned int histograms[4][256];
+    unsigned int offset;
+    SortKey* source;
+    SortKey* destination;
+    unsigned int count = (unsigned int)m_sortKeys.size();
+
+    m_sortScratch.resize(count);
+
+    memset(histograms, 0, sizeof(histograms));
+    for (unsigned int i = 0; i < count; ++i)
+    {
+        for (auto pass = 0; pass < 4; ++pass)
+        {
+            histograms[pass][(m_sortKeys[i].key >> (pass * 8)) & 0xFF]++;
+        }
+    }
+
+    source = m_sortKeys.data();
+    destination = m_sortScratch.data();
+    for (auto pass = 0; pass < 4; ++pass)
+    {
+        unsigned int* histogram = histograms[pass];
+        int shift = pass * 8;
+
+        //every key has the same byte, the pass would not move anything
+        if (histogram[(source[0].key >> shift) & 0xFF] == count)
+        {
+            continue;
+        }
+
+        offset = 0;
+        for (auto digit = 0; digit < 256; ++digit)
+        {
+            unsigned int digitCount = histogram[digit];
+            histogram[digit] = offset;
+            offset += digitCount;
+        }
+        for (unsigned int i = 0; i < count; ++i)
+        {
+            destination[histogram[(source[i].key >> shift) & 0xFF]++] = source[i];
+        }
+        std::swap(source, destination);
+    }
+
+    return source;
+}
+
 void ParticleManager::PlaceNodeInZSortedList(Particle * insertNode, Particle **headNode)
 {
     bool found = false;
@@ -2,9 +2,23 @@
 #include <d3d11.h>
 #include <DirectXMath.h>
 #include <math.h>
+#include <vector>
 
-#include "RNGClass.h"
-#include "TextureClass.h"
+#include "BillboardBuffer.h"
+#include "CollisionWorld.h"
+#include "CompactParticlePool.h"
+#include "DensityGrid.h"
+#include "EffectLibrary.h"
+#include "InstanceRingBuffer.h"
+#include "OcclusionCuller.h"
+#include "ParticleArena.h"
+#include "ParticleAutoTuner.h"
+#include "ParticleKernels.h"
+#include "ParticleCache.h"
+#include "ParticleStats.h"
+#include "SpawnCommandQueue.h"
+#include "TaskPool.h"
+#include "TextureCache.h"
 
 using namespace DirectX;
 
@@ -37,25 +51,234 @@ private:
     //linked lists
     Particle* m_headOfAllocatedList;
     Particle* m_headOfRainAllocatedList;
-    Particle* m_headOfFreeList;
     Particle* m_headOfFireAllocatedList;
 
+    //each list takes its particles from its own slice of the pool
+    enum ParticleSlice
+    {
+        SLICE_RAIN,
+        SLICE_FIRE,
+        SLICE_GENERAL,
+        SLICE_COUNT
+    };
+    ParticleArena m_particleArena;
+
 public:
+    //particle types feeding the density grid
+    enum DensitySource
+    {
+        DENSITY_RAIN,
+        DENSITY_FIRE,
+        DENSITY_GENERAL,
+        DENSITY_SOURCE_COUNT
+    };
+
     ParticleManager();
     ~ParticleManager();
 
-    // calls private load/initilize functions for textures as well as vertex and instance buffers
+    // queues the textures on the shared texture cache and initializes the vertex and instance buffers, the textures
+    // are loaded in the background so the texture getters return nullptr until they are ready
     bool Initialize(ID3D11Device* device, ID3D11DeviceContext* deviceContext, const char* defaultTextureFilename, const char* rainTextureFilename, const char* fireTextureFilename);
     void Shutdown();
 
     bool Frame(ID3D11DeviceContext* deviceContext, float frameTime);
     void Render(ID3D11DeviceContext* deviceContext);
 
+    //switches rain to stateless drops whose positions are computed from a seed and the elapsed time, must be called before Initialize
+    //@param dropCount: number of rain drops, these do not use the particle pool so it can be much larger than m_maxParticles, their splashes do and are
+    //                 thinned out to fit in part of it
+    void EnableAnalyticRain(int dropCount, unsigned int seed);
+
+    //loads effect parameters from a compiled effect library, the "default" effect of each type replaces the built in values.
+    //The file is watched and reloaded while running, values that size the particle pool only apply at Initialize
+    bool LoadEffectLibrary(const char* filename);
+
+    //simulates the fire once at the origin and renders it under every transform added with AddFireInstance,
+    //must be called before Initialize so the instance buffer can hold the copies. The copies are given room for a
+    //steady fire, when queued fire or a hotter effect outgrows it the farthest copies are left out for the frame and
+    //counted in the stats as dropped instances
+    void EnableFireInstancing(int maxCopies);
+    //@param transform: local to world transform of the copy, row vector convention like the rest of DirectXMath
+    //@param timeOffset: seconds the copy lags behind the simulation, limited to the last MaxFireHistoryFrames frames
+    //@return index of the copy or -1 if maxCopies copies already exist
+    int AddFireInstance(const XMFLOAT4X4& transform, float timeOffset);
+    void SetFireInstanceTransform(int copyIndex, const XMFLOAT4X4& transform);
+    void ClearFireInstances();
+    //bytes of particle state saved by rendering copies instead of simulating each one, minus the cost of the history
+    int GetInstancedFireMemorySaved();
+
+    //tests clusters of particles against occluder meshes rasterized into a cpu depth buffer and leaves the hidden
+    //clusters out of the instance buffer
+    bool EnableOcclusionCulling(int depthWidth, int depthHeight);
+    //@param viewProjection: world to clip space transform of the camera the particles are rendered with
+    void SetOcclusionCamera(const XMFLOAT4X4& viewProjection);
+    //occluder meshes are copied and rasterized again every frame, keep them to a few low poly shapes
+    void AddOccluderMesh(const XMFLOAT3* vertices, int vertexCount, const unsigned int* indices, int indexCount);
+    void ClearOccluderMeshes();
+    //particles left out and kept by the last frame's occlusion test
+    int GetOccludedParticleCount();
+    int GetVisibleParticleCount();
+
+    //static scene geometry the particles collide with, each frame's motion is tested as a segment against the meshes.
+    //BuildSceneCollision must be called after meshes are added. Analytic rain does not collide and neither does an
+    //instanced fire, whose particles are simulated at the origin rather than where its copies are drawn
+    //@return id of the mesh, reported in the impacts
+    int AddCollisionMesh(const XMFLOAT3* vertices, int vertexCount, const unsigned int* indices, int indexCount, CollisionResponse response);
+    bool BuildSceneCollision();
+    void ClearCollisionMeshes();
+    //impacts from the last frame, only the first MaxImpactsPerFrame are kept
+    int GetImpactCount();
+    const ParticleImpact* GetImpacts();
+
+    //splats the particles into a coarse grid of density and emitted light every frame, for fog, volumetric lighting and
+    //"is in smoke" queries. The grid is filled from the frame's instances before occlusion culling, so it does not
+    //depend on where the camera is. Must be called after Initialize
+    //@param minimum, maximum: world space bounds of the grid, particles outside are ignored
+    bool EnableDensityGrid(const XMFLOAT3& minimum, const XMFLOAT3& maximum, int resolutionX, int resolutionY, int resolutionZ);
+    //@param emissionWeight: light added per particle is its color times this
+    void SetDensityWeights(DensitySource source, float densityWeight, float emissionWeight);
+    //nullptr until EnableDensityGrid
+    DensityGrid* GetDensityGrid();
+
+    //records the instance data of every following frame into a baked particle cache
+    bool BeginCacheCapture(const char* filename);
+    bool EndCacheCapture();
+    //replaces the simulation with frames read from a baked particle cache until EndCachePlayback is called
+    //@param loop: restart from the first frame when the cache runs out, otherwise the last frame is held
+    bool BeginCachePlayback(const char* filename, bool loop);
+    void EndCachePlayback();
+
+    //sizes the spawn queue, must be called before Initialize
+    //@param capacity: commands that can wait between two frames before the policy applies
+    void SetSpawnQueueCapacity(int capacity, SpawnQueuePolicy policy);
+    //queue effects to be spawned at the start of the next Frame, these are safe to call from any thread while the
+    //manager is initialized and return false when the request was dropped
+    bool QueueRing(const XMFLOAT3& position, int numberOfParticles);
+    //with fire instancing the position is ignored, the particles join the fire simulated at the origin and show up
+    //under every copy
+    bool QueueFire(const XMFLOAT3& position, int numberOfParticles);
+    bool QueueBurst(const XMFLOAT3& position, int numberOfParticles, float speed, float lifeTime, const XMFLOAT3& color);
+    //for pushing prepared commands and reading the drop counters
+    SpawnCommandQueue* GetSpawnQueue();
+
+    //the continuous fire, not thread safe, call from the thread that calls Frame
+    void SetFirePosition(const XMFLOAT3& position);
+    void SetFireEnabled(bool enabled);
+
+    //throws away every particle of the rain, fire or ring effect at once, rain starts falling again from the top. Ring
+    //also covers bursts, particles in the compact pool are left to expire
+    void ResetEffect(EffectType effect);
+    //packs each effect's particles together in the order they are drawn, the manager also does this by itself every
+    //second when the pool has become fragmented. Not thread safe, call from the thread that calls Frame
+    //@return false when the pool is too full for every effect to start on a block of its own, nothing is moved then
+    bool DefragmentParticles();
+
+    //keeps splash and burst particles in a 24 byte quantized format instead of the linked list, must be called before Initialize
+    //@param maxParticles: size of the compact pool, in addition to the linked list pool
+    void EnableCompactParticles(int maxParticles);
+    //bytes allocated for particle state by the linked list pool and the compact pool
+    int GetParticleStateMemory();
+
+    //advances the effects by the given seconds at a fraction of the cost of running that many frames, for use at load
+    //or when an emitter comes into view. Fire is placed from its steady state, rain is moved along its fall in closed
+    //form and only the bouncing general particles are stepped, with large steps
+    bool Prewarm(float seconds);
+
+    //fire and rain stop simulating and give their particles back to the pool while their bounds are outside the
+    //relevance camera's frustum or further than maxDistance, and catch up with a prewarm of the time they were away.
+    //Fire stays awake while any of its particles, queued fire included, can be seen and QueueFire wakes it
+    //@param maxDistance: 0 for no distance limit
+    void EnableDormantEmitters(float maxDistance);
+    //@param viewProjection: row vector convention like the rest of DirectXMath
+    void SetRelevanceCamera(const XMFLOAT4X4& viewProjection, const XMFLOAT3& cameraPosition);
+    bool IsFireDormant();
+    bool IsRainDormant();
+
+    //extra views (split screen, reflections, minimaps) get their own instance stream built from the one simulation,
+    //culled to the view's frustum and sorted back to front for its camera. Views are built in parallel during Frame.
+    //Occlusion culling is done for the main camera only, views start from the instances before that test
+    //@param device: nullptr keeps the view's instances on the cpu, for a manager initialized without a device
+    //@return index of the view or -1 on failure, must be called after Initialize
+    int AddView(ID3D11Device* device);
+    //@param viewMatrix, projectionMatrix: row vector convention like the rest of DirectXMath
+    void SetViewCamera(int viewIndex, const XMFLOAT4X4& viewMatrix, const XMFLOAT4X4& projectionMatrix);
+    void SetViewEnabled(int viewIndex, bool enabled);
+    void ClearViews();
+    //binds the view's instances, draw the rain, fire and general ranges with the view instance counts below
+    void RenderView(ID3D11DeviceContext* deviceContext, int viewIndex);
+    int GetViewCount();
+    int GetViewRainInstanceCount(int viewIndex);
+    int GetViewFireInstanceCount(int viewIndex);
+    int GetViewInstanceCount(int viewIndex);
+
+    //uploads the instances into a ring buffer shared by every manager on the same immediate context, mapped with no
+    //overwrite, instead of discarding the manager's own instance buffer every frame. Must be called before Initialize
+    //and has no effect with vertex pulling. The first manager on the context sizes the ring. A frame's range is handed
+    //back at the next Frame, so its draws must have been issued by then, and a manager that stops calling Frame holds
+    //its range until Shutdown. When the ring is full the manager's own buffer is used for that frame
+    void EnableInstanceRing(int sizeInBytes);
+    //nullptr until the manager is initialized with the ring enabled
+    InstanceRingBuffer* GetInstanceRing();
+
+    //captures the particle pool, emitter state and random state into a flat buffer and puts them back with bulk copies,
+    //for save games, rollback and resets. Queued spawn commands, impacts and the instanced fire history are not part of
+    //a snapshot, and restored particles show up in the instances at the next Frame
+    int GetMaxSnapshotSize();
+    //@param bytesWritten: out, size of the snapshot, at most GetMaxSnapshotSize
+    bool SaveSnapshot(void* buffer, int bufferSize, int* bytesWritten);
+    //returns false and leaves the manager as it was when the snapshot was taken by a manager with a different pool
+    //layout or any link or index in it is out of range
+    bool RestoreSnapshot(const void* buffer, int bufferSize);
+    //seeds the random numbers used to spawn particles, the same seed and inputs give the same particles
+    void SetRandomSeed(unsigned int seed);
+
+    //updates every list with the runtime configured kernel instead of the kernel specialized for its effect, to compare the two
+    void SetGenericKernels(bool enabled);
+    //updates the lists one after the other or split into chunks of chunkSize particles on the task pool, the auto tuner
+    //replaces this with its own choice while it is enabled
+    void SetUpdateStrategy(UpdateStrategy strategy, int chunkSize);
+
+    //times each stage of Frame and counts particles allocated and dropped by the pool, see ParticleStats. A manager
+    //initialized with a null device and context runs the whole simulation without uploading or rendering, so scenarios
+    //can be measured headless
+    //@param hardwareCounters: also count cache misses and instructions where the platform allows it
+    bool EnableStats(bool hardwareCounters);
+    void DisableStats();
+    //nullptr until EnableStats
+    ParticleStats* GetStats();
+
+    //picks the update and sort strategies while the manager runs, from the particle count and the measured cost of each
+    //strategy, see ParticleAutoTuner. Must be called after Initialize. Each decision is logged to the stats when enabled
+    bool EnableAutoTuner();
+    //goes back to a serial update with insertion sorting
+    void DisableAutoTuner();
+    //nullptr until EnableAutoTuner
+    ParticleAutoTuner* GetAutoTuner();
+
+    //draws the particles from a structured buffer with billboard.vs instead of the vertex, index and instance buffers,
+    //must be called before Initialize. Render then binds the instances to the vertex shader and the particles are drawn
+    //with DrawInstanced(BillboardBuffer::VerticesPerBillboard, GetActiveInstanceCount(), 0, 0)
+    void EnableVertexPulling();
+    bool IsVertexPulling();
+
+    //packs the small particle textures into one atlas texture when they finish loading, must be called before Initialize.
+    //The atlas belongs to the texture cache of the device, the first manager to enable it decides its sizes and every
+    //manager on that device then has its textures packed
+    void EnableTextureAtlas(int atlasSize, int maxTextureSize);
+
     //standard getters
 
     ID3D11ShaderResourceView* GetDefaultTexture();
     ID3D11ShaderResourceView* GetRainTexture();
     ID3D11ShaderResourceView* GetFireTexture();
+    ID3D11ShaderResourceView* GetTextureAtlas();
+    //@param uvRect: out, (left, top, right, bottom) of the texture inside the atlas
+    bool GetDefaultAtlasRegion(XMFLOAT4* uvRect);
+    bool GetRainAtlasRegion(XMFLOAT4* uvRect);
+    bool GetFireAtlasRegion(XMFLOAT4* uvRect);
+    bool AreTexturesLoaded();
+    //true once any of the textures could not be loaded, AreTexturesLoaded then stays false
+    bool HaveTexturesFailed();
     int GetIndexCount();
     int GetVertexCount();
     int GetRainInstanceCount();
@@ -65,34 +288,135 @@ public:
 
 private:
 
-    //sets texture pointer to a new texture and then initializes it using the file passed in
-    bool LoadTexture(ID3D11Device* device, ID3D11DeviceContext* deviceContext, const char* filename, TextureClass** texture);
+    //requests the textures from the cache shared by every manager on the device, creating it for the first one
+    bool AcquireTextures(ID3D11Device* device, const char* defaultTextureFilename, const char* rainTextureFilename, const char* fireTextureFilename);
     void ReleaseTextures();
 
-    TextureClass* m_defaultTexture;
-    TextureClass* m_rainTexture;
-    TextureClass* m_fireTexture;
+    //handles into the texture cache, which is shared by every particle manager on the same device so textures are
+    //only loaded once
+    int m_defaultTexture;
+    int m_rainTexture;
+    int m_fireTexture;
+    bool m_textureCacheAcquired;
+    TextureCache* m_textureCache;
+    bool m_buildTextureAtlas;
+    int m_atlasSize, m_atlasMaxTextureSize;
+
+    struct SharedTextureCache
+    {
+        ID3D11Device* device;
+        TextureCache* cache;
+        int users;
+    };
+    static std::vector<SharedTextureCache> s_textureCaches;
+
+    //worker threads shared by every particle manager
+    bool AcquireTaskPool();
+    void ReleaseTaskPool();
+    bool m_taskPoolAcquired;
+
+    static TaskPool* s_taskPool;
+    static int s_taskPoolUsers;
+
+    //instance ring shared by every particle manager on the same context that enables it
+    bool AcquireInstanceRing(ID3D11Device* device, ID3D11DeviceContext* deviceContext);
+    void ReleaseInstanceRing();
+    bool m_instanceRingAcquired;
+    InstanceRingBuffer* m_instanceRing;
+    int m_instanceRingSize;
+    //range of the ring holding this frame's instances, the allocation is -1 when the own buffer was used
+    int m_instanceRingOffset, m_instanceRingAllocation;
+
+    struct SharedInstanceRing
+    {
+        ID3D11DeviceContext* deviceContext;
+        InstanceRingBuffer* ring;
+        int users;
+    };
+    static std::vector<SharedInstanceRing> s_instanceRings;
+
+    //stage timings, null when stats are off so every hook is one check
+    void BeginStage(ParticleStage stage);
+    void EndStage(ParticleStage stage);
+    //called where a stage hands work to the task pool, the stats then know its counters only saw this thread
+    void MarkStageParallel(ParticleStage stage);
+    void CountAllocations(int allocated, int dropped);
+    void CountDroppedInstances(int dropped);
+    ParticleStats* m_stats;
+
+    //strategies in use, picked by the auto tuner when there is one
+    void BeginTunedWork(TunedWork work);
+    void EndTunedWork(TunedWork work);
+    void ApplyTunerStrategies();
+    ParticleAutoTuner* m_autoTuner;
+    UpdateStrategy m_updateStrategy;
+    int m_updateChunkSize;
+    SortStrategy m_sortStrategy;
 
     //particle initialize
     bool InitializeParticleSystem();
     void ShutdownParticleSystem();
 
     bool InitializeBuffers(ID3D11Device* device);
+    //builds the three particle quads used when vertex pulling is off
+    bool InitializeQuadBuffers(ID3D11Device* device);
     void ShutdownBuffers();
 
 
     void UpdateParticles(float frameTime);
+    //runs the update kernel of the effect over a list, the slice is the one the list's particles come from
+    void RunParticleKernel(EffectType effect, ParticleSlice slice, Particle* headNode, float frameTime);
+    void RunParticleKernelOnList(EffectType effect, Particle* headNode, const ParticleKernelParams& params);
+    void RunParticleKernelOnRange(EffectType effect, int start, int count, const ParticleKernelParams& params);
+    //splits the slice's blocks into chunks of at most m_updateChunkSize particles and updates them on the task pool
+    void RunParticleKernelChunks(EffectType effect, ParticleSlice slice, const ParticleKernelParams& params);
+    //first particle index and particle count of each chunk
+    std::vector<int> m_kernelChunkStarts, m_kernelChunkCounts;
+    //gravity, ground bounces and ageing of the general and compact particles
+    void UpdateGeneralParticles(float frameTime);
     //moves particles based on thier velocity
     void MoveParticles(float frameTime, Particle *currentNode);
     void KillParticles();
 
     //Updates the instance buffers with the individual instance data for each particle type
     bool UpdateBuffers(ID3D11DeviceContext* deviceContext);
+    //writes one instance, going through the occlusion clusters when culling is enabled
+    void WriteInstance(int* index, const XMFLOAT3& position, const XMFLOAT4& color);
+    //tests the gathered cluster and writes it out if it can be seen
+    void FlushOcclusionCluster(int* index);
+    void PrepareOcclusion();
+    //copies m_Instances into the instance buffer
+    bool UploadInstances(ID3D11DeviceContext* deviceContext);
+    //copies the written instances into the next range of the shared ring, returns false when the own buffer has to be used
+    bool UploadInstancesToRing();
+    //packs the instances into a billboard buffer, the type of each comes from the rain and fire ranges
+    bool UploadBillboards(ID3D11DeviceContext* deviceContext, BillboardBuffer* billboardBuffer, const InstanceType* instances, int count, int rainCount, int fireCount);
+    //stores this frame's fire instances in the history ring used by time offset copies
+    void RecordFireHistory(float frameTime);
+    //writes the fire as seen by every copy, returns the index after the last instance written
+    int WriteFireCopyInstances(int index);
+
+    //decodes the cache frame for the current playback time into m_Instances and uploads it
+    bool PlayCacheFrame(ID3D11DeviceContext* deviceContext, float frameTime);
     // set the stride/offest and set the buffers
-    void RenderBuffers(ID3D11DeviceContext* deviceContext);
+    //@param instanceOffset: bytes into the instance buffer where the instances start
+    void RenderBuffers(ID3D11DeviceContext* deviceContext, ID3D11Buffer* instanceBuffer, unsigned int instanceOffset, BillboardBuffer* billboardBuffer);
 
 
 
+    //copies the parameters of the library's default effects into the manager
+    //@param initializing: true when called before the particle pool and buffers are created
+    void ApplyEffectLibrary(bool initializing);
+
+    //update kernels by effect type, a null kernel means the effect has no particle list
+    typedef void (*ParticleKernel)(Particle* headNode, const ParticleKernelParams& params);
+    static const ParticleKernel s_particleKernels[EFFECT_TYPE_COUNT];
+    //the same kernels over particles stored one after the other
+    typedef void (*ParticleRangeKernel)(Particle* particles, int count, const ParticleKernelParams& params);
+    static const ParticleRangeKernel s_particleRangeKernels[EFFECT_TYPE_COUNT];
+    static const ParticleKernelConfig s_genericKernelConfigs[EFFECT_TYPE_COUNT];
+    bool m_useGenericKernels;
+
     //m_maxParticles will be the number of particles allocated by the memory manager
     int m_maxParticles;
     float m_gravityConstant;
@@ -102,34 +426,258 @@ private:
     Particle* m_particleList;
 
     int m_vertexCount, m_indexCount;
-    VertexType* m_vertices;
     InstanceType* m_Instances;
     ID3D11Buffer *m_vertexBuffer, *m_indexBuffer, *m_instanceBuffer;
+    bool m_useVertexPulling;
+    BillboardBuffer m_billboardBuffer;
     int m_totalInstanceCount, m_rainInstanceCount, m_fireInstanceCount;
-    int m_fireParticlesPerSecond;
+    //instances written by the last UpdateBuffers, these differ from the simulated counts when the fire is instanced or
+    //particles are occluded
+    int m_rainRenderCount, m_fireRenderCount;
     float m_rainSpawnInHeight, m_rainSpawnYVelocity;
-    float m_smokeLifeTime;
+    int m_rainSplashParticles;
     float m_activeParticles;
 
+    //effect parameters, filled with the defaults and replaced by the effect library when one is loaded
+    FireEffectDesc m_fireEffect;
+    RingEffectDesc m_ringEffect;
+    EffectLibrary m_effectLibrary;
+
+    //instanced fire, one simulated fire drawn at each copy's transform
+    struct EffectCopy
+    {
+        XMFLOAT4X4 transform;
+        float timeOffset;
+    };
+    struct FireHistoryFrame
+    {
+        std::vector<InstanceType> instances;
+        float frameTime;
+    };
+    static const int MaxFireHistoryFrames = 64;
+    bool m_useFireInstancing;
+    EffectCopy* m_fireCopies;
+    int* m_fireCopyOrder;
+    int m_fireCopyCount, m_maxFireCopies;
+    FireHistoryFrame m_fireHistory[MaxFireHistoryFrames];
+    int m_fireHistoryHead, m_fireHistoryCount;
+    bool m_recordFireHistory;
+    //recorded frame a copy with a time offset draws, nullptr when it draws the live fire
+    const std::vector<InstanceType>* FindFireCopyHistory(const EffectCopy& copy);
+
+    //spawn requests from other threads, drained into m_spawnBatch once per frame
+    SpawnCommandQueue m_spawnQueue;
+    std::vector<SpawnCommand> m_spawnBatch;
+    int m_spawnQueueCapacity;
+    SpawnQueuePolicy m_spawnQueuePolicy;
+
+    XMFLOAT3 m_firePosition;
+    bool m_fireEnabled;
+
+    //per view instance streams
+    struct ViewSortKey
+    {
+        float depth;
+        int index;
+    };
+    struct ViewStream
+    {
+        XMFLOAT4X4 viewMatrix;
+        XMFLOAT4X4 viewProjection;
+        bool enabled;
+        std::vector<InstanceType> instances;
+        std::vector<ViewSortKey> keys;
+        int rainCount, fireCount, instanceCount;
+        //only one of these is created, depending on m_useVertexPulling
+        ID3D11Buffer* instanceBuffer;
+        BillboardBuffer* billboardBuffer;
+    };
+    std::vector<ViewStream*> m_views;
+
+    //culls and sorts every view in parallel then uploads them
+    bool UpdateViews(ID3D11DeviceContext* deviceContext);
+    void BuildViewStream(ViewStream* view);
+    void ShutdownView(ViewStream* view);
+
+    //dormant emitters only keep how long they have been away
+    struct EmitterState
+    {
+        bool dormant;
+        float dormantTime;
+    };
+    bool m_useDormantEmitters;
+    bool m_relevanceCameraSet;
+    XMFLOAT4X4 m_relevanceViewProjection;
+    XMFLOAT3 m_relevanceCameraPosition;
+    float m_relevanceDistance;
+    EmitterState m_fireEmitter, m_rainEmitter;
+
+    //scene collision, the segments are laid out as rain, fire and general list particles followed by compact particles
+    static const int MaxImpactsPerFrame = 4096;
+    static const int CollisionBatchSize = 4096;
+    CollisionWorld m_collisionWorld;
+    std::vector<XMFLOAT3> m_collisionStarts, m_collisionEnds;
+    std::vector<CollisionHit> m_collisionHits;
+    std::vector<Particle*> m_collisionParticles;
+    int m_collisionRainCount, m_collisionFireCount, m_collisionCompactCount;
+    std::vector<ParticleImpact> m_impacts;
+
+    //remembers where every particle starts the frame
+    void BeginSceneCollision();
+    //tests the frame's motion against the scene and bounces, kills or respawns the particles that hit
+    void ResolveSceneCollisions();
+    //@param position: out, where the segment hit, lifted just off the surface
+    //@param normal: out, the triangle normal facing the side the segment started on
+    void GetCollisionPoint(int segment, XMFLOAT3* position, XMFLOAT3* normal);
+    void AddImpact(const XMFLOAT3& position, const XMFLOAT3& normal, ImpactParticleType particleType, int triangle);
+
+    //density grid, rebuilt from m_Instances after they are written
+    DensityGrid* m_densityGrid;
+    float m_densityWeights[DENSITY_SOURCE_COUNT];
+    float m_emissionWeights[DENSITY_SOURCE_COUNT];
+    void UpdateDensityGrid();
+
+    //compact general particles, used in place of m_headOfAllocatedList when enabled
+    CompactParticlePool* m_compactParticles;
+    int m_compactParticleCapacity;
+
+    //baked cache capture and playback
+    ParticleCacheWriter* m_cacheWriter;
+    ParticleCachePlayer* m_cachePlayer;
+    float m_cachePlaybackTime;
+    bool m_cacheLoop;
+
+    //occlusion culling
+    struct OccluderMesh
+    {
+        std::vector<XMFLOAT3> vertices;
+        std::vector<unsigned int> indices;
+    };
+    static const int MaxOcclusionClusterSize = 32;
+    OcclusionCuller* m_occlusionCuller;
+    XMFLOAT4X4 m_occlusionViewProjection;
+    std::vector<OccluderMesh> m_occluders;
+    InstanceType m_occlusionCluster[MaxOcclusionClusterSize];
+    XMFLOAT3 m_occlusionClusterMin, m_occlusionClusterMax;
+    int m_occlusionClusterCount;
+    float m_occlusionClusterSize;
+
+    //the frame's instances as they were before the occlusion test, kept while the extra views or the density grid need
+    //them. Occlusion only holds for the camera it was tested from, so anything else has to start from these
+    std::vector<InstanceType> m_unculledInstances;
+    int m_unculledRainCount, m_unculledFireCount, m_unculledCount;
+    bool m_keepUnculledInstances;
+    //the instances before occlusion culling with their rain and fire ranges, m_Instances when nothing was culled
+    const InstanceType* GetUnculledInstances(int* rainCount, int* fireCount, int* count);
+    int m_occludedParticles, m_visibleParticles;
+    bool m_useEffectLibrary;
+    float m_effectReloadTimer;
+
     // (xleft boundry, xright boundry, zclose boundry, zfar boundry)
     float m_rainBoxCoordinates[4];
 
+    //analytic rain state, the whole effect is described by these values instead of per particle data
+    bool m_useAnalyticRain;
+    int m_analyticRainDropCount;
+    unsigned int m_rainSeed;
+    double m_rainTime;
+    float m_rainCycleTime;
+    //only every m_analyticRainSplashStride'th landing makes a splash, so the splashes of a dense rain stay within
+    //AnalyticRainSplashShare of the particles they are spawned into
+    int m_analyticRainSplashStride;
+    static const float AnalyticRainSplashShare;
+    //drop positions of this frame and the drop indices far to near, filled by SortAnalyticRain
+    std::vector<XMFLOAT3> m_analyticRainPositions;
+    std::vector<int> m_analyticRainOrder;
+
+
+    //random integer in [min, max], from the manager's own generator so snapshots can capture it
+    int RandomInteger(int min, int max);
+    unsigned int m_randomState;
+
+    //index of a node in m_particleList, -1 for nullptr
+    int GetParticleIndex(Particle* particle);
+    //checks that every link and list head of a snapshot is -1 or a particle index and that the lists end without
+    //sharing a particle, so a damaged snapshot is rejected before anything is restored
+    //@param headSlices: arena slice of the list starting at each head
+    //@param particleSlices: out, the slice of the list each particle is on or -1, m_maxParticles entries
+    bool ValidateSnapshotLinks(const int32_t* links, const int32_t* heads, const int* headSlices, int headCount, int* particleSlices);
 
     //Particle effects, 
     // makes a ring effect at given posotin, in the demo it is used in the rain spash effect
     void MakeRingEffect(XMFLOAT3, int numberOfParticles);
 
-    //makes a number of fire particles at a given position, the number of partilces is equal to m_fireParticlesPerSecond / frametime
+    //makes a number of fire particles at a given position, the number of partilces is equal to particlesPerSecond * frametime
     void MakeFireEffect(XMFLOAT3 targetPosition, float frameTime);
+    //@param maxAge: particles are made as if emitted up to this many seconds ago, 0 for new particles
+    void MakeFireParticles(XMFLOAT3 targetPosition, int numberOfParticles, float maxAge);
+
+    //throws particles out from a point in random directions
+    //@param color: rgb
+    void MakeBurstEffect(XMFLOAT3 targetPosition, int numberOfParticles, float speed, float lifeTime, const float* color);
+
+    //drains the spawn queue and makes the requested effects
+    void ProcessSpawnCommands();
+
+    //puts emitters to sleep or wakes them from the relevance camera
+    void UpdateEmitterRelevance(float frameTime);
+    //catches the fire up with the time it was dormant
+    void WakeFireEmitter();
+    bool IsEmitterRelevant(const XMFLOAT4* planes, const XMFLOAT3& center, float radius, bool dormant);
+    //empties the list and hands its slice back to the pool
+    void FreeParticleList(Particle** headNode, ParticleSlice slice);
+    //nullptr when the slice is full and the pool has no free block
+    Particle* AllocateParticle(ParticleSlice slice);
+    void FreeParticle(ParticleSlice slice, Particle* particle);
+    float m_defragmentTimer;
+    std::vector<Particle> m_defragmentParticles;
+
+    //prewarm of each particle type
+    void PrewarmFire(float seconds);
+    void PrewarmRain(float seconds);
+    void PrewarmGeneralParticles(float seconds);
+    static const float PrewarmStepTime;
 
     //starts the rainfall particles on their way, the kill function restarts the rain partciles, so this funciton needs only be called to start the effect
     void InitiateRainEffects();
 
+    //analytic rain helpers, a drop falls from m_rainSpawnInHeight to the ground in m_rainCycleTime and then respawns at a new random x/z
+    bool InitiateAnalyticRainEffects();
+    //advances the rain clock and makes a ring effect for the drops that hit the ground since the last frame, thinned out
+    //by m_analyticRainSplashStride
+    void UpdateAnalyticRain(float frameTime);
+    //time the drop is already into its fall at rain time 0
+    double GetAnalyticRainDropPhase(int dropIndex);
+    //@param cycle: out, number of times the drop has hit the ground by the given time
+    void GetAnalyticRainDrop(int dropIndex, double time, XMFLOAT3* position, long long* cycle);
+    //x and z position of a drop during the given cycle
+    void GetAnalyticRainDropColumn(int dropIndex, long long cycle, float* positionX, float* positionZ);
+
     //linked list helper functins
 
     //places a node into its appropriate list, ordered by z position for alpha blending purposes
     //@param insertNode: is the node of the from the free list that is already loaded with the proper data and ready to be put in the list
     //@param headNode: The head of the list that you want the node inserted into
     void PlaceNodeInZSortedList(Particle* insertNode, Particle** headNode);
+    //adds a new particle to a list the way the sort strategy wants, in order or at the front
+    void InsertParticle(Particle* insertNode, Particle** headNode);
+    //puts every list back in z order
+    void SortParticleLists();
+    //stable least significant digit radix sort of a list by z, back to front
+    void RadixSortList(Particle** headNode);
+    //orders the analytic drops back to front at the current rain time, the drops have no list to sort
+    void SortAnalyticRain();
+
+    struct SortKey
+    {
+        unsigned int key;
+        unsigned int index;
+    };
+    //key that puts the largest z first when sorted in increasing order
+    static unsigned int GetDepthSortKey(float positionZ);
+    //stable radix sort of m_sortKeys, which must not be empty. Returns the sorted keys, in m_sortKeys or m_sortScratch
+    const SortKey* RadixSortKeys();
+    std::vector<Particle*> m_sortNodes;
+    std::vector<SortKey> m_sortKeys, m_sortScratch;
 };
 
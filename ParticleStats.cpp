@@ -0,0 +1,450 @@
+#include "ParticleStats.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+static const char* StageNames[STAGE_COUNT] = {"emitters", "kill", "spawn", "update", "collision", "sort", "instances", "upload"};
+
+
+#ifdef __linux__
+//counts user space of the calling thread on any cpu, the first counter of a group leads it and starts disabled. The
+//task pool's workers are not followed, a counter per worker would have to be opened from inside each of them
+static int OpenCounter(unsigned int type, unsigned long long config, int groupLeader)
+{
+    perf_event_attr attributes;
+
+    memset(&attributes, 0, sizeof(attributes));
+    attributes.size = sizeof(attributes);
+    attributes.type = type;
+    attributes.config = config;
+    attributes.disabled = groupLeader < 0 ? 1 : 0;
+    attributes.exclude_kernel = 1;
+    attributes.exclude_hv = 1;
+    attributes.read_format = PERF_FORMAT_GROUP;
+
+    return (int)syscall(__NR_perf_event_open, &attributes, 0, -1, groupLeader, 0);
+}
+#endif
+
+
+//appends a string with the characters JSON needs escaped
+static void AppendJsonString(std::string* json, const char* text)
+{
+    char escaped[8];
+
+    json->push_back('"');
+    for (; *text; ++text)
+    {
+        unsigned char c = (unsigned char)*text;
+        if (c == '"' || c == '\\')
+        {
+            json->push_back('\\');
+            json->push_back((char)c);
+        }
+        else if (c < 0x20)
+        {
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            json->append(escaped);
+        }
+        else
+        {
+            json->push_back((char)c);
+        }
+    }
+    json->push_back('"');
+    return;
+}
+
+
+ParticleStats::ParticleStats()
+{
+    m_cacheMissCounter = -1;
+    m_instructionCounter = -1;
+    m_logStart = 0;
+    Reset();
+}
+
+
+ParticleStats::~ParticleStats()
+{
+}
+
+
+bool ParticleStats::Initialize(bool hardwareCounters)
+{
+    Reset();
+    m_log.clear();
+    m_logStart = 0;
+
+#ifdef __linux__
+    if (hardwareCounters)
+    {
+        m_cacheMissCounter = OpenCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, -1);
+        if (m_cacheMissCounter >= 0)
+        {
+            m_instructionCounter = OpenCounter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, m_cacheMissCounter);
+        }
+
+        // virtual machines and locked down kernels often refuse, the timings are still worth having without the counters
+        if (m_cacheMissCounter < 0 || m_instructionCounter < 0)
+        {
+            Shutdown();
+            Log("hardware counters unavailable");
+        }
+        else
+        {
+            ioctl(m_cacheMissCounter, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+            ioctl(m_cacheMissCounter, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        }
+    }
+#else
+    if (hardwareCounters)
+    {
+        Log("hardware counters unavailable");
+    }
+#endif
+    return true;
+}
+
+
+void ParticleStats::Shutdown()
+{
+#ifdef __linux__
+    if (m_instructionCounter >= 0)
+    {
+        close(m_instructionCounter);
+    }
+    if (m_cacheMissCounter >= 0)
+    {
+        close(m_cacheMissCounter);
+    }
+#endif
+    m_instructionCounter = -1;
+    m_cacheMissCounter = -1;
+    return;
+}
+
+
+void ParticleStats::Reset()
+{
+    memset(m_stages, 0, sizeof(m_stages));
+    for (auto i = 0; i < STAGE_COUNT; ++i)
+    {
+        m_stageStartCacheMisses[i] = 0;
+        m_stageStartInstructions[i] = 0;
+    }
+    m_lastFrameTime = 0.0;
+    m_totalFrameTime = 0.0;
+    m_frameCount = 0;
+    m_particleFrames = 0;
+    m_allocations = 0;
+    m_dropped = 0;
+    m_droppedInstances = 0;
+    m_lastFrameAllocations = 0;
+    m_lastFrameDropped = 0;
+    m_frameAllocations = 0;
+    m_frameDropped = 0;
+    return;
+}
+
+
+void ParticleStats::BeginFrame()
+{
+    m_frameAllocations = 0;
+    m_frameDropped = 0;
+    m_frameStart = std::chrono::steady_clock::now();
+    return;
+}
+
+
+void ParticleStats::EndFrame(int liveParticles)
+{
+    m_lastFrameTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - m_frameStart).count();
+    m_totalFrameTime += m_lastFrameTime;
+    m_frameCount++;
+    m_particleFrames += liveParticles;
+    m_lastFrameAllocations = m_frameAllocations;
+    m_lastFrameDropped = m_frameDropped;
+    return;
+}
+
+
+void ParticleStats::BeginStage(ParticleStage stage)
+{
+    m_stages[stage].parallel = false;
+    ReadCounters(&m_stageStartCacheMisses[stage], &m_stageStartInstructions[stage]);
+    m_stageStart[stage] = std::chrono::steady_clock::now();
+    return;
+}
+
+
+void ParticleStats::EndStage(ParticleStage stage)
+{
+    StageStats& stats = m_stages[stage];
+    long long cacheMisses, instructions;
+
+    stats.lastTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - m_stageStart[stage]).count();
+    stats.totalTime += stats.lastTime;
+    if (stats.lastTime > stats.maxTime)
+    {
+        stats.maxTime = stats.lastTime;
+    }
+    if (stats.parallel)
+    {
+        stats.parallelFrames++;
+        stats.parallel = false;
+    }
+
+    if (ReadCounters(&cacheMisses, &instructions))
+    {
+        stats.lastCacheMisses = cacheMisses - m_stageStartCacheMisses[stage];
+        stats.lastInstructions = instructions - m_stageStartInstructions[stage];
+        stats.totalCacheMisses += stats.lastCacheMisses;
+        stats.totalInstructions += stats.lastInstructions;
+    }
+    return;
+}
+
+
+void ParticleStats::MarkStageParallel(ParticleStage stage)
+{
+    m_stages[stage].parallel = true;
+    return;
+}
+
+
+void ParticleStats::AddAllocations(int allocated, int dropped)
+{
+    m_allocations += allocated;
+    m_dropped += dropped;
+    m_frameAllocations += allocated;
+    m_frameDropped += dropped;
+    return;
+}
+
+
+void ParticleStats::AddDroppedInstances(int dropped)
+{
+    m_droppedInstances += dropped;
+    return;
+}
+
+
+void ParticleStats::Log(const char* message)
+{
+    LogEntry entry;
+
+    entry.frame = m_frameCount;
+    entry.message = message;
+
+    if ((int)m_log.size() < MaxLogEntries)
+    {
+        m_log.push_back(entry);
+    }
+    else
+    {
+        m_log[m_logStart] = entry;
+        m_logStart = (m_logStart + 1) % MaxLogEntries;
+    }
+    return;
+}
+
+
+double ParticleStats::GetLastStageTime(ParticleStage stage)
+{
+    return m_stages[stage].lastTime;
+}
+
+
+double ParticleStats::GetAverageStageTime(ParticleStage stage)
+{
+    return m_frameCount > 0 ? m_stages[stage].totalTime / (double)m_frameCount : 0.0;
+}
+
+
+double ParticleStats::GetLastFrameTime()
+{
+    return m_lastFrameTime;
+}
+
+
+double ParticleStats::GetAverageFrameTime()
+{
+    return m_frameCount > 0 ? m_totalFrameTime / (double)m_frameCount : 0.0;
+}
+
+
+double ParticleStats::GetParticlesPerSecond()
+{
+    return m_totalFrameTime > 0.0 ? (double)m_particleFrames * 1000.0 / m_totalFrameTime : 0.0;
+}
+
+
+long long ParticleStats::GetFrameCount()
+{
+    return m_frameCount;
+}
+
+
+long long ParticleStats::GetAllocationCount()
+{
+    return m_allocations;
+}
+
+
+long long ParticleStats::GetDroppedCount()
+{
+    return m_dropped;
+}
+
+
+long long ParticleStats::GetDroppedInstanceCount()
+{
+    return m_droppedInstances;
+}
+
+
+long long ParticleStats::GetParallelFrameCount(ParticleStage stage)
+{
+    return m_stages[stage].parallelFrames;
+}
+
+
+bool ParticleStats::HasHardwareCounters()
+{
+    return m_cacheMissCounter >= 0;
+}
+
+
+int ParticleStats::GetLogCount()
+{
+    return (int)m_log.size();
+}
+
+
+const char* ParticleStats::GetLogEntry(int index)
+{
+    if (index < 0 || index >= (int)m_log.size())
+    {
+        return nullptr;
+    }
+    return m_log[(m_logStart + index) % (int)m_log.size()].message.c_str();
+}
+
+
+void ParticleStats::WriteJson(std::string* json)
+{
+    char number[128];
+    bool counters;
+
+    counters = HasHardwareCounters();
+    json->clear();
+
+    snprintf(number, sizeof(number), "{\"frames\":%lld,\"averageFrameMs\":%.6f,\"lastFrameMs\":%.6f,", m_frameCount,
+             GetAverageFrameTime(), m_lastFrameTime);
+    json->append(number);
+    snprintf(number, sizeof(number), "\"particlesPerSecond\":%.1f,\"allocated\":%lld,\"dropped\":%lld,\"droppedInstances\":%lld,",
+             GetParticlesPerSecond(), m_allocations, m_dropped, m_droppedInstances);
+    json->append(number);
+    json->append(counters ? "\"hardwareCounters\":true," : "\"hardwareCounters\":false,");
+
+    json->append("\"stages\":{");
+    for (auto i = 0; i < STAGE_COUNT; ++i)
+    {
+        const StageStats& stats = m_stages[i];
+
+        AppendJsonString(json, StageNames[i]);
+        snprintf(number, sizeof(number), ":{\"averageMs\":%.6f,\"lastMs\":%.6f,\"maxMs\":%.6f", GetAverageStageTime((ParticleStage)i),
+                 stats.lastTime, stats.maxTime);
+        json->append(number);
+        snprintf(number, sizeof(number), ",\"parallelFrames\":%lld", stats.parallelFrames);
+        json->append(number);
+        if (counters && m_frameCount > 0)
+        {
+            snprintf(number, sizeof(number), ",\"cacheMissesPerFrame\":%lld,\"instructionsPerFrame\":%lld",
+                     stats.totalCacheMisses / m_frameCount, stats.totalInstructions / m_frameCount);
+            json->append(number);
+            //the workers' share of the stage is not in the counts
+            if (stats.parallelFrames > 0)
+            {
+                json->append(",\"countersMainThreadOnly\":true");
+            }
+        }
+        json->append(i + 1 < STAGE_COUNT ? "}," : "}");
+    }
+    json->append("},");
+
+    json->append("\"log\":[");
+    for (auto i = 0; i < (int)m_log.size(); ++i)
+    {
+        const LogEntry& entry = m_log[(m_logStart + i) % (int)m_log.size()];
+
+        snprintf(number, sizeof(number), "{\"frame\":%lld,\"message\":", entry.frame);
+        json->append(number);
+        AppendJsonString(json, entry.message.c_str());
+        json->append(i + 1 < (int)m_log.size() ? "}," : "}");
+    }
+    json->append("]}");
+    return;
+}
+
+
+bool ParticleStats::WriteJsonFile(const char* filename)
+{
+    std::string json;
+    FILE* file;
+    size_t written;
+
+    WriteJson(&json);
+
+    file = fopen(filename, "wb");
+    if (!file)
+    {
+        return false;
+    }
+    written = fwrite(json.data(), 1, json.size(), file);
+    fclose(file);
+    return written == json.size();
+}
+
+
+const char* ParticleStats::GetStageName(ParticleStage stage)
+{
+    return StageNames[stage];
+}
+
+
+bool ParticleStats::ReadCounters(long long* cacheMisses, long long* instructions)
+{
+#ifdef __linux__
+    //layout of a group read without time fields, one value per counter in the order they joined the group
+    struct
+    {
+        unsigned long long count;
+        unsigned long long values[2];
+    } group;
+
+    if (m_cacheMissCounter < 0)
+    {
+        return false;
+    }
+    if (read(m_cacheMissCounter, &group, sizeof(group)) != (ssize_t)sizeof(group) || group.count != 2)
+    {
+        return false;
+    }
+    (*cacheMisses) = (long long)group.values[0];
+    (*instructions) = (long long)group.values[1];
+    return true;
+#else
+    (void)cacheMisses;
+    (void)instructions;
+    return false;
+#endif
+}
@@ -0,0 +1,119 @@
+#pragma once
+#include <chrono>
+#include <string>
+#include <vector>
+
+//parts of ParticleManager::Frame that are timed separately
+enum ParticleStage
+{
+    //dormant emitter checks
+    STAGE_EMITTERS,
+    STAGE_KILL,
+    //analytic rain, queued spawns and fire emission
+    STAGE_SPAWN,
+    STAGE_UPDATE,
+    STAGE_COLLISION,
+    //radix sorting the lists, only when that sort strategy is in use
+    STAGE_SORT,
+    //writing and occlusion culling the instances
+    STAGE_INSTANCES,
+    //buffer uploads, the density grid and the extra views
+    STAGE_UPLOAD,
+    STAGE_COUNT
+};
+
+// Instrumentation for the particle manager: time spent in each stage of a frame, particles allocated from and dropped
+// by the pool, particles simulated per second and, on linux, cache misses and instructions from perf events. Decisions
+// made at runtime are written to a small log. Everything can be written out as one JSON object so runs can be compared
+// by scripts. Hardware counters only count the thread that calls Frame, work handed to the task pool is not included, so
+// the JSON marks the counters of every stage that handed work to the pool as main thread only.
+class ParticleStats
+{
+public:
+    static const int MaxLogEntries = 256;
+
+    ParticleStats();
+    ~ParticleStats();
+
+    //@param hardwareCounters: also open the perf event counters, the stats still work without them when they are not
+    //available or the kernel does not allow them
+    bool Initialize(bool hardwareCounters);
+    void Shutdown();
+    //clears every total, the log is kept
+    void Reset();
+
+    void BeginFrame();
+    //@param liveParticles: particles simulated during the frame
+    void EndFrame(int liveParticles);
+    void BeginStage(ParticleStage stage);
+    void EndStage(ParticleStage stage);
+    //the stage open now handed some of its work to the task pool, its hardware counters miss that part
+    void MarkStageParallel(ParticleStage stage);
+
+    //@param dropped: particles that were asked for but did not fit in the pool
+    void AddAllocations(int allocated, int dropped);
+    //@param dropped: instances that were simulated but did not fit in the instance array
+    void AddDroppedInstances(int dropped);
+    //records an event with the frame it happened on, the oldest entry is dropped once MaxLogEntries are kept
+    void Log(const char* message);
+
+    //times are in milliseconds
+    double GetLastStageTime(ParticleStage stage);
+    double GetAverageStageTime(ParticleStage stage);
+    double GetLastFrameTime();
+    double GetAverageFrameTime();
+    //particles simulated per second of frame time, over every frame since the last Reset
+    double GetParticlesPerSecond();
+    long long GetFrameCount();
+    long long GetAllocationCount();
+    long long GetDroppedCount();
+    long long GetDroppedInstanceCount();
+    //frames in which the stage handed work to the task pool
+    long long GetParallelFrameCount(ParticleStage stage);
+    bool HasHardwareCounters();
+    int GetLogCount();
+    //@param index: 0 is the oldest entry still kept
+    const char* GetLogEntry(int index);
+
+    void WriteJson(std::string* json);
+    bool WriteJsonFile(const char* filename);
+
+    static const char* GetStageName(ParticleStage stage);
+
+private:
+    struct StageStats
+    {
+        double lastTime, totalTime, maxTime;
+        long long lastCacheMisses, totalCacheMisses;
+        long long lastInstructions, totalInstructions;
+        bool parallel;
+        long long parallelFrames;
+    };
+    struct LogEntry
+    {
+        long long frame;
+        std::string message;
+    };
+
+    //reads both counters at once, returns false when hardware counters are off
+    bool ReadCounters(long long* cacheMisses, long long* instructions);
+
+    StageStats m_stages[STAGE_COUNT];
+    std::chrono::steady_clock::time_point m_stageStart[STAGE_COUNT];
+    long long m_stageStartCacheMisses[STAGE_COUNT], m_stageStartInstructions[STAGE_COUNT];
+
+    std::chrono::steady_clock::time_point m_frameStart;
+    double m_lastFrameTime, m_totalFrameTime;
+    long long m_frameCount;
+    long long m_particleFrames;
+    long long m_allocations, m_dropped;
+    long long m_droppedInstances;
+    long long m_lastFrameAllocations, m_lastFrameDropped;
+    long long m_frameAllocations, m_frameDropped;
+
+    std::vector<LogEntry> m_log;
+    int m_logStart;
+
+    //perf event file descriptors, the instruction counter is read as part of the cache miss group
+    int m_cacheMissCounter, m_instructionCounter;
+};
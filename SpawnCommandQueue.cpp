@@ -0,0 +1,341 @@
+#include "SpawnCommandQueue.h"
+
+#include <math.h>
+
+const float SpawnCommandQueue::CoalesceCellSize = 1.0f;
+
+//grid cells are stored as 12 bit unsigned coordinates around the origin
+static const int CoalesceCellBits = 12;
+static const int CoalesceCellOffset = 1 << (CoalesceCellBits - 1);
+static const int CoalesceCountBits = 24;
+static const uint64_t CoalesceCountMask = (1ull << CoalesceCountBits) - 1;
+
+
+//returns false for positions outside the grid, clamping them would spawn the command somewhere else
+static bool QuantizeCoalesceCell(float value, float cellSize, uint64_t* cell)
+{
+    float gridCell = floorf(value / cellSize) + CoalesceCellOffset;
+    if (!(gridCell >= 0.0f && gridCell < (float)(1 << CoalesceCellBits)))
+    {
+        return false;
+    }
+    (*cell) = (uint64_t)gridCell;
+    return true;
+}
+
+
+static float DequantizeCoalesceCell(uint64_t cell, float cellSize)
+{
+    return (((int)cell - CoalesceCellOffset) + 0.5f) * cellSize;
+}
+
+
+SpawnCommandQueue::SpawnCommandQueue()
+{
+    m_cells = nullptr;
+    m_mask = 0;
+    m_policy = SPAWN_POLICY_DROP;
+    m_enqueuePosition.store(0);
+    m_dequeuePosition.store(0);
+    for (auto i = 0; i < CoalesceSlotCount; ++i)
+    {
+        m_coalesceSlots[i].store(0);
+    }
+    m_pushedCount.store(0);
+    m_droppedCount.store(0);
+    m_coalescedCount.store(0);
+}
+
+
+SpawnCommandQueue::~SpawnCommandQueue()
+{
+}
+
+
+bool SpawnCommandQueue::Initialize(int capacity, SpawnQueuePolicy policy)
+{
+    uint32_t size = 2;
+
+    if (capacity <= 0)
+    {
+        return false;
+    }
+
+    while (size < (uint32_t)capacity)
+    {
+        size <<= 1;
+    }
+
+    m_cells = new Cell[size];
+    if (!m_cells)
+    {
+        return false;
+    }
+
+    // a cell is free for the producer at position p when its sequence is p
+    for (uint32_t i = 0; i < size; ++i)
+    {
+        m_cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    m_mask = size - 1;
+    m_policy = policy;
+    m_enqueuePosition.store(0, std::memory_order_relaxed);
+    m_dequeuePosition.store(0, std::memory_order_relaxed);
+    for (auto i = 0; i < CoalesceSlotCount; ++i)
+    {
+        m_coalesceSlots[i].store(0, std::memory_order_relaxed);
+    }
+    m_pushedCount.store(0);
+    m_droppedCount.store(0);
+    m_coalescedCount.store(0);
+    return true;
+}
+
+
+void SpawnCommandQueue::Shutdown()
+{
+    if (m_cells)
+    {
+        delete[] m_cells;
+        m_cells = nullptr;
+    }
+    m_mask = 0;
+    return;
+}
+
+
+bool SpawnCommandQueue::Push(const SpawnCommand& command)
+{
+    if (!m_cells || command.count <= 0 || command.type < 0 || command.type >= SPAWN_TYPE_COUNT)
+    {
+        return false;
+    }
+
+    m_pushedCount.fetch_add(1, std::memory_order_relaxed);
+
+    if (TryPush(command))
+    {
+        return true;
+    }
+
+    if (m_policy == SPAWN_POLICY_COALESCE && command.type != SPAWN_BURST)
+    {
+        if (Coalesce(command))
+        {
+            m_coalescedCount.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+
+    m_droppedCount.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+
+bool SpawnCommandQueue::TryPush(const SpawnCommand& command)
+{
+    Cell* cell;
+    uint32_t position, sequence;
+    int32_t difference;
+
+    position = m_enqueuePosition.load(std::memory_order_relaxed);
+    for (;;)
+    {
+        cell = &m_cells[position & m_mask];
+        sequence = cell->sequence.load(std::memory_order_acquire);
+        difference = (int32_t)(sequence - position);
+        if (difference == 0)
+        {
+            // the cell is free, claim the position
+            if (m_enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if (difference < 0)
+        {
+            // the consumer has not emptied this cell yet so the queue is full
+            return false;
+        }
+        else
+        {
+            // another producer took the position first
+            position = m_enqueuePosition.load(std::memory_order_relaxed);
+        }
+    }
+
+    cell->command = command;
+    cell->sequence.store(position + 1, std::memory_order_release);
+    return true;
+}
+
+
+bool SpawnCommandQueue::TryPop(SpawnCommand* command)
+{
+    Cell* cell;
+    uint32_t position, sequence;
+
+    // there is only one consumer so the dequeue position needs no compare exchange
+    position = m_dequeuePosition.load(std::memory_order_relaxed);
+    cell = &m_cells[position & m_mask];
+    sequence = cell->sequence.load(std::memory_order_acquire);
+    if ((int32_t)(sequence - (position + 1)) < 0)
+    {
+        return false;
+    }
+
+    *command = cell->command;
+    m_dequeuePosition.store(position + 1, std::memory_order_relaxed);
+    cell->sequence.store(position + m_mask + 1, std::memory_order_release);
+    return true;
+}
+
+
+bool SpawnCommandQueue::Coalesce(const SpawnCommand& command)
+{
+    uint64_t key, slotValue, newValue, count, hash;
+    uint64_t cellX, cellY, cellZ;
+    int slot;
+
+    if (!QuantizeCoalesceCell(command.position.x, CoalesceCellSize, &cellX) ||
+        !QuantizeCoalesceCell(command.position.y, CoalesceCellSize, &cellY) ||
+        !QuantizeCoalesceCell(command.position.z, CoalesceCellSize, &cellZ))
+    {
+        return false;
+    }
+
+    key = ((uint64_t)command.type + 1);
+    key = (key << CoalesceCellBits) | cellX;
+    key = (key << CoalesceCellBits) | cellY;
+    key = (key << CoalesceCellBits) | cellZ;
+
+    hash = key * 0x9e3779b97f4a7c15ull;
+    for (auto probe = 0; probe < CoalesceProbeCount; ++probe)
+    {
+        slot = (int)((hash >> 58) + probe) & (CoalesceSlotCount - 1);
+        slotValue = m_coalesceSlots[slot].load(std::memory_order_relaxed);
+        for (;;)
+        {
+            if (slotValue != 0 && (slotValue >> CoalesceCountBits) != key)
+            {
+                // taken by another cell, try the next slot
+                break;
+            }
+
+            count = (slotValue & CoalesceCountMask) + (uint64_t)command.count;
+            if (count > CoalesceCountMask)
+            {
+                count = CoalesceCountMask;
+            }
+            newValue = (key << CoalesceCountBits) | count;
+
+            if (m_coalesceSlots[slot].compare_exchange_weak(slotValue, newValue, std::memory_order_relaxed))
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+
+int SpawnCommandQueue::Drain(SpawnCommand* commands, int maxCommands)
+{
+    uint64_t slotValue, key;
+    int count = 0;
+
+    if (!m_cells)
+    {
+        return 0;
+    }
+
+    while (count < maxCommands && TryPop(&commands[count]))
+    {
+        count++;
+    }
+
+    for (auto i = 0; i < CoalesceSlotCount && count < maxCommands; ++i)
+    {
+        if (m_coalesceSlots[i].load(std::memory_order_relaxed) == 0)
+        {
+            continue;
+        }
+
+        slotValue = m_coalesceSlots[i].exchange(0, std::memory_order_relaxed);
+        if (slotValue == 0)
+        {
+            continue;
+        }
+
+        // coalesced commands are placed at the centre of their grid cell
+        key = slotValue >> CoalesceCountBits;
+        SpawnCommand& command = commands[count];
+        command.position.z = DequantizeCoalesceCell(key & ((1 << CoalesceCellBits) - 1), CoalesceCellSize);
+        key >>= CoalesceCellBits;
+        command.position.y = DequantizeCoalesceCell(key & ((1 << CoalesceCellBits) - 1), CoalesceCellSize);
+        key >>= CoalesceCellBits;
+        command.position.x = DequantizeCoalesceCell(key & ((1 << CoalesceCellBits) - 1), CoalesceCellSize);
+        key >>= CoalesceCellBits;
+        command.type = (SpawnCommandType)(key - 1);
+        command.count = (int)(slotValue & CoalesceCountMask);
+        command.speed = 0.0f;
+        command.lifeTime = 0.0f;
+        command.color[0] = 1.0f;
+        command.color[1] = 1.0f;
+        command.color[2] = 1.0f;
+        count++;
+    }
+    return count;
+}
+
+
+void SpawnCommandQueue::Discard()
+{
+    SpawnCommand command;
+
+    if (!m_cells)
+    {
+        return;
+    }
+
+    while (TryPop(&command))
+    {
+    }
+
+    for (auto i = 0; i < CoalesceSlotCount; ++i)
+    {
+        m_coalesceSlots[i].store(0, std::memory_order_relaxed);
+    }
+    return;
+}
+
+
+int SpawnCommandQueue::GetMaxDrainCount()
+{
+    return m_cells ? (int)(m_mask + 1) + CoalesceSlotCount : 0;
+}
+
+
+int SpawnCommandQueue::GetCapacity()
+{
+    return m_cells ? (int)(m_mask + 1) : 0;
+}
+
+
+int SpawnCommandQueue::GetPushedCount()
+{
+    return m_pushedCount.load(std::memory_order_relaxed);
+}
+
+
+int SpawnCommandQueue::GetDroppedCount()
+{
+    return m_droppedCount.load(std::memory_order_relaxed);
+}
+
+
+int SpawnCommandQueue::GetCoalescedCount()
+{
+    return m_coalescedCount.load(std::memory_order_relaxed);
+}
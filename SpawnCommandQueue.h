@@ -0,0 +1,99 @@
+#pragma once
+#include <DirectXMath.h>
+
+#include <atomic>
+#include <cstdint>
+
+using namespace DirectX;
+
+enum SpawnCommandType
+{
+    //ring of particles using the ring effect parameters, the rain splash
+    SPAWN_RING,
+    //fire particles using the fire effect parameters
+    SPAWN_FIRE,
+    //particles thrown out in random directions with the command's own speed, lifetime and color, sparks and explosions
+    SPAWN_BURST,
+    SPAWN_TYPE_COUNT
+};
+
+//what a full queue does with a new command
+enum SpawnQueuePolicy
+{
+    //the command is dropped and counted
+    SPAWN_POLICY_DROP,
+    //ring and fire commands are merged into a command of the same type in the same grid cell, bursts are still dropped.
+    //The grid covers 2048 cells either side of the origin, commands outside it are dropped as well
+    SPAWN_POLICY_COALESCE
+};
+
+struct SpawnCommand
+{
+    SpawnCommandType type;
+    XMFLOAT3 position;
+    int count;
+    //only used by SPAWN_BURST
+    float speed;
+    float lifeTime;
+    float color[3];
+};
+
+// Bounded lock-free queue of spawn requests. Any number of threads can push while the particle manager pops from the
+// render thread, each cell carries a sequence number so producers only contend on the shared enqueue position and a
+// full queue never allocates. Commands that do not fit are dropped or, with SPAWN_POLICY_COALESCE, added to a small
+// table of per grid cell counters that is emptied along with the queue.
+class SpawnCommandQueue
+{
+private:
+    struct alignas(64) Cell
+    {
+        std::atomic<uint32_t> sequence;
+        SpawnCommand command;
+    };
+
+    //coalesced commands are stored as one word, the type and grid cell in the high bits and the count in the low 24
+    static const int CoalesceSlotCount = 64;
+    static const int CoalesceProbeCount = 4;
+    static const float CoalesceCellSize;
+
+public:
+    SpawnCommandQueue();
+    ~SpawnCommandQueue();
+
+    //@param capacity: rounded up to a power of two
+    bool Initialize(int capacity, SpawnQueuePolicy policy);
+    void Shutdown();
+
+    //safe to call from any thread, returns false if the command was dropped
+    bool Push(const SpawnCommand& command);
+
+    //pops up to maxCommands commands in the order they were pushed followed by the coalesced commands, only one thread may drain
+    int Drain(SpawnCommand* commands, int maxCommands);
+    //empties the queue without returning the commands
+    void Discard();
+
+    //the most commands one Drain can return
+    int GetMaxDrainCount();
+    int GetCapacity();
+    //counters since Initialize, for tuning the capacity under load
+    int GetPushedCount();
+    int GetDroppedCount();
+    int GetCoalescedCount();
+
+private:
+    bool TryPush(const SpawnCommand& command);
+    bool TryPop(SpawnCommand* command);
+    bool Coalesce(const SpawnCommand& command);
+
+    Cell* m_cells;
+    uint32_t m_mask;
+    SpawnQueuePolicy m_policy;
+
+    //kept on separate cache lines so producers and the consumer do not invalidate each other
+    alignas(64) std::atomic<uint32_t> m_enqueuePosition;
+    alignas(64) std::atomic<uint32_t> m_dequeuePosition;
+
+    alignas(64) std::atomic<uint64_t> m_coalesceSlots[CoalesceSlotCount];
+
+    std::atomic<int> m_pushedCount, m_droppedCount, m_coalescedCount;
+};
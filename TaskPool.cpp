@@ -0,0 +1,143 @@
+#include "TaskPool.h"
+
+
+TaskPool::TaskPool()
+{
+    m_function = nullptr;
+    m_nextIndex.store(0);
+    m_count = 0;
+    m_busyThreads = 0;
+    m_batch = 0;
+    m_quit = false;
+}
+
+
+TaskPool::~TaskPool()
+{
+}
+
+
+bool TaskPool::Initialize(int threadCount)
+{
+    if (threadCount < 0)
+    {
+        threadCount = (int)std::thread::hardware_concurrency() - 1;
+        if (threadCount < 0)
+        {
+            threadCount = 0;
+        }
+    }
+
+    m_quit = false;
+    m_batch = 0;
+    for (auto i = 0; i < threadCount; ++i)
+    {
+        m_threads.push_back(std::thread(&TaskPool::WorkerThread, this));
+    }
+    return true;
+}
+
+
+void TaskPool::Shutdown()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_wakeCondition.notify_all();
+
+    for (auto i = 0; i < (int)m_threads.size(); ++i)
+    {
+        m_threads[i].join();
+    }
+    m_threads.clear();
+    return;
+}
+
+
+void TaskPool::ParallelFor(int count, const std::function<void(int)>& function)
+{
+    if (count <= 0)
+    {
+        return;
+    }
+
+    // nothing to share the work with, or not enough work to be worth waking anyone
+    if (m_threads.empty() || count == 1)
+    {
+        for (auto i = 0; i < count; ++i)
+        {
+            function(i);
+        }
+        return;
+    }
+
+    std::lock_guard<std::mutex> batchLock(m_batchMutex);
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_function = &function;
+        m_count = count;
+        m_nextIndex.store(0, std::memory_order_relaxed);
+        m_busyThreads = (int)m_threads.size();
+        m_batch++;
+    }
+    m_wakeCondition.notify_all();
+
+    RunIndices();
+
+    // the function must outlive every call made by the workers
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_doneCondition.wait(lock, [this] { return m_busyThreads == 0; });
+    m_function = nullptr;
+    return;
+}
+
+
+int TaskPool::GetThreadCount()
+{
+    return (int)m_threads.size();
+}
+
+
+void TaskPool::WorkerThread()
+{
+    unsigned int lastBatch = 0;
+
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wakeCondition.wait(lock, [this, lastBatch] { return m_quit || m_batch != lastBatch; });
+            if (m_quit)
+            {
+                return;
+            }
+            lastBatch = m_batch;
+        }
+
+        RunIndices();
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_busyThreads--;
+        }
+        m_doneCondition.notify_one();
+    }
+}
+
+
+void TaskPool::RunIndices()
+{
+    int index;
+
+    for (;;)
+    {
+        index = m_nextIndex.fetch_add(1, std::memory_order_relaxed);
+        if (index >= m_count)
+        {
+            return;
+        }
+        (*m_function)(index);
+    }
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Small pool of worker threads for splitting per frame work. ParallelFor hands out indices from an atomic counter so
+// uneven items balance themselves, and the calling thread works through indices too instead of only waiting.
+class TaskPool
+{
+public:
+    TaskPool();
+    ~TaskPool();
+
+    //@param threadCount: worker threads besides the caller, a negative count uses one less than the number of cores
+    bool Initialize(int threadCount);
+    void Shutdown();
+
+    //calls function(index) for every index in [0, count) and returns once all calls have finished. Calls from
+    //different threads are run one after the other
+    void ParallelFor(int count, const std::function<void(int)>& function);
+
+    //worker threads, not counting the caller
+    int GetThreadCount();
+
+private:
+    void WorkerThread();
+    //takes indices until none are left
+    void RunIndices();
+
+    std::vector<std::thread> m_threads;
+
+    //held for the whole of a ParallelFor so only one batch runs at a time
+    std::mutex m_batchMutex;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wakeCondition;
+    std::condition_variable m_doneCondition;
+    const std::function<void(int)>* m_function;
+    std::atomic<int> m_nextIndex;
+    int m_count;
+    int m_busyThreads;
+    unsigned int m_batch;
+    bool m_quit;
+};
@@ -0,0 +1,308 @@
+#include "NullDevice.h"
+
+#include <string.h>
+#include <vector>
+
+namespace
+{
+    //reference counting for every object the device hands out, the count of live objects goes back to the device
+    template <class Interface>
+    class NullObject : public Interface
+    {
+    public:
+        NullObject(std::atomic<int>* liveObjects)
+        {
+            m_references = 1;
+            m_liveObjects = liveObjects;
+            (*m_liveObjects)++;
+        }
+
+        virtual ~NullObject()
+        {
+            (*m_liveObjects)--;
+        }
+
+        unsigned long AddRef() override
+        {
+            return ++m_references;
+        }
+
+        unsigned long Release() override
+        {
+            unsigned long references = --m_references;
+            if (references == 0)
+            {
+                delete this;
+            }
+            return references;
+        }
+
+    private:
+        std::atomic<unsigned long> m_references;
+        std::atomic<int>* m_liveObjects;
+    };
+
+    class NullBuffer : public NullObject<ID3D11Buffer>
+    {
+    public:
+        NullBuffer(std::atomic<int>* liveObjects, UINT byteWidth) : NullObject<ID3D11Buffer>(liveObjects), m_data(byteWidth)
+        {
+        }
+
+        void GetType(D3D11_RESOURCE_DIMENSION* resourceDimension) override
+        {
+            (*resourceDimension) = D3D11_RESOURCE_DIMENSION_BUFFER;
+        }
+
+        std::vector<unsigned char> m_data;
+    };
+
+    class NullTexture2D : public NullObject<ID3D11Texture2D>
+    {
+    public:
+        NullTexture2D(std::atomic<int>* liveObjects, const D3D11_TEXTURE2D_DESC& desc) : NullObject<ID3D11Texture2D>(liveObjects)
+        {
+            m_desc = desc;
+        }
+
+        void GetType(D3D11_RESOURCE_DIMENSION* resourceDimension) override
+        {
+            (*resourceDimension) = D3D11_RESOURCE_DIMENSION_TEXTURE2D;
+        }
+
+        void GetDesc(D3D11_TEXTURE2D_DESC* desc) override
+        {
+            (*desc) = m_desc;
+        }
+
+    private:
+        D3D11_TEXTURE2D_DESC m_desc;
+    };
+
+    class NullShaderResourceView : public NullObject<ID3D11ShaderResourceView>
+    {
+    public:
+        NullShaderResourceView(std::atomic<int>* liveObjects, ID3D11Resource* resource) : NullObject<ID3D11ShaderResourceView>(liveObjects)
+        {
+            m_resource = resource;
+            m_resource->AddRef();
+        }
+
+        ~NullShaderResourceView()
+        {
+            m_resource->Release();
+        }
+
+        void GetResource(ID3D11Resource** resource) override
+        {
+            m_resource->AddRef();
+            (*resource) = m_resource;
+        }
+
+    private:
+        ID3D11Resource* m_resource;
+    };
+
+    class NullQuery : public NullObject<ID3D11Query>
+    {
+    public:
+        NullQuery(std::atomic<int>* liveObjects) : NullObject<ID3D11Query>(liveObjects)
+        {
+        }
+    };
+
+    class NullCommandList : public NullObject<ID3D11CommandList>
+    {
+    public:
+        NullCommandList(std::atomic<int>* liveObjects) : NullObject<ID3D11CommandList>(liveObjects)
+        {
+        }
+    };
+
+    class NullDeviceContext : public NullObject<ID3D11DeviceContext>
+    {
+    public:
+        NullDeviceContext(std::atomic<int>* liveObjects, std::atomic<int>* executedCommandLists, std::atomic<int>* copies)
+            : NullObject<ID3D11DeviceContext>(liveObjects)
+        {
+            m_liveObjects = liveObjects;
+            m_executedCommandLists = executedCommandLists;
+            m_copies = copies;
+        }
+
+        HRESULT Map(ID3D11Resource* resource, UINT, D3D11_MAP, UINT, D3D11_MAPPED_SUBRESOURCE* mappedResource) override
+        {
+            D3D11_RESOURCE_DIMENSION dimension;
+
+            //only buffers have memory behind them
+            resource->GetType(&dimension);
+            if (dimension != D3D11_RESOURCE_DIMENSION_BUFFER)
+            {
+                return E_FAIL;
+            }
+
+            NullBuffer* buffer = static_cast<NullBuffer*>(static_cast<ID3D11Buffer*>(resource));
+            mappedResource->pData = buffer->m_data.data();
+            mappedResource->RowPitch = (UINT)buffer->m_data.size();
+            mappedResource->DepthPitch = (UINT)buffer->m_data.size();
+            return S_OK;
+        }
+
+        void Unmap(ID3D11Resource*, UINT) override
+        {
+        }
+
+        void IASetIndexBuffer(ID3D11Buffer*, DXGI_FORMAT, UINT) override
+        {
+        }
+
+        void IASetVertexBuffers(UINT, UINT, ID3D11Buffer* const*, const UINT*, const UINT*) override
+        {
+        }
+
+        void IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY) override
+        {
+        }
+
+        void VSSetShaderResources(UINT, UINT, ID3D11ShaderResourceView* const*) override
+        {
+        }
+
+        void End(ID3D11Asynchronous*) override
+        {
+        }
+
+        HRESULT GetData(ID3D11Asynchronous*, void* data, UINT dataSize, UINT) override
+        {
+            //nothing is ever in flight, so every query is done
+            if (data && dataSize >= sizeof(int))
+            {
+                (*(int*)data) = TRUE;
+            }
+            return S_OK;
+        }
+
+        HRESULT FinishCommandList(int, ID3D11CommandList** commandList) override
+        {
+            (*commandList) = new NullCommandList(m_liveObjects);
+            return S_OK;
+        }
+
+        void ExecuteCommandList(ID3D11CommandList*, int) override
+        {
+            (*m_executedCommandLists)++;
+        }
+
+        void CopySubresourceRegion(ID3D11Resource*, UINT, UINT, UINT, UINT, ID3D11Resource*, UINT, const D3D11_BOX*) override
+        {
+            (*m_copies)++;
+        }
+
+    private:
+        std::atomic<int>* m_liveObjects;
+        std::atomic<int>* m_executedCommandLists;
+        std::atomic<int>* m_copies;
+    };
+
+    // the immediate context is not counted as a live object, it lives as long as the device
+    std::atomic<int> s_untrackedObjects(0);
+}
+
+
+NullDevice::NullDevice(bool deferredContexts)
+{
+    m_deferredContexts = deferredContexts;
+    m_liveObjects = 0;
+    m_executedCommandLists = 0;
+    m_copies = 0;
+    m_immediateContext = new NullDeviceContext(&s_untrackedObjects, &m_executedCommandLists, &m_copies);
+}
+
+
+NullDevice::~NullDevice()
+{
+    m_immediateContext->Release();
+    m_immediateContext = nullptr;
+}
+
+
+unsigned long NullDevice::AddRef()
+{
+    return 1;
+}
+
+
+unsigned long NullDevice::Release()
+{
+    //the device belongs to the test that made it
+    return 1;
+}
+
+
+HRESULT NullDevice::CreateBuffer(const D3D11_BUFFER_DESC* desc, const D3D11_SUBRESOURCE_DATA* initialData, ID3D11Buffer** buffer)
+{
+    NullBuffer* nullBuffer = new NullBuffer(&m_liveObjects, desc->ByteWidth);
+    if (initialData && initialData->pSysMem)
+    {
+        memcpy(nullBuffer->m_data.data(), initialData->pSysMem, desc->ByteWidth);
+    }
+    (*buffer) = nullBuffer;
+    return S_OK;
+}
+
+
+HRESULT NullDevice::CreateShaderResourceView(ID3D11Resource* resource, const D3D11_SHADER_RESOURCE_VIEW_DESC*, ID3D11ShaderResourceView** view)
+{
+    (*view) = new NullShaderResourceView(&m_liveObjects, resource);
+    return S_OK;
+}
+
+
+HRESULT NullDevice::CreateQuery(const D3D11_QUERY_DESC*, ID3D11Query** query)
+{
+    (*query) = new NullQuery(&m_liveObjects);
+    return S_OK;
+}
+
+
+HRESULT NullDevice::CreateDeferredContext(UINT, ID3D11DeviceContext** deferredContext)
+{
+    if (!m_deferredContexts)
+    {
+        return E_FAIL;
+    }
+
+    (*deferredContext) = new NullDeviceContext(&m_liveObjects, &m_executedCommandLists, &m_copies);
+    return S_OK;
+}
+
+
+HRESULT NullDevice::CreateTexture2D(const D3D11_TEXTURE2D_DESC* desc, const D3D11_SUBRESOURCE_DATA*, ID3D11Texture2D** texture)
+{
+    (*texture) = new NullTexture2D(&m_liveObjects, *desc);
+    return S_OK;
+}
+
+
+ID3D11DeviceContext* NullDevice::GetImmediateContext()
+{
+    return m_immediateContext;
+}
+
+
+int NullDevice::GetLiveObjectCount()
+{
+    return m_liveObjects;
+}
+
+
+int NullDevice::GetExecutedCommandListCount()
+{
+    return m_executedCommandLists;
+}
+
+
+int NullDevice::GetCopyCount()
+{
+    return m_copies;
+}
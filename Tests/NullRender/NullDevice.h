@@ -0,0 +1,40 @@
+#pragma once
+#include <d3d11.h>
+
+#include <atomic>
+
+// Device and immediate context that draw nothing but keep count of what they are asked to do, so the tests can run the
+// paths that need a device. Buffers are backed by memory so they can be mapped, queries are finished as soon as they
+// are ended and command lists are empty.
+class NullDevice : public ID3D11Device
+{
+public:
+    //@param deferredContexts: false makes CreateDeferredContext fail like a driver without them
+    NullDevice(bool deferredContexts);
+    ~NullDevice();
+
+    unsigned long AddRef() override;
+    unsigned long Release() override;
+
+    HRESULT CreateBuffer(const D3D11_BUFFER_DESC* desc, const D3D11_SUBRESOURCE_DATA* initialData, ID3D11Buffer** buffer) override;
+    HRESULT CreateShaderResourceView(ID3D11Resource* resource, const D3D11_SHADER_RESOURCE_VIEW_DESC* desc, ID3D11ShaderResourceView** view) override;
+    HRESULT CreateQuery(const D3D11_QUERY_DESC* desc, ID3D11Query** query) override;
+    HRESULT CreateDeferredContext(UINT contextFlags, ID3D11DeviceContext** deferredContext) override;
+    HRESULT CreateTexture2D(const D3D11_TEXTURE2D_DESC* desc, const D3D11_SUBRESOURCE_DATA* initialData, ID3D11Texture2D** texture) override;
+
+    ID3D11DeviceContext* GetImmediateContext();
+
+    //objects created through the device and not yet released, the immediate context not included
+    int GetLiveObjectCount();
+    int GetExecutedCommandListCount();
+    int GetCopyCount();
+
+private:
+    ID3D11DeviceContext* m_immediateContext;
+    bool m_deferredContexts;
+
+    // shared with the objects, the loader thread creates them next to the render thread
+    std::atomic<int> m_liveObjects;
+    std::atomic<int> m_executedCommandLists;
+    std::atomic<int> m_copies;
+};
@@ -0,0 +1,125 @@
+#pragma once
+
+// The parts of DirectXMath the particle manager uses, for building the simulation and the tests where the Windows SDK
+// is not available. Vectors are plain floats rather than SSE registers, the manager only stores, loads and multiplies
+// matrices so speed does not matter here.
+namespace DirectX
+{
+    struct XMFLOAT2
+    {
+        float x, y;
+
+        XMFLOAT2() = default;
+        constexpr XMFLOAT2(float _x, float _y) : x(_x), y(_y) {}
+    };
+
+    struct XMFLOAT3
+    {
+        float x, y, z;
+
+        XMFLOAT3() = default;
+        constexpr XMFLOAT3(float _x, float _y, float _z) : x(_x), y(_y), z(_z) {}
+    };
+
+    struct XMFLOAT4
+    {
+        float x, y, z, w;
+
+        XMFLOAT4() = default;
+        constexpr XMFLOAT4(float _x, float _y, float _z, float _w) : x(_x), y(_y), z(_z), w(_w) {}
+    };
+
+    struct XMFLOAT4X4
+    {
+        union
+        {
+            struct
+            {
+                float _11, _12, _13, _14;
+                float _21, _22, _23, _24;
+                float _31, _32, _33, _34;
+                float _41, _42, _43, _44;
+            };
+            float m[4][4];
+        };
+    };
+
+    struct XMVECTOR
+    {
+        float v[4];
+    };
+
+    struct XMMATRIX
+    {
+        XMVECTOR r[4];
+    };
+
+    inline XMMATRIX XMLoadFloat4x4(const XMFLOAT4X4* source)
+    {
+        XMMATRIX result;
+        for (auto row = 0; row < 4; ++row)
+        {
+            for (auto column = 0; column < 4; ++column)
+            {
+                result.r[row].v[column] = source->m[row][column];
+            }
+        }
+        return result;
+    }
+
+    inline void XMStoreFloat4x4(XMFLOAT4X4* destination, const XMMATRIX& matrix)
+    {
+        for (auto row = 0; row < 4; ++row)
+        {
+            for (auto column = 0; column < 4; ++column)
+            {
+                destination->m[row][column] = matrix.r[row].v[column];
+            }
+        }
+    }
+
+    inline XMMATRIX XMMatrixIdentity()
+    {
+        XMMATRIX result;
+        for (auto row = 0; row < 4; ++row)
+        {
+            for (auto column = 0; column < 4; ++column)
+            {
+                result.r[row].v[column] = (row == column) ? 1.0f : 0.0f;
+            }
+        }
+        return result;
+    }
+
+    // row vectors like DirectXMath, so a point is transformed by a then b
+    inline XMMATRIX XMMatrixMultiply(const XMMATRIX& a, const XMMATRIX& b)
+    {
+        XMMATRIX result;
+        for (auto row = 0; row < 4; ++row)
+        {
+            for (auto column = 0; column < 4; ++column)
+            {
+                float sum = 0.0f;
+                for (auto k = 0; k < 4; ++k)
+                {
+                    sum += a.r[row].v[k] * b.r[k].v[column];
+                }
+                result.r[row].v[column] = sum;
+            }
+        }
+        return result;
+    }
+
+    inline XMMATRIX XMMatrixTranspose(const XMMATRIX& matrix)
+    {
+        XMMATRIX result;
+        for (auto row = 0; row < 4; ++row)
+        {
+            for (auto column = 0; column < 4; ++column)
+            {
+                result.r[row].v[column] = matrix.r[column].v[row];
+            }
+        }
+        return result;
+    }
+}
@@ -0,0 +1,83 @@
+#include "TextureClass.h"
+
+#include <stdio.h>
+#include <string.h>
+
+
+TextureClass::TextureClass()
+{
+    m_texture = nullptr;
+    m_textureView = nullptr;
+}
+
+
+TextureClass::~TextureClass()
+{
+}
+
+
+bool TextureClass::Initialize(ID3D11Device* device, ID3D11DeviceContext*, const char* filename)
+{
+    D3D11_TEXTURE2D_DESC textureDesc;
+    HRESULT result;
+    FILE* file;
+    int width = 0, height = 0;
+
+    file = fopen(filename, "r");
+    if (!file)
+    {
+        return false;
+    }
+    int fieldsRead = fscanf(file, "%d %d", &width, &height);
+    fclose(file);
+    if (fieldsRead != 2 || width <= 0 || height <= 0)
+    {
+        return false;
+    }
+
+    memset(&textureDesc, 0, sizeof(textureDesc));
+    textureDesc.Width = width;
+    textureDesc.Height = height;
+    textureDesc.MipLevels = 1;
+    textureDesc.ArraySize = 1;
+    textureDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+    textureDesc.SampleDesc.Count = 1;
+    textureDesc.Usage = D3D11_USAGE_DEFAULT;
+    textureDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+
+    result = device->CreateTexture2D(&textureDesc, nullptr, &m_texture);
+    if (FAILED(result))
+    {
+        return false;
+    }
+
+    result = device->CreateShaderResourceView(m_texture, nullptr, &m_textureView);
+    if (FAILED(result))
+    {
+        return false;
+    }
+
+    return true;
+}
+
+
+void TextureClass::Shutdown()
+{
+    if (m_textureView)
+    {
+        m_textureView->Release();
+        m_textureView = nullptr;
+    }
+    if (m_texture)
+    {
+        m_texture->Release();
+        m_texture = nullptr;
+    }
+    return;
+}
+
+
+ID3D11ShaderResourceView* TextureClass::GetTexture()
+{
+    return m_textureView;
+}
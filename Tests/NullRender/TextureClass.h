@@ -0,0 +1,21 @@
+#pragma once
+#include <d3d11.h>
+
+// Null version of the application's texture class for the texture cache tests. There are no image decoders here, the
+// file holds the width and height as text and Initialize creates a blank texture of that size. A missing or unreadable
+// file fails like a bad image would.
+class TextureClass
+{
+public:
+    TextureClass();
+    ~TextureClass();
+
+    bool Initialize(ID3D11Device* device, ID3D11DeviceContext* deviceContext, const char* filename);
+    void Shutdown();
+
+    ID3D11ShaderResourceView* GetTexture();
+
+private:
+    ID3D11Texture2D* m_texture;
+    ID3D11ShaderResourceView* m_textureView;
+};
@@ -0,0 +1,1064 @@
+#include "ParticleManager.h"
+#include "CompactParticlePool.h"
+#include "EffectLibrary.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Headless benchmarks for the particle manager. Managers are initialized with a null device and context so the whole
+// simulation runs without a gpu, and every benchmark prints its own results. Run with no arguments for all of them or
+// name the ones to run, --quick cuts every benchmark down to a few frames so the suite doubles as a smoke test.
+//
+//   ParticleBenchmark [--quick] [--json directory] [name ...]
+
+namespace
+{
+    struct BenchmarkOptions
+    {
+        bool quick;
+        //scenarios write their stats here as <scenario>.json when set
+        const char* jsonDirectory;
+    };
+
+    typedef bool (*BenchmarkFunction)(const BenchmarkOptions& options);
+
+    struct Benchmark
+    {
+        const char* name;
+        const char* description;
+        BenchmarkFunction function;
+    };
+
+    const float FrameTime = 1.0f / 60.0f;
+
+    double GetMilliseconds(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    //---------------------------------------------------------------------------------------------------------------
+    // scenarios, each one sets a manager up before Initialize, drives it through the public api every frame and has
+    // its per stage stats printed
+
+    typedef void (*ScenarioSetup)(ParticleManager* manager);
+    typedef void (*ScenarioFrame)(ParticleManager* manager, int frame);
+
+    struct Scenario
+    {
+        const char* name;
+        const char* description;
+        ScenarioSetup setup;
+        ScenarioFrame frame;
+    };
+
+    void SetupRainOnly(ParticleManager* manager)
+    {
+        manager->SetFireEnabled(false);
+    }
+
+    void SetupAnalyticRain(ParticleManager* manager)
+    {
+        manager->EnableAnalyticRain(20000, 1234);
+        manager->SetFireEnabled(false);
+    }
+
+    void SetupCampfire(ParticleManager* manager)
+    {
+        manager->SetFirePosition(XMFLOAT3(5.0f, 0.0f, 30.0f));
+    }
+
+    void SetupCompact(ParticleManager* manager)
+    {
+        manager->EnableCompactParticles(50000);
+        manager->SetFireEnabled(false);
+    }
+
+    void SetupStorm(ParticleManager* manager)
+    {
+        manager->SetSpawnQueueCapacity(1024, SPAWN_POLICY_COALESCE);
+        manager->EnableCompactParticles(20000);
+        manager->SetFirePosition(XMFLOAT3(5.0f, 0.0f, 30.0f));
+    }
+
+    void NoFrameWork(ParticleManager*, int)
+    {
+        return;
+    }
+
+    //a few bursts a frame spread over the rain box, the same pattern for every run
+    void QueueBursts(ParticleManager* manager, int frame)
+    {
+        for (auto i = 0; i < 4; ++i)
+        {
+            float x = (float)(((frame * 7) + (i * 13)) % 30) - 10.0f;
+            float z = (float)(((frame * 11) + (i * 5)) % 35) + 15.0f;
+            manager->QueueBurst(XMFLOAT3(x, 2.0f, z), 60, 3.0f, 1.5f, XMFLOAT3(1.0f, 0.6f, 0.2f));
+        }
+    }
+
+    void QueueStorm(ParticleManager* manager, int frame)
+    {
+        QueueBursts(manager, frame);
+
+        for (auto i = 0; i < 8; ++i)
+        {
+            float x = (float)(((frame * 3) + (i * 17)) % 30) - 10.0f;
+            float z = (float)(((frame * 13) + (i * 7)) % 35) + 15.0f;
+            manager->QueueRing(XMFLOAT3(x, 0.0f, z), 8);
+        }
+
+        //a second fire flaring up now and then
+        if ((frame % 30) == 0)
+        {
+            manager->QueueFire(XMFLOAT3(-5.0f, 0.0f, 25.0f), 40);
+        }
+    }
+
+    const Scenario s_scenarios[] =
+    {
+        { "rain",          "list rain with splashes, no fire",                        SetupRainOnly,     NoFrameWork },
+        { "analytic-rain", "20000 analytic rain drops, no fire",                      SetupAnalyticRain, NoFrameWork },
+        { "campfire",      "rain and the continuous fire",                            SetupCampfire,     NoFrameWork },
+        { "bursts",        "rain and queued bursts in the compact pool",              SetupCompact,      QueueBursts },
+        { "storm",         "rain, fire, queued bursts, rings and extra fire at once", SetupStorm,        QueueStorm  },
+    };
+
+    void PrintStats(ParticleStats* stats)
+    {
+        for (auto i = 0; i < STAGE_COUNT; ++i)
+        {
+            printf("    %-10s %8.4f ms\n", ParticleStats::GetStageName((ParticleStage)i), stats->GetAverageStageTime((ParticleStage)i));
+        }
+        printf("    %-10s %8.4f ms\n", "frame", stats->GetAverageFrameTime());
+        printf("    %.0f particles/s, %lld allocated, %lld dropped\n", stats->GetParticlesPerSecond(),
+            stats->GetAllocationCount(), stats->GetDroppedCount());
+    }
+
+    bool RunScenario(const Scenario& scenario, const BenchmarkOptions& options)
+    {
+        int warmupFrames = options.quick ? 10 : 300;
+        int frames = options.quick ? 20 : 1200;
+
+        ParticleManager* manager = new ParticleManager;
+        scenario.setup(manager);
+        manager->SetRandomSeed(1234);
+
+        bool result = manager->EnableStats(false);
+        if (result)
+        {
+            result = manager->Initialize(nullptr, nullptr, nullptr, nullptr, nullptr);
+        }
+
+        //reach a steady state before measuring
+        for (auto i = 0; result && i < warmupFrames; ++i)
+        {
+            scenario.frame(manager, i);
+            result = manager->Frame(nullptr, FrameTime);
+        }
+        if (result)
+        {
+            manager->GetStats()->Reset();
+        }
+        for (auto i = 0; result && i < frames; ++i)
+        {
+            scenario.frame(manager, warmupFrames + i);
+            result = manager->Frame(nullptr, FrameTime);
+        }
+
+        if (result)
+        {
+            printf("  %s: %s, %d frames, %d instances in the last frame\n", scenario.name, scenario.description, frames,
+                manager->GetActiveInstanceCount());
+            PrintStats(manager->GetStats());
+
+            if (options.jsonDirectory)
+            {
+                std::string filename = std::string(options.jsonDirectory) + "/" + scenario.name + ".json";
+                result = manager->GetStats()->WriteJsonFile(filename.c_str());
+            }
+        }
+        else
+        {
+            printf("  %s: failed\n", scenario.name);
+        }
+
+        manager->Shutdown();
+        delete manager;
+        return result;
+    }
+
+    bool BenchmarkScenarios(const BenchmarkOptions& options)
+    {
+        bool result = true;
+        for (auto i = 0; i < (int)(sizeof(s_scenarios) / sizeof(s_scenarios[0])); ++i)
+        {
+            result = RunScenario(s_scenarios[i], options) && result;
+        }
+        return result;
+    }
+
+    //---------------------------------------------------------------------------------------------------------------
+    // snapshots, save and restore of a busy pool including the link conversion and the checks on restore
+
+    bool BenchmarkSnapshot(const BenchmarkOptions& options)
+    {
+        int iterations = options.quick ? 5 : 500;
+        ParticleManager manager;
+        std::vector<unsigned char> snapshot;
+        int bytesWritten = 0;
+        bool result;
+
+        manager.SetFirePosition(XMFLOAT3(5.0f, 0.0f, 30.0f));
+        manager.SetRandomSeed(1234);
+        result = manager.Initialize(nullptr, nullptr, nullptr, nullptr, nullptr);
+        for (auto i = 0; result && i < 300; ++i)
+        {
+            QueueBursts(&manager, i);
+            result = manager.Frame(nullptr, FrameTime);
+        }
+        if (!result)
+        {
+            manager.Shutdown();
+            return false;
+        }
+
+        snapshot.resize(manager.GetMaxSnapshotSize());
+
+        auto start = std::chrono::steady_clock::now();
+        for (auto i = 0; result && i < iterations; ++i)
+        {
+            result = manager.SaveSnapshot(snapshot.data(), (int)snapshot.size(), &bytesWritten);
+        }
+        double saveTime = GetMilliseconds(start) / iterations;
+
+        start = std::chrono::steady_clock::now();
+        for (auto i = 0; result && i < iterations; ++i)
+        {
+            result = manager.RestoreSnapshot(snapshot.data(), bytesWritten);
+        }
+        double restoreTime = GetMilliseconds(start) / iterations;
+
+        if (result)
+        {
+            printf("  %d live particles, %d bytes\n", manager.GetActiveInstanceCount(), bytesWritten);
+            printf("    save       %8.4f ms  %8.1f MB/s\n", saveTime, (bytesWritten / (1024.0 * 1024.0)) / (saveTime / 1000.0));
+            printf("    restore    %8.4f ms  %8.1f MB/s\n", restoreTime, (bytesWritten / (1024.0 * 1024.0)) / (restoreTime / 1000.0));
+        }
+
+        manager.Shutdown();
+        return result;
+    }
+
+    //---------------------------------------------------------------------------------------------------------------
+    // scene collision, the rain box over a floor and a row of crates with bursts bouncing off them
+
+    void AddCollisionBox(ParticleManager* manager, const XMFLOAT3& minimum, const XMFLOAT3& maximum)
+    {
+        const XMFLOAT3 corners[8] =
+        {
+            XMFLOAT3(minimum.x, minimum.y, minimum.z), XMFLOAT3(maximum.x, minimum.y, minimum.z),
+            XMFLOAT3(maximum.x, maximum.y, minimum.z), XMFLOAT3(minimum.x, maximum.y, minimum.z),
+            XMFLOAT3(minimum.x, minimum.y, maximum.z), XMFLOAT3(maximum.x, minimum.y, maximum.z),
+            XMFLOAT3(maximum.x, maximum.y, maximum.z), XMFLOAT3(minimum.x, maximum.y, maximum.z),
+        };
+        const unsigned int indices[36] =
+        {
+            0, 2, 1, 0, 3, 2,  4, 5, 6, 4, 6, 7,  0, 1, 5, 0, 5, 4,
+            3, 7, 6, 3, 6, 2,  0, 4, 7, 0, 7, 3,  1, 2, 6, 1, 6, 5,
+        };
+
+        manager->AddCollisionMesh(corners, 8, indices, 36, COLLISION_BOUNCE);
+    }
+
+    bool BenchmarkCollision(const BenchmarkOptions& options)
+    {
+        int warmupFrames = options.quick ? 10 : 300;
+        int frames = options.quick ? 20 : 1200;
+        ParticleManager manager;
+        double particles = 0.0;
+        bool result;
+
+        manager.EnableCompactParticles(20000);
+        manager.SetFirePosition(XMFLOAT3(5.0f, 0.0f, 30.0f));
+        manager.SetRandomSeed(1234);
+        result = manager.EnableStats(false);
+        if (result)
+        {
+            result = manager.Initialize(nullptr, nullptr, nullptr, nullptr, nullptr);
+        }
+        if (result)
+        {
+            AddCollisionBox(&manager, XMFLOAT3(-20.0f, -1.0f, 0.0f), XMFLOAT3(30.0f, 0.1f, 60.0f));
+            for (auto i = 0; i < 8; ++i)
+            {
+                float x = -10.0f + (i * 4.0f);
+                AddCollisionBox(&manager, XMFLOAT3(x, 0.0f, 20.0f + (i * 3.0f)), XMFLOAT3(x + 2.0f, 1.5f, 22.0f + (i * 3.0f)));
+            }
+            result = manager.BuildSceneCollision();
+        }
+
+        for (auto i = 0; result && i < warmupFrames; ++i)
+        {
+            QueueBursts(&manager, i);
+            result = manager.Frame(nullptr, FrameTime);
+        }
+        if (result)
+        {
+            manager.GetStats()->Reset();
+        }
+        for (auto i = 0; result && i < frames; ++i)
+        {
+            QueueBursts(&manager, warmupFrames + i);
+            result = manager.Frame(nullptr, FrameTime);
+            //every live particle is one segment against the scene
+            particles += manager.GetActiveInstanceCount();
+        }
+
+        if (result)
+        {
+            double collisionTime = manager.GetStats()->GetAverageStageTime(STAGE_COLLISION);
+            particles /= frames;
+            printf("  %.0f particles a frame against 9 meshes\n", particles);
+            printf("    collision  %8.4f ms  %12.0f particles/s\n", collisionTime, particles / (collisionTime / 1000.0));
+        }
+
+        manager.Shutdown();
+        return result;
+    }
+
+    //---------------------------------------------------------------------------------------------------------------
+    // update strategies, the lists walked one after the other against the slices' blocks split into chunks
+
+    bool RunUpdateStrategy(UpdateStrategy strategy, int chunkSize, const BenchmarkOptions& options)
+    {
+        int warmupFrames = options.quick ? 10 : 300;
+        int frames = options.quick ? 20 : 1200;
+        ParticleManager manager;
+        bool result;
+
+        manager.SetSpawnQueueCapacity(1024, SPAWN_POLICY_COALESCE);
+        manager.SetFirePosition(XMFLOAT3(5.0f, 0.0f, 30.0f));
+        manager.SetRandomSeed(1234);
+        result = manager.EnableStats(false);
+        if (result)
+        {
+            result = manager.Initialize(nullptr, nullptr, nullptr, nullptr, nullptr);
+        }
+        manager.SetUpdateStrategy(strategy, chunkSize);
+
+        for (auto i = 0; result && i < warmupFrames; ++i)
+        {
+            QueueStorm(&manager, i);
+            result = manager.Frame(nullptr, FrameTime);
+        }
+        if (result)
+        {
+            manager.GetStats()->Reset();
+        }
+        for (auto i = 0; result && i < frames; ++i)
+        {
+            QueueStorm(&manager, warmupFrames + i);
+            result = manager.Frame(nullptr, FrameTime);
+        }
+
+        if (result)
+        {
+            double updateTime = manager.GetStats()->GetAverageStageTime(STAGE_UPDATE);
+            if (strategy == UPDATE_SERIAL)
+            {
+                printf("    %-16s", "serial lists");
+            }
+            else
+            {
+                printf("    chunks of %-6d", chunkSize);
+            }
+            printf(" %8.4f ms  %12.0f particles/s\n", updateTime, manager.GetActiveInstanceCount() / (updateTime / 1000.0));
+        }
+
+        manager.Shutdown();
+        return result;
+    }
+
+    bool BenchmarkUpdate(const BenchmarkOptions& options)
+    {
+        bool result = RunUpdateStrategy(UPDATE_SERIAL, 0, options);
+        for (auto i = 0; i < ParticleAutoTuner::ChunkSizeCount; ++i)
+        {
+            result = RunUpdateStrategy(UPDATE_PARALLEL, ParticleAutoTuner::ChunkSizes[i], options) && result;
+        }
+        return result;
+    }
+
+    //---------------------------------------------------------------------------------------------------------------
+    // particle formats, a million falling and bouncing particles in the compact pool and in the linked list format
+
+    //same layout as ParticleManager::Particle, which is private to the manager
+    struct ListParticle
+    {
+        float positionX, positionY, positionZ;
+        float red, green, blue, alpha;
+        float velocityX, velocityY, velocityZ;
+
+        ListParticle* next;
+        float remainingLifeTime;
+    };
+
+    //the same particles for both formats every run
+    struct FormatRandom
+    {
+        unsigned int state;
+
+        float Next(float minimum, float maximum)
+        {
+            state = (state * 1664525u) + 1013904223u;
+            return minimum + ((maximum - minimum) * (float)(state >> 8) * (1.0f / 16777216.0f));
+        }
+    };
+
+    void PrintFormat(const char* name, int count, long long bytes, double updateTime)
+    {
+        printf("    %-8s %3d bytes each %8.1f MB  update %8.4f ms  %12.0f particles/s\n", name, (int)(bytes / count),
+            bytes / (1024.0 * 1024.0), updateTime, count / (updateTime / 1000.0));
+    }
+
+    bool BenchmarkParticleFormats(const BenchmarkOptions& options)
+    {
+        int count = options.quick ? 10000 : 1000000;
+        int frames = options.quick ? 3 : 120;
+        const float gravity = -9.8f;
+        CompactParticlePool pool;
+        std::vector<ListParticle> list(count);
+        ParticleKernelParams params;
+        FormatRandom random;
+        int palette;
+
+        if (!pool.Initialize(count))
+        {
+            return false;
+        }
+        palette = pool.FindPaletteColor(1.0f, 0.6f, 0.2f);
+
+        random.state = 1234;
+        for (auto i = 0; i < count; ++i)
+        {
+            ListParticle& particle = list[i];
+            particle.positionX = random.Next(-10.0f, 20.0f);
+            particle.positionY = random.Next(0.0f, 5.0f);
+            particle.positionZ = random.Next(15.0f, 50.0f);
+            particle.red = 1.0f;
+            particle.green = 0.6f;
+            particle.blue = 0.2f;
+            particle.alpha = 1.0f;
+            particle.velocityX = random.Next(-3.0f, 3.0f);
+            particle.velocityY = random.Next(-3.0f, 3.0f);
+            particle.velocityZ = random.Next(-3.0f, 3.0f);
+            particle.remainingLifeTime = 60.0f;
+            particle.next = (i + 1 < count) ? &list[i + 1] : nullptr;
+
+            pool.Spawn(XMFLOAT3(particle.positionX, particle.positionY, particle.positionZ),
+                XMFLOAT3(particle.velocityX, particle.velocityY, particle.velocityZ), particle.remainingLifeTime, palette);
+        }
+        pool.SortByDepth();
+
+        params.frameTime = FrameTime;
+        params.gravity = gravity;
+        params.smokeLifeTime = 0.0f;
+        params.smokeColor[0] = 0.0f;
+        params.smokeColor[1] = 0.0f;
+        params.smokeColor[2] = 0.0f;
+
+        //the general list kernel, as the manager runs it on rings and bursts
+        auto start = std::chrono::steady_clock::now();
+        for (auto i = 0; i < frames; ++i)
+        {
+            UpdateParticleKernel<GravityAboveGround, Ageing, GroundBounce>(list.data(), params);
+        }
+        double listTime = GetMilliseconds(start) / frames;
+
+        start = std::chrono::steady_clock::now();
+        for (auto i = 0; i < frames; ++i)
+        {
+            pool.Update(FrameTime, gravity);
+        }
+        double compactTime = GetMilliseconds(start) / frames;
+
+        start = std::chrono::steady_clock::now();
+        for (auto i = 0; i < frames; ++i)
+        {
+            pool.Kill();
+            pool.SortByDepth();
+        }
+        double sortTime = GetMilliseconds(start) / frames;
+
+        bool result = pool.GetCount() == count;
+        if (result)
+        {
+            printf("  %d particles\n", count);
+            PrintFormat("list", count, (long long)sizeof(ListParticle) * count, listTime);
+            PrintFormat("compact", count, pool.GetMemoryUsage(), compactTime);
+            printf("    compact kill and depth sort %8.4f ms\n", sortTime);
+        }
+
+        pool.Shutdown();
+        return result;
+    }
+
+    //---------------------------------------------------------------------------------------------------------------
+    // spawn queue contention, producer threads queue effects as fast as they can while the frames drain the queue
+
+    void ProduceSpawns(ParticleManager* manager, int thread, std::atomic<bool>* stop, long long* pushed)
+    {
+        long long count = 0;
+        for (auto i = 0; !stop->load(std::memory_order_relaxed); ++i)
+        {
+            float x = (float)(((thread * 13) + (i * 7)) % 30) - 10.0f;
+            float z = (float)(((thread * 5) + (i * 11)) % 35) + 15.0f;
+            switch (i % 3)
+            {
+            case 0:
+                manager->QueueRing(XMFLOAT3(x, 0.0f, z), 8);
+                break;
+            case 1:
+                manager->QueueFire(XMFLOAT3(x, 0.0f, z), 4);
+                break;
+            default:
+                manager->QueueBurst(XMFLOAT3(x, 2.0f, z), 8, 3.0f, 1.0f, XMFLOAT3(1.0f, 0.6f, 0.2f));
+                break;
+            }
+            count++;
+        }
+        (*pushed) = count;
+        return;
+    }
+
+    bool RunSpawnContention(int threadCount, const BenchmarkOptions& options)
+    {
+        int frames = options.quick ? 10 : 600;
+        ParticleManager manager;
+        std::vector<std::thread> threads;
+        std::vector<long long> pushed(threadCount, 0);
+        std::atomic<bool> stop(false);
+        long long totalPushed = 0;
+        bool result;
+
+        manager.SetSpawnQueueCapacity(4096, SPAWN_POLICY_COALESCE);
+        manager.EnableCompactParticles(50000);
+        manager.SetFirePosition(XMFLOAT3(5.0f, 0.0f, 30.0f));
+        manager.SetRandomSeed(1234);
+        result = manager.EnableStats(false);
+        if (result)
+        {
+            result = manager.Initialize(nullptr, nullptr, nullptr, nullptr, nullptr);
+        }
+        if (!result)
+        {
+            manager.Shutdown();
+            return false;
+        }
+
+        for (auto i = 0; i < threadCount; ++i)
+        {
+            threads.push_back(std::thread(ProduceSpawns, &manager, i, &stop, &pushed[i]));
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        for (auto i = 0; result && i < frames; ++i)
+        {
+            result = manager.Frame(nullptr, FrameTime);
+        }
+        double time = GetMilliseconds(start);
+
+        stop = true;
+        for (auto i = 0; i < threadCount; ++i)
+        {
+            threads[i].join();
+            totalPushed += pushed[i];
+        }
+
+        if (result)
+        {
+            SpawnCommandQueue* queue = manager.GetSpawnQueue();
+            printf("    %2d producers %12.0f commands/s  %6.2f%% dropped  %6.2f%% coalesced  spawn %8.4f ms  frame %8.4f ms\n",
+                threadCount, totalPushed / (time / 1000.0), 100.0 * queue->GetDroppedCount() / (double)totalPushed,
+                100.0 * queue->GetCoalescedCount() / (double)totalPushed, manager.GetStats()->GetAverageStageTime(STAGE_SPAWN),
+                manager.GetStats()->GetAverageFrameTime());
+        }
+
+        manager.Shutdown();
+        return result;
+    }
+
+    bool BenchmarkSpawnContention(const BenchmarkOptions& options)
+    {
+        bool result = true;
+        int maxThreads = options.quick ? 2 : 16;
+        for (auto threadCount = 1; threadCount <= maxThreads; threadCount *= 2)
+        {
+            result = RunSpawnContention(threadCount, options) && result;
+        }
+        return result;
+    }
+
+    //---------------------------------------------------------------------------------------------------------------
+    // prewarm, skipping ahead with Prewarm against running the frames of the same time
+
+    bool InitializePrewarmManager(ParticleManager* manager)
+    {
+        manager->SetFirePosition(XMFLOAT3(5.0f, 0.0f, 30.0f));
+        manager->SetRandomSeed(1234);
+        return manager->Initialize(nullptr, nullptr, nullptr, nullptr, nullptr);
+    }
+
+    bool BenchmarkPrewarm(const BenchmarkOptions& options)
+    {
+        const float seconds[] = { 1.0f, 5.0f, 30.0f };
+        int secondsCount = options.quick ? 1 : (int)(sizeof(seconds) / sizeof(seconds[0]));
+        bool result = true;
+
+        for (auto i = 0; result && i < secondsCount; ++i)
+        {
+            ParticleManager prewarmed, stepped;
+            int frames = (int)((seconds[i] / FrameTime) + 0.5f);
+
+            result = InitializePrewarmManager(&prewarmed) && InitializePrewarmManager(&stepped);
+
+            auto start = std::chrono::steady_clock::now();
+            result = result && prewarmed.Prewarm(seconds[i]);
+            double prewarmTime = GetMilliseconds(start);
+
+            start = std::chrono::steady_clock::now();
+            for (auto j = 0; result && j < frames; ++j)
+            {
+                result = stepped.Frame(nullptr, FrameTime);
+            }
+            double frameTime = GetMilliseconds(start);
+
+            //one frame writes the prewarmed particles out so both can be counted
+            result = result && prewarmed.Frame(nullptr, FrameTime) && stepped.Frame(nullptr, FrameTime);
+            if (result)
+            {
+                printf("    %5.1f s  prewarm %9.4f ms  %5d frames %10.4f ms  %7.1fx  %d and %d instances after\n", seconds[i],
+                    prewarmTime, frames, frameTime, frameTime / prewarmTime, prewarmed.GetActiveInstanceCount(), stepped.GetActiveInstanceCount());
+            }
+
+            prewarmed.Shutdown();
+            stepped.Shutdown();
+        }
+        return result;
+    }
+
+    //---------------------------------------------------------------------------------------------------------------
+    // update kernels, each effect's specialized kernel against the runtime configured one over the same particles
+
+    typedef void (*ListKernel)(ListParticle* headNode, const ParticleKernelParams& params);
+    typedef void (*RangeKernel)(ListParticle* particles, int count, const ParticleKernelParams& params);
+
+    //the same kernels and flags as the manager's tables, which are private to it
+    struct KernelEffect
+    {
+        const char* name;
+        ListKernel listKernel;
+        RangeKernel rangeKernel;
+        ParticleKernelConfig config;
+    };
+
+    const KernelEffect s_kernelEffects[] =
+    {
+        { "rain", UpdateParticleKernel<Gravity, Immortal, NoCollision, ListParticle>,
+            UpdateParticleRangeKernel<Gravity, Immortal, NoCollision, ListParticle>, { true, false, false, false, false } },
+        { "fire", UpdateParticleKernel<NoForce, AgeingWithSmoke, NoCollision, ListParticle>,
+            UpdateParticleRangeKernel<NoForce, AgeingWithSmoke, NoCollision, ListParticle>, { false, false, true, true, false } },
+        { "ring", UpdateParticleKernel<GravityAboveGround, Ageing, GroundBounce, ListParticle>,
+            UpdateParticleRangeKernel<GravityAboveGround, Ageing, GroundBounce, ListParticle>, { true, true, true, false, true } },
+    };
+
+    void FillKernelParticles(std::vector<ListParticle>* particles)
+    {
+        FormatRandom random;
+
+        random.state = 1234;
+        for (auto i = 0; i < (int)particles->size(); ++i)
+        {
+            ListParticle& particle = (*particles)[i];
+            particle.positionX = random.Next(-10.0f, 20.0f);
+            particle.positionY = random.Next(-0.5f, 5.0f);
+            particle.positionZ = random.Next(15.0f, 50.0f);
+            particle.red = 1.0f;
+            particle.green = 0.6f;
+            particle.blue = 0.2f;
+            particle.alpha = 1.0f;
+            particle.velocityX = random.Next(-3.0f, 3.0f);
+            particle.velocityY = random.Next(-3.0f, 3.0f);
+            particle.velocityZ = random.Next(-3.0f, 3.0f);
+            //a mix of young, smoking and expired particles so every select goes both ways
+            particle.remainingLifeTime = random.Next(-0.5f, 2.0f);
+            particle.next = (i + 1 < (int)particles->size()) ? &(*particles)[i + 1] : nullptr;
+        }
+        return;
+    }
+
+    //everything but the links, which point into each particle's own array
+    bool IsSameState(const std::vector<ListParticle>& first, const std::vector<ListParticle>& second)
+    {
+        for (auto i = 0; i < (int)first.size(); ++i)
+        {
+            if (memcmp(&first[i], &second[i], offsetof(ListParticle, next)) != 0 ||
+                memcmp(&first[i].remainingLifeTime, &second[i].remainingLifeTime, sizeof(float)) != 0)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool BenchmarkKernels(const BenchmarkOptions& options)
+    {
+        int count = options.quick ? 10000 : 1000000;
+        int frames = options.quick ? 3 : 60;
+        std::vector<ListParticle> specialized(count), generic(count);
+        ParticleKernelParams params;
+        bool result = true;
+
+        params.frameTime = FrameTime;
+        params.gravity = -9.8f;
+        params.smokeLifeTime = 0.5f;
+        params.smokeColor[0] = 0.3f;
+        params.smokeColor[1] = 0.3f;
+        params.smokeColor[2] = 0.3f;
+
+        printf("  %d particles, ms a frame\n", count);
+        printf("    %-6s %14s %14s %14s %14s\n", "effect", "list", "generic list", "range", "generic range");
+        for (auto i = 0; i < (int)(sizeof(s_kernelEffects) / sizeof(s_kernelEffects[0])); ++i)
+        {
+            const KernelEffect& effect = s_kernelEffects[i];
+            double times[4];
+
+            FillKernelParticles(&specialized);
+            FillKernelParticles(&generic);
+
+            auto start = std::chrono::steady_clock::now();
+            for (auto j = 0; j < frames; ++j)
+            {
+                effect.listKernel(specialized.data(), params);
+            }
+            times[0] = GetMilliseconds(start) / frames;
+
+            start = std::chrono::steady_clock::now();
+            for (auto j = 0; j < frames; ++j)
+            {
+                UpdateParticleGenericKernel(generic.data(), params, effect.config);
+            }
+            times[1] = GetMilliseconds(start) / frames;
+
+            start = std::chrono::steady_clock::now();
+            for (auto j = 0; j < frames; ++j)
+            {
+                effect.rangeKernel(specialized.data(), count, params);
+            }
+            times[2] = GetMilliseconds(start) / frames;
+
+            start = std::chrono::steady_clock::now();
+            for (auto j = 0; j < frames; ++j)
+            {
+                UpdateParticleGenericRangeKernel(generic.data(), count, params, effect.config);
+            }
+            times[3] = GetMilliseconds(start) / frames;
+
+            //both ran the same steps on the same particles, anything else means the kernels disagree
+            if (!IsSameState(specialized, generic))
+            {
+                printf("    %s: specialized and generic kernels disagree\n", effect.name);
+                result = false;
+            }
+            printf("    %-6s %14.4f %14.4f %14.4f %14.4f\n", effect.name, times[0], times[1], times[2], times[3]);
+        }
+        return result;
+    }
+
+    //---------------------------------------------------------------------------------------------------------------
+    // baked caches, decoding a captured storm front to back and at random frames
+
+    bool BenchmarkCachePlayback(const BenchmarkOptions& options)
+    {
+        int frames = options.quick ? 30 : 600;
+        int passes = options.quick ? 1 : 5;
+        int seeks = options.quick ? 20 : 2000;
+        int warmupFrames = options.quick ? 10 : 300;
+        const char* filename = "benchmark_playback.cache";
+        ParticleManager manager;
+        ParticleCachePlayer player;
+        std::vector<unsigned char> instances;
+        int instanceCount, rainCount, fireCount;
+        long long decodedBytes = 0;
+        bool result;
+
+        SetupStorm(&manager);
+        manager.SetRandomSeed(1234);
+        result = manager.Initialize(nullptr, nullptr, nullptr, nullptr, nullptr);
+        for (auto i = 0; result && i < warmupFrames; ++i)
+        {
+            QueueStorm(&manager, i);
+            result = manager.Frame(nullptr, FrameTime);
+        }
+        result = result && manager.BeginCacheCapture(filename);
+        for (auto i = 0; result && i < frames; ++i)
+        {
+            QueueStorm(&manager, warmupFrames + i);
+            result = manager.Frame(nullptr, FrameTime);
+        }
+        result = manager.EndCacheCapture() && result;
+        manager.Shutdown();
+
+        result = result && player.Open(filename) && player.GetFrameCount() == frames;
+        if (!result)
+        {
+            remove(filename);
+            return false;
+        }
+        instances.resize((size_t)player.GetMaxInstances() * player.GetInstanceStride());
+
+        //front to back only decodes each frame's delta against the one before it
+        auto start = std::chrono::steady_clock::now();
+        for (auto i = 0; result && i < passes; ++i)
+        {
+            for (auto j = 0; result && j < frames; ++j)
+            {
+                result = player.ReadFrame(j, instances.data(), &instanceCount, &rainCount, &fireCount);
+                decodedBytes += (long long)instanceCount * player.GetInstanceStride();
+            }
+        }
+        double sequentialTime = GetMilliseconds(start);
+
+        //a jump decodes from the start of the frame's chunk
+        start = std::chrono::steady_clock::now();
+        for (auto i = 0; result && i < seeks; ++i)
+        {
+            result = player.ReadFrame((int)(((long long)i * 7919) % frames), instances.data(), &instanceCount, &rainCount, &fireCount);
+        }
+        double seekTime = GetMilliseconds(start);
+
+        if (result)
+        {
+            int sequentialFrames = frames * passes;
+            printf("  %d frames of up to %d instances\n", frames, player.GetMaxInstances());
+            printf("    sequential %8.4f ms/frame  %8.1f frames/s  %8.1f MB/s decoded\n", sequentialTime / sequentialFrames,
+                (sequentialFrames * 1000.0) / sequentialTime, (decodedBytes / (1024.0 * 1024.0)) / (sequentialTime / 1000.0));
+            printf("    seek       %8.4f ms/frame  %8.1f frames/s\n", seekTime / seeks, (seeks * 1000.0) / seekTime);
+        }
+
+        player.Close();
+        remove(filename);
+        return result;
+    }
+
+    //---------------------------------------------------------------------------------------------------------------
+    // effect library, compiling and mapping a library of thousands of effects and looking them up by name
+
+    bool WriteEffectText(const char* filename, int count)
+    {
+        static const char* typeNames[] = { "rain", "fire", "ring" };
+
+        FILE* file = fopen(filename, "w");
+        if (!file)
+        {
+            return false;
+        }
+
+        for (auto i = 0; i < count; ++i)
+        {
+            fprintf(file, "[%s effect%d]\n", typeNames[i % 3], i);
+            switch (i % 3)
+            {
+            case 0: fprintf(file, "dropCount = %d\nbox = -10 20 15 %d\n", 500 + i, 50 + (i % 7)); break;
+            case 1: fprintf(file, "particlesPerSecond = %d\ncolor = 2.0 0.8 0.%d\n", 100 + (i % 100), i % 10); break;
+            case 2: fprintf(file, "velocity = 0.%d\nlifeTime = 0.5\n", 1 + (i % 9)); break;
+            }
+        }
+
+        return fclose(file) == 0;
+    }
+
+    bool BenchmarkEffectLibrary(const BenchmarkOptions& options)
+    {
+        const int counts[] = { 1000, 10000, 50000 };
+        int countCount = options.quick ? 1 : (int)(sizeof(counts) / sizeof(counts[0]));
+        int lookups = options.quick ? 10000 : 1000000;
+        const char* textFilename = "benchmark_effects.txt";
+        const char* binaryFilename = "benchmark_effects.fxlib";
+        static const EffectType types[] = { EFFECT_RAIN, EFFECT_FIRE, EFFECT_RING };
+        bool result = true;
+
+        printf("    %7s %12s %12s %14s\n", "effects", "compile ms", "load us", "lookup ns");
+        for (auto i = 0; result && i < countCount; ++i)
+        {
+            EffectLibrary library;
+            int errorLine = 0;
+            int found = 0;
+            char name[EffectLibrary::MaxNameLength];
+
+            result = WriteEffectText(textFilename, counts[i]);
+
+            auto start = std::chrono::steady_clock::now();
+            result = result && EffectLibrary::CompileText(textFilename, binaryFilename, &errorLine);
+            double compileTime = GetMilliseconds(start);
+
+            result = result && library.Load(binaryFilename) && library.GetEffectCount() == counts[i];
+            if (!result)
+            {
+                printf("    %d effects failed to compile or load, line %d\n", counts[i], errorLine);
+                break;
+            }
+
+            //names are built ahead of the timing, they are a different one each lookup
+            std::vector<std::string> names(counts[i]);
+            for (auto j = 0; j < counts[i]; ++j)
+            {
+                snprintf(name, sizeof(name), "effect%d", j);
+                names[j] = name;
+            }
+
+            start = std::chrono::steady_clock::now();
+            for (auto j = 0; j < lookups; ++j)
+            {
+                int index = (int)(((long long)j * 7919) % counts[i]);
+                if (library.FindEffect(names[index].c_str(), types[index % 3]))
+                {
+                    found++;
+                }
+            }
+            double lookupTime = GetMilliseconds(start);
+
+            if (found != lookups)
+            {
+                printf("    %d of %d lookups missed\n", lookups - found, lookups);
+                result = false;
+            }
+            printf("    %7d %12.3f %12.1f %14.1f\n", counts[i], compileTime, library.GetLastLoadTime(), (lookupTime * 1000000.0) / lookups);
+
+            library.Shutdown();
+        }
+
+        remove(textFilename);
+        remove(binaryFilename);
+        return result;
+    }
+
+    //---------------------------------------------------------------------------------------------------------------
+
+    const Benchmark s_benchmarks[] =
+    {
+        { "scenarios",  "per stage frame times of the named headless scenarios",            BenchmarkScenarios       },
+        { "snapshot",   "save and restore of a busy particle pool",                         BenchmarkSnapshot        },
+        { "collision",  "particles tested against scene meshes per second",                 BenchmarkCollision       },
+        { "update",     "serial list update against chunked updates of the blocks",         BenchmarkUpdate          },
+        { "contention", "queued effects per second with many producer threads",             BenchmarkSpawnContention },
+        { "prewarm",    "Prewarm against running the frames of the same time",              BenchmarkPrewarm         },
+        { "kernels",    "specialized update kernels against the runtime configured kernel", BenchmarkKernels         },
+        { "formats",    "memory and update speed of a million compact and list particles",  BenchmarkParticleFormats },
+        { "playback",   "decode speed of a baked cache played through and seeked",          BenchmarkCachePlayback   },
+        { "effects",    "compile, load and lookup of libraries with thousands of effects",  BenchmarkEffectLibrary   },
+    };
+
+    const int BenchmarkCount = (int)(sizeof(s_benchmarks) / sizeof(s_benchmarks[0]));
+
+    bool IsSelected(const char* name, int nameCount, char** names)
+    {
+        if (nameCount == 0)
+        {
+            return true;
+        }
+        for (auto i = 0; i < nameCount; ++i)
+        {
+            if (strcmp(names[i], name) == 0)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+}
+
+
+int main(int argc, char** argv)
+{
+    BenchmarkOptions options;
+    options.quick = false;
+    options.jsonDirectory = nullptr;
+
+    //options first, whatever follows names benchmarks or scenarios
+    int argument = 1;
+    while (argument < argc && strncmp(argv[argument], "--", 2) == 0)
+    {
+        if (strcmp(argv[argument], "--quick") == 0)
+        {
+            options.quick = true;
+        }
+        else if (strcmp(argv[argument], "--json") == 0 && argument + 1 < argc)
+        {
+            options.jsonDirectory = argv[++argument];
+        }
+        else
+        {
+            printf("usage: %s [--quick] [--json directory] [benchmark or scenario ...]\n", argv[0]);
+            for (auto i = 0; i < BenchmarkCount; ++i)
+            {
+                printf("  %-12s %s\n", s_benchmarks[i].name, s_benchmarks[i].description);
+            }
+            for (auto i = 0; i < (int)(sizeof(s_scenarios) / sizeof(s_scenarios[0])); ++i)
+            {
+                printf("  %-12s scenario: %s\n", s_scenarios[i].name, s_scenarios[i].description);
+            }
+            return 1;
+        }
+        argument++;
+    }
+
+    int nameCount = argc - argument;
+    char** names = argv + argument;
+    int failures = 0;
+    int matched = 0;
+
+    for (auto i = 0; i < BenchmarkCount; ++i)
+    {
+        if (IsSelected(s_benchmarks[i].name, nameCount, names))
+        {
+            printf("%s\n", s_benchmarks[i].name);
+            matched++;
+            if (!s_benchmarks[i].function(options))
+            {
+                printf("%s failed\n", s_benchmarks[i].name);
+                failures++;
+            }
+        }
+    }
+
+    //single scenarios can be named directly when the scenarios benchmark is not already running all of them
+    if (nameCount > 0 && !IsSelected("scenarios", nameCount, names))
+    {
+        for (auto i = 0; i < (int)(sizeof(s_scenarios) / sizeof(s_scenarios[0])); ++i)
+        {
+            if (IsSelected(s_scenarios[i].name, nameCount, names))
+            {
+                matched++;
+                if (!RunScenario(s_scenarios[i], options))
+                {
+                    failures++;
+                }
+            }
+        }
+    }
+
+    if (matched == 0)
+    {
+        printf("no benchmark or scenario matched\n");
+        return 1;
+    }
+    return (failures == 0) ? 0 : 1;
+}
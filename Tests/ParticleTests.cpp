@@ -0,0 +1,1613 @@
+#include "ParticleManager.h"
+#include "BillboardBuffer.h"
+#include "DensityGrid.h"
+#include "EffectLibrary.h"
+#include "InstanceRingBuffer.h"
+#include "TextureCache.h"
+
+#ifdef PARTICLE_NULL_DEVICE
+#include "NullDevice.h"
+#endif
+
+#include <cmath>
+#include <cstdio>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+// Headless tests for the particle manager and the classes it is built from. Each test is a function returning true
+// when it passes, ctest runs them one at a time by name and with no arguments every test runs.
+//
+//   ParticleTests [name ...]
+
+namespace
+{
+    #define CHECK(condition) \
+        do \
+        { \
+            if (!(condition)) \
+            { \
+                printf("  %s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+                return false; \
+            } \
+        } while (0)
+
+    typedef bool (*TestFunction)();
+
+    struct Test
+    {
+        const char* name;
+        TestFunction function;
+    };
+
+    const float FrameTime = 1.0f / 60.0f;
+
+    //the same inputs every run, so two managers given the same frames end up in the same state
+    void QueueTestEffects(ParticleManager* manager, int frame)
+    {
+        if ((frame % 5) == 0)
+        {
+            float x = (float)((frame * 7) % 30) - 10.0f;
+            float z = (float)((frame * 11) % 35) + 15.0f;
+            manager->QueueBurst(XMFLOAT3(x, 2.0f, z), 40, 3.0f, 1.0f, XMFLOAT3(1.0f, 0.5f, 0.2f));
+        }
+    }
+
+    bool RunFrames(ParticleManager* manager, int firstFrame, int frameCount)
+    {
+        for (auto i = 0; i < frameCount; ++i)
+        {
+            QueueTestEffects(manager, firstFrame + i);
+            if (!manager->Frame(nullptr, FrameTime))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool InitializeTestManager(ParticleManager* manager)
+    {
+        manager->SetRandomSeed(42);
+        manager->SetFirePosition(XMFLOAT3(5.0f, 0.0f, 30.0f));
+        return manager->Initialize(nullptr, nullptr, nullptr, nullptr, nullptr);
+    }
+
+    bool SaveSnapshot(ParticleManager* manager, std::vector<unsigned char>* snapshot)
+    {
+        int bytesWritten = 0;
+
+        snapshot->resize(manager->GetMaxSnapshotSize());
+        if (!manager->SaveSnapshot(snapshot->data(), (int)snapshot->size(), &bytesWritten))
+        {
+            return false;
+        }
+        snapshot->resize(bytesWritten);
+        return true;
+    }
+
+    //---------------------------------------------------------------------------------------------------------------
+    // snapshots
+
+    //a snapshot restored into another manager saves back byte for byte and simulates on exactly like the original
+    bool TestSnapshotRoundTrip()
+    {
+        ParticleManager first, second;
+        std::vector<unsigned char> saved, restored, firstAfter, secondAfter;
+
+        CHECK(InitializeTestManager(&first));
+        CHECK(RunFrames(&first, 0, 120));
+        CHECK(SaveSnapshot(&first, &saved));
+
+        //the second manager's pool lives at another address and holds other particles when the snapshot arrives
+        CHECK(InitializeTestManager(&second));
+        CHECK(RunFrames(&second, 500, 30));
+        CHECK(second.RestoreSnapshot(saved.data(), (int)saved.size()));
+        CHECK(SaveSnapshot(&second, &restored));
+        CHECK(restored == saved);
+
+        CHECK(RunFrames(&first, 120, 60));
+        CHECK(RunFrames(&second, 120, 60));
+        CHECK(SaveSnapshot(&first, &firstAfter));
+        CHECK(SaveSnapshot(&second, &secondAfter));
+        CHECK(firstAfter == secondAfter);
+        CHECK(first.GetActiveInstanceCount() == second.GetActiveInstanceCount());
+
+        first.Shutdown();
+        second.Shutdown();
+        return true;
+    }
+
+    //truncated or damaged snapshots are turned down and the manager keeps the state it had
+    bool TestSnapshotRejectsDamage()
+    {
+        ParticleManager manager;
+        std::vector<unsigned char> saved, before, damaged, after;
+        unsigned int random = 12345;
+        int rejected = 0;
+
+        CHECK(InitializeTestManager(&manager));
+        CHECK(RunFrames(&manager, 0, 90));
+        CHECK(SaveSnapshot(&manager, &saved));
+        CHECK(RunFrames(&manager, 90, 10));
+        CHECK(SaveSnapshot(&manager, &before));
+
+        CHECK(!manager.RestoreSnapshot(saved.data(), (int)saved.size() - 1));
+        CHECK(!manager.RestoreSnapshot(saved.data(), 16));
+
+        damaged = saved;
+        damaged[4] ^= 0xFF;
+        CHECK(!manager.RestoreSnapshot(damaged.data(), (int)damaged.size()));
+
+        CHECK(SaveSnapshot(&manager, &after));
+        CHECK(after == before);
+
+        //overwrite words anywhere in the snapshot with values that are out of range as an index or turn a link back
+        //on itself. Whatever is accepted has to be safe to simulate, whatever is rejected must change nothing
+        const int32_t values[] = { -2, -1, 0, 1, 255, 256, 9999, 10000, 65536, 0x7FFFFFFF, (int32_t)0x80000000 };
+        for (auto i = 0; i < 3000; ++i)
+        {
+            random = (random * 1103515245u) + 12345u;
+            int offset = (int)((random >> 8) % (saved.size() / 4)) * 4;
+            random = (random * 1103515245u) + 12345u;
+            int32_t value = values[(random >> 8) % (sizeof(values) / sizeof(values[0]))];
+
+            damaged = saved;
+            memcpy(&damaged[offset], &value, sizeof(value));
+            if (manager.RestoreSnapshot(damaged.data(), (int)damaged.size()))
+            {
+                CHECK(RunFrames(&manager, 0, 2));
+                CHECK(manager.RestoreSnapshot(saved.data(), (int)saved.size()));
+            }
+            else
+            {
+                rejected++;
+            }
+        }
+        printf("  %d of 3000 damaged snapshots rejected\n", rejected);
+        CHECK(rejected > 0);
+
+        manager.Shutdown();
+        return true;
+    }
+
+    //---------------------------------------------------------------------------------------------------------------
+    // particle arena
+
+    //a full 10000 particle pool, whose last block only holds 16, cannot be packed with every slice starting on a block
+    //of its own: rain takes 11 full blocks and 16 of a twelfth, fire 24 blocks and the general slice needs 4 more
+    //blocks where only 3 full ones and the short one are left
+    bool TestArenaRebuildFullPool()
+    {
+        ParticleArena arena;
+        const int liveCounts[3] = { 2832, 6144, 1024 };
+        int allocated[3] = { 0, 0, 0 };
+        std::vector<unsigned char> before, after;
+
+        CHECK(arena.Initialize(10000, 3));
+
+        //take the particles in turns so the slices' blocks interleave, with the rain's last 16 in the short block
+        const int firstCounts[3] = { 2816, 6144, 1024 };
+        for (auto i = 0; i < 9984; ++i)
+        {
+            int slice = i % 3;
+            while (allocated[slice] == firstCounts[slice])
+            {
+                slice = (slice + 1) % 3;
+            }
+            CHECK(arena.Allocate(slice) >= 0);
+            allocated[slice]++;
+        }
+        for (auto i = 0; i < 16; ++i)
+        {
+            CHECK(arena.Allocate(0) >= 9984);
+        }
+        CHECK(arena.Allocate(0) < 0);
+        CHECK(arena.GetLiveCount(0) == liveCounts[0]);
+
+        before.resize(arena.GetStateSize());
+        arena.SaveState(before.data());
+        CHECK(!arena.Rebuild(liveCounts));
+        after.resize(arena.GetStateSize());
+        arena.SaveState(after.data());
+        CHECK(after == before);
+
+        //once a block's worth has died everything fits again
+        const int fewerCounts[3] = { 2832 - 40, 6144, 1024 };
+        CHECK(arena.Rebuild(fewerCounts));
+        CHECK(arena.GetSliceStart(0) == 0);
+        CHECK(arena.GetSliceStart(1) == 11 * ParticleArena::BlockSize);
+        CHECK(arena.GetSliceStart(2) == 35 * ParticleArena::BlockSize);
+        CHECK(arena.GetLiveCount(2) == 1024);
+        CHECK(arena.GetFreeBlockCount() == 1);
+        CHECK(arena.GetFragmentation() == 0);
+
+        arena.Shutdown();
+        return true;
+    }
+
+    //a manager whose pool is full is defragmented only when its lists fit, and the lists and arena agree afterwards
+    bool TestDefragmentFullPool()
+    {
+        ParticleManager manager;
+        std::vector<unsigned char> saved;
+        int packed = 0;
+        int skipped = 0;
+
+        CHECK(InitializeTestManager(&manager));
+
+        //long lived bursts fill the pool up while the rain and fire keep churning
+        for (auto frame = 0; frame < 240; ++frame)
+        {
+            if ((frame % 10) == 0)
+            {
+                manager.QueueBurst(XMFLOAT3(0.0f, 5.0f, 30.0f), 3000, 2.0f, 20.0f, XMFLOAT3(1.0f, 1.0f, 1.0f));
+            }
+            CHECK(manager.Frame(nullptr, FrameTime));
+
+            if (manager.DefragmentParticles())
+            {
+                packed++;
+            }
+            else
+            {
+                skipped++;
+            }
+
+            //a snapshot only restores when every list is inside the blocks the arena gives its slice
+            CHECK(SaveSnapshot(&manager, &saved));
+            CHECK(manager.RestoreSnapshot(saved.data(), (int)saved.size()));
+        }
+        printf("  %d passes packed, %d skipped\n", packed, skipped);
+        CHECK(skipped > 0);
+        CHECK(packed > 0);
+
+        manager.Shutdown();
+        return true;
+    }
+
+    //---------------------------------------------------------------------------------------------------------------
+    // occlusion culling and the views
+
+    //camera at the origin looking down +z with a 90 degree field of view, which takes in the whole rain box
+    void GetTestCamera(XMFLOAT4X4* viewMatrix, XMFLOAT4X4* projectionMatrix, XMFLOAT4X4* viewProjection)
+    {
+        const float nearPlane = 0.1f;
+        const float farPlane = 100.0f;
+
+        XMStoreFloat4x4(viewMatrix, XMMatrixIdentity());
+        memset(projectionMatrix, 0, sizeof(XMFLOAT4X4));
+        projectionMatrix->_11 = 1.0f;
+        projectionMatrix->_22 = 1.0f;
+        projectionMatrix->_33 = farPlane / (farPlane - nearPlane);
+        projectionMatrix->_34 = 1.0f;
+        projectionMatrix->_43 = -nearPlane * farPlane / (farPlane - nearPlane);
+        XMStoreFloat4x4(viewProjection, XMMatrixMultiply(XMLoadFloat4x4(viewMatrix), XMLoadFloat4x4(projectionMatrix)));
+    }
+
+    //the test scene with a view on the same camera and, when asked, a wall in front of that camera hiding everything
+    //from the occlusion test
+    bool InitializeOccludedManager(ParticleManager* manager, bool occlusion, int* viewIndex)
+    {
+        XMFLOAT4X4 viewMatrix, projectionMatrix, viewProjection;
+        const XMFLOAT3 wall[4] = { XMFLOAT3(-100.0f, -100.0f, 5.0f), XMFLOAT3(100.0f, -100.0f, 5.0f), XMFLOAT3(100.0f, 100.0f, 5.0f), XMFLOAT3(-100.0f, 100.0f, 5.0f) };
+        const unsigned int wallIndices[6] = { 0, 1, 2, 0, 2, 3 };
+
+        GetTestCamera(&viewMatrix, &projectionMatrix, &viewProjection);
+        if (!InitializeTestManager(manager))
+        {
+            return false;
+        }
+
+        if (occlusion)
+        {
+            if (!manager->EnableOcclusionCulling(128, 64))
+            {
+                return false;
+            }
+            manager->SetOcclusionCamera(viewProjection);
+            manager->AddOccluderMesh(wall, 4, wallIndices, 6);
+        }
+
+        (*viewIndex) = manager->AddView(nullptr);
+        if ((*viewIndex) < 0)
+        {
+            return false;
+        }
+        manager->SetViewCamera((*viewIndex), viewMatrix, projectionMatrix);
+        return true;
+    }
+
+    //occlusion only applies to the main camera, a view sees the same particles whether or not the main stream is culled
+    bool TestViewIgnoresOcclusion()
+    {
+        ParticleManager culled, unculled;
+        int culledView, unculledView;
+
+        CHECK(InitializeOccludedManager(&culled, true, &culledView));
+        CHECK(InitializeOccludedManager(&unculled, false, &unculledView));
+        CHECK(RunFrames(&culled, 0, 60));
+        CHECK(RunFrames(&unculled, 0, 60));
+
+        //the wall hides everything from the main camera
+        CHECK(culled.GetOccludedParticleCount() > 0);
+        CHECK(culled.GetActiveInstanceCount() < unculled.GetActiveInstanceCount() / 10);
+
+        CHECK(unculled.GetViewInstanceCount(unculledView) > 0);
+        CHECK(culled.GetViewInstanceCount(culledView) == unculled.GetViewInstanceCount(unculledView));
+        CHECK(culled.GetViewRainInstanceCount(culledView) == unculled.GetViewRainInstanceCount(unculledView));
+        CHECK(culled.GetViewFireInstanceCount(culledView) == unculled.GetViewFireInstanceCount(unculledView));
+
+        culled.Shutdown();
+        unculled.Shutdown();
+        return true;
+    }
+
+    //the density grid is not tied to a camera, smoke behind the wall still has to land in it
+    bool TestDensityGridIgnoresOcclusion()
+    {
+        ParticleManager culled, unculled;
+        int culledView, unculledView;
+
+        CHECK(InitializeOccludedManager(&culled, true, &culledView));
+        CHECK(InitializeOccludedManager(&unculled, false, &unculledView));
+        CHECK(culled.EnableDensityGrid(XMFLOAT3(-20.0f, -5.0f, 0.0f), XMFLOAT3(30.0f, 20.0f, 60.0f), 16, 8, 16));
+        CHECK(unculled.EnableDensityGrid(XMFLOAT3(-20.0f, -5.0f, 0.0f), XMFLOAT3(30.0f, 20.0f, 60.0f), 16, 8, 16));
+        CHECK(RunFrames(&culled, 0, 60));
+        CHECK(RunFrames(&unculled, 0, 60));
+
+        CHECK(culled.GetActiveInstanceCount() < unculled.GetActiveInstanceCount() / 10);
+
+        DensityGrid* culledGrid = culled.GetDensityGrid();
+        DensityGrid* unculledGrid = unculled.GetDensityGrid();
+        float total = 0.0f;
+        CHECK(culledGrid->GetCellCount() == unculledGrid->GetCellCount());
+        for (auto i = 0; i < unculledGrid->GetCellCount(); ++i)
+        {
+            CHECK(fabsf(culledGrid->GetCells()[i].w - unculledGrid->GetCells()[i].w) <= 1e-4f * (1.0f + unculledGrid->GetCells()[i].w));
+            total += unculledGrid->GetCells()[i].w;
+        }
+        CHECK(total > 0.0f);
+
+        culled.Shutdown();
+        unculled.Shutdown();
+        return true;
+    }
+
+    //a chunked update runs over the slices' blocks instead of the lists and has to move the same particles, while the
+    //bursts keep freeing and reusing particles inside the blocks
+    bool TestParallelUpdateMatchesSerial()
+    {
+        ParticleManager serial, parallel;
+
+        CHECK(InitializeTestManager(&serial));
+        CHECK(InitializeTestManager(&parallel));
+        //not a multiple of the block size, so chunks also end inside blocks
+        parallel.SetUpdateStrategy(UPDATE_PARALLEL, 300);
+        CHECK(serial.EnableDensityGrid(XMFLOAT3(-20.0f, -5.0f, 0.0f), XMFLOAT3(30.0f, 20.0f, 60.0f), 16, 8, 16));
+        CHECK(parallel.EnableDensityGrid(XMFLOAT3(-20.0f, -5.0f, 0.0f), XMFLOAT3(30.0f, 20.0f, 60.0f), 16, 8, 16));
+
+        for (auto i = 0; i < 240; ++i)
+        {
+            CHECK(RunFrames(&serial, i, 1));
+            CHECK(RunFrames(&parallel, i, 1));
+            CHECK(serial.GetActiveInstanceCount() == parallel.GetActiveInstanceCount());
+        }
+
+        DensityGrid* serialGrid = serial.GetDensityGrid();
+        DensityGrid* parallelGrid = parallel.GetDensityGrid();
+        CHECK(memcmp(serialGrid->GetCells(), parallelGrid->GetCells(), sizeof(XMFLOAT4) * serialGrid->GetCellCount()) == 0);
+
+        serial.Shutdown();
+        parallel.Shutdown();
+        return true;
+    }
+
+    //a stage that handed work to the task pool is counted once per frame however many batches it handed out, and the
+    //JSON says so
+    bool TestStatsMarkParallelStages()
+    {
+        ParticleStats stats;
+        std::string json;
+
+        CHECK(stats.Initialize(false));
+        for (auto i = 0; i < 3; ++i)
+        {
+            stats.BeginFrame();
+            stats.BeginStage(STAGE_UPDATE);
+            if (i > 0)
+            {
+                stats.MarkStageParallel(STAGE_UPDATE);
+                stats.MarkStageParallel(STAGE_UPDATE);
+            }
+            stats.EndStage(STAGE_UPDATE);
+            stats.BeginStage(STAGE_COLLISION);
+            stats.EndStage(STAGE_COLLISION);
+            stats.EndFrame(0);
+        }
+
+        CHECK(stats.GetParallelFrameCount(STAGE_UPDATE) == 2);
+        CHECK(stats.GetParallelFrameCount(STAGE_COLLISION) == 0);
+        stats.WriteJson(&json);
+        CHECK(json.find("\"update\":{") != std::string::npos);
+        CHECK(json.find("\"parallelFrames\":2", json.find("\"update\":{")) < json.find("\"collision\":{"));
+
+        stats.Reset();
+        CHECK(stats.GetParallelFrameCount(STAGE_UPDATE) == 0);
+        stats.Shutdown();
+        return true;
+    }
+
+    //---------------------------------------------------------------------------------------------------------------
+    // draw order
+
+    //bursts land in the compact pool every frame, the ones spawned this frame included the general range has to stay
+    //far to near. The instances are read back from a cache capture, which stores them as they were written
+    bool TestGeneralInstancesBackToFront()
+    {
+        const char* filename = "general_instances_back_to_front.cache";
+        ParticleManager manager;
+        ParticleCachePlayer player;
+        std::vector<float> instances;
+        int instanceCount, rainCount, fireCount;
+        int floatsPerInstance = 7;
+        int generalCount = 0;
+
+        manager.EnableCompactParticles(20000);
+        CHECK(InitializeTestManager(&manager));
+        CHECK(manager.BeginCacheCapture(filename));
+        for (auto i = 0; i < 60; ++i)
+        {
+            float x = (float)((i * 7) % 30) - 10.0f;
+            float z = (float)((i * 11) % 35) + 15.0f;
+            CHECK(manager.QueueBurst(XMFLOAT3(x, 2.0f, z), 40, 3.0f, 1.0f, XMFLOAT3(1.0f, 0.5f, 0.2f)));
+            CHECK(manager.Frame(nullptr, FrameTime));
+        }
+        CHECK(manager.EndCacheCapture());
+        manager.Shutdown();
+
+        CHECK(player.Open(filename));
+        CHECK(player.GetInstanceStride() == (int)(sizeof(float) * floatsPerInstance));
+        instances.resize((size_t)player.GetMaxInstances() * floatsPerInstance);
+        for (auto frame = 0; frame < player.GetFrameCount(); ++frame)
+        {
+            CHECK(player.ReadFrame(frame, instances.data(), &instanceCount, &rainCount, &fireCount));
+            for (auto i = rainCount + fireCount + 1; i < instanceCount; ++i)
+            {
+                CHECK(instances[(i - 1) * floatsPerInstance + 2] >= instances[i * floatsPerInstance + 2]);
+            }
+            generalCount += instanceCount - rainCount - fireCount;
+        }
+        player.Close();
+        remove(filename);
+
+        CHECK(generalCount > 0);
+        return true;
+    }
+
+    //analytic drops change column every time they land, they have to be sorted into the rain range like list rain
+    bool TestAnalyticRainBackToFront()
+    {
+        const char* filename = "analytic_rain_back_to_front.cache";
+        ParticleManager manager;
+        ParticleCachePlayer player;
+        std::vector<float> instances;
+        int instanceCount, rainCount, fireCount;
+        int floatsPerInstance = 7;
+
+        manager.EnableAnalyticRain(5000, 1234);
+        CHECK(InitializeTestManager(&manager));
+        CHECK(manager.BeginCacheCapture(filename));
+        CHECK(RunFrames(&manager, 0, 30));
+        CHECK(manager.EndCacheCapture());
+        manager.Shutdown();
+
+        CHECK(player.Open(filename));
+        instances.resize((size_t)player.GetMaxInstances() * floatsPerInstance);
+        for (auto frame = 0; frame < player.GetFrameCount(); ++frame)
+        {
+            CHECK(player.ReadFrame(frame, instances.data(), &instanceCount, &rainCount, &fireCount));
+            CHECK(rainCount >= 5000);
+            for (auto i = 1; i < rainCount; ++i)
+            {
+                CHECK(instances[(i - 1) * floatsPerInstance + 2] >= instances[i * floatsPerInstance + 2]);
+            }
+        }
+        player.Close();
+        remove(filename);
+        return true;
+    }
+
+    //a dense analytic rain lands far more drops a second than the pool holds splashes for, the splashes are thinned
+    //out so they never take the whole pool
+    bool TestAnalyticRainSplashesFitPool()
+    {
+        ParticleManager manager;
+
+        manager.EnableAnalyticRain(20000, 1234);
+        CHECK(manager.EnableStats(false));
+        CHECK(InitializeTestManager(&manager));
+        //a whole fall, every drop lands at least once
+        CHECK(RunFrames(&manager, 0, 240));
+
+        CHECK(manager.GetStats()->GetAllocationCount() > 0);
+        CHECK(manager.GetStats()->GetDroppedCount() == 0);
+
+        manager.Shutdown();
+        return true;
+    }
+
+    //---------------------------------------------------------------------------------------------------------------
+    // fire instancing
+
+    //queued fire has to go where the continuous fire goes, a world position in the instanced fire would be drawn again
+    //under every copy's transform
+    bool TestQueuedFireJoinsInstancedFire()
+    {
+        const char* filename = "queued_fire_joins_instanced_fire.cache";
+        ParticleManager manager;
+        ParticleCachePlayer player;
+        std::vector<float> instances;
+        XMFLOAT4X4 transform;
+        int instanceCount, rainCount, fireCount;
+        int floatsPerInstance = 7;
+        int fireTotal = 0;
+
+        manager.EnableFireInstancing(4);
+        CHECK(InitializeTestManager(&manager));
+        XMStoreFloat4x4(&transform, XMMatrixIdentity());
+        transform._41 = 5.0f;
+        transform._43 = 30.0f;
+        CHECK(manager.AddFireInstance(transform, 0.0f) >= 0);
+
+        CHECK(manager.BeginCacheCapture(filename));
+        for (auto i = 0; i < 30; ++i)
+        {
+            CHECK(manager.QueueFire(XMFLOAT3(-40.0f, 0.0f, 90.0f), 20));
+            CHECK(manager.Frame(nullptr, FrameTime));
+        }
+        CHECK(manager.EndCacheCapture());
+        manager.Shutdown();
+
+        //every fire instance sits around the one copy
+        CHECK(player.Open(filename));
+        instances.resize((size_t)player.GetMaxInstances() * floatsPerInstance);
+        for (auto frame = 0; frame < player.GetFrameCount(); ++frame)
+        {
+            CHECK(player.ReadFrame(frame, instances.data(), &instanceCount, &rainCount, &fireCount));
+            for (auto i = rainCount; i < rainCount + fireCount; ++i)
+            {
+                CHECK(fabsf(instances[i * floatsPerInstance] - 5.0f) < 5.0f);
+                CHECK(fabsf(instances[i * floatsPerInstance + 2] - 30.0f) < 5.0f);
+            }
+            fireTotal += fireCount;
+        }
+        player.Close();
+        remove(filename);
+
+        CHECK(fireTotal > 0);
+        return true;
+    }
+
+    //copy placed at (x, 0, z), turned half way around the y axis when rotated
+    XMFLOAT4X4 GetCopyTransform(float x, float z, bool rotated)
+    {
+        XMFLOAT4X4 transform;
+
+        XMStoreFloat4x4(&transform, XMMatrixIdentity());
+        if (rotated)
+        {
+            transform._11 = -1.0f;
+            transform._33 = -1.0f;
+        }
+        transform._41 = x;
+        transform._43 = z;
+        return transform;
+    }
+
+    //instances of the fire range that fall in the box around a copy's position, in the order they were written
+    void GetCopyInstances(const std::vector<float>& instances, int first, int count, float x, float z, std::vector<float>* copyInstances)
+    {
+        const int floatsPerInstance = 7;
+
+        copyInstances->clear();
+        for (auto i = first; i < first + count; ++i)
+        {
+            const float* instance = &instances[i * floatsPerInstance];
+            if (fabsf(instance[0] - x) < 8.0f && fabsf(instance[2] - z) < 8.0f)
+            {
+                copyInstances->insert(copyInstances->end(), instance, instance + floatsPerInstance);
+            }
+        }
+        return;
+    }
+
+    //copies moved back to their local space have to match the copy drawn without a transform or time offset, frame for
+    //frame for a rotated copy and from an older frame for a copy that lags behind
+    bool MatchesCopy(const std::vector<float>& copy, const std::vector<float>& reference, float x, float z, bool rotated)
+    {
+        const int floatsPerInstance = 7;
+
+        if (copy.size() != reference.size() || copy.empty())
+        {
+            return false;
+        }
+        for (auto i = 0; i < (int)copy.size(); i += floatsPerInstance)
+        {
+            float localX = rotated ? x - copy[i] : copy[i] - x;
+            float localZ = rotated ? z - copy[i + 2] : copy[i + 2] - z;
+            if (fabsf(localX - reference[i]) > 0.001f || fabsf(copy[i + 1] - reference[i + 1]) > 0.001f ||
+                fabsf(localZ - reference[i + 2]) > 0.001f || memcmp(&copy[i + 3], &reference[i + 3], sizeof(float) * 4) != 0)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    //each copy draws the fire under its own transform, and a time offset copy draws the fire from the history ring
+    //however long the capture runs past the 64 frames the ring holds
+    bool TestFireCopiesFollowTransforms()
+    {
+        const char* filename = "fire_copies_follow_transforms.cache";
+        ParticleManager manager;
+        ParticleCachePlayer player;
+        std::vector<float> instances;
+        std::vector<std::vector<float>> reference;
+        std::vector<float> rotated, lagging, oldest;
+        int instanceCount, rainCount, fireCount;
+        int floatsPerInstance = 7;
+
+        manager.EnableFireInstancing(4);
+        CHECK(InitializeTestManager(&manager));
+
+        //the reference copy sits at (0, 0, 70) and the others are compared against its local positions
+        CHECK(manager.AddFireInstance(GetCopyTransform(0.0f, 70.0f, false), 0.0f) >= 0);
+        CHECK(manager.AddFireInstance(GetCopyTransform(-20.0f, 40.0f, true), 0.0f) >= 0);
+        //0.49 seconds is 30 frames back, 5 seconds is further back than the ring goes and draws its oldest frame
+        CHECK(manager.AddFireInstance(GetCopyTransform(20.0f, 40.0f, false), 0.49f) >= 0);
+        CHECK(manager.AddFireInstance(GetCopyTransform(0.0f, 10.0f, false), 5.0f) >= 0);
+
+        CHECK(manager.BeginCacheCapture(filename));
+        CHECK(RunFrames(&manager, 0, 150));
+        CHECK(manager.EndCacheCapture());
+        manager.Shutdown();
+
+        CHECK(player.Open(filename));
+        CHECK(player.GetFrameCount() == 150);
+        instances.resize((size_t)player.GetMaxInstances() * floatsPerInstance);
+        reference.resize(player.GetFrameCount());
+        for (auto frame = 0; frame < player.GetFrameCount(); ++frame)
+        {
+            CHECK(player.ReadFrame(frame, instances.data(), &instanceCount, &rainCount, &fireCount));
+            GetCopyInstances(instances, rainCount, fireCount, 0.0f, 70.0f, &reference[frame]);
+            for (auto i = 0; i < (int)reference[frame].size(); i += floatsPerInstance)
+            {
+                reference[frame][i + 2] -= 70.0f;
+            }
+
+            GetCopyInstances(instances, rainCount, fireCount, -20.0f, 40.0f, &rotated);
+            CHECK(MatchesCopy(rotated, reference[frame], -20.0f, 40.0f, true));
+            if (frame >= 30)
+            {
+                GetCopyInstances(instances, rainCount, fireCount, 20.0f, 40.0f, &lagging);
+                CHECK(MatchesCopy(lagging, reference[frame - 30], 20.0f, 40.0f, false));
+            }
+            if (frame >= 63)
+            {
+                GetCopyInstances(instances, rainCount, fireCount, 0.0f, 10.0f, &oldest);
+                CHECK(MatchesCopy(oldest, reference[frame - 63], 0.0f, 10.0f, false));
+            }
+        }
+        player.Close();
+        remove(filename);
+        return true;
+    }
+
+    //queued fire can grow past the room the copies were given, the farthest copies are left out and counted instead of
+    //the general particles written after the fire
+    bool TestFireCopiesFitInstanceArray()
+    {
+        const char* filename = "fire_copies_fit_instance_array.cache";
+        ParticleManager manager;
+        ParticleCachePlayer player;
+        std::vector<float> instances;
+        int instanceCount, rainCount, fireCount;
+        int floatsPerInstance = 7;
+
+        manager.EnableFireInstancing(4);
+        CHECK(InitializeTestManager(&manager));
+        CHECK(manager.EnableStats(false));
+        for (auto i = 0; i < 4; ++i)
+        {
+            CHECK(manager.AddFireInstance(GetCopyTransform(-30.0f + 20.0f * i, 40.0f + 10.0f * i, false), 0.0f) >= 0);
+        }
+
+        CHECK(manager.BeginCacheCapture(filename));
+        CHECK(manager.QueueBurst(XMFLOAT3(0.0f, 10.0f, 60.0f), 300, 0.5f, 20.0f, XMFLOAT3(0.25f, 1.0f, 0.25f)));
+        for (auto i = 0; i < 40; ++i)
+        {
+            CHECK(manager.QueueFire(XMFLOAT3(0.0f, 0.0f, 0.0f), 100));
+            CHECK(manager.Frame(nullptr, FrameTime));
+        }
+        CHECK(manager.EndCacheCapture());
+        CHECK(manager.GetStats()->GetDroppedInstanceCount() > 0);
+        manager.Shutdown();
+
+        //every particle of the burst is drawn on every frame, and the nearest copy is never the one left out
+        CHECK(player.Open(filename));
+        instances.resize((size_t)player.GetMaxInstances() * floatsPerInstance);
+        for (auto frame = 0; frame < player.GetFrameCount(); ++frame)
+        {
+            CHECK(player.ReadFrame(frame, instances.data(), &instanceCount, &rainCount, &fireCount));
+            int burstCount = 0;
+            for (auto i = rainCount + fireCount; i < instanceCount; ++i)
+            {
+                const float* color = &instances[i * floatsPerInstance + 3];
+                burstCount += (color[0] == 0.25f && color[1] == 1.0f && color[2] == 0.25f) ? 1 : 0;
+            }
+            CHECK(burstCount == 300);
+            CHECK(fabsf(instances[(rainCount + fireCount - 1) * floatsPerInstance] + 30.0f) < 8.0f);
+        }
+        player.Close();
+        remove(filename);
+        return true;
+    }
+
+    //the runtime configured kernel is there to compare against, it has to simulate exactly what the specialized ones do
+    bool TestGenericKernelsMatchSpecialized()
+    {
+        ParticleManager specialized, generic;
+
+        CHECK(InitializeTestManager(&specialized));
+        CHECK(InitializeTestManager(&generic));
+        generic.SetGenericKernels(true);
+        CHECK(specialized.EnableDensityGrid(XMFLOAT3(-20.0f, -5.0f, 0.0f), XMFLOAT3(30.0f, 20.0f, 60.0f), 16, 8, 16));
+        CHECK(generic.EnableDensityGrid(XMFLOAT3(-20.0f, -5.0f, 0.0f), XMFLOAT3(30.0f, 20.0f, 60.0f), 16, 8, 16));
+
+        for (auto i = 0; i < 240; ++i)
+        {
+            CHECK(RunFrames(&specialized, i, 1));
+            CHECK(RunFrames(&generic, i, 1));
+            CHECK(specialized.GetActiveInstanceCount() == generic.GetActiveInstanceCount());
+        }
+
+        DensityGrid* specializedGrid = specialized.GetDensityGrid();
+        DensityGrid* genericGrid = generic.GetDensityGrid();
+        CHECK(memcmp(specializedGrid->GetCells(), genericGrid->GetCells(), sizeof(XMFLOAT4) * specializedGrid->GetCellCount()) == 0);
+
+        specialized.Shutdown();
+        generic.Shutdown();
+        return true;
+    }
+
+    //---------------------------------------------------------------------------------------------------------------
+    // scene collision
+
+    //an instanced fire lives at the origin, a mesh there must not catch it while the copies burn somewhere else
+    bool TestInstancedFireSkipsCollision()
+    {
+        ParticleManager manager;
+        const XMFLOAT3 floor[4] = { XMFLOAT3(-3.0f, 0.5f, -3.0f), XMFLOAT3(3.0f, 0.5f, -3.0f), XMFLOAT3(3.0f, 0.5f, 3.0f), XMFLOAT3(-3.0f, 0.5f, 3.0f) };
+        const unsigned int floorIndices[6] = { 0, 1, 2, 0, 2, 3 };
+        XMFLOAT4X4 transform;
+        int fireImpacts = 0;
+
+        manager.EnableFireInstancing(4);
+        CHECK(InitializeTestManager(&manager));
+        XMStoreFloat4x4(&transform, XMMatrixIdentity());
+        transform._41 = 5.0f;
+        transform._43 = 30.0f;
+        CHECK(manager.AddFireInstance(transform, 0.0f) >= 0);
+        CHECK(manager.AddCollisionMesh(floor, 4, floorIndices, 6, COLLISION_KILL) >= 0);
+        CHECK(manager.BuildSceneCollision());
+
+        for (auto i = 0; i < 120; ++i)
+        {
+            CHECK(manager.Frame(nullptr, FrameTime));
+            for (auto j = 0; j < manager.GetImpactCount(); ++j)
+            {
+                if (manager.GetImpacts()[j].particleType == IMPACT_FIRE)
+                {
+                    fireImpacts++;
+                }
+            }
+        }
+
+        CHECK(manager.GetFireInstanceCount() > 0);
+        CHECK(fireImpacts == 0);
+
+        manager.Shutdown();
+        return true;
+    }
+
+    //---------------------------------------------------------------------------------------------------------------
+    // billboard packing
+
+    float UnpackRed(unsigned int half)
+    {
+        return BillboardBuffer::UnpackColor(half, 0).x;
+    }
+
+    unsigned int PackRed(float value)
+    {
+        unsigned int colorRG, colorBA;
+        BillboardBuffer::PackColor(XMFLOAT4(value, 0.0f, 0.0f, 0.0f), &colorRG, &colorBA);
+        return colorRG & 0xffff;
+    }
+
+    //hdr colors have to reach the shader as they are, the old rgba8 packing clamped them to 1
+    bool TestBillboardColorPacking()
+    {
+        BillboardBuffer::BillboardInstance instance;
+        XMFLOAT4 color;
+
+        CHECK(sizeof(BillboardBuffer::BillboardInstance) == 32);
+
+        //every finite half survives the trip through float and back
+        for (unsigned int half = 0; half < 0x10000; ++half)
+        {
+            if ((half & 0x7c00) == 0x7c00)
+            {
+                continue;
+            }
+            CHECK(PackRed(UnpackRed(half)) == half);
+        }
+
+        CHECK(PackRed(1.0f) == 0x3c00);
+        CHECK(PackRed(-2.0f) == 0xc000);
+        CHECK(PackRed(65504.0f) == 0x7bff);
+        CHECK(PackRed(1.0e6f) == 0x7bff);
+        CHECK(PackRed(-1.0e6f) == 0xfbff);
+        CHECK(PackRed(NAN) == 0);
+        CHECK(PackRed(1.0e-9f) == 0);
+        //halfway between two halves goes to the even one
+        CHECK(PackRed(1.0f + (1.0f / 2048.0f)) == 0x3c00);
+        CHECK(PackRed(1.0f + (3.0f / 2048.0f)) == 0x3c02);
+        CHECK(PackRed(7.0f / 33554432.0f) == 0x0004);
+        CHECK(PackRed(5.0f / 33554432.0f) == 0x0002);
+
+        for (auto i = 0; i < 1000; ++i)
+        {
+            float value = 0.001f * powf(1.0137f, (float)i);
+            CHECK(fabsf(UnpackRed(PackRed(value)) - value) <= value * (1.0f / 2048.0f));
+        }
+
+        BillboardBuffer::PackInstance(XMFLOAT3(1.0f, 2.0f, 3.0f), XMFLOAT4(6.5f, 2.25f, 0.5f, 1.0f), BillboardBuffer::BILLBOARD_FIRE, &instance);
+        color = BillboardBuffer::UnpackColor(instance.colorRG, instance.colorBA);
+        CHECK(color.x == 6.5f && color.y == 2.25f && color.z == 0.5f && color.w == 1.0f);
+        CHECK(instance.type == BillboardBuffer::BILLBOARD_FIRE);
+        return true;
+    }
+
+    //---------------------------------------------------------------------------------------------------------------
+    // instance ring
+
+    //maps and unmaps straight away like an upload, fills the range so overwrites of other ranges show up
+    int MapRange(InstanceRingBuffer* ring, int bytes, unsigned char value, int* allocation)
+    {
+        int offset = -1;
+        unsigned char* memory = ring->Map(bytes, &offset, allocation);
+        if (!memory)
+        {
+            return -1;
+        }
+        memset(memory, value, bytes);
+        ring->Unmap();
+        return offset;
+    }
+
+    bool IsRangeFilled(const unsigned char* memory, int offset, int bytes, unsigned char value)
+    {
+        for (auto i = 0; i < bytes; ++i)
+        {
+            if (memory[offset + i] != value)
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    //a range that does not fit before the end of the buffer starts again at 0 while an older range is still in flight
+    bool TestRingWrapsAround()
+    {
+        InstanceRingBuffer ring;
+        CpuInstanceRingBackend* backend = new CpuInstanceRingBackend;
+        int first, second, third, fourth, fifth, unused;
+        unsigned char* memory;
+
+        //fences only complete when the test says so
+        backend->SetLatency(1000);
+        CHECK(ring.Initialize(backend, 1024));
+        memory = backend->Map(false);
+        CHECK(memory);
+        backend->Unmap();
+
+        CHECK(MapRange(&ring, 300, 1, &first) == 0);
+        CHECK(MapRange(&ring, 300, 2, &second) == 304);
+        CHECK(MapRange(&ring, 300, 3, &third) == 608);
+        CHECK(ring.GetUsedBytes() == 912);
+
+        //the third range is still being drawn from, the first two are done
+        ring.Release(first);
+        ring.Release(second);
+        backend->CompleteAllFences();
+
+        //the end of the buffer is skipped and counted as used until the ring passes it
+        CHECK(MapRange(&ring, 300, 4, &fourth) == 0);
+        CHECK(ring.GetUsedBytes() == (1024 - 608) + 304);
+        //ends exactly where the third range starts
+        CHECK(MapRange(&ring, 300, 5, &fifth) == 304);
+        CHECK(ring.GetUsedBytes() == 1024);
+        CHECK(MapRange(&ring, 16, 6, &unused) < 0);
+        CHECK(ring.GetFullCount() == 1);
+
+        CHECK(IsRangeFilled(memory, 0, 300, 4));
+        CHECK(IsRangeFilled(memory, 304, 300, 5));
+        CHECK(IsRangeFilled(memory, 608, 300, 3));
+        CHECK(ring.GetAllocationsInFlight() == 3);
+        //only the first map of the buffer throws the contents away
+        CHECK(backend->GetDiscardCount() == 1);
+
+        ring.Shutdown();
+        return true;
+    }
+
+    //released ranges come back once the gpu passes their fence, and not before
+    bool TestRingWaitsForFence()
+    {
+        InstanceRingBuffer ring;
+        CpuInstanceRingBackend* backend = new CpuInstanceRingBackend;
+        int first, second, third, fourth, unused;
+
+        //a fence completes once one more has been issued after it
+        backend->SetLatency(1);
+        CHECK(ring.Initialize(backend, 1024));
+
+        CHECK(MapRange(&ring, 512, 1, &first) == 0);
+        CHECK(MapRange(&ring, 512, 2, &second) == 512);
+
+        //released but the gpu has not got there yet
+        ring.Release(first);
+        CHECK(MapRange(&ring, 512, 3, &unused) < 0);
+        CHECK(ring.GetFullCount() == 1);
+        CHECK(!backend->IsMapped());
+
+        //the second fence puts the first one behind the gpu
+        ring.Release(second);
+        CHECK(MapRange(&ring, 512, 3, &third) == 0);
+        CHECK(ring.GetAllocationsInFlight() == 2);
+
+        //an allocation that was never released holds back the ones after it, even with every fence complete
+        backend->CompleteAllFences();
+        CHECK(MapRange(&ring, 512, 4, &fourth) == 512);
+        ring.Release(fourth);
+        backend->CompleteAllFences();
+        CHECK(MapRange(&ring, 16, 5, &unused) < 0);
+        CHECK(ring.GetAllocationsInFlight() == 2);
+
+        ring.Release(third);
+        backend->CompleteAllFences();
+        CHECK(MapRange(&ring, 1024, 5, &unused) == 0);
+        CHECK(ring.GetAllocationsInFlight() == 1);
+
+        ring.Shutdown();
+        return true;
+    }
+
+    //a range larger than the ring fails without mapping or counting as full, and the ring keeps working
+    bool TestRingRejectsOversized()
+    {
+        InstanceRingBuffer ring;
+        CpuInstanceRingBackend* backend = new CpuInstanceRingBackend;
+        int allocation = -1;
+        int offset = -1;
+
+        CHECK(ring.Initialize(backend, 1000));
+        //rounded down to the range alignment
+        CHECK(ring.GetSize() == 992);
+
+        CHECK(ring.Map(993, &offset, &allocation) == nullptr);
+        CHECK(ring.Map(INT_MAX, &offset, &allocation) == nullptr);
+        CHECK(ring.Map(0, &offset, &allocation) == nullptr);
+        CHECK(ring.Map(-16, &offset, &allocation) == nullptr);
+        CHECK(backend->GetMapCount() == 0);
+        CHECK(!backend->IsMapped());
+        CHECK(ring.GetFullCount() == 0);
+        CHECK(ring.GetAllocationsInFlight() == 0);
+
+        CHECK(MapRange(&ring, 992, 1, &allocation) == 0);
+        CHECK(ring.GetUsedBytes() == 992);
+
+        ring.Shutdown();
+        return true;
+    }
+
+#ifdef PARTICLE_NULL_DEVICE
+    bool InitializeRingManager(ParticleManager* manager, NullDevice* device, ID3D11DeviceContext* deviceContext)
+    {
+        manager->SetRandomSeed(42);
+        manager->SetFirePosition(XMFLOAT3(5.0f, 0.0f, 30.0f));
+        manager->EnableInstanceRing(1 << 20);
+        //the textures are never loaded, the ring does not need them
+        return manager->Initialize(device, deviceContext, "missing.tex", "missing.tex", "missing.tex");
+    }
+
+    //a ring is mapped and fenced through one context, managers on another context get a ring of their own
+    bool TestRingPerContext()
+    {
+        NullDevice device(true);
+        ParticleManager first, second, other;
+        ID3D11DeviceContext* otherContext = nullptr;
+
+        CHECK(SUCCEEDED(device.CreateDeferredContext(0, &otherContext)));
+        CHECK(InitializeRingManager(&first, &device, device.GetImmediateContext()));
+        CHECK(InitializeRingManager(&second, &device, device.GetImmediateContext()));
+        CHECK(InitializeRingManager(&other, &device, otherContext));
+        CHECK(first.GetInstanceRing() != nullptr);
+        CHECK(first.GetInstanceRing() == second.GetInstanceRing());
+        CHECK(other.GetInstanceRing() != nullptr);
+        CHECK(other.GetInstanceRing() != first.GetInstanceRing());
+
+        first.Shutdown();
+        CHECK(second.GetInstanceRing() != nullptr);
+        second.Shutdown();
+        other.Shutdown();
+        otherContext->Release();
+        CHECK(device.GetLiveObjectCount() == 0);
+        return true;
+    }
+
+    //a manager that stops uploading hands its range back, otherwise the ranges after it could never retire and the
+    //other manager on the ring would end up on its own buffer
+    bool TestRingSkippedUploadReleasesRange()
+    {
+        NullDevice device(true);
+        ParticleManager skipping, uploading;
+        ID3D11DeviceContext* deviceContext = device.GetImmediateContext();
+
+        CHECK(InitializeRingManager(&skipping, &device, deviceContext));
+        CHECK(InitializeRingManager(&uploading, &device, deviceContext));
+        InstanceRingBuffer* ring = uploading.GetInstanceRing();
+
+        CHECK(skipping.Frame(deviceContext, FrameTime));
+        CHECK(uploading.Frame(deviceContext, FrameTime));
+        CHECK(ring->GetAllocationsInFlight() == 2);
+        for (auto i = 0; i < 200; ++i)
+        {
+            //headless frames simulate without uploading
+            CHECK(skipping.Frame(nullptr, FrameTime));
+            CHECK(uploading.Frame(deviceContext, FrameTime));
+            CHECK(ring->GetAllocationsInFlight() <= 2);
+        }
+        CHECK(ring->GetFullCount() == 0);
+
+        skipping.Shutdown();
+        uploading.Shutdown();
+        CHECK(device.GetLiveObjectCount() == 0);
+        return true;
+    }
+#endif
+
+    //---------------------------------------------------------------------------------------------------------------
+    // dormant emitters
+
+    //the test camera moved sideways, or turned around to face away from the whole scene
+    void GetMovedCamera(float offsetX, bool turnAround, XMFLOAT4X4* viewProjection)
+    {
+        XMFLOAT4X4 viewMatrix, projectionMatrix, unused;
+
+        GetTestCamera(&viewMatrix, &projectionMatrix, &unused);
+        viewMatrix._41 = -offsetX;
+        if (turnAround)
+        {
+            viewMatrix._11 = -1.0f;
+            viewMatrix._33 = -1.0f;
+        }
+        XMStoreFloat4x4(viewProjection, XMMatrixMultiply(XMLoadFloat4x4(&viewMatrix), XMLoadFloat4x4(&projectionMatrix)));
+    }
+
+    bool RunQuietFrames(ParticleManager* manager, int frameCount)
+    {
+        for (auto i = 0; i < frameCount; ++i)
+        {
+            if (!manager->Frame(nullptr, FrameTime))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    //a fire that was away catches up with every frame it missed, the one it went dormant on included
+    bool TestDormantFireCatchesUp()
+    {
+        ParticleManager manager;
+        XMFLOAT4X4 viewProjection, awayViewProjection;
+        const int awayFrames = 120;
+
+        GetMovedCamera(0.0f, false, &viewProjection);
+        GetMovedCamera(0.0f, true, &awayViewProjection);
+        manager.EnableDormantEmitters(0.0f);
+        CHECK(InitializeTestManager(&manager));
+        manager.SetRelevanceCamera(viewProjection, XMFLOAT3(0.0f, 0.0f, 0.0f));
+        CHECK(RunQuietFrames(&manager, 1));
+        CHECK(!manager.IsFireDormant());
+
+        manager.SetRelevanceCamera(awayViewProjection, XMFLOAT3(0.0f, 0.0f, 0.0f));
+        CHECK(RunQuietFrames(&manager, awayFrames));
+        CHECK(manager.IsFireDormant());
+        CHECK(manager.IsRainDormant());
+        CHECK(manager.GetFireInstanceCount() == 0);
+
+        //the catch up places the fire emitted over the frames away, 150 a second, and the frame back emits 2 more
+        manager.SetRelevanceCamera(viewProjection, XMFLOAT3(0.0f, 0.0f, 0.0f));
+        CHECK(RunQuietFrames(&manager, 1));
+        CHECK(!manager.IsFireDormant());
+        CHECK(!manager.IsRainDormant());
+        CHECK(manager.GetFireInstanceCount() >= (int)(150.0f * awayFrames * FrameTime) + 1);
+        CHECK(manager.GetFireInstanceCount() <= (int)(150.0f * awayFrames * FrameTime) + 2);
+
+        manager.Shutdown();
+        return true;
+    }
+
+    //queued fire burns away from the fire position, turning away from the continuous fire must not take it along
+    bool TestDormancyKeepsQueuedFire()
+    {
+        ParticleManager manager;
+        XMFLOAT4X4 viewProjection, movedViewProjection, awayViewProjection;
+        int fireCount;
+
+        GetMovedCamera(0.0f, false, &viewProjection);
+        //the continuous fire at x = 5 is out of view, the queued fire at x = -55 is in front of the camera
+        GetMovedCamera(-60.0f, false, &movedViewProjection);
+        GetMovedCamera(0.0f, true, &awayViewProjection);
+        manager.EnableDormantEmitters(0.0f);
+        CHECK(InitializeTestManager(&manager));
+        manager.SetRelevanceCamera(viewProjection, XMFLOAT3(0.0f, 0.0f, 0.0f));
+        CHECK(manager.QueueFire(XMFLOAT3(-55.0f, 0.0f, 30.0f), 100));
+        CHECK(RunQuietFrames(&manager, 10));
+        fireCount = manager.GetFireInstanceCount();
+
+        manager.SetRelevanceCamera(movedViewProjection, XMFLOAT3(-60.0f, 0.0f, 0.0f));
+        CHECK(RunQuietFrames(&manager, 10));
+        CHECK(!manager.IsFireDormant());
+        CHECK(manager.GetFireInstanceCount() >= fireCount);
+
+        //with nothing of the fire in view it goes dormant, a new queued fire wakes it again
+        manager.SetRelevanceCamera(awayViewProjection, XMFLOAT3(0.0f, 0.0f, 0.0f));
+        CHECK(RunQuietFrames(&manager, 2));
+        CHECK(manager.IsFireDormant());
+        CHECK(manager.QueueFire(XMFLOAT3(-55.0f, 0.0f, 30.0f), 100));
+        CHECK(RunQuietFrames(&manager, 1));
+        CHECK(manager.GetFireInstanceCount() >= 100);
+        manager.Shutdown();
+
+        //without a continuous fire only the queued fire decides
+        ParticleManager disabled;
+        disabled.SetFireEnabled(false);
+        disabled.EnableDormantEmitters(0.0f);
+        CHECK(InitializeTestManager(&disabled));
+        disabled.SetRelevanceCamera(viewProjection, XMFLOAT3(0.0f, 0.0f, 0.0f));
+        CHECK(RunQuietFrames(&disabled, 1));
+        CHECK(disabled.QueueFire(XMFLOAT3(0.0f, 0.0f, 20.0f), 100));
+        CHECK(RunQuietFrames(&disabled, 10));
+        CHECK(!disabled.IsFireDormant());
+        CHECK(disabled.GetFireInstanceCount() == 100);
+        disabled.Shutdown();
+        return true;
+    }
+
+    //---------------------------------------------------------------------------------------------------------------
+    // effect library
+
+    bool WriteText(const char* filename, const char* text)
+    {
+        FILE* file = fopen(filename, "w");
+        if (!file)
+        {
+            return false;
+        }
+        fputs(text, file);
+        return fclose(file) == 0;
+    }
+
+    //a name used twice for the same type fails on the second definition, not on line 0
+    bool TestEffectDuplicateReportsLine()
+    {
+        const char* textFilename = "effect_duplicate_reports_line.txt";
+        const char* binaryFilename = "effect_duplicate_reports_line.fxlib";
+        int errorLine = -1;
+        bool compiled;
+
+        CHECK(WriteText(textFilename,
+            "[fire campfire]\n"
+            "particlesPerSecond = 100\n"
+            "\n"
+            "[ring campfire]\n"
+            "[fire torch]\n"
+            "# the same name as the first section\n"
+            "[fire campfire]\n"
+            "particlesPerSecond = 200\n"));
+        compiled = EffectLibrary::CompileText(textFilename, binaryFilename, &errorLine);
+        remove(textFilename);
+        remove(binaryFilename);
+
+        CHECK(!compiled);
+        CHECK(errorLine == 7);
+        return true;
+    }
+
+    //a rewrite within the same second that keeps the file size is still picked up
+    bool TestEffectReloadSameSize()
+    {
+        const char* textFilename = "effect_reload_same_size.txt";
+        const char* binaryFilename = "effect_reload_same_size.fxlib";
+        EffectLibrary library;
+        const EffectLibrary::EffectRecord* record;
+        int errorLine = 0;
+        bool passed = false;
+
+        //records are fixed size, so changing a value leaves the size of the compiled file alone
+        if (WriteText(textFilename, "[fire campfire]\nparticlesPerSecond = 100\n") &&
+            EffectLibrary::CompileText(textFilename, binaryFilename, &errorLine) && library.Load(binaryFilename) &&
+            !library.CheckForReload() &&
+            WriteText(textFilename, "[fire campfire]\nparticlesPerSecond = 200\n") &&
+            EffectLibrary::CompileText(textFilename, binaryFilename, &errorLine) && library.CheckForReload())
+        {
+            record = library.FindEffect("campfire", EFFECT_FIRE);
+            passed = record && record->fire.particlesPerSecond == 200.0f && !library.CheckForReload();
+        }
+
+        library.Shutdown();
+        remove(textFilename);
+        remove(binaryFilename);
+
+        CHECK(passed);
+        return true;
+    }
+
+    //---------------------------------------------------------------------------------------------------------------
+    // particle cache
+
+    //rewrites the header of a cache file in place
+    bool PatchCacheHeader(const char* filename, uint32_t instanceStride, uint32_t maxInstances)
+    {
+        ParticleCacheFormat::FileHeader header;
+
+        FILE* file = fopen(filename, "r+b");
+        if (!file)
+        {
+            return false;
+        }
+        bool result = fread(&header, sizeof(header), 1, file) == 1;
+        header.instanceStride = instanceStride;
+        header.maxInstances = maxInstances;
+        result = result && fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1;
+        fclose(file);
+        return result;
+    }
+
+    //frame sizes from a damaged header are refused before anything is allocated from them, and the writer does not
+    //make files the player would refuse
+    bool TestCacheRejectsOversizedHeader()
+    {
+        const char* filename = "cache_rejects_oversized_header.cache";
+        ParticleCacheWriter writer;
+        ParticleCachePlayer player;
+        std::vector<float> frame(7 * 100, 1.0f);
+
+        CHECK(!writer.Open(filename, 1024, 100, 4));
+        CHECK(!writer.Open(filename, 28, INT_MAX, 4));
+        CHECK(writer.Open(filename, 28, 100, 4));
+        CHECK(writer.WriteFrame(frame.data(), 100, 0, 0, FrameTime));
+        CHECK(writer.WriteFrame(frame.data(), 100, 0, 0, FrameTime));
+        CHECK(writer.Close());
+        CHECK(player.Open(filename));
+        player.Close();
+
+        //the product of these overflows 32 bits
+        CHECK(PatchCacheHeader(filename, 28, 0xffffffffu));
+        CHECK(!player.Open(filename));
+        CHECK(PatchCacheHeader(filename, 1u << 30, 100));
+        CHECK(!player.Open(filename));
+        CHECK(PatchCacheHeader(filename, 28, ParticleCacheFormat::MaxFrameBytes / 28 + 1));
+        CHECK(!player.Open(filename));
+        CHECK(PatchCacheHeader(filename, 28, 0));
+        CHECK(!player.Open(filename));
+
+        CHECK(PatchCacheHeader(filename, 28, 100));
+        CHECK(player.Open(filename));
+        player.Close();
+        remove(filename);
+        return true;
+    }
+
+    //---------------------------------------------------------------------------------------------------------------
+    // spawn queue
+
+    //a full coalescing queue merges commands in the same grid cell and drops the ones outside the grid instead of
+    //moving them to its edge
+    bool TestCoalesceDropsFarCells()
+    {
+        SpawnCommandQueue queue;
+        SpawnCommand command, drained[8];
+
+        CHECK(queue.Initialize(2, SPAWN_POLICY_COALESCE));
+        memset(&command, 0, sizeof(command));
+        command.type = SPAWN_RING;
+        command.count = 10;
+        command.position = XMFLOAT3(0.0f, 0.0f, 0.0f);
+        CHECK(queue.Push(command));
+        CHECK(queue.Push(command));
+
+        command.position = XMFLOAT3(5000.0f, 0.0f, 0.0f);
+        CHECK(!queue.Push(command));
+        command.position = XMFLOAT3(0.0f, 0.0f, -3000.0f);
+        CHECK(!queue.Push(command));
+        command.position = XMFLOAT3(12.2f, 1.5f, 40.7f);
+        CHECK(queue.Push(command));
+        CHECK(queue.Push(command));
+        CHECK(queue.GetDroppedCount() == 2);
+        CHECK(queue.GetCoalescedCount() == 2);
+
+        CHECK(queue.Drain(drained, 8) == 3);
+        CHECK(drained[2].count == 20);
+        CHECK(drained[2].position.x == 12.5f && drained[2].position.y == 1.5f && drained[2].position.z == 40.5f);
+
+        queue.Shutdown();
+        return true;
+    }
+
+#ifdef PARTICLE_NULL_DEVICE
+    //---------------------------------------------------------------------------------------------------------------
+    // texture cache
+
+    //the null texture class reads the size of the texture from the file
+    bool WriteTextureFile(const char* filename, int width, int height)
+    {
+        FILE* file = fopen(filename, "w");
+        if (!file)
+        {
+            return false;
+        }
+        fprintf(file, "%d %d\n", width, height);
+        fclose(file);
+        return true;
+    }
+
+    //runs frames until every texture of the manager has loaded or one of them failed
+    bool WaitForTextures(ParticleManager* manager, ID3D11DeviceContext* deviceContext)
+    {
+        for (auto i = 0; i < 2000; ++i)
+        {
+            if (manager->AreTexturesLoaded() || manager->HaveTexturesFailed())
+            {
+                return true;
+            }
+            if (!manager->Frame(deviceContext, FrameTime))
+            {
+                return false;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return false;
+    }
+
+    bool InitializeTextureManager(ParticleManager* manager, NullDevice* device, const char* fireTextureFilename)
+    {
+        manager->SetRandomSeed(42);
+        manager->SetFirePosition(XMFLOAT3(5.0f, 0.0f, 30.0f));
+        return manager->Initialize(device, device->GetImmediateContext(), "default.tex", "rain.tex", fireTextureFilename);
+    }
+
+    //a texture that can not be loaded is reported instead of leaving the manager waiting for it, with and without the
+    //loader thread
+    bool TestTextureMissingFileFails()
+    {
+        CHECK(WriteTextureFile("default.tex", 32, 32));
+        CHECK(WriteTextureFile("rain.tex", 16, 64));
+
+        for (auto deferredContexts = 0; deferredContexts < 2; ++deferredContexts)
+        {
+            NullDevice device(deferredContexts != 0);
+            ParticleManager manager;
+
+            CHECK(InitializeTextureManager(&manager, &device, "missing.tex"));
+            CHECK(WaitForTextures(&manager, device.GetImmediateContext()));
+            CHECK(manager.HaveTexturesFailed());
+            CHECK(!manager.AreTexturesLoaded());
+            CHECK(manager.GetFireTexture() == nullptr);
+
+            manager.Shutdown();
+            CHECK(device.GetLiveObjectCount() == 0);
+        }
+
+        remove("default.tex");
+        remove("rain.tex");
+        return true;
+    }
+
+    //managers on one device load each file once and get the same views, a manager on another device gets its own
+    bool TestTextureCachePerDevice()
+    {
+        NullDevice firstDevice(true), secondDevice(true);
+        ParticleManager first, second, other;
+
+        CHECK(WriteTextureFile("default.tex", 32, 32));
+        CHECK(WriteTextureFile("rain.tex", 16, 64));
+        CHECK(WriteTextureFile("fire.tex", 64, 64));
+
+        //only the first manager asks for the atlas, it is a setting of its device's cache
+        first.EnableTextureAtlas(256, 64);
+        CHECK(InitializeTextureManager(&first, &firstDevice, "fire.tex"));
+        CHECK(InitializeTextureManager(&second, &firstDevice, "fire.tex"));
+        CHECK(InitializeTextureManager(&other, &secondDevice, "fire.tex"));
+        CHECK(WaitForTextures(&first, firstDevice.GetImmediateContext()));
+        CHECK(WaitForTextures(&second, firstDevice.GetImmediateContext()));
+        CHECK(WaitForTextures(&other, secondDevice.GetImmediateContext()));
+        CHECK(first.AreTexturesLoaded() && second.AreTexturesLoaded() && other.AreTexturesLoaded());
+        CHECK(!first.HaveTexturesFailed());
+
+        CHECK(firstDevice.GetExecutedCommandListCount() == 3);
+        CHECK(secondDevice.GetExecutedCommandListCount() == 3);
+        CHECK(first.GetFireTexture() == second.GetFireTexture());
+        CHECK(first.GetFireTexture() != other.GetFireTexture());
+
+        //the atlas is built once the loads are done, both managers on the first device share it
+        CHECK(first.Frame(firstDevice.GetImmediateContext(), FrameTime));
+        CHECK(first.GetTextureAtlas() != nullptr);
+        CHECK(second.GetTextureAtlas() == first.GetTextureAtlas());
+        CHECK(other.GetTextureAtlas() == nullptr);
+
+        first.Shutdown();
+        CHECK(second.GetFireTexture() != nullptr);
+        second.Shutdown();
+        other.Shutdown();
+        CHECK(firstDevice.GetLiveObjectCount() == 0);
+        CHECK(secondDevice.GetLiveObjectCount() == 0);
+
+        remove("default.tex");
+        remove("rain.tex");
+        remove("fire.tex");
+        return true;
+    }
+
+    //rebuilding the atlas swaps in a new texture, the view handed out before the rebuild is still alive afterwards
+    bool TestTextureAtlasSwap()
+    {
+        NullDevice device(true);
+        TextureCache cache;
+        XMFLOAT4 region;
+        bool built = false;
+
+        CHECK(WriteTextureFile("default.tex", 32, 32));
+        CHECK(WriteTextureFile("rain.tex", 16, 64));
+        CHECK(cache.Initialize(&device));
+        cache.SetAtlasEnabled(true, 256, 64);
+
+        int first = cache.AcquireTexture("default.tex");
+        for (auto i = 0; i < 2000 && !built; ++i)
+        {
+            cache.Update(device.GetImmediateContext());
+            built = cache.GetAtlasRegion(first, &region);
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        CHECK(built);
+        ID3D11ShaderResourceView* firstAtlas = cache.GetAtlasTexture();
+        CHECK(firstAtlas != nullptr);
+        firstAtlas->AddRef();
+
+        int second = cache.AcquireTexture("rain.tex");
+        built = false;
+        for (auto i = 0; i < 2000 && !built; ++i)
+        {
+            cache.Update(device.GetImmediateContext());
+            built = cache.GetAtlasRegion(second, &region);
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        CHECK(built);
+        CHECK(cache.GetAtlasRegion(first, &region));
+        CHECK(cache.GetAtlasTexture() != firstAtlas);
+        CHECK(device.GetCopyCount() == 3);
+
+        //the cache still holds the old atlas next to our reference
+        unsigned long references = firstAtlas->Release();
+
+        cache.ReleaseTexture(first);
+        cache.ReleaseTexture(second);
+        cache.Shutdown();
+        CHECK(references > 0);
+        CHECK(device.GetLiveObjectCount() == 0);
+
+        remove("default.tex");
+        remove("rain.tex");
+        return true;
+    }
+#endif
+
+    //---------------------------------------------------------------------------------------------------------------
+
+    const Test s_tests[] =
+    {
+        { "snapshot_round_trip",                TestSnapshotRoundTrip              },
+        { "snapshot_rejects_damage",            TestSnapshotRejectsDamage          },
+        { "arena_rebuild_full_pool",            TestArenaRebuildFullPool           },
+        { "defragment_full_pool",               TestDefragmentFullPool             },
+        { "view_ignores_occlusion",             TestViewIgnoresOcclusion           },
+        { "density_grid_ignores_occlusion",     TestDensityGridIgnoresOcclusion    },
+        { "instanced_fire_skips_collision",     TestInstancedFireSkipsCollision    },
+        { "billboard_color_packing",            TestBillboardColorPacking          },
+        { "parallel_update_matches_serial",     TestParallelUpdateMatchesSerial    },
+        { "stats_mark_parallel_stages",         TestStatsMarkParallelStages        },
+        { "generic_kernels_match_specialized",  TestGenericKernelsMatchSpecialized },
+        { "ring_wraps_around",                  TestRingWrapsAround                },
+        { "ring_waits_for_fence",               TestRingWaitsForFence              },
+        { "ring_rejects_oversized",             TestRingRejectsOversized           },
+#ifdef PARTICLE_NULL_DEVICE
+        { "ring_per_context",                   TestRingPerContext                 },
+        { "ring_skipped_upload_releases_range", TestRingSkippedUploadReleasesRange },
+#endif
+        { "general_instances_back_to_front",    TestGeneralInstancesBackToFront    },
+        { "queued_fire_joins_instanced_fire",   TestQueuedFireJoinsInstancedFire   },
+        { "fire_copies_follow_transforms",      TestFireCopiesFollowTransforms     },
+        { "fire_copies_fit_instance_array",     TestFireCopiesFitInstanceArray     },
+        { "effect_duplicate_reports_line",      TestEffectDuplicateReportsLine     },
+        { "effect_reload_same_size",            TestEffectReloadSameSize           },
+        { "cache_rejects_oversized_header",     TestCacheRejectsOversizedHeader    },
+        { "coalesce_drops_far_cells",           TestCoalesceDropsFarCells          },
+        { "analytic_rain_back_to_front",        TestAnalyticRainBackToFront        },
+        { "analytic_rain_splashes_fit_pool",    TestAnalyticRainSplashesFitPool    },
+        { "dormant_fire_catches_up",            TestDormantFireCatchesUp           },
+        { "dormancy_keeps_queued_fire",         TestDormancyKeepsQueuedFire        },
+#ifdef PARTICLE_NULL_DEVICE
+        { "texture_missing_file_fails",         TestTextureMissingFileFails        },
+        { "texture_cache_per_device",           TestTextureCachePerDevice          },
+        { "texture_atlas_swap",                 TestTextureAtlasSwap               },
+#endif
+    };
+
+    const int TestCount = (int)(sizeof(s_tests) / sizeof(s_tests[0]));
+}
+
+
+int main(int argc, char** argv)
+{
+    int failures = 0;
+    int matched = 0;
+
+    for (auto i = 0; i < TestCount; ++i)
+    {
+        bool selected = (argc < 2);
+        for (auto j = 1; j < argc; ++j)
+        {
+            if (strcmp(argv[j], s_tests[i].name) == 0)
+            {
+                selected = true;
+            }
+        }
+        if (!selected)
+        {
+            continue;
+        }
+
+        matched++;
+        bool result = s_tests[i].function();
+        printf("%s %s\n", result ? "pass" : "FAIL", s_tests[i].name);
+        if (!result)
+        {
+            failures++;
+        }
+    }
+
+    if (matched == 0)
+    {
+        printf("no test matched\n");
+        return 1;
+    }
+    return (failures == 0) ? 0 : 1;
+}
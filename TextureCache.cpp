@@ -0,0 +1,569 @@
+#include "TextureCache.h"
+
+#include <string.h>
+
+
+TextureCache::TextureCache()
+{
+    m_device = nullptr;
+    m_deferredContext = nullptr;
+    m_loaderRunning = false;
+
+    m_atlasEnabled = false;
+    m_atlasDirty = false;
+    m_atlasSize = 0;
+    m_atlasMaxTextureSize = 0;
+    m_atlasTexture = nullptr;
+    m_atlasView = nullptr;
+    m_retiredAtlasTexture = nullptr;
+    m_retiredAtlasView = nullptr;
+}
+
+
+TextureCache::~TextureCache()
+{
+}
+
+
+bool TextureCache::Initialize(ID3D11Device* device)
+{
+    HRESULT result;
+
+    m_device = device;
+
+    // the loader thread records its texture uploads into a deferred context, if the driver can not give us one the
+    // textures are loaded on the render thread in Update instead, one per frame
+    result = m_device->CreateDeferredContext(0, &m_deferredContext);
+    if (FAILED(result))
+    {
+        m_deferredContext = nullptr;
+        return true;
+    }
+
+    m_loaderRunning = true;
+    m_loaderThread = std::thread(&TextureCache::LoaderThread, this);
+
+    return true;
+}
+
+
+void TextureCache::Shutdown()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_loaderRunning = false;
+    }
+    m_loadCondition.notify_all();
+
+    if (m_loaderThread.joinable())
+    {
+        m_loaderThread.join();
+    }
+
+    for (auto i = 0; i < (int)m_entries.size(); ++i)
+    {
+        ReleaseEntry(&m_entries[i]);
+    }
+    m_entries.clear();
+    m_loadQueue.clear();
+
+    ReleaseAtlas();
+
+    if (m_deferredContext)
+    {
+        m_deferredContext->Release();
+        m_deferredContext = nullptr;
+    }
+    m_device = nullptr;
+
+    return;
+}
+
+
+int TextureCache::AcquireTexture(const char* filename)
+{
+    int freeSlot = -1;
+
+    if (!filename)
+    {
+        return -1;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    //share the texture if it is already loaded or on its way
+    for (auto i = 0; i < (int)m_entries.size(); ++i)
+    {
+        if (m_entries[i].state == ENTRY_UNUSED)
+        {
+            if (freeSlot < 0)
+            {
+                freeSlot = i;
+            }
+            continue;
+        }
+
+        if (m_entries[i].filename == filename)
+        {
+            m_entries[i].referenceCount++;
+            return i;
+        }
+    }
+
+    if (freeSlot < 0)
+    {
+        freeSlot = (int)m_entries.size();
+        m_entries.push_back(CacheEntry());
+    }
+
+    CacheEntry& entry = m_entries[freeSlot];
+    entry.filename = filename;
+    entry.texture = nullptr;
+    entry.commandList = nullptr;
+    entry.referenceCount = 1;
+    entry.state = ENTRY_QUEUED;
+    entry.atlasRegion = XMFLOAT4(0.0f, 0.0f, 0.0f, 0.0f);
+    entry.inAtlas = false;
+
+    m_loadQueue.push_back(freeSlot);
+    m_loadCondition.notify_one();
+
+    return freeSlot;
+}
+
+
+void TextureCache::ReleaseTexture(int handle)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (handle < 0 || handle >= (int)m_entries.size() || m_entries[handle].referenceCount <= 0)
+    {
+        return;
+    }
+
+    CacheEntry& entry = m_entries[handle];
+    entry.referenceCount--;
+    if (entry.referenceCount > 0)
+    {
+        return;
+    }
+
+    if (entry.state == ENTRY_QUEUED)
+    {
+        for (auto it = m_loadQueue.begin(); it != m_loadQueue.end(); ++it)
+        {
+            if ((*it) == handle)
+            {
+                m_loadQueue.erase(it);
+                break;
+            }
+        }
+        entry.state = ENTRY_UNUSED;
+    }
+    else if (entry.state != ENTRY_LOADING && entry.state != ENTRY_UPLOADING)
+    {
+        // textures still in flight are cleaned up by Update once the loader hands them over
+        if (entry.inAtlas)
+        {
+            m_atlasDirty = true;
+        }
+        ReleaseEntry(&entry);
+    }
+
+    return;
+}
+
+
+void TextureCache::Update(ID3D11DeviceContext* deviceContext)
+{
+    bool loadsInFlight = false;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (!m_deferredContext)
+    {
+        LoadQueuedTextureImmediate(deviceContext);
+    }
+
+    for (auto i = 0; i < (int)m_entries.size(); ++i)
+    {
+        CacheEntry& entry = m_entries[i];
+
+        if (entry.state == ENTRY_UPLOADING)
+        {
+            if (entry.referenceCount > 0)
+            {
+                deviceContext->ExecuteCommandList(entry.commandList, FALSE);
+                entry.state = ENTRY_READY;
+                m_atlasDirty = true;
+            }
+            else
+            {
+                //every user released the texture while it was loading
+                ReleaseEntry(&entry);
+                continue;
+            }
+
+            entry.commandList->Release();
+            entry.commandList = nullptr;
+        }
+        else if (entry.state == ENTRY_LOADING)
+        {
+            loadsInFlight = true;
+        }
+        else if (entry.state == ENTRY_FAILED && entry.referenceCount <= 0)
+        {
+            ReleaseEntry(&entry);
+        }
+    }
+
+    //wait for a batch of loads to finish so the atlas is not rebuilt once per texture
+    if (m_atlasEnabled && m_atlasDirty && !loadsInFlight && m_loadQueue.empty())
+    {
+        if (BuildAtlas(deviceContext))
+        {
+            m_atlasDirty = false;
+        }
+    }
+
+    return;
+}
+
+
+ID3D11ShaderResourceView* TextureCache::GetTexture(int handle)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (handle < 0 || handle >= (int)m_entries.size() || m_entries[handle].state != ENTRY_READY)
+    {
+        return nullptr;
+    }
+    return m_entries[handle].texture->GetTexture();
+}
+
+
+bool TextureCache::IsLoaded(int handle)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (handle < 0 || handle >= (int)m_entries.size())
+    {
+        return false;
+    }
+    return m_entries[handle].state == ENTRY_READY;
+}
+
+
+bool TextureCache::HasFailed(int handle)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (handle < 0 || handle >= (int)m_entries.size())
+    {
+        return true;
+    }
+    return m_entries[handle].state == ENTRY_FAILED;
+}
+
+
+bool TextureCache::IsAtlasEnabled()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_atlasEnabled;
+}
+
+
+void TextureCache::SetAtlasEnabled(bool enabled, int atlasSize, int maxTextureSize)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    m_atlasEnabled = enabled;
+    m_atlasSize = atlasSize;
+    m_atlasMaxTextureSize = maxTextureSize;
+    m_atlasDirty = true;
+    return;
+}
+
+
+ID3D11ShaderResourceView* TextureCache::GetAtlasTexture()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_atlasView;
+}
+
+
+bool TextureCache::GetAtlasRegion(int handle, XMFLOAT4* uvRect)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if (handle < 0 || handle >= (int)m_entries.size() || !m_entries[handle].inAtlas)
+    {
+        return false;
+    }
+    (*uvRect) = m_entries[handle].atlasRegion;
+    return true;
+}
+
+
+void TextureCache::LoaderThread()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while (true)
+    {
+        m_loadCondition.wait(lock, [this]() { return !m_loaderRunning || !m_loadQueue.empty(); });
+        if (!m_loaderRunning)
+        {
+            return;
+        }
+
+        int handle = m_loadQueue.front();
+        m_loadQueue.pop_front();
+
+        // the filename is copied as m_entries may grow while the lock is released
+        std::string filename = m_entries[handle].filename;
+        m_entries[handle].state = ENTRY_LOADING;
+        lock.unlock();
+
+        TextureClass* texture = new TextureClass;
+        ID3D11CommandList* commandList = nullptr;
+        bool result = texture->Initialize(m_device, m_deferredContext, filename.c_str());
+
+        // finish the command list even on failure so the deferred context starts clean for the next texture
+        HRESULT commandResult = m_deferredContext->FinishCommandList(FALSE, &commandList);
+        if (!result || FAILED(commandResult))
+        {
+            texture->Shutdown();
+            delete texture;
+            texture = nullptr;
+
+            if (commandList)
+            {
+                commandList->Release();
+                commandList = nullptr;
+            }
+        }
+
+        lock.lock();
+        m_entries[handle].texture = texture;
+        m_entries[handle].commandList = commandList;
+        m_entries[handle].state = texture ? ENTRY_UPLOADING : ENTRY_FAILED;
+    }
+}
+
+
+void TextureCache::LoadQueuedTextureImmediate(ID3D11DeviceContext* deviceContext)
+{
+    if (m_loadQueue.empty())
+    {
+        return;
+    }
+
+    int handle = m_loadQueue.front();
+    m_loadQueue.pop_front();
+
+    CacheEntry& entry = m_entries[handle];
+    entry.texture = new TextureClass;
+    if (!entry.texture->Initialize(m_device, deviceContext, entry.filename.c_str()))
+    {
+        entry.texture->Shutdown();
+        delete entry.texture;
+        entry.texture = nullptr;
+        entry.state = ENTRY_FAILED;
+        return;
+    }
+
+    entry.state = ENTRY_READY;
+    m_atlasDirty = true;
+    return;
+}
+
+
+void TextureCache::ReleaseEntry(CacheEntry* entry)
+{
+    if (entry->commandList)
+    {
+        entry->commandList->Release();
+        entry->commandList = nullptr;
+    }
+    if (entry->texture)
+    {
+        entry->texture->Shutdown();
+        delete entry->texture;
+        entry->texture = nullptr;
+    }
+
+    entry->filename.clear();
+    entry->referenceCount = 0;
+    entry->inAtlas = false;
+    entry->state = ENTRY_UNUSED;
+    return;
+}
+
+
+bool TextureCache::BuildAtlas(ID3D11DeviceContext* deviceContext)
+{
+    D3D11_TEXTURE2D_DESC atlasDesc, sourceDesc;
+    D3D11_RESOURCE_DIMENSION dimension;
+    D3D11_BOX sourceBox;
+    ID3D11Resource* resource;
+    ID3D11Texture2D* sourceTexture;
+    ID3D11Texture2D* atlasTexture = nullptr;
+    ID3D11ShaderResourceView* atlasView = nullptr;
+    HRESULT result;
+
+    // shelf packing, textures are placed left to right and a new shelf is started when the row is full
+    // positions are kept on 4 texel boundaries so block compressed textures can be copied as well
+    const int padding = 4;
+    int shelfX = 0, shelfY = 0, shelfHeight = 0;
+    bool formatChosen = false;
+
+    // the new atlas is built next to the current one, which stays valid for anyone already holding it. The regions are
+    // only written to the entries once the new atlas is complete
+    std::vector<XMFLOAT4> regions(m_entries.size());
+    std::vector<char> packed(m_entries.size(), 0);
+
+    memset(&atlasDesc, 0, sizeof(atlasDesc));
+    atlasDesc.Width = m_atlasSize;
+    atlasDesc.Height = m_atlasSize;
+    atlasDesc.MipLevels = 1;
+    atlasDesc.ArraySize = 1;
+    atlasDesc.SampleDesc.Count = 1;
+    atlasDesc.SampleDesc.Quality = 0;
+    atlasDesc.Usage = D3D11_USAGE_DEFAULT;
+    atlasDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+    atlasDesc.CPUAccessFlags = 0;
+    atlasDesc.MiscFlags = 0;
+
+    for (auto i = 0; i < (int)m_entries.size(); ++i)
+    {
+        CacheEntry& entry = m_entries[i];
+
+        if (entry.state != ENTRY_READY)
+        {
+            continue;
+        }
+
+        entry.texture->GetTexture()->GetResource(&resource);
+        resource->GetType(&dimension);
+        if (dimension != D3D11_RESOURCE_DIMENSION_TEXTURE2D)
+        {
+            resource->Release();
+            continue;
+        }
+        sourceTexture = static_cast<ID3D11Texture2D*>(resource);
+        sourceTexture->GetDesc(&sourceDesc);
+
+        //the first small texture decides the format of the atlas, the others have to match it
+        if (!formatChosen && (int)sourceDesc.Width <= m_atlasMaxTextureSize && (int)sourceDesc.Height <= m_atlasMaxTextureSize)
+        {
+            atlasDesc.Format = sourceDesc.Format;
+            result = m_device->CreateTexture2D(&atlasDesc, nullptr, &atlasTexture);
+            if (FAILED(result))
+            {
+                resource->Release();
+                return false;
+            }
+            formatChosen = true;
+        }
+
+        if (!formatChosen || sourceDesc.Format != atlasDesc.Format || sourceDesc.SampleDesc.Count != 1 ||
+            (int)sourceDesc.Width > m_atlasMaxTextureSize || (int)sourceDesc.Height > m_atlasMaxTextureSize)
+        {
+            resource->Release();
+            continue;
+        }
+
+        if (shelfX + (int)sourceDesc.Width > m_atlasSize)
+        {
+            shelfX = 0;
+            shelfY += shelfHeight;
+            shelfHeight = 0;
+        }
+        if (shelfY + (int)sourceDesc.Height > m_atlasSize)
+        {
+            //atlas is full, the texture stays on its own
+            resource->Release();
+            continue;
+        }
+
+        sourceBox.left = 0;
+        sourceBox.top = 0;
+        sourceBox.front = 0;
+        sourceBox.right = sourceDesc.Width;
+        sourceBox.bottom = sourceDesc.Height;
+        sourceBox.back = 1;
+        deviceContext->CopySubresourceRegion(atlasTexture, 0, shelfX, shelfY, 0, sourceTexture, 0, &sourceBox);
+        resource->Release();
+
+        regions[i] = XMFLOAT4((float)shelfX / m_atlasSize, (float)shelfY / m_atlasSize,
+            (float)(shelfX + sourceDesc.Width) / m_atlasSize, (float)(shelfY + sourceDesc.Height) / m_atlasSize);
+        packed[i] = 1;
+
+        int paddedWidth = ((sourceDesc.Width + padding + 3) / 4) * 4;
+        int paddedHeight = ((sourceDesc.Height + padding + 3) / 4) * 4;
+        shelfX += paddedWidth;
+        if (paddedHeight > shelfHeight)
+        {
+            shelfHeight = paddedHeight;
+        }
+    }
+
+    if (atlasTexture)
+    {
+        result = m_device->CreateShaderResourceView(atlasTexture, nullptr, &atlasView);
+        if (FAILED(result))
+        {
+            atlasTexture->Release();
+            return false;
+        }
+    }
+
+    // the atlas this one replaces is kept until the next rebuild, a view handed out earlier in the frame stays usable
+    ReleaseRetiredAtlas();
+    m_retiredAtlasTexture = m_atlasTexture;
+    m_retiredAtlasView = m_atlasView;
+    m_atlasTexture = atlasTexture;
+    m_atlasView = atlasView;
+
+    for (auto i = 0; i < (int)m_entries.size(); ++i)
+    {
+        m_entries[i].inAtlas = packed[i] != 0;
+        m_entries[i].atlasRegion = packed[i] ? regions[i] : XMFLOAT4(0.0f, 0.0f, 0.0f, 0.0f);
+    }
+
+    return true;
+}
+
+
+void TextureCache::ReleaseAtlas()
+{
+    if (m_atlasView)
+    {
+        m_atlasView->Release();
+        m_atlasView = nullptr;
+    }
+    if (m_atlasTexture)
+    {
+        m_atlasTexture->Release();
+        m_atlasTexture = nullptr;
+    }
+    ReleaseRetiredAtlas();
+    return;
+}
+
+
+void TextureCache::ReleaseRetiredAtlas()
+{
+    if (m_retiredAtlasView)
+    {
+        m_retiredAtlasView->Release();
+        m_retiredAtlasView = nullptr;
+    }
+    if (m_retiredAtlasTexture)
+    {
+        m_retiredAtlasTexture->Release();
+        m_retiredAtlasTexture = nullptr;
+    }
+    return;
+}
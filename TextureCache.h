@@ -0,0 +1,102 @@
+#pragma once
+#include <d3d11.h>
+#include <DirectXMath.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "TextureClass.h"
+
+using namespace DirectX;
+
+// Reference counted texture cache keyed by filename. Textures are created on a loader thread through a deferred context
+// and the recorded command lists are executed on the immediate context in Update, so requesting a texture never blocks.
+// A cache belongs to the device it was initialized with, its textures can not be used with any other device.
+class TextureCache
+{
+private:
+    enum EntryState
+    {
+        ENTRY_UNUSED,
+        ENTRY_QUEUED,
+        ENTRY_LOADING,
+        ENTRY_UPLOADING,
+        ENTRY_READY,
+        ENTRY_FAILED
+    };
+
+    struct CacheEntry
+    {
+        std::string filename;
+        TextureClass* texture;
+        ID3D11CommandList* commandList;
+        int referenceCount;
+        EntryState state;
+
+        // (left, top, right, bottom) in atlas uv space, only valid when inAtlas is set
+        XMFLOAT4 atlasRegion;
+        bool inAtlas;
+    };
+
+public:
+    TextureCache();
+    ~TextureCache();
+
+    bool Initialize(ID3D11Device* device);
+    void Shutdown();
+
+    //returns a handle to the texture, queuing the load if this is the first reference to the filename. Returns -1 on failure
+    int AcquireTexture(const char* filename);
+    void ReleaseTexture(int handle);
+
+    //executes finished loads on the immediate context and rebuilds the atlas when needed, call once per frame from the render thread
+    void Update(ID3D11DeviceContext* deviceContext);
+
+    //returns nullptr until the texture has finished loading
+    ID3D11ShaderResourceView* GetTexture(int handle);
+    bool IsLoaded(int handle);
+    bool HasFailed(int handle);
+
+    //small textures are copied into a shared atlas once they are loaded. The atlas is a setting of the whole cache, it
+    //covers the textures of everyone using the cache
+    //@param maxTextureSize: textures wider or taller than this are left out of the atlas
+    void SetAtlasEnabled(bool enabled, int atlasSize, int maxTextureSize);
+    bool IsAtlasEnabled();
+    //the view stays valid until the atlas is rebuilt twice, so one fetched before a rebuild can still be drawn with
+    ID3D11ShaderResourceView* GetAtlasTexture();
+    bool GetAtlasRegion(int handle, XMFLOAT4* uvRect);
+
+private:
+    void LoaderThread();
+    //loads a queued texture on the calling thread, used when the driver can not create a deferred context
+    void LoadQueuedTextureImmediate(ID3D11DeviceContext* deviceContext);
+    void ReleaseEntry(CacheEntry* entry);
+
+    //builds a new atlas and swaps it in, a failed build keeps the current one
+    bool BuildAtlas(ID3D11DeviceContext* deviceContext);
+    void ReleaseAtlas();
+    void ReleaseRetiredAtlas();
+
+    ID3D11Device* m_device;
+    ID3D11DeviceContext* m_deferredContext;
+
+    std::vector<CacheEntry> m_entries;
+    std::deque<int> m_loadQueue;
+    std::mutex m_mutex;
+    std::condition_variable m_loadCondition;
+    std::thread m_loaderThread;
+    bool m_loaderRunning;
+
+    bool m_atlasEnabled;
+    bool m_atlasDirty;
+    int m_atlasSize, m_atlasMaxTextureSize;
+    ID3D11Texture2D* m_atlasTexture;
+    ID3D11ShaderResourceView* m_atlasView;
+    //the atlas before the last rebuild
+    ID3D11Texture2D* m_retiredAtlasTexture;
+    ID3D11ShaderResourceView* m_retiredAtlasView;
+};
@@ -0,0 +1,89 @@
+////////////////////////////////////////////////////////////////////////////////
+// Filename: billboard.vs
+// vertex pulling particle shader, draw with DrawInstanced(6, instanceCount, 0, 0) and a null input layout
+////////////////////////////////////////////////////////////////////////////////
+
+
+/////////////
+// GLOBALS //
+/////////////
+cbuffer MatrixBuffer : register(b0)
+{
+    matrix worldMatrix;
+    matrix viewMatrix;
+    matrix projectionMatrix;
+};
+
+cbuffer CameraBuffer : register(b1)
+{
+    // world space right and up axes of the camera, the first two rows of the inverse view matrix
+    float3 cameraRight;
+    float padding0;
+    float3 cameraUp;
+    float padding1;
+};
+
+
+//////////////
+// TYPEDEFS //
+//////////////
+// must match BillboardBuffer::BillboardInstance
+struct BillboardInstance
+{
+    float3 position;
+    float size;
+    // half4, red and blue in the low 16 bits
+    uint colorRG;
+    uint colorBA;
+    uint type;
+    float stretch;
+};
+
+StructuredBuffer<BillboardInstance> Instances : register(t0);
+
+struct PixelInputType
+{
+    float4 position : SV_POSITION;
+    float2 tex : TEXCOORD0;
+    float4 color : COLOR;
+};
+
+static const uint BillboardRain = 1;
+
+// two triangles in the same order as the old vertex buffer quads
+static const float2 Corners[6] =
+{
+    float2(-1.0f, -1.0f), float2(-1.0f, 1.0f), float2(1.0f, -1.0f),
+    float2(1.0f, -1.0f), float2(-1.0f, 1.0f), float2(1.0f, 1.0f)
+};
+
+static const float2 TexCoords[6] =
+{
+    float2(0.0f, 1.0f), float2(0.0f, 0.0f), float2(1.0f, 1.0f),
+    float2(1.0f, 1.0f), float2(0.0f, 0.0f), float2(1.0f, 0.0f)
+};
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Vertex Shader
+////////////////////////////////////////////////////////////////////////////////
+PixelInputType BillboardVertexShader(uint vertexId : SV_VertexID, uint instanceId : SV_InstanceID)
+{
+    PixelInputType output;
+    BillboardInstance instance = Instances[instanceId];
+    float2 corner = Corners[vertexId];
+
+    // rain streaks keep the world up axis so they stay vertical, everything else faces the camera
+    float3 up = (instance.type == BillboardRain) ? float3(0.0f, 1.0f, 0.0f) : cameraUp;
+    float3 worldPosition = instance.position + (cameraRight * corner.x * instance.size) + (up * corner.y * instance.size * instance.stretch);
+
+    output.position = mul(float4(worldPosition, 1.0f), worldMatrix);
+    output.position = mul(output.position, viewMatrix);
+    output.position = mul(output.position, projectionMatrix);
+
+    output.tex = TexCoords[vertexId];
+
+    output.color = float4(f16tof32(instance.colorRG), f16tof32(instance.colorRG >> 16), f16tof32(instance.colorBA), f16tof32(instance.colorBA >> 16));
+
+    return output;
+}